@@ -0,0 +1,100 @@
+/**
+ * Read/write throughput of the block cache under concurrent threads
+ * Each thread works on its own array, the threads only share the allocator
+ * @usage: cache_bench [max threads] [nb blocks] [block size] [elements per thread] [rounds]
+ * @info: with enough blocks to hold every array, the numbers measure the contention on the allocator locks, with fewer blocks they also include the evictions
+ */
+
+#include <rd_utils/memory/cache/_.hh>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace rd_utils::memory::cache;
+
+namespace {
+
+  struct Result {
+    double write;
+    double read;
+    uint64_t bad;
+  };
+
+  double elapsed (std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  }
+
+  Result run (uint32_t nbThreads, uint32_t len, uint32_t rounds) {
+    std::vector <collection::CacheArray<uint32_t>*> arrays;
+    for (uint32_t t = 0 ; t < nbThreads ; t++) {
+      arrays.push_back (new collection::CacheArray<uint32_t> (len));
+    }
+
+    std::atomic<uint64_t> bad (0);
+    Result res = {.write = 0, .read = 0, .bad = 0};
+
+    auto start = std::chrono::steady_clock::now ();
+    std::vector <std::thread> th;
+    for (uint32_t t = 0 ; t < nbThreads ; t++) {
+      th.emplace_back ([&, t] () {
+        auto & a = *arrays [t];
+        for (uint32_t r = 0 ; r < rounds ; r++) {
+          for (uint32_t i = 0 ; i < len ; i++) a.set (i, i + t + r);
+        }
+      });
+    }
+
+    for (auto & it : th) it.join ();
+    res.write = elapsed (start);
+    th.clear ();
+
+    start = std::chrono::steady_clock::now ();
+    for (uint32_t t = 0 ; t < nbThreads ; t++) {
+      th.emplace_back ([&, t] () {
+        auto & a = *arrays [t];
+        uint64_t local = 0;
+        for (uint32_t r = 0 ; r < rounds ; r++) {
+          for (uint32_t i = 0 ; i < len ; i++) {
+            if (a.get (i) != i + t + rounds - 1) local += 1;
+          }
+        }
+
+        bad += local;
+      });
+    }
+
+    for (auto & it : th) it.join ();
+    res.read = elapsed (start);
+    res.bad = bad;
+
+    for (auto & it : arrays) delete it;
+    return res;
+  }
+
+}
+
+int main (int argc, char ** argv) {
+  uint32_t maxThreads = argc > 1 ? atoi (argv [1]) : std::thread::hardware_concurrency ();
+  uint32_t nbBlocks = argc > 2 ? atoi (argv [2]) : 256;
+  uint32_t blockSize = argc > 3 ? atoi (argv [3]) : 64 * 1024;
+  uint32_t len = argc > 4 ? atoi (argv [4]) : 100000;
+  uint32_t rounds = argc > 5 ? atoi (argv [5]) : 20;
+
+  Allocator::instance ().configure (nbBlocks, blockSize);
+
+  std::cout << "threads\twrite Mop/s\tread Mop/s" << std::endl;
+  for (uint32_t nb = 1 ; nb <= std::max (maxThreads, (uint32_t) 1) ; nb *= 2) {
+    auto res = run (nb, len, rounds);
+    double ops = (double) nb * len * rounds / 1e6;
+    std::cout << nb << "\t" << ops / res.write << "\t" << ops / res.read << std::endl;
+    if (res.bad != 0) {
+      std::cerr << "Wrong values read back : " << res.bad << std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
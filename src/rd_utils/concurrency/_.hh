@@ -3,6 +3,7 @@
 #include <rd_utils/concurrency/cond.hh>
 #include <rd_utils/concurrency/iopipe.hh>
 #include <rd_utils/concurrency/mutex.hh>
+#include <rd_utils/concurrency/rwlock.hh>
 #include <rd_utils/concurrency/mailbox.hh>
 #include <rd_utils/concurrency/lfmailbox.hh>
 #include <rd_utils/concurrency/proc.hh>
@@ -0,0 +1,78 @@
+#include <rd_utils/concurrency/rwlock.hh>
+
+namespace rd_utils::concurrency {
+
+  rwlock::rwlock () :
+    _m (new pthread_rwlock_t ())
+  {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init (&attr);
+    pthread_rwlockattr_setkind_np (&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+    pthread_rwlock_init (this-> _m, &attr);
+    pthread_rwlockattr_destroy (&attr);
+  }
+
+  rwlock::rwlock (rwlock && other) :
+    _m (other._m)
+  {
+    other._m = nullptr;
+  }
+
+  void rwlock::operator= (rwlock && other) {
+    if (this-> _m != nullptr) {
+      pthread_rwlock_destroy (this-> _m);
+      delete this-> _m;
+    }
+
+    this-> _m = other._m;
+    other._m = nullptr;
+  }
+
+  void rwlock::lockShared () {
+    if (this-> _m != nullptr) {
+      pthread_rwlock_rdlock (this-> _m);
+    }
+  }
+
+  void rwlock::lock () {
+    if (this-> _m != nullptr) {
+      pthread_rwlock_wrlock (this-> _m);
+    }
+  }
+
+  void rwlock::unlock () {
+    if (this-> _m != nullptr) {
+      pthread_rwlock_unlock (this-> _m);
+    }
+  }
+
+  rwlock::~rwlock () {
+    if (this-> _m != nullptr) {
+      pthread_rwlock_destroy (this-> _m);
+      delete this-> _m;
+      this-> _m = nullptr;
+    }
+  }
+
+  rwlock_shared_locker::rwlock_shared_locker (rwlock & m) :
+    _m (m)
+  {
+    m.lockShared ();
+  }
+
+  rwlock_shared_locker::~rwlock_shared_locker () {
+    this-> _m.unlock ();
+  }
+
+  rwlock_locker::rwlock_locker (rwlock & m) :
+    _m (m)
+  {
+    m.lock ();
+  }
+
+  rwlock_locker::~rwlock_locker () {
+    this-> _m.unlock ();
+  }
+
+}
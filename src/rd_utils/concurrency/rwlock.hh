@@ -0,0 +1,79 @@
+#pragma once
+
+#include <pthread.h>
+
+namespace rd_utils {
+
+    namespace concurrency {
+
+		/**
+		 * Reader/writer lock, many threads can hold the lock in shared mode at the same time, only one in exclusive mode
+		 * @info: writers are preferred, so that a stream of readers cannot starve a waiting writer
+		 */
+		class rwlock {
+
+			pthread_rwlock_t* _m;
+
+		public:
+
+			rwlock (const rwlock&) = delete;
+			void operator=(const rwlock&) = delete;
+
+			rwlock (rwlock&&);
+			void operator=(rwlock&&);
+
+			rwlock ();
+
+			/**
+			 * Acquire the lock in shared mode
+			 */
+			void lockShared ();
+
+			/**
+			 * Acquire the lock in exclusive mode
+			 */
+			void lock ();
+
+			/**
+			 * Release the lock (shared or exclusive)
+			 */
+			void unlock ();
+
+			~rwlock ();
+
+		};
+
+		class rwlock_shared_locker {
+
+			rwlock & _m;
+
+		public:
+
+			rwlock_shared_locker (rwlock & m);
+
+			~rwlock_shared_locker ();
+
+		};
+
+		class rwlock_locker {
+
+			rwlock & _m;
+
+		public:
+
+			rwlock_locker (rwlock & m);
+
+			~rwlock_locker ();
+
+		};
+
+    }
+
+}
+
+
+#define WITH_RLOCK(m)												\
+	if (auto m_ = rd_utils::concurrency::rwlock_shared_locker (m) ; true)
+
+#define WITH_WLOCK(m)												\
+	if (auto m_ = rd_utils::concurrency::rwlock_locker (m) ; true)
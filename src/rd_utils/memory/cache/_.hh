@@ -2,5 +2,8 @@
 
 #include <rd_utils/memory/cache/collection/_.hh>
 #include <rd_utils/memory/cache/allocator.hh>
+#include <rd_utils/memory/cache/cgroup.hh>
+#include <rd_utils/memory/cache/paged.hh>
+#include <rd_utils/memory/cache/shared.hh>
 #include <rd_utils/memory/cache/algorithm/_.hh>
 #include <rd_utils/memory/cache/remote/_.hh>
@@ -7,7 +7,7 @@
 
 namespace rd_utils::memory::cache::algorithm {
 
-  uint32_t flp2 (uint32_t x);
+  uint64_t flp2 (uint64_t x);
 
   template <typename T>
   void compAndSwap (T * a, T * b, uint32_t i, uint32_t dir) {
@@ -23,7 +23,7 @@ namespace rd_utils::memory::cache::algorithm {
   template <typename T>
   void bitonicMergeBlock (T * a, uint32_t low, uint32_t nb, uint32_t dir) {
     if (nb > 1) {
-      int k = flp2 (nb - 1);
+      uint32_t k = flp2 (nb - 1);
       for (int i = low ; i < low + nb - k ; i++) {
         auto atI = a [i];
         auto atJ = a [i + k];
@@ -40,13 +40,13 @@ namespace rd_utils::memory::cache::algorithm {
   }
 
   template <typename T>
-  void bitonicMerge (T * buffer, uint32_t BLK_SIZE, collection::CacheArray<T> & arr, uint32_t low, uint32_t nb, uint32_t dir) {
+  void bitonicMerge (T * buffer, uint32_t BLK_SIZE, collection::CacheArray<T> & arr, uint64_t low, uint64_t nb, uint32_t dir) {
     if (nb > 1) {
-      uint32_t k = flp2 (nb - 1);
-      uint32_t end = low + nb - k;
+      uint64_t k = flp2 (nb - 1);
+      uint64_t end = low + nb - k;
       auto locBLK_SIZE = BLK_SIZE / 2;
-      for (uint32_t i = low ; i < end ; i += locBLK_SIZE) {
-        auto nb_read = end - i < locBLK_SIZE ? end - i : locBLK_SIZE;
+      for (uint64_t i = low ; i < end ; i += locBLK_SIZE) {
+        uint32_t nb_read = end - i < locBLK_SIZE ? end - i : locBLK_SIZE;
 
         arr.getNb (i, buffer, nb_read);
         arr.getNb (i + k, buffer + nb_read, nb_read);
@@ -79,13 +79,20 @@ namespace rd_utils::memory::cache::algorithm {
 
 
   template <typename T>
-  void bitonicSort (T * buffer, uint32_t BLK_SIZE, collection::CacheArray<T> & arr, uint32_t low, uint32_t nb, uint32_t dir) {
+  void bitonicSort (T * buffer, uint32_t BLK_SIZE, collection::CacheArray<T> & arr, uint64_t low, uint64_t nb, uint32_t dir) {
     if (nb > 1) {
       auto k = nb / 2;
       bitonicSort (buffer, BLK_SIZE, arr, low, k, !dir);
       bitonicSort (buffer, BLK_SIZE, arr, low + k, nb - k, dir);
 
       if (nb <= BLK_SIZE) {
+        auto span = arr.pin (low, nb);
+        if (span.len () == nb) { // the chunk is inside a single block, merged in place
+          bitonicMergeBlock (span.data (), 0, nb, dir);
+          return;
+        }
+
+        span.release ();
         arr.getNb (low, buffer, nb);
         bitonicMergeBlock (buffer, 0, nb, dir);
         arr.setNb (low, buffer, nb);
@@ -11,7 +11,7 @@ namespace rd_utils::memory::cache::algorithm {
 
   template <typename T>
   collection::CacheArray<T> copy (collection::CacheArray<T> & array) {
-    collection::CacheArray<T> result (array.len ());
+    collection::CacheArray<T> result (array.len (), array.getAllocator ());
 
     if (array.len () == 0) return result;
     result.copyRaw (array);
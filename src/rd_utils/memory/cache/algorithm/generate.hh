@@ -10,13 +10,10 @@
 namespace rd_utils::memory::cache::algorithm {
 
   template <typename Z, typename F>
-  collection::CacheArray<Z> generate (uint32_t len, F func) {
+  collection::CacheArray<Z> generate (uint64_t len, F func) {
     collection::CacheArray<Z> result (len);
     if (len > 0) {
-      Z * buffer = reinterpret_cast <Z*> (malloc (ARRAY_BUFFER_SIZE * sizeof (Z)));
-      result.generate (buffer, ARRAY_BUFFER_SIZE, func);
-
-      free (buffer);
+      result.generate (func);
     }
 
     return result;
@@ -25,10 +22,7 @@ namespace rd_utils::memory::cache::algorithm {
   template <typename Z, typename F>
   void generate (collection::CacheArray<Z> & result, F func) {
     if (result.len () > 0) {
-      Z * buffer = reinterpret_cast <Z*> (malloc (ARRAY_BUFFER_SIZE * sizeof (Z)));
-      result.generate (buffer, ARRAY_BUFFER_SIZE, func);
-
-      free (buffer);
+      result.generate (func);
     }
   }
 
@@ -9,7 +9,7 @@
 namespace rd_utils::memory::cache::algorithm {
 
   template <typename T>
-  void insert_sort (T * buffer, collection::CacheArray<T> & arr, uint32_t low, uint32_t n) {
+  void insert_sort (T * buffer, collection::CacheArray<T> & arr, uint64_t low, uint64_t n) {
     int64_t i, j;
 
     for (i = low  ; i < (n + low) ; i++) {
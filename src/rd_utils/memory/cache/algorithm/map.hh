@@ -9,11 +9,8 @@ namespace rd_utils::memory::cache::algorithm {
 
   template <typename Z, typename T, typename F>
   collection::CacheArray<T> map (collection::CacheArray<T> && array, F func) {
-    uint32_t len = array.len ();
-    if (len > 0) {
-      Z * buffer = reinterpret_cast <Z*> (malloc (ARRAY_BUFFER_SIZE * sizeof (Z)));
-      array.map (buffer, ARRAY_BUFFER_SIZE, func);
-      free (buffer);
+    if (array.len () > 0) {
+      array.map (func);
     }
 
     return std::move (array);
@@ -57,6 +57,13 @@ namespace rd_utils::memory::cache::algorithm {
   template <typename T>
   void merge_sort (T * buffer, T * buffer2, collection::CacheArray<T> * array, collection::CacheArray<T> * aux, int64_t begin, int64_t end) {
     if (end - begin <= ARRAY_BUFFER_SIZE) {
+      auto span = array-> pin (begin, end - begin);
+      if (span.len () == end - begin) { // the chunk is inside a single block, sorted in place
+        std::sort (span.begin (), span.end ());
+        return;
+      }
+
+      span.release ();
       array-> getNb (begin, buffer, end - begin);
       std::sort (buffer, buffer + (end - begin));
       array-> setNb (begin, buffer, end - begin);
@@ -75,7 +82,7 @@ namespace rd_utils::memory::cache::algorithm {
     T * buffer = new T [ARRAY_BUFFER_SIZE];
     T * buffer2 = new T [ARRAY_BUFFER_SIZE];
     {
-      collection::CacheArray<T> aux (array.len ());
+      collection::CacheArray<T> aux (array.len (), array.getAllocator ());
       merge_sort (buffer, buffer2, &array, &aux, 0, array.len ());
     } // free (aux)
 
@@ -11,11 +11,7 @@ namespace rd_utils::memory::cache::algorithm {
   Z reduce (collection::CacheArray<T> & array, F func, Z fst = Z ()) {
     if (array.len () == 0) return fst;
 
-    T * buffer = reinterpret_cast <T*> (malloc (ARRAY_BUFFER_SIZE * sizeof (T)));
-    auto res = array.reduce (buffer, ARRAY_BUFFER_SIZE, func, fst);
-    free (buffer);
-
-    return res;
+    return array.reduce (func, fst);
   }
 
   template <typename Z, typename T, typename F>
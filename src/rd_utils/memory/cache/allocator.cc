@@ -1,5 +1,6 @@
 #include "allocator.hh"
 #include <cstring>
+#include <algorithm>
 #include <rd_utils/concurrency/timer.hh>
 #include <rd_utils/utils/log.hh>
 #include "free_list.hh"
@@ -12,10 +13,50 @@ namespace rd_utils::memory::cache {
 #define BLOCK_SIZE 1024 * 1024 * 4
 #define NB_BLOCKS 1024 // 1GB
 
+  // The id of the next allocator
+  static std::atomic<uint32_t> __LAST_ID__ (0);
 
   Allocator Allocator::__GLOBAL__ (NB_BLOCKS, BLOCK_SIZE);
 
-  concurrency::mutex Allocator::__GLOBAL_MUTEX__;
+  /**
+   * Gives the magazines of a thread (one per allocator it used) back to their allocators when the thread ends
+   */
+  struct MagazineHolder {
+    std::vector <Magazine*> mags;
+
+    ~MagazineHolder () {
+      for (auto mag : this-> mags) {
+        auto owner = mag-> owner.load (std::memory_order_acquire);
+        if (owner != nullptr) {
+          owner-> releaseMagazine (mag);
+        } else {
+          delete mag;
+        }
+      }
+    }
+  };
+
+  static thread_local MagazineHolder __MAGAZINE__;
+
+  /**
+   * @returns: the size class of a small allocation (8 << class is the size of its segments)
+   */
+  static inline uint32_t magazine_class (uint32_t size) {
+    if (size <= 8) return 0;
+    return 32 - __builtin_clz (size - 1) - 3;
+  }
+
+  // The shard of the next thread tracking relocatable segments
+  static std::atomic<uint32_t> __LAST_SHARD__ (0);
+
+  /**
+   * @returns: the shard of the relocatable segments used by the calling thread
+   * @info: a thread always uses the same shard, so tracking a segment touches a lock and slots that are already in its cache
+   */
+  static inline uint32_t relocation_shard () {
+    static thread_local uint32_t shard = (__LAST_SHARD__++) % NB_BLOCK_STRIPES;
+    return shard;
+  }
 
   /**
    * ============================================================================
@@ -25,7 +66,16 @@ namespace rd_utils::memory::cache {
    * ============================================================================
    * */
 
-  Allocator::Allocator (uint32_t nbBlocks, uint32_t blockSize) {
+  Allocator::Allocator (uint32_t nbBlocks, uint32_t blockSize) :
+    _id (__LAST_ID__++)
+    , _stripes (NB_BLOCK_STRIPES)
+    , _flusher (0)
+    , _prefetcher (0)
+    , _exportThread (0)
+    , _relocatable (NB_BLOCK_STRIPES)
+    , _compactor (0)
+    , _balancer (0)
+  {
     this-> configure (nbBlocks, blockSize);
   }
 
@@ -33,39 +83,80 @@ namespace rd_utils::memory::cache {
     return __GLOBAL__;
   }
 
-  void Allocator::configure (uint32_t nbBlocks, uint32_t blockSize) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
+  void Allocator::configure (uint32_t nbBlocks, uint32_t blockSize, EvictionPolicyKind policy, CodecKind codec) {
+    this-> removeClasses ();
+    this-> stopCompactor ();
+    this-> stopFlusher ();
+    this-> stopPrefetcher ();
+    this-> drainMagazines ();
+    WITH_WLOCK (this-> _metaM) {
       if (this-> _blocks.size () != 0) {
         throw std::runtime_error ("Cannot change size when there are already allocations");
       }
 
       this-> _max_blocks = nbBlocks;
       this-> _block_size = blockSize;
-      this-> _max_allocable = blockSize - ALLOC_HEAD_SIZE;
-      if (this-> _persister != nullptr) {
-        delete this-> _persister;
-        this-> _persister = nullptr;
+      this-> _max_allocable = free_list_capacity (blockSize);
+      this-> dispose ();
+      this-> resetMetrics ();
+      this-> _pool.configure (blockSize);
+
+      // every allocator has its own slab file
+      this-> _persister = new LocalPersister ("./alloc" + std::to_string (this-> _id), codec);
+      this-> _policy = EvictionPolicy::create (policy, nbBlocks);
+    }
+  }
+
+  void Allocator::configure (uint32_t nbBlocks, uint32_t blockSize, net::SockAddrV4 addr, EvictionPolicyKind policy, CodecKind codec) {
+    this-> removeClasses ();
+    this-> stopCompactor ();
+    this-> stopFlusher ();
+    this-> stopPrefetcher ();
+    this-> drainMagazines ();
+    WITH_WLOCK (this-> _metaM) {
+      if (this-> _blocks.size () != 0) {
+        throw std::runtime_error ("Cannot change size when there are already allocations");
       }
 
-      this-> _persister = new LocalPersister ();
+      this-> _max_blocks = nbBlocks;
+      this-> _block_size = blockSize;
+      this-> _max_allocable = free_list_capacity (blockSize);
+      this-> dispose ();
+      this-> resetMetrics ();
+      this-> _pool.configure (blockSize);
+
+      this-> _persister = new RemotePersister (addr, codec);
+      this-> _policy = EvictionPolicy::create (policy, nbBlocks);
     }
   }
 
-  void Allocator::configure (uint32_t nbBlocks, uint32_t blockSize, net::SockAddrV4 addr) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
+  void Allocator::configure (uint32_t nbBlocks, uint32_t blockSize, BlockPersister * persister, EvictionPolicyKind policy) {
+    try {
+      this-> removeClasses ();
+    } catch (const std::runtime_error &) {
+      delete persister;
+      throw;
+    }
+
+    this-> stopCompactor ();
+    this-> stopFlusher ();
+    this-> stopPrefetcher ();
+    this-> drainMagazines ();
+    WITH_WLOCK (this-> _metaM) {
       if (this-> _blocks.size () != 0) {
+        delete persister;
         throw std::runtime_error ("Cannot change size when there are already allocations");
       }
 
       this-> _max_blocks = nbBlocks;
       this-> _block_size = blockSize;
-      this-> _max_allocable = blockSize - ALLOC_HEAD_SIZE;
-      if (this-> _persister != nullptr) {
-        delete this-> _persister;
-        this-> _persister = nullptr;
-      }
+      this-> _max_allocable = free_list_capacity (blockSize);
+      this-> dispose ();
+      this-> resetMetrics ();
+      this-> _pool.configure (blockSize);
 
-      this-> _persister = new RemotePersister (addr);
+      this-> _persister = persister;
+      this-> _policy = EvictionPolicy::create (policy, nbBlocks);
     }
   }
 
@@ -74,10 +165,122 @@ namespace rd_utils::memory::cache {
       delete this-> _persister;
       this-> _persister = nullptr;
     }
+
+    if (this-> _policy != nullptr) {
+      delete this-> _policy;
+      this-> _policy = nullptr;
+    }
+  }
+
+  void Allocator::startFlusher (float high, float low) {
+    this-> stopFlusher ();
+
+    WITH_WLOCK (this-> _metaM) {
+      this-> _highWatermark = high;
+      this-> _lowWatermark = low < high ? low : high;
+      this-> _flusherRunning = true;
+    }
+
+    this-> _flusher = concurrency::spawn (this, &Allocator::flusherMain);
+    for (auto c : this-> _classes) {
+      c-> startFlusher (high, low);
+    }
+  }
+
+  void Allocator::stopFlusher () {
+    for (auto c : this-> _classes) {
+      c-> stopFlusher ();
+    }
+
+    if (this-> _flusherRunning) {
+      this-> _flusherRunning = false;
+      this-> _flushSem.post ();
+
+      concurrency::join (this-> _flusher);
+      this-> _flusher = concurrency::Thread (0);
+    }
+  }
+
+  void Allocator::startMetricsExport (utils::trace::TraceExporter * exporter, float period) {
+    this-> stopMetricsExport ();
+
+    this-> _exporter = exporter;
+    this-> _exporter-> setHeader (AllocatorMetrics::header ());
+    this-> _exportPeriod = period;
+    this-> _exporterRunning = true;
+
+    this-> _exportThread = concurrency::spawn (this, &Allocator::exporterMain);
+  }
+
+  void Allocator::stopMetricsExport () {
+    if (this-> _exporterRunning) {
+      this-> _exporterRunning = false;
+      this-> _exportSem.post ();
+
+      concurrency::join (this-> _exportThread);
+      this-> _exportThread = concurrency::Thread (0);
+    }
+
+    if (this-> _exporter != nullptr) {
+      delete this-> _exporter;
+      this-> _exporter = nullptr;
+    }
+  }
+
+  void Allocator::startCompactor (float period, float sparse) {
+    this-> stopCompactor ();
+
+    this-> _compactPeriod = period;
+    this-> _sparseRatio = sparse;
+    this-> _compactorRunning = true;
+
+    this-> _compactor = concurrency::spawn (this, &Allocator::compactorMain);
+    for (auto c : this-> _classes) {
+      c-> startCompactor (period, sparse);
+    }
+  }
+
+  void Allocator::stopCompactor () {
+    for (auto c : this-> _classes) {
+      c-> stopCompactor ();
+    }
+
+    if (this-> _compactorRunning) {
+      this-> _compactorRunning = false;
+      this-> _compactSem.post ();
+
+      concurrency::join (this-> _compactor);
+      this-> _compactor = concurrency::Thread (0);
+    }
   }
 
   Allocator::~Allocator () {
+    // the threads still running keep their magazine, it is deleted when they end
+    WITH_LOCK (this-> _magazineM) {
+      for (auto mag : this-> _magazines) {
+        WITH_LOCK (mag-> m) {
+          mag-> owner.store (nullptr, std::memory_order_release);
+        }
+      }
+
+      this-> _magazines.clear ();
+    }
+
+    this-> stopMetricsExport ();
+    this-> stopCompactor ();
+    this-> stopFlusher ();
+    this-> stopPrefetcher ();
     this-> dispose ();
+
+    if (this-> _balancerRunning) {
+      this-> _balancerRunning = false;
+      this-> _balanceSem.post ();
+      concurrency::join (this-> _balancer);
+    }
+
+    for (auto c : this-> _classes) {
+      delete c;
+    }
   }
 
   /**
@@ -94,26 +297,56 @@ namespace rd_utils::memory::cache {
 
 
   uint32_t Allocator::getMaxNbLoadable () const {
+    if (this-> _classes.size () != 0) {
+      return std::min ((uint64_t) UINT32_MAX, this-> _budget / this-> _block_size);
+    }
+
     return this-> _max_blocks;
   }
 
+  uint32_t Allocator::getNbClasses () const {
+    return this-> _classes.size () + 1;
+  }
+
+  Allocator & Allocator::getClass (uint32_t i) {
+    if (this-> _classes.size () == 0) return *this;
+    return *this-> _routes [i];
+  }
+
+  uint64_t Allocator::getBudget () const {
+    return this-> _budget;
+  }
+
+  uint32_t Allocator::getBlockSize () const {
+    return this-> _block_size;
+  }
+
   uint32_t Allocator::getNbLoaded () const {
     return this-> _loaded.size ();
   }
 
+  uint64_t Allocator::getResidentBytes () const {
+    uint64_t bytes = (uint64_t) this-> _loaded.size () * this-> _block_size;
+    for (auto c : this-> _classes) {
+      bytes += (uint64_t) c-> _loaded.size () * c-> _block_size;
+    }
+
+    return bytes;
+  }
+
   uint32_t Allocator::getMaxAllocable () const {
     return this-> _max_allocable;
   }
 
-  uint32_t Allocator::getNbStored () const {
-    if (this-> _loaded.size () < this-> _blocks.size ()) {
-      return this-> _blocks.size () - this-> _loaded.size ();
+  uint64_t Allocator::getNbStored () const {
+    if (this-> _loaded.size () + this-> _emptyBlocks.size () < this-> _blocks.size ()) {
+      return this-> _blocks.size () - this-> _loaded.size () - this-> _emptyBlocks.size ();
     }
 
     return 0;
   }
 
-  uint32_t Allocator::getMinNbStorable () const {
+  uint64_t Allocator::getMinNbStorable () const {
     if (this-> _max_blocks < this-> _blocks.size ()) {
       return this-> _blocks.size () - this-> _max_blocks;
     }
@@ -121,7 +354,7 @@ namespace rd_utils::memory::cache {
     return 0;
   }
 
-  uint32_t Allocator::getNbAllocated () const {
+  uint64_t Allocator::getNbAllocated () const {
     return this-> _blocks.size ();
   }
 
@@ -129,6 +362,59 @@ namespace rd_utils::memory::cache {
     return this-> _uniqLoads;
   }
 
+  uint32_t Allocator::getNbDirty () const {
+    return this-> _nbDirty;
+  }
+
+  uint32_t Allocator::getNbCleanEvictions () const {
+    return this-> _nbCleanEvictions;
+  }
+
+  uint32_t Allocator::getNbPrefetched () const {
+    return this-> _nbPrefetched;
+  }
+
+  int Allocator::getNumaNode () {
+    return this-> _pool.getNode ();
+  }
+
+  void Allocator::getMetrics (AllocatorMetrics & metrics) {
+    WITH_RLOCK (this-> _metaM) {
+      metrics.nbResident = this-> _loaded.size ();
+      metrics.nbLoadable = this-> _max_blocks;
+      metrics.nbAllocated = this-> _blocks.size () - this-> _emptyBlocks.size ();
+      metrics.nbDirty = this-> _nbDirty;
+
+      metrics.hits = this-> _nbHits;
+      metrics.misses = this-> _nbMisses;
+      metrics.prefetched = this-> _nbPrefetched;
+      metrics.evictions = this-> _nbEvictions;
+      metrics.dirtySaves = this-> _nbDirtySaves;
+      metrics.cleanEvictions = this-> _nbCleanEvictions;
+      metrics.bytesLoaded = this-> _bytesLoaded;
+      metrics.bytesSaved = this-> _bytesSaved;
+      metrics.nbShared = this-> _nbAliases;
+      metrics.zeroElided = this-> _nbZeroElided;
+
+      WITH_LOCK (this-> _persistM) {
+        metrics.loadLatency = this-> _loadLatency;
+        metrics.saveLatency = this-> _saveLatency;
+      }
+    }
+  }
+
+  void Allocator::getFragmentation (FragmentationMetrics & metrics, float sparse) {
+    WITH_RLOCK (this-> _metaM) {
+      this-> measureFragmentation (metrics, sparse);
+    }
+  }
+
+  void Allocator::getLastCompaction (CompactionReport & report) {
+    WITH_LOCK (this-> _compactM) {
+      report = this-> _lastCompaction;
+    }
+  }
+
   /**
    * ============================================================================
    * ============================================================================
@@ -138,22 +424,63 @@ namespace rd_utils::memory::cache {
    * */
 
   void Allocator::resize (uint32_t nbBlocks) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
+    if (this-> _classes.size () != 0) {
+      WITH_LOCK (this-> _classM) {
+        this-> _budget = (uint64_t) nbBlocks * this-> _block_size;
+      }
+
+      this-> balanceClasses ();
+      return;
+    }
+
+    this-> resizeOwn (nbBlocks);
+  }
+
+  void Allocator::resizeOwn (uint32_t nbBlocks) {
+    WITH_WLOCK (this-> _metaM) {
       if (nbBlocks < 2) this-> _max_blocks = 2;
       else this-> _max_blocks = nbBlocks;
+
+      this-> _policy-> resize (this-> _max_blocks);
       while (this-> _loaded.size () > this-> _max_blocks) {
-        this-> evictSome (this-> _loaded.size () - this-> _max_blocks);
+        // pinned blocks stay in memory until they are unpinned
+        if (this-> evictSome (this-> _loaded.size () - this-> _max_blocks) == 0) break;
       }
     }
   }
 
   void Allocator::resetUniqCounter () {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
+    for (auto c : this-> _classes) {
+      c-> resetUniqCounter ();
+    }
+
+    WITH_WLOCK (this-> _metaM) {
       this-> _lruStamp = this-> _lastLRU;
       this-> _uniqLoads = 0;
     }
   }
 
+  void Allocator::resetMetrics () {
+    for (auto c : this-> _classes) {
+      c-> resetMetrics ();
+    }
+
+    this-> _nbHits = 0;
+    this-> _nbMisses = 0;
+    this-> _nbPrefetched = 0;
+    this-> _nbEvictions = 0;
+    this-> _nbDirtySaves = 0;
+    this-> _nbCleanEvictions = 0;
+    this-> _bytesLoaded = 0;
+    this-> _bytesSaved = 0;
+    this-> _nbZeroElided = 0;
+
+    WITH_LOCK (this-> _persistM) {
+      this-> _loadLatency.clear ();
+      this-> _saveLatency.clear ();
+    }
+  }
+
   /**
    * ============================================================================
    * ============================================================================
@@ -163,62 +490,95 @@ namespace rd_utils::memory::cache {
    * */
 
   bool Allocator::allocate (uint32_t size, AllocatedSegment & alloc, bool newBlock, bool lock) {
-    auto realSize = free_list_real_size (size);
-    if (realSize > this-> _max_allocable) {
+    if (this-> _classes.size () != 0) {
+      auto c = this-> route (size, newBlock);
+      if (c != this) {
+        if (!c-> allocate (size, alloc, newBlock)) return false;
+
+        alloc.blockAddr |= c-> _tag;
+        return true;
+      }
+    }
+
+    if (size > this-> _max_allocable) {
       //LOG_ERROR ("Cannot allocate more than ", this-> _max_allocable, "B at a time");
       return false;
     }
 
-    uint32_t offset;
+    if (lock) {
+      WITH_WLOCK (this-> _metaM) {
+        return this-> allocateInner (size, alloc, newBlock);
+      }
+    }
+
+    return this-> allocateInner (size, alloc, newBlock);
+  }
+
+  bool Allocator::allocateInner (uint32_t size, AllocatedSegment & alloc, bool newBlock) {
     if (!newBlock) {
-      if (lock) __GLOBAL_MUTEX__.lock ();
-      for (auto & [addr, mem] : this-> _loaded) {
-        auto & bl = this-> _blocks [addr - 1];
-        if (bl.maxSize >= realSize) {
-          if (free_list_allocate (reinterpret_cast <free_list_instance*> (mem), size, offset)) {
-            bl.maxSize = free_list_max_size (reinterpret_cast <free_list_instance*> (mem));
-            bl.lru = this-> _lastLRU++;
-            alloc = {.blockAddr = addr, .offset = offset};
-            if (lock) __GLOBAL_MUTEX__.unlock ();
-            return true;
-          }
-        }
+      // best fit in the resident blocks
+      auto it = this-> _residentIndex.lower_bound ({size, 0});
+      if (it != this-> _residentIndex.end ()) {
+        auto addr = it-> second;
+        if (this-> allocateIn (addr, this-> load (addr), size, alloc)) return true;
       }
 
-      for (size_t addr = 1 ; addr <= this-> _blocks.size () ; addr++) {
-        auto & bl = this-> _blocks [addr - 1];
-        if (bl.maxSize >= realSize) { // no need to load a block whose size is not big enough for the allocation
-          auto mem = this-> load (addr);
-          if (free_list_allocate (mem, size, offset)) {
-            bl.maxSize = free_list_max_size (mem);
-            alloc = {.blockAddr = (uint32_t) addr, .offset = offset};
-            if (lock) __GLOBAL_MUTEX__.unlock ();
-            return true;
-          }
-        }
+      // reuse a freed block, it costs no read
+      if (this-> _emptyBlocks.size () != 0) {
+        auto addr = *this-> _emptyBlocks.begin ();
+        this-> _emptyBlocks.erase (this-> _emptyBlocks.begin ());
+
+        auto mem = this-> createBlock (addr);
+        if (this-> allocateIn (addr, reinterpret_cast <free_list_instance*> (mem), size, alloc)) return true;
+      }
+
+      // best fit in the stored blocks
+      it = this-> _storedIndex.lower_bound ({size, 0});
+      if (it != this-> _storedIndex.end ()) {
+        auto addr = it-> second;
+        if (this-> allocateIn (addr, this-> load (addr), size, alloc)) return true;
       }
     }
 
-    uint32_t addr;
-    if (lock) __GLOBAL_MUTEX__.lock ();
+    uint64_t addr;
     auto mem = this-> allocateNewBlock (addr);
-    if (free_list_allocate (reinterpret_cast <free_list_instance*> (mem), size, offset)) {
-      auto & bl = this-> _blocks [addr - 1];
-      bl.maxSize = free_list_max_size (reinterpret_cast <free_list_instance*> (mem));
-      bl.lru = this-> _lastLRU++;
-
-      alloc = {.blockAddr = addr, .offset = offset};
-      if (lock) __GLOBAL_MUTEX__.unlock ();
+    if (this-> allocateIn (addr, reinterpret_cast <free_list_instance*> (mem), size, alloc)) {
       return true;
     } else {
-      if (lock) __GLOBAL_MUTEX__.unlock ();
       //LOG_ERROR ("Failed to allocate ", size, ", possible corruption ?");
       return false;
     }
   }
 
-  bool Allocator::allocateSegments (uint32_t elemSize, uint64_t size, AllocatedSegment & rest, uint32_t & fstBlock, uint32_t & nbBlocks, uint32_t & blockSize) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
+  bool Allocator::allocateIn (uint64_t addr, free_list_instance * mem, uint32_t size, AllocatedSegment & alloc) {
+    uint32_t offset;
+    auto & bl = this-> _blocks [addr - 1];
+
+    this-> unindex (addr);
+    bool found = free_list_allocate (mem, size, offset);
+    if (found) {
+      bl.maxSize = free_list_max_size (mem);
+      alloc = {.blockAddr = addr, .offset = offset};
+      this-> markDirty (addr);
+    }
+
+    this-> index (addr);
+    return found;
+  }
+
+  bool Allocator::allocateSegments (uint32_t elemSize, uint64_t size, AllocatedSegment & rest, uint64_t & fstBlock, uint64_t & nbBlocks, uint32_t & blockSize) {
+    if (this-> _classes.size () != 0) {
+      auto c = this-> routeArray (size);
+      if (c != this) {
+        // the whole array is in the same class, its blocks stay consecutive
+        c-> allocateSegments (elemSize, size, rest, fstBlock, nbBlocks, blockSize);
+        if (nbBlocks != 0) fstBlock |= c-> _tag;
+        if (rest.blockAddr != 0) rest.blockAddr |= c-> _tag;
+        return true;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
       AllocatedSegment seg;
       bool fst = true;
       nbBlocks = 0;
@@ -227,8 +587,13 @@ namespace rd_utils::memory::cache {
         auto allocable = this-> _max_allocable - sizeof (uint32_t);
         auto toAlloc = allocable - (allocable % elemSize);
 
+        // the segment takes the whole block, so no other allocation lands in it and it can be shared (copy on write)
         blockSize = toAlloc;
-        this-> allocate (toAlloc, seg, true, false);
+        this-> allocateInner (this-> _max_allocable, seg, true);
+
+        // the bytes after the elements are never written, zeroing them lets a block of zeros be detected
+        auto mem = this-> _blocks [seg.blockAddr - 1].mem;
+        memset (mem + ALLOC_HEAD_SIZE + toAlloc, 0, this-> _block_size - ALLOC_HEAD_SIZE - toAlloc);
         if (fst) { fstBlock = seg.blockAddr; fst = false; }
         nbBlocks += 1;
         size -= toAlloc;
@@ -238,7 +603,7 @@ namespace rd_utils::memory::cache {
         auto allocable = size;
         auto toAlloc = allocable - (allocable % elemSize);
 
-        this-> allocate (size, rest, false, false);
+        this-> allocateInner (size, rest, false);
         size -= toAlloc;
       }
     }
@@ -247,211 +612,1691 @@ namespace rd_utils::memory::cache {
   }
 
   void Allocator::free (AllocatedSegment alloc) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
-      auto mem = this-> load (alloc.blockAddr);
-      free_list_free (mem, alloc.offset);
+    if (this-> _classes.size () != 0 && (alloc.blockAddr >> ALLOC_CLASS_SHIFT)) {
+      this-> owner (alloc.blockAddr)-> free (alloc);
+      return;
+    }
 
-      auto & bl = this-> _blocks [alloc.blockAddr - 1];
-      bl.maxSize = free_list_max_size (mem);
+    WITH_WLOCK (this-> _metaM) {
+      alloc.blockAddr &= ALLOC_ADDR_MASK;
+      this-> freeInner (alloc);
+    }
+  }
 
-      if (free_list_empty (mem)) {
-        this-> freeBlock (alloc.blockAddr);
-      }
+  void Allocator::freeInner (AllocatedSegment alloc) {
+    auto mem = this-> load (alloc.blockAddr);
+    free_list_free (mem, alloc.offset);
+
+    auto & bl = this-> _blocks [alloc.blockAddr - 1];
+    this-> unindex (alloc.blockAddr);
+    bl.maxSize = free_list_max_size (mem);
+
+    if (free_list_empty (mem)) {
+      this-> freeBlock (alloc.blockAddr);
+    } else {
+      this-> markDirty (alloc.blockAddr);
+      this-> index (alloc.blockAddr);
     }
   }
 
-  void Allocator::freeFast (uint32_t blockAddr) {
-    auto & bl = this-> _blocks [blockAddr - 1];
-    bl.maxSize = this-> _max_allocable;
-    this-> freeBlock (blockAddr);
+  void Allocator::freeFast (uint64_t blockAddr) {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      this-> owner (blockAddr)-> freeFast (blockAddr & ALLOC_ADDR_MASK);
+      return;
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      auto & bl = this-> _blocks [blockAddr - 1];
+      this-> unindex (blockAddr);
+      bl.maxSize = this-> _max_allocable;
+      this-> freeBlock (blockAddr);
+    }
   }
 
   void Allocator::free (const std::vector <AllocatedSegment> & segments) {
-    std::vector <AllocatedSegment> copy = segments;
-    int i = 0;
-    for (auto it : segments) { // Start by freeing already loaded blocks
-      __GLOBAL_MUTEX__.lock ();
-      auto lt = this-> _loaded.find (it.blockAddr) ;
-      __GLOBAL_MUTEX__.unlock ();
-
-      if (lt != this-> _loaded.end ()) {
-        this-> free (it);
-        copy.erase (copy.begin () + i);
-      } else {
-        i += 1;
+    auto tagged = [] (const AllocatedSegment & seg) { return (seg.blockAddr >> ALLOC_CLASS_SHIFT) != 0; };
+    if (this-> _classes.size () != 0 && std::any_of (segments.begin (), segments.end (), tagged)) {
+      std::vector <std::vector <AllocatedSegment> > groups (this-> _classes.size () + 1);
+      for (auto & it : segments) {
+        groups [it.blockAddr >> ALLOC_CLASS_SHIFT].push_back (it);
+      }
+
+      for (uint32_t c = 1 ; c < groups.size () ; c++) {
+        if (groups [c].size () != 0) this-> _classes [c - 1]-> free (groups [c]);
       }
-    }
 
-    for (auto it : copy) { // free other blocks
-      this-> free (it);
+      if (groups [0].size () != 0) this-> free (groups [0]);
+      return;
     }
-  }
 
-  /**
-   * =============================================================================
-   * =============================================================================
-   * =============================    INPUT/OUTPUT   =============================
-   * =============================================================================
-   * =============================================================================
-   * */
+    WITH_WLOCK (this-> _metaM) {
+      std::vector <AllocatedSegment> rest;
+      for (auto it : segments) { // Start by freeing already loaded blocks
+        it.blockAddr &= ALLOC_ADDR_MASK;
+        if (this-> _blocks [it.blockAddr - 1].mem != nullptr) {
+          this-> freeInner (it);
+        } else {
+          rest.push_back (it);
+        }
+      }
 
-  void Allocator::read (AllocatedSegment alloc, void * data, uint32_t offset, uint32_t size) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
-      auto mem = reinterpret_cast <uint8_t*> (this-> load (alloc.blockAddr));
-      memcpy (data, mem + alloc.offset + offset, size);
+      for (auto it : rest) { // free other blocks
+        this-> freeInner (it);
+      }
     }
   }
 
-  void Allocator::write (AllocatedSegment alloc, const void * data, uint32_t offset, uint32_t size) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
-      auto mem = reinterpret_cast <uint8_t*> (this-> load (alloc.blockAddr));
-      memcpy (mem + alloc.offset + offset, data, size);
+  uint64_t Allocator::track (AllocatedSegment * handle, uint32_t size) {
+    // the segment is moved by the compactor of its class (the handle keeps its tagged address), the ticket keeps the class
+    if (this-> _classes.size () != 0 && (handle-> blockAddr >> ALLOC_CLASS_SHIFT)) {
+      auto tag = handle-> blockAddr & ~ALLOC_ADDR_MASK;
+      return this-> owner (handle-> blockAddr)-> track (handle, size) | tag;
     }
-  }
 
-  void Allocator::copy (AllocatedSegment left, AllocatedSegment right, uint32_t size) {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
-      auto lMem = reinterpret_cast <uint8_t*> (this-> load (left.blockAddr));
-      auto rMem = reinterpret_cast <uint8_t*> (this-> load (right.blockAddr));
+    auto index = relocation_shard ();
+    auto & shard = this-> _relocatable [index];
+    WITH_LOCK (shard.m) {
+      // the slots are reused, tracking a segment does not allocate once the shard is warm
+      uint64_t slot;
+      if (shard.free.size () != 0) {
+        slot = shard.free.back ();
+        shard.free.pop_back ();
+        shard.slots [slot] = {handle, size};
+      } else {
+        slot = shard.slots.size ();
+        shard.slots.emplace_back (handle, size);
+      }
 
-      memcpy (rMem + right.offset, lMem + left.offset, size);
+      return slot * NB_BLOCK_STRIPES + index;
     }
+
+    return 0;
   }
 
-  bool Allocator::isLoaded (uint32_t blockAddr) const {
-    WITH_LOCK (__GLOBAL_MUTEX__) {
-      auto & bl = this-> _blocks [blockAddr - 1];
-      return bl.mem != nullptr;
+  void Allocator::untrack (uint64_t ticket) {
+    if (this-> _classes.size () != 0 && (ticket >> ALLOC_CLASS_SHIFT)) {
+      this-> owner (ticket)-> untrack (ticket & ALLOC_ADDR_MASK);
+      return;
+    }
+
+    auto & shard = this-> _relocatable [ticket % NB_BLOCK_STRIPES];
+    auto slot = ticket / NB_BLOCK_STRIPES;
+    WITH_LOCK (shard.m) {
+      shard.slots [slot].first = nullptr;
+      shard.free.push_back (slot);
     }
   }
 
   /**
-   * ===========================================================================
-   * ===========================================================================
-   * =============================    MANAGEMENT   =============================
-   * ===========================================================================
-   * ===========================================================================
+   * =============================================================================
+   * =============================================================================
+   * ==============================    MAGAZINES   ===============================
+   * =============================================================================
+   * =============================================================================
    * */
 
-  uint8_t * Allocator::allocateNewBlock (uint32_t & addr) {
-    uint8_t * mem = nullptr;
-    if (this-> _loaded.size () == this-> _max_blocks) {
-      this-> evictSome (std::min (1, std::max (1, NB_BLOCKS - 1)));
+  bool Allocator::allocateSmall (uint32_t size, AllocatedSegment & alloc) {
+    if (this-> _classes.size () != 0) {
+      auto c = this-> route (size, false);
+      if (c != this) {
+        if (!c-> allocateSmall (size, alloc)) return false;
+
+        alloc.blockAddr |= c-> _tag;
+        return true;
+      }
     }
 
-    mem = new uint8_t[this-> _block_size];
-    memset (mem, 0, this-> _block_size);
-    free_list_create (reinterpret_cast<free_list_instance*> (mem), this-> _block_size);
-    addr = this-> _blocks.size () + 1;
-    uint32_t lru = this-> _lastLRU++;
-    BlockInfo info = {.mem = mem, .lru = lru, .maxSize = this-> _max_allocable};
-    this-> _blocks.push_back (info);
-    this-> _loaded.emplace (addr, mem);
-    this-> _uniqLoads += 1;
+    if (size > MAGAZINE_MAX_SIZE) {
+      return this-> allocate (size, alloc);
+    }
 
-    return mem;
-  }
+    auto cls = magazine_class (size);
+    auto mag = this-> magazine ();
+    WITH_LOCK (mag-> m) {
+      auto & segments = mag-> segments [cls];
+      if (segments.size () == 0) { // refill the magazine with a batch of segments
+        WITH_WLOCK (this-> _metaM) {
+          AllocatedSegment seg;
+          while (segments.size () < MAGAZINE_BATCH && this-> allocateInner (8 << cls, seg, false)) {
+            segments.push_back (seg);
+          }
+        }
 
-  free_list_instance * Allocator::load (uint32_t addr) {
-    auto & memory = this-> _blocks [addr - 1];
-    auto lru = this-> _lastLRU++;
+        if (segments.size () == 0) return false;
+      }
 
-    if (memory.mem == nullptr) {
-      uint8_t * out = nullptr;
+      alloc = segments.back ();
+      segments.pop_back ();
+      return true;
+    }
 
-      if (this-> _loaded.size () == this-> _max_blocks) {
-        this-> evictSome (std::min (1, std::max (1, NB_BLOCKS - 1)));
-      }
+    return false;
+  }
 
-      out = new uint8_t [this-> _block_size];
-      this-> _persister-> load (addr, out, this-> _block_size);
-      this-> _loaded.emplace (addr, out);
+  void Allocator::freeSmall (AllocatedSegment alloc, uint32_t size) {
+    if (this-> _classes.size () != 0 && (alloc.blockAddr >> ALLOC_CLASS_SHIFT)) {
+      this-> owner (alloc.blockAddr)-> freeSmall (alloc, size);
+      return;
+    }
 
-      if (memory.lru < this-> _lruStamp) {
-        this-> _uniqLoads += 1;
-      }
+    // an untracked segment is not moved anymore, the magazine keeps it without its class
+    alloc.blockAddr &= ALLOC_ADDR_MASK;
 
-      memory.lru = lru;
-      memory.mem = out;
+    if (size > MAGAZINE_MAX_SIZE) {
+      this-> free (alloc);
+      return;
+    }
 
-      return (free_list_instance*) out;
-    } else {
-      if (memory.lru < this-> _lruStamp) {
-        this-> _uniqLoads += 1;
-      }
+    auto mag = this-> magazine ();
+    WITH_LOCK (mag-> m) {
+      auto & segments = mag-> segments [magazine_class (size)];
+      segments.push_back (alloc);
 
-      memory.lru = lru;
-      return (free_list_instance*) (memory.mem);
+      if (segments.size () > MAGAZINE_SIZE) { // give the oldest segments back to the allocator
+        std::vector <AllocatedSegment> rest (segments.begin (), segments.begin () + MAGAZINE_BATCH);
+        segments.erase (segments.begin (), segments.begin () + MAGAZINE_BATCH);
+        this-> free (rest);
+      }
     }
   }
 
-  void Allocator::evictSome (uint32_t nb) {
-    // We don't lock the mutex, we can only enter here if we are already locked
-
-    for (size_t i = 0 ; i < nb ; i++) {
-      auto min = time (NULL) + 10;
-      uint32_t addr = 0;
+  void Allocator::drainMagazines () {
+    for (auto c : this-> _classes) {
+      c-> drainMagazines ();
+    }
 
-      for (auto & [it, ld_mem] : this-> _loaded) {
-        auto & bl = this-> _blocks [it - 1];
-        if (bl.lru < min) {
-          addr = it;
-          min = bl.lru;
+    WITH_LOCK (this-> _magazineM) {
+      for (auto mag : this-> _magazines) {
+        WITH_LOCK (mag-> m) {
+          this-> drain (mag);
         }
       }
-
-      if (addr != 0) {
-        auto mem = this-> _loaded [addr];
-        this-> _persister-> save (addr, mem, this-> _block_size);
-        this-> _loaded.erase (addr);
-        this-> _blocks [addr - 1].mem = nullptr;
-        delete [] mem;
-        mem = nullptr;
-      }
-      else {
-        concurrency::timer::sleep (0.1);
-        evictSome (nb - i);
-      }
     }
   }
 
-  void Allocator::freeBlock (uint32_t addr) {
-    // No need to lock, only called within lock
-    auto & bl = this-> _blocks [addr - 1];
-    if (bl.mem != nullptr) {
-      delete [] bl.mem;
-      bl.mem = nullptr;
+  Magazine * Allocator::magazine () {
+    // a thread uses a few allocators at most, the magazines of the destroyed ones are dropped on the way
+    auto & mags = __MAGAZINE__.mags;
+    for (auto it = mags.begin () ; it != mags.end () ;) {
+      auto owner = (*it)-> owner.load (std::memory_order_acquire);
+      if (owner == this) return *it;
+      if (owner == nullptr) {
+        delete *it;
+        it = mags.erase (it);
+      } else it ++;
     }
 
-    // std::cout << "Freeing block : " << addr << std::endl;
-    this-> _persister-> erase (addr);
-    this-> _loaded.erase (addr);
+    auto mag = new Magazine ();
+    mag-> owner.store (this, std::memory_order_release);
+    WITH_LOCK (this-> _magazineM) {
+      this-> _magazines.emplace (mag);
+    }
 
-    while (this-> _blocks.size () != 0) {
-      auto & bl = this-> _blocks.back ();
-      if (bl.maxSize == this-> _max_allocable) {
-        if (bl.mem != nullptr) {
-          delete [] bl.mem;
-          bl.mem = nullptr;
-        }
+    __MAGAZINE__.mags.push_back (mag);
+    return mag;
+  }
+
+  void Allocator::drain (Magazine * mag) {
+    std::vector <AllocatedSegment> rest;
+    for (auto & segments : mag-> segments) {
+      rest.insert (rest.end (), segments.begin (), segments.end ());
+      segments.clear ();
+    }
 
-        this-> _blocks.pop_back ();
-      } else break;
+    if (rest.size () != 0) {
+      this-> free (rest);
     }
   }
 
-  /**
-   * ============================================================================
-   * ============================================================================
-   * =============================      MISCS      ==============================
-   * ============================================================================
-   * ============================================================================
-   * */
+  void Allocator::releaseMagazine (Magazine * mag) {
+    WITH_LOCK (this-> _magazineM) {
+      this-> _magazines.erase (mag);
+      WITH_LOCK (mag-> m) {
+        this-> drain (mag);
+      }
+    }
+
+    delete mag;
+  }
+
+  /**
+   * =============================================================================
+   * =============================================================================
+   * =============================    INPUT/OUTPUT   =============================
+   * =============================================================================
+   * =============================================================================
+   * */
+
+  void Allocator::read (const AllocatedSegment & alloc, void * data, uint32_t offset, uint32_t size) {
+    // the class bits of a handle never change, the rest is only read under the lock of its class (the compactor rewrites it)
+    if (this-> _classes.size () != 0 && (alloc.blockAddr >> ALLOC_CLASS_SHIFT)) {
+      this-> owner (alloc.blockAddr)-> read (alloc, data, offset, size);
+      return;
+    }
+
+    WITH_RLOCK (this-> _metaM) { // fast path, the block is resident only the lock of the block is needed
+      auto addr = this-> physical (alloc.blockAddr & ALLOC_ADDR_MASK);
+      auto mem = this-> touch (addr);
+      if (mem != nullptr) {
+        WITH_LOCK (this-> stripe (addr)) {
+          memcpy (data, mem + alloc.offset + offset, size);
+        }
+
+        return;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      auto mem = reinterpret_cast <uint8_t*> (this-> load (alloc.blockAddr & ALLOC_ADDR_MASK, false));
+      memcpy (data, mem + alloc.offset + offset, size);
+    }
+  }
+
+  void Allocator::write (const AllocatedSegment & alloc, const void * data, uint32_t offset, uint32_t size) {
+    if (this-> _classes.size () != 0 && (alloc.blockAddr >> ALLOC_CLASS_SHIFT)) {
+      this-> owner (alloc.blockAddr)-> write (alloc, data, offset, size);
+      return;
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      // a shared block is copied before being modified, that needs the exclusive lock
+      auto addr = alloc.blockAddr & ALLOC_ADDR_MASK;
+      auto mem = this-> shared (addr) ? nullptr : this-> touch (addr);
+      if (mem != nullptr) {
+        WITH_LOCK (this-> stripe (addr)) {
+          memcpy (mem + alloc.offset + offset, data, size);
+          this-> markDirty (addr);
+        }
+
+        return;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      auto addr = alloc.blockAddr & ALLOC_ADDR_MASK;
+      auto mem = reinterpret_cast <uint8_t*> (this-> load (addr));
+      memcpy (mem + alloc.offset + offset, data, size);
+      this-> markDirty (addr);
+    }
+  }
+
+  void Allocator::copy (const AllocatedSegment & left, const AllocatedSegment & right, uint32_t size) {
+    if (this-> _classes.size () != 0 && ((left.blockAddr | right.blockAddr) >> ALLOC_CLASS_SHIFT)) {
+      auto from = this-> owner (left.blockAddr), to = this-> owner (right.blockAddr);
+      if (from == to) {
+        from-> copy (left, right, size);
+        return;
+      }
+
+      // two classes have no lock in common, the data goes through a buffer
+      std::vector <uint8_t> buffer (size);
+      from-> read (left, buffer.data (), 0, size);
+      to-> write (right, buffer.data (), 0, size);
+      return;
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      auto lAddr = this-> physical (left.blockAddr & ALLOC_ADDR_MASK);
+      auto rAddr = right.blockAddr & ALLOC_ADDR_MASK;
+      auto lMem = this-> touch (lAddr);
+      auto rMem = this-> shared (rAddr) ? nullptr : this-> touch (rAddr);
+      if (lMem != nullptr && rMem != nullptr) {
+        // Stripes are always taken in the same order to avoid dead locks
+        auto fst = lAddr % NB_BLOCK_STRIPES, scd = rAddr % NB_BLOCK_STRIPES;
+        if (fst > scd) std::swap (fst, scd);
+
+        this-> _stripes [fst].lock ();
+        if (fst != scd) this-> _stripes [scd].lock ();
+
+        memcpy (rMem + right.offset, lMem + left.offset, size);
+        this-> markDirty (rAddr);
+
+        if (fst != scd) this-> _stripes [scd].unlock ();
+        this-> _stripes [fst].unlock ();
+        return;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      // the block read stays resident while the written one is loaded (or copied if it is shared)
+      auto lAddr = this-> physical (left.blockAddr & ALLOC_ADDR_MASK);
+      auto rAddr = right.blockAddr & ALLOC_ADDR_MASK;
+      auto lMem = reinterpret_cast <uint8_t*> (this-> load (lAddr, false));
+      this-> _blocks [lAddr - 1].pins += 1;
+      auto rMem = reinterpret_cast <uint8_t*> (this-> load (rAddr));
+      this-> _blocks [lAddr - 1].pins -= 1;
+
+      memcpy (rMem + right.offset, lMem + left.offset, size);
+      this-> markDirty (rAddr);
+    }
+  }
+
+  void Allocator::readv (IoVec * vecs, uint32_t nb) {
+    if (this-> _classes.size () != 0) this-> dispatch (vecs, nb, false);
+    else this-> transfer (vecs, nb, false);
+  }
+
+  void Allocator::writev (IoVec * vecs, uint32_t nb) {
+    if (this-> _classes.size () != 0) this-> dispatch (vecs, nb, true);
+    else this-> transfer (vecs, nb, true);
+  }
+
+  void Allocator::dispatch (IoVec * vecs, uint32_t nb, bool write) {
+    // the class is in the high bits of the addresses, the pieces of a class are contiguous once sorted
+    auto byBlock = [] (const IoVec & a, const IoVec & b) { return a.seg.blockAddr < b.seg.blockAddr; };
+    if (!std::is_sorted (vecs, vecs + nb, byBlock)) {
+      std::stable_sort (vecs, vecs + nb, byBlock);
+    }
+
+    for (uint32_t i = 0 ; i < nb ;) {
+      auto tag = vecs [i].seg.blockAddr & ~ALLOC_ADDR_MASK;
+      uint32_t end = i;
+      for (; end < nb && (vecs [end].seg.blockAddr & ~ALLOC_ADDR_MASK) == tag ; end++) {
+        vecs [end].seg.blockAddr &= ALLOC_ADDR_MASK;
+      }
+
+      this-> owner (tag)-> transfer (vecs + i, end - i, write);
+      for (; i < end ; i++) {
+        vecs [i].seg.blockAddr |= tag;
+      }
+    }
+  }
+
+  void Allocator::transfer (IoVec * vecs, uint32_t nb, bool write) {
+    if (nb == 0) return;
+
+    // the pieces of the collections are usually in order already, a stable sort keeps the order of overlapping writes
+    auto byBlock = [] (const IoVec & a, const IoVec & b) { return a.seg.blockAddr < b.seg.blockAddr; };
+    if (!std::is_sorted (vecs, vecs + nb, byBlock)) {
+      std::stable_sort (vecs, vecs + nb, byBlock);
+    }
+
+    WITH_RLOCK (this-> _metaM) { // fast path, every block is resident
+      bool resident = true;
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto addr = vecs [i].seg.blockAddr;
+        if (write && this-> shared (addr)) { resident = false; break; }
+        if (this-> _blocks [this-> physical (addr) - 1].mem == nullptr) { resident = false; break; }
+      }
+
+      if (resident) {
+        for (uint32_t i = 0 ; i < nb ;) {
+          auto addr = vecs [i].seg.blockAddr;
+          auto phys = this-> physical (addr);
+          auto mem = this-> touch (phys);
+          WITH_LOCK (this-> stripe (phys)) {
+            for (; i < nb && vecs [i].seg.blockAddr == addr ; i++) {
+              auto & v = vecs [i];
+              if (write) memcpy (mem + v.seg.offset + v.offset, v.data, v.size);
+              else memcpy (v.data, mem + v.seg.offset + v.offset, v.size);
+            }
+
+            if (write) this-> markDirty (addr);
+          }
+        }
+
+        return;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      // the shared blocks read the memory of their source, the written ones are copied from it
+      std::vector <uint64_t> missing;
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto addr = this-> physical (vecs [i].seg.blockAddr);
+        if (this-> _blocks [addr - 1].mem == nullptr) {
+          missing.push_back (addr);
+        }
+      }
+
+      std::sort (missing.begin (), missing.end ());
+      missing.erase (std::unique (missing.begin (), missing.end ()), missing.end ());
+
+      this-> loadBatch (missing);
+      for (uint32_t i = 0 ; i < nb ;) {
+        auto addr = vecs [i].seg.blockAddr;
+        auto phys = this-> physical (addr);
+
+        // the blocks of the batch are already counted as misses, the other ones are hits (or reloaded if a request bigger than the loadable blocks evicted them)
+        auto mem = this-> _blocks [phys - 1].mem;
+        if (mem == nullptr || (write && this-> shared (addr)) || !std::binary_search (missing.begin (), missing.end (), phys)) {
+          mem = reinterpret_cast <uint8_t*> (this-> load (addr, write));
+        }
+
+        for (; i < nb && vecs [i].seg.blockAddr == addr ; i++) {
+          auto & v = vecs [i];
+          if (write) memcpy (mem + v.seg.offset + v.offset, v.data, v.size);
+          else memcpy (v.data, mem + v.seg.offset + v.offset, v.size);
+        }
+
+        if (write) this-> markDirty (addr);
+      }
+    }
+  }
+
+  uint8_t * Allocator::pin (uint64_t blockAddr, bool write) {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      return this-> owner (blockAddr)-> pin (blockAddr & ALLOC_ADDR_MASK, write);
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      // the pinned memory can be modified without the allocator knowing it, a shared block gets its own copy before a write pin
+      // a read pin of a shared block pins the memory of its source
+      auto addr = write ? blockAddr : this-> physical (blockAddr);
+      auto mem = (write && this-> shared (blockAddr)) ? nullptr : this-> touch (addr);
+      if (mem != nullptr) {
+        // evictions need the exclusive lock, the block cannot leave before the pin is registered
+        // the stripe orders the pin with the flusher, that never writes back a pinned block
+        WITH_LOCK (this-> stripe (addr)) {
+          this-> _blocks [addr - 1].pins += 1;
+          if (write) this-> markDirty (addr);
+        }
+
+        return mem;
+      }
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      auto mem = reinterpret_cast <uint8_t*> (this-> load (blockAddr, write));
+      auto addr = write ? blockAddr : this-> physical (blockAddr);
+      this-> _blocks [addr - 1].pins += 1;
+      if (write) this-> markDirty (addr);
+
+      return mem;
+    }
+  }
+
+  void Allocator::unpin (uint64_t blockAddr, const uint8_t * memory) {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      this-> owner (blockAddr)-> unpin (blockAddr & ALLOC_ADDR_MASK, memory);
+      return;
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      this-> _blocks [this-> pinned (blockAddr, memory) - 1].pins -= 1;
+    }
+  }
+
+  uint64_t Allocator::pinned (uint64_t addr, const uint8_t * memory) const {
+    if (this-> _blocks [addr - 1].mem == memory) return addr;
+
+    auto src = this-> physical (addr);
+    if (this-> _blocks [src - 1].mem == memory) return src;
+
+    // the source was written since the pin, its pinned memory went to one of its aliases (see unshare)
+    for (auto & it : this-> _loaded) {
+      if (it.second == memory) return it.first;
+    }
+
+    return addr;
+  }
+
+  void Allocator::prefetch (uint64_t blockAddr) {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      this-> owner (blockAddr)-> prefetch (blockAddr & ALLOC_ADDR_MASK);
+      return;
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      if (blockAddr == 0 || blockAddr > this-> _blocks.size ()) return;
+
+      // the content of a shared block is read from its source
+      blockAddr = this-> physical (blockAddr);
+      if (this-> _blocks [blockAddr - 1].mem != nullptr) return;
+    }
+
+    WITH_LOCK (this-> _prefetchM) {
+      // Prefetching more than the loadable blocks would evict the first prefetched ones
+      if (this-> _prefetchQueue.size () >= this-> _max_blocks) return;
+      if (!this-> _prefetcherRunning) {
+        this-> _prefetcherRunning = true;
+        this-> _prefetcher = concurrency::spawn (this, &Allocator::prefetcherMain);
+      }
+
+      this-> _prefetchQueue.push_back (blockAddr);
+    }
+
+    this-> _prefetchSem.post ();
+  }
+
+  void Allocator::setNumaNode (int node) {
+    for (auto c : this-> _classes) {
+      c-> setNumaNode (node);
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      this-> _pool.setNode (node);
+
+      // the accesses to the resident blocks are stopped by the exclusive lock while their pages move
+      for (auto & it : this-> _loaded) {
+        this-> _pool.bind (it.second);
+      }
+    }
+  }
+
+  void Allocator::prefetch (const std::vector <uint64_t> & blockAddrs) {
+    for (auto addr : blockAddrs) {
+      this-> prefetch (addr);
+    }
+  }
+
+  void Allocator::evict (uint64_t blockAddr) {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      this-> owner (blockAddr)-> evict (blockAddr & ALLOC_ADDR_MASK);
+      return;
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      if (blockAddr == 0 || blockAddr > this-> _blocks.size ()) return;
+
+      auto & bl = this-> _blocks [blockAddr - 1];
+      if (bl.mem == nullptr || bl.pins != 0) return;
+
+      this-> _policy-> onRemove (blockAddr);
+      this-> writeBack ({blockAddr});
+    }
+  }
+
+  bool Allocator::isLoaded (uint64_t blockAddr) const {
+    if (blockAddr >> ALLOC_CLASS_SHIFT) {
+      return this-> owner (blockAddr)-> isLoaded (blockAddr & ALLOC_ADDR_MASK);
+    }
+
+    WITH_RLOCK (this-> _metaM) {
+      auto & bl = this-> _blocks [this-> physical (blockAddr) - 1];
+      return bl.mem != nullptr;
+    }
+  }
+
+  /**
+   * ===========================================================================
+   * ===========================================================================
+   * ============================    SIZE CLASSES   ============================
+   * ===========================================================================
+   * ===========================================================================
+   * */
+
+  void Allocator::configureClasses (const std::vector <uint32_t> & blockSizes, uint64_t budget, const std::vector <BlockPersister*> & persisters) {
+    try {
+      if (blockSizes.size () > ALLOC_MAX_CLASSES) {
+        throw std::runtime_error ("Too many size classes");
+      }
+
+      this-> removeClasses ();
+      WITH_RLOCK (this-> _metaM) {
+        if (this-> _blocks.size () != 0) {
+          throw std::runtime_error ("Cannot add size classes when there are already allocations");
+        }
+      }
+    } catch (const std::runtime_error &) {
+      for (auto p : persisters) delete p;
+      throw;
+    }
+
+    for (uint32_t i = 0 ; i < blockSizes.size () ; i++) {
+      auto c = new Allocator (2, blockSizes [i]);
+      if (i < persisters.size () && persisters [i] != nullptr) {
+        c-> configure (2, blockSizes [i], persisters [i]);
+      }
+
+      c-> _tag = ((uint64_t) i + 1) << ALLOC_CLASS_SHIFT;
+      if (this-> getNumaNode () >= 0) c-> setNumaNode (this-> getNumaNode ());
+      if (this-> _flusherRunning) c-> startFlusher (this-> _highWatermark, this-> _lowWatermark);
+      if (this-> _compactorRunning) c-> startCompactor (this-> _compactPeriod, this-> _sparseRatio);
+
+      this-> _classes.push_back (c);
+    }
+
+    for (uint32_t i = blockSizes.size () ; i < persisters.size () ; i++) {
+      delete persisters [i];
+    }
+
+    this-> _routes = this-> _classes;
+    this-> _routes.push_back (this);
+    std::stable_sort (this-> _routes.begin (), this-> _routes.end (), [] (Allocator * a, Allocator * b) { return a-> _block_size < b-> _block_size; });
+
+    WITH_LOCK (this-> _classM) {
+      this-> _budget = budget;
+      this-> _lastLoaded.clear ();
+      for (auto c : this-> _routes) {
+        this-> _lastLoaded.push_back (c-> _bytesLoaded);
+      }
+    }
+
+    this-> balanceClasses ();
+
+    this-> _balancerRunning = true;
+    this-> _balancer = concurrency::spawn (this, &Allocator::balancerMain);
+  }
+
+  void Allocator::balanceClasses () {
+    if (this-> _classes.size () == 0) return;
+
+    WITH_LOCK (this-> _classM) {
+      auto nb = this-> _routes.size ();
+      std::vector <uint64_t> given (nb), need (nb), weight (nb);
+      uint64_t left = this-> _budget;
+      double totalWeight = 0;
+
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto c = this-> _routes [i];
+        uint64_t size = c-> _block_size;
+
+        // a class never has less than 2 loadable blocks (see resize)
+        given [i] = 2 * size;
+        left -= std::min (left, given [i]);
+
+        WITH_RLOCK (c-> _metaM) {
+          need [i] = (c-> _blocks.size () - c-> _emptyBlocks.size ()) * size;
+        }
+
+        // the loaded bytes go back to 0 when the metrics are reset
+        uint64_t loaded = c-> _bytesLoaded;
+        weight [i] = loaded - std::min (loaded, this-> _lastLoaded [i]) + size;
+        this-> _lastLoaded [i] = loaded;
+        totalWeight += weight [i];
+      }
+
+      // the classes that loaded the most get the biggest part, but never more than their allocated blocks
+      for (uint32_t pass = 0 ; pass < nb && left != 0 ; pass++) {
+        double total = 0;
+        for (uint32_t i = 0 ; i < nb ; i++) {
+          if (given [i] < need [i]) total += weight [i];
+        }
+
+        if (total == 0) break;
+
+        uint64_t spent = 0;
+        for (uint32_t i = 0 ; i < nb ; i++) {
+          if (given [i] >= need [i]) continue;
+
+          uint64_t part = std::min ((uint64_t) (left * (weight [i] / total)), need [i] - given [i]);
+          given [i] += part;
+          spent += part;
+        }
+
+        if (spent == 0) break;
+        left -= std::min (left, spent);
+      }
+
+      // every class has room for its blocks, the rest is shared the same way for the next allocations
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        given [i] += (uint64_t) (left * (weight [i] / totalWeight));
+        this-> _routes [i]-> resizeOwn (std::min ((uint64_t) UINT32_MAX, given [i] / this-> _routes [i]-> _block_size));
+      }
+    }
+  }
+
+  void Allocator::balancerMain (concurrency::Thread) {
+    while (this-> _balancerRunning) {
+      this-> _balanceSem.wait (ALLOC_CLASS_BALANCE_PERIOD);
+      if (!this-> _balancerRunning) break;
+
+      this-> balanceClasses ();
+    }
+  }
+
+  void Allocator::removeClasses () {
+    if (this-> _classes.size () == 0) return;
+
+    for (auto c : this-> _classes) {
+      c-> drainMagazines ();
+      WITH_RLOCK (c-> _metaM) {
+        if (c-> _blocks.size () != 0) {
+          throw std::runtime_error ("Cannot remove size classes when there are already allocations");
+        }
+      }
+    }
+
+    if (this-> _balancerRunning) {
+      this-> _balancerRunning = false;
+      this-> _balanceSem.post ();
+
+      concurrency::join (this-> _balancer);
+      this-> _balancer = concurrency::Thread (0);
+    }
+
+    for (auto c : this-> _classes) {
+      delete c;
+    }
+
+    this-> _classes.clear ();
+    this-> _routes.clear ();
+    this-> _budget = 0;
+  }
+
+  Allocator * Allocator::owner (uint64_t addr) const {
+    auto c = addr >> ALLOC_CLASS_SHIFT;
+    if (c == 0) return const_cast <Allocator*> (this);
+
+    // the tag comes from the caller (e.g. a handle of another allocator or a stale one after a reconfiguration)
+    if (c > this-> _classes.size ()) {
+      throw std::runtime_error ("Block address of an unknown size class : " + std::to_string (c));
+    }
+
+    return this-> _classes [c - 1];
+  }
+
+  Allocator * Allocator::route (uint64_t size, bool newBlock) const {
+    // the smallest class in which the allocation is small, so loading it pulls as few bytes as possible
+    if (!newBlock) {
+      for (auto c : this-> _routes) {
+        if (size * ALLOC_CLASS_FILL <= c-> _max_allocable) return c;
+      }
+    }
+
+    for (auto c : this-> _routes) {
+      if (size <= c-> _max_allocable) return c;
+    }
+
+    // fails in the biggest class
+    return this-> _routes.back ();
+  }
+
+  Allocator * Allocator::routeArray (uint64_t size) const {
+    // the biggest blocks the array fills, so it has few blocks and few metadata
+    for (auto it = this-> _routes.rbegin () ; it != this-> _routes.rend () ; it++) {
+      if (size >= (uint64_t) ALLOC_CLASS_MIN_BLOCKS * (*it)-> _max_allocable) return *it;
+    }
+
+    return this-> route (size, false);
+  }
+
+  /**
+   * ===========================================================================
+   * ===========================================================================
+   * ===============================    SHARING   ==============================
+   * ===========================================================================
+   * ===========================================================================
+   * */
+
+  void Allocator::share (uint64_t src, uint64_t dst) {
+    if ((src | dst) >> ALLOC_CLASS_SHIFT) {
+      if ((src & ~ALLOC_ADDR_MASK) != (dst & ~ALLOC_ADDR_MASK)) {
+        throw std::runtime_error ("Only blocks of the same size class can be shared");
+      }
+
+      this-> owner (src)-> share (src & ALLOC_ADDR_MASK, dst & ALLOC_ADDR_MASK);
+      return;
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      if (this-> _blocks [src - 1].maxSize != 0 || this-> _blocks [dst - 1].maxSize != 0) {
+        throw std::runtime_error ("Only full blocks can be shared");
+      }
+
+      auto root = this-> physical (src);
+      if (root == this-> physical (dst)) return; // already the same content
+
+      // the aliases of dst keep its current content
+      auto & d = this-> _blocks [dst - 1];
+      if (d.aliases != 0) this-> unshare (dst);
+      if (d.source != 0) this-> unalias (dst);
+
+      // a pinned block is accessed without the allocator lock, the data is copied now
+      if (d.pins != 0 || this-> _blocks [root - 1].pins != 0) {
+        auto from = reinterpret_cast <uint8_t*> (this-> load (root, false));
+        this-> _blocks [root - 1].pins += 1;
+        auto to = reinterpret_cast <uint8_t*> (this-> load (dst));
+        this-> _blocks [root - 1].pins -= 1;
+
+        memcpy (to, from, this-> _block_size);
+        this-> markDirty (dst);
+        return;
+      }
+
+      // the content of dst is dropped, it is read from the root from now on
+      this-> unindex (dst);
+      if (d.mem != nullptr) {
+        this-> _policy-> onRemove (dst);
+        this-> _loaded.erase (dst);
+        this-> _pool.release (d.mem);
+        d.mem = nullptr;
+      }
+
+      this-> markClean (dst);
+      this-> _prefetching.erase (dst);
+      WITH_LOCK (this-> _persistM) {
+        this-> _zeroHeads.erase (dst);
+        d.zero = false;
+      }
+
+      this-> unindex (root);
+      d.source = root;
+      d.maxSize = this-> _blocks [root - 1].maxSize;
+      this-> _blocks [root - 1].aliases += 1;
+      this-> _aliases [root].push_back (dst);
+      this-> _nbAliases += 1;
+    }
+  }
+
+  uint64_t Allocator::physical (uint64_t addr) const {
+    auto source = this-> _blocks [addr - 1].source;
+    return source != 0 ? source : addr;
+  }
+
+  bool Allocator::shared (uint64_t addr) const {
+    auto & bl = this-> _blocks [addr - 1];
+    return bl.source != 0 || bl.aliases != 0;
+  }
+
+  uint8_t * Allocator::materialize (uint64_t addr) {
+    auto src = this-> _blocks [addr - 1].source;
+    auto from = reinterpret_cast <uint8_t*> (this-> load (src, false));
+
+    // the source stays resident while it is copied
+    this-> _blocks [src - 1].pins += 1;
+    if (this-> _loaded.size () >= this-> _max_blocks) {
+      this-> evictSome (this-> _loaded.size () - this-> _max_blocks + 1);
+    }
+
+    auto mem = this-> _pool.acquire ();
+    memcpy (mem, from, this-> _block_size);
+    this-> _blocks [src - 1].pins -= 1;
+
+    this-> unalias (addr);
+    this-> install (addr, mem);
+    this-> markDirty (addr); // the persister has no copy of this content at this address
+
+    return mem;
+  }
+
+  void Allocator::unshare (uint64_t addr) {
+    auto heir = this-> _aliases [addr].front ();
+    this-> materialize (heir);
+
+    // the pins of a block with aliases are read pins (of the block or of its aliases), their readers keep the current content
+    // the pinned memory goes to the heir with the pins, the block is written in the copy
+    auto & bl = this-> _blocks [addr - 1];
+    auto & hr = this-> _blocks [heir - 1];
+    if (bl.pins != 0) {
+      std::swap (bl.mem, hr.mem);
+      this-> _loaded [addr] = bl.mem;
+      this-> _loaded [heir] = hr.mem;
+      hr.pins += bl.pins.exchange (0);
+    }
+
+    auto it = this-> _aliases.find (addr);
+    if (it == this-> _aliases.end ()) return; // the heir was the only alias
+
+    // the other aliases share the copy of the heir
+    auto rest = std::move (it-> second);
+    this-> _aliases.erase (it);
+    this-> _blocks [addr - 1].aliases = 0;
+    this-> index (addr);
+
+    this-> unindex (heir);
+    for (auto alias : rest) {
+      this-> _blocks [alias - 1].source = heir;
+    }
+
+    this-> _blocks [heir - 1].aliases = rest.size ();
+    this-> _aliases [heir] = std::move (rest);
+  }
+
+  void Allocator::unalias (uint64_t addr) {
+    auto & bl = this-> _blocks [addr - 1];
+    auto src = bl.source;
+
+    auto it = this-> _aliases.find (src);
+    it-> second.erase (std::find (it-> second.begin (), it-> second.end (), addr));
+    if (it-> second.size () == 0) this-> _aliases.erase (it);
+
+    bl.source = 0;
+    this-> _blocks [src - 1].aliases -= 1;
+    this-> _nbAliases -= 1;
+
+    // the source can receive allocations again once it is not shared anymore
+    this-> index (src);
+  }
+
+  /**
+   * ===========================================================================
+   * ===========================================================================
+   * =============================    COMPACTION   =============================
+   * ===========================================================================
+   * ===========================================================================
+   * */
+
+  void Allocator::compact (CompactionReport & report, float sparse) {
+    report = {};
+
+    // the free segments of the magazines are allocated in the blocks, they would keep the sparse blocks alive
+    this-> drainMagazines ();
+
+    WITH_WLOCK (this-> _metaM) {
+      this-> measureFragmentation (report.before, sparse);
+
+      // the owners cannot untrack (and free) a segment while it is moved
+      for (auto & shard : this-> _relocatable) shard.m.lock ();
+
+      // the tracked segments of each resident block
+      std::unordered_map <uint64_t, std::vector <std::pair <AllocatedSegment*, uint32_t> > > owned;
+      for (auto & shard : this-> _relocatable) {
+        for (auto & it : shard.slots) {
+          if (it.first == nullptr) continue;
+
+          auto addr = it.first-> blockAddr & ALLOC_ADDR_MASK;
+          if (this-> _blocks [addr - 1].mem != nullptr) {
+            owned [addr].push_back (it);
+          }
+        }
+      }
+
+      std::vector <std::pair <uint32_t, uint64_t> > candidates;
+      for (auto & it : owned) {
+        auto & bl = this-> _blocks [it.first - 1];
+        auto inst = reinterpret_cast <free_list_instance*> (bl.mem);
+        if (bl.pins != 0 || bl.aliases != 0 || inst-> used_size > sparse * inst-> total_size) continue;
+
+        // a segment that is not tracked cannot be moved, the block would stay allocated anyway
+        uint64_t tracked = 0;
+        for (auto & seg : it.second) {
+          tracked += free_list_segment_size (inst, seg.first-> offset);
+        }
+
+        if (tracked == inst-> used_size) {
+          candidates.emplace_back (inst-> used_size, it.first);
+        }
+      }
+
+      // the sparsest blocks are emptied first, into the denser ones
+      std::sort (candidates.begin (), candidates.end ());
+      for (auto & it : candidates) {
+        auto addr = it.second;
+        auto & bl = this-> _blocks [addr - 1];
+        auto inst = reinterpret_cast <free_list_instance*> (bl.mem);
+
+        // the block received segments of sparser blocks, it is dense enough now
+        if (inst-> used_size > sparse * inst-> total_size) continue;
+
+        // no segment is moved back into the block being evacuated
+        this-> unindex (addr);
+        bool fitted = this-> evacuate (addr, owned, report);
+
+        bl.maxSize = free_list_max_size (inst);
+        if (free_list_empty (inst)) {
+          this-> freeBlock (addr);
+          report.nbFreed += 1;
+        } else {
+          this-> index (addr);
+        }
+
+        if (!fitted) break;
+      }
+
+      for (auto & shard : this-> _relocatable) shard.m.unlock ();
+
+      this-> measureFragmentation (report.after, sparse);
+    }
+  }
+
+  bool Allocator::evacuate (uint64_t addr, std::unordered_map <uint64_t, std::vector <std::pair <AllocatedSegment*, uint32_t> > > & owned, CompactionReport & report) {
+    auto mem = this-> _blocks [addr - 1].mem;
+    auto inst = reinterpret_cast <free_list_instance*> (mem);
+    auto segments = std::move (owned [addr]);
+
+    for (auto & seg : segments) {
+      auto handle = seg.first;
+
+      // the destination is as big as the source, not as the tracked size: a segment of a magazine goes back to the magazine of its size
+      uint32_t size = free_list_segment_size (inst, handle-> offset) - sizeof (uint32_t);
+
+      // best fit in the other resident blocks, moving a segment never loads a block
+      auto it = this-> _residentIndex.lower_bound ({size, 0});
+      if (it == this-> _residentIndex.end ()) return false;
+
+      AllocatedSegment to;
+      auto dstAddr = it-> second;
+      auto dst = this-> _blocks [dstAddr - 1].mem;
+      if (!this-> allocateIn (dstAddr, reinterpret_cast <free_list_instance*> (dst), size, to)) return false;
+
+      // the readers and writers of the resident blocks hold the lock in shared mode, the copy cannot be seen half done
+      memcpy (dst + to.offset, mem + handle-> offset, size);
+      free_list_free (inst, handle-> offset);
+      this-> markDirty (addr);
+      *handle = {.blockAddr = to.blockAddr | this-> _tag, .offset = to.offset};
+
+      // the destination can be evacuated later in the pass
+      owned [dstAddr].push_back (seg);
+      report.nbMoved += 1;
+      report.bytesMoved += size;
+    }
+
+    return true;
+  }
+
+  void Allocator::measureFragmentation (FragmentationMetrics & metrics, float sparse) const {
+    metrics = {};
+
+    uint64_t capacity = 0;
+    for (auto & it : this-> _loaded) {
+      auto inst = reinterpret_cast <const free_list_instance*> (it.second);
+      if (inst-> used_size == 0) continue;
+
+      metrics.nbBlocks += 1;
+      metrics.usedBytes += inst-> used_size;
+      metrics.freeBytes += inst-> total_size - inst-> used_size;
+      metrics.largestFree += inst-> max_free;
+      if (inst-> used_size <= sparse * inst-> total_size) metrics.nbSparse += 1;
+
+      capacity = inst-> total_size;
+    }
+
+    if (capacity != 0) {
+      metrics.nbPacked = (metrics.usedBytes + capacity - 1) / capacity;
+    }
+  }
+
+  void Allocator::compactorMain (concurrency::Thread) {
+    CompactionReport report;
+    while (this-> _compactorRunning) {
+      this-> _compactSem.wait (this-> _compactPeriod);
+      if (!this-> _compactorRunning) break;
+
+      this-> compact (report, this-> _sparseRatio);
+      WITH_LOCK (this-> _compactM) {
+        this-> _lastCompaction = report;
+      }
+    }
+  }
+
+  /**
+   * ===========================================================================
+   * ===========================================================================
+   * =============================    MANAGEMENT   =============================
+   * ===========================================================================
+   * ===========================================================================
+   * */
+
+  uint8_t * Allocator::allocateNewBlock (uint64_t & addr) {
+    addr = this-> _blocks.size () + 1;
+    this-> _blocks.emplace_back ();
+
+    return this-> createBlock (addr);
+  }
+
+  uint8_t * Allocator::createBlock (uint64_t addr) {
+    uint8_t * mem = nullptr;
+    if (this-> _loaded.size () >= this-> _max_blocks) {
+      this-> evictSome (this-> _loaded.size () - this-> _max_blocks + 1);
+    }
+
+    // only the header of the free list is initialized, the segments are not zeroed
+    mem = this-> _pool.acquire ();
+    free_list_create (reinterpret_cast<free_list_instance*> (mem), this-> _block_size);
+
+    auto & info = this-> _blocks [addr - 1];
+    info.mem = mem;
+    info.lru = this-> _lastLRU++;
+    info.maxSize = this-> _max_allocable;
+    info.pins = 0;
+    info.dirty = false;
+    info.source = 0;
+    info.aliases = 0;
+    this-> markDirty (addr); // never persisted
+    this-> _loaded.emplace (addr, mem);
+    this-> _policy-> onLoad (addr);
+    this-> _uniqLoads += 1;
+    this-> index (addr);
+
+    return mem;
+  }
+
+  void Allocator::index (uint64_t addr) {
+    auto & bl = this-> _blocks [addr - 1];
+
+    // allocating in a shared block would break the sharing
+    if (bl.source != 0 || bl.aliases != 0) return;
+    if (bl.mem != nullptr) {
+      this-> _residentIndex.emplace (bl.maxSize, addr);
+    } else {
+      this-> _storedIndex.emplace (bl.maxSize, addr);
+    }
+  }
+
+  void Allocator::unindex (uint64_t addr) {
+    auto & bl = this-> _blocks [addr - 1];
+    if (bl.mem != nullptr) {
+      this-> _residentIndex.erase ({bl.maxSize, addr});
+    } else {
+      this-> _storedIndex.erase ({bl.maxSize, addr});
+    }
+  }
+
+  uint8_t * Allocator::touch (uint64_t addr) {
+    auto & memory = this-> _blocks [addr - 1];
+    if (memory.mem == nullptr) return nullptr;
+
+    if (memory.lru < this-> _lruStamp) {
+      this-> _uniqLoads += 1;
+    }
+
+    memory.lru = this-> _lastLRU++;
+    this-> _policy-> onAccess (addr);
+    this-> _nbHits += 1;
+    return memory.mem;
+  }
+
+  concurrency::mutex & Allocator::stripe (uint64_t addr) {
+    return this-> _stripes [addr % NB_BLOCK_STRIPES];
+  }
+
+  void Allocator::markDirty (uint64_t addr) {
+    auto & bl = this-> _blocks [addr - 1];
+    bl.version = ++ this-> _nbMarks;
+    if (!bl.dirty.exchange (true)) {
+      auto nb = ++ this-> _nbDirty;
+      if (this-> _flusherRunning && nb == (uint32_t) (this-> _highWatermark * this-> _max_blocks) + 1) {
+        this-> _flushSem.post ();
+      }
+    }
+  }
+
+  void Allocator::markClean (uint64_t addr) {
+    if (this-> _blocks [addr - 1].dirty.exchange (false)) {
+      this-> _nbDirty -= 1;
+    }
+  }
+
+  free_list_instance * Allocator::load (uint64_t addr, bool write) {
+    auto & memory = this-> _blocks [addr - 1];
+    if (memory.source != 0) {
+      if (!write) return this-> load (memory.source, false);
+      return reinterpret_cast <free_list_instance*> (this-> materialize (addr));
+    }
+
+    // the aliases keep the current content
+    if (write && memory.aliases != 0) {
+      this-> unshare (addr);
+    }
+
+    auto lru = this-> _lastLRU++;
+
+    if (memory.mem == nullptr) {
+      uint8_t * out = nullptr;
+
+      if (this-> _loaded.size () >= this-> _max_blocks) {
+        this-> evictSome (this-> _loaded.size () - this-> _max_blocks + 1);
+      }
+
+      out = this-> _pool.acquire ();
+      WITH_LOCK (this-> _persistM) {
+        this-> fetch ({{addr, out}});
+      }
+
+      this-> _nbMisses += 1;
+
+      // a prefetch of the block is in flight, its copy must not be installed over this one
+      this-> _prefetching.erase (addr);
+      this-> install (addr, out);
+
+      return (free_list_instance*) out;
+    } else {
+      if (memory.lru < this-> _lruStamp) {
+        this-> _uniqLoads += 1;
+      }
+
+      memory.lru = lru;
+      this-> _policy-> onAccess (addr);
+      this-> _nbHits += 1;
+      return (free_list_instance*) (memory.mem);
+    }
+  }
+
+  void Allocator::loadBatch (const std::vector <uint64_t> & addrs) {
+    std::vector <BlockIo> toLoad;
+    for (auto addr : addrs) {
+      if (toLoad.size () >= this-> _max_blocks) break;
+      if (this-> _blocks [addr - 1].mem == nullptr) {
+        toLoad.push_back ({addr, nullptr});
+      }
+    }
+
+    if (toLoad.size () == 0) return;
+    if (this-> _loaded.size () + toLoad.size () > this-> _max_blocks) {
+      this-> evictSome (this-> _loaded.size () + toLoad.size () - this-> _max_blocks);
+    }
+
+    for (auto & b : toLoad) {
+      b.memory = this-> _pool.acquire ();
+    }
+
+    WITH_LOCK (this-> _persistM) {
+      this-> fetch (toLoad);
+    }
+
+    this-> _nbMisses += toLoad.size ();
+
+    for (auto & b : toLoad) {
+      // a prefetch of the block is in flight, its copy must not be installed over this one
+      this-> _prefetching.erase (b.addr);
+      this-> install (b.addr, b.memory);
+    }
+  }
+
+  /**
+   * @returns: true if the bytes of a block after its head (the header of the free list and of its first segment) are all zeros
+   */
+  static bool is_zero_block (const uint8_t * mem, uint32_t size) {
+    // the head is 8 bytes aligned, the words are or-ed by chunks so the loop vectorizes and still stops early
+    auto words = reinterpret_cast <const uint64_t*> (mem + ALLOC_HEAD_SIZE);
+    uint64_t nb = (size - ALLOC_HEAD_SIZE) / sizeof (uint64_t);
+    for (uint64_t i = 0 ; i < nb ; i += 64) {
+      uint64_t acc = 0;
+      for (uint64_t j = i ; j < std::min (nb, i + 64) ; j++) acc |= words [j];
+      if (acc != 0) return false;
+    }
+
+    for (uint64_t i = ALLOC_HEAD_SIZE + nb * sizeof (uint64_t) ; i < size ; i++) {
+      if (mem [i] != 0) return false;
+    }
+
+    return true;
+  }
+
+  void Allocator::fetch (const std::vector <BlockIo> & blocks) {
+    std::vector <BlockIo> toRead;
+    for (auto & b : blocks) {
+      if (this-> _blocks [b.addr - 1].zero) {
+        auto & head = this-> _zeroHeads [b.addr];
+        memcpy (b.memory, head.data (), ALLOC_HEAD_SIZE);
+        memset (b.memory + ALLOC_HEAD_SIZE, 0, this-> _block_size - ALLOC_HEAD_SIZE);
+        this-> _nbZeroElided += 1;
+      } else {
+        toRead.push_back (b);
+      }
+    }
+
+    this-> readStored (toRead);
+  }
+
+  void Allocator::readStored (const std::vector <BlockIo> & blocks) {
+    if (blocks.size () == 0) return;
+
+    concurrency::timer t;
+    if (blocks.size () == 1) {
+      this-> _persister-> load (blocks [0].addr, blocks [0].memory, this-> _block_size);
+    } else {
+      this-> _persister-> loadBatch (blocks, this-> _block_size);
+    }
+
+    this-> _loadLatency.record (t.time_since_start ());
+    this-> _bytesLoaded += blocks.size () * this-> _block_size;
+  }
+
+  uint32_t Allocator::store (const std::vector <BlockIo> & blocks) {
+    return this-> writeStored (this-> elideZeros (blocks));
+  }
+
+  std::vector <BlockIo> Allocator::elideZeros (const std::vector <BlockIo> & blocks) {
+    std::vector <BlockIo> toWrite;
+    for (auto & b : blocks) {
+      auto & bl = this-> _blocks [b.addr - 1];
+      if (is_zero_block (b.memory, this-> _block_size)) {
+        // the stale copy of the persister is never read again, it is overwritten or erased with the block
+        this-> _zeroHeads [b.addr].assign (b.memory, b.memory + ALLOC_HEAD_SIZE);
+        bl.zero = true;
+        this-> _nbZeroElided += 1;
+      } else {
+        if (bl.zero) {
+          this-> _zeroHeads.erase (b.addr);
+          bl.zero = false;
+        }
+
+        toWrite.push_back (b);
+      }
+    }
+
+    return toWrite;
+  }
+
+  uint32_t Allocator::writeStored (const std::vector <BlockIo> & toWrite) {
+    if (toWrite.size () == 0) return 0;
+
+    concurrency::timer t;
+    if (toWrite.size () == 1) {
+      this-> _persister-> save (toWrite [0].addr, toWrite [0].memory, this-> _block_size);
+    } else {
+      this-> _persister-> saveBatch (toWrite, this-> _block_size);
+    }
+
+    this-> _saveLatency.record (t.time_since_start ());
+    this-> _bytesSaved += toWrite.size () * this-> _block_size;
+    return toWrite.size ();
+  }
+
+  uint32_t Allocator::evictSome (uint32_t nb) {
+    // We don't lock the mutex, we can only enter here if we are already locked
+    std::vector <uint64_t> pinned;
+    std::vector <uint64_t> victims;
+
+    while (victims.size () < nb) {
+      auto addr = this-> _policy-> evict ();
+      if (addr == 0) break; // nothing is loaded
+
+      if (this-> _blocks [addr - 1].pins != 0) {
+        pinned.push_back (addr);
+        continue;
+      }
+
+      victims.push_back (addr);
+    }
+
+    // The pinned blocks are still resident, the policy must keep tracking them
+    for (auto addr : pinned) {
+      this-> _policy-> reinsert (addr);
+    }
+
+    this-> writeBack (victims);
+    return victims.size ();
+  }
+
+  void Allocator::writeBack (const std::vector <uint64_t> & addrs) {
+    std::vector <BlockIo> dirty;
+    for (auto addr : addrs) {
+      if (this-> _blocks [addr - 1].dirty) {
+        dirty.push_back ({addr, this-> _loaded [addr]});
+      } else { // the persisted copy is still valid
+        this-> _nbCleanEvictions += 1;
+      }
+    }
+
+    if (dirty.size () != 0) {
+      uint32_t nb = 0;
+      WITH_LOCK (this-> _persistM) {
+        nb = this-> store (dirty);
+      }
+
+      this-> _nbDirtySaves += nb;
+    }
+
+    this-> _nbEvictions += addrs.size ();
+
+    for (auto addr : addrs) {
+      auto mem = this-> _loaded [addr];
+      this-> markClean (addr);
+      this-> _loaded.erase (addr);
+
+      this-> unindex (addr);
+      this-> _blocks [addr - 1].mem = nullptr;
+      this-> index (addr);
+      this-> _pool.release (mem);
+    }
+  }
+
+  void Allocator::install (uint64_t addr, uint8_t * mem) {
+    auto & memory = this-> _blocks [addr - 1];
+    memory.dirty = false; // the persister keeps its copy
+    this-> _loaded.emplace (addr, mem);
+    this-> _policy-> onLoad (addr);
+
+    if (memory.lru < this-> _lruStamp) {
+      this-> _uniqLoads += 1;
+    }
+
+    this-> unindex (addr);
+    memory.lru = this-> _lastLRU++;
+    memory.mem = mem;
+    this-> index (addr);
+  }
+
+  void Allocator::prefetchSome (const std::vector <uint64_t> & addrs) {
+    std::vector <BlockIo> toLoad;
+    std::vector <std::vector <uint8_t> > heads;
+    WITH_WLOCK (this-> _metaM) {
+      for (auto addr : addrs) {
+        if (addr > this-> _blocks.size () || this-> _emptyBlocks.count (addr) != 0) continue;
+        if (this-> _blocks [addr - 1].mem != nullptr || this-> _prefetching.count (addr) != 0) continue;
+        if (this-> _blocks [addr - 1].source != 0) continue; // the source is prefetched instead
+
+        this-> _prefetching.emplace (addr);
+        toLoad.push_back ({addr, nullptr});
+      }
+
+      // the blocks are not looked up outside of the lock, they can be freed (and _blocks shrunk) during the reads
+      WITH_LOCK (this-> _persistM) {
+        heads.resize (toLoad.size ());
+        for (uint64_t i = 0 ; i < toLoad.size () ; i++) {
+          auto addr = toLoad [i].addr;
+          if (this-> _blocks [addr - 1].zero) {
+            heads [i] = this-> _zeroHeads.at (addr);
+          } else {
+            this-> _prefetchReads.emplace (addr);
+          }
+        }
+      }
+    }
+
+    if (toLoad.size () == 0) return;
+
+    // The allocator is not locked during the reads, the other threads can use the resident blocks
+    std::vector <BlockIo> toRead;
+    for (uint64_t i = 0 ; i < toLoad.size () ; i++) {
+      auto & b = toLoad [i];
+      b.memory = this-> _pool.acquire ();
+      if (heads [i].size () != 0) {
+        memcpy (b.memory, heads [i].data (), ALLOC_HEAD_SIZE);
+        memset (b.memory + ALLOC_HEAD_SIZE, 0, this-> _block_size - ALLOC_HEAD_SIZE);
+        this-> _nbZeroElided += 1;
+      } else {
+        toRead.push_back (b);
+      }
+    }
+
+    try {
+      WITH_LOCK (this-> _persistM) {
+        // a block freed since the selection has no persisted copy anymore, its buffer is released below
+        std::vector <BlockIo> alive;
+        for (auto & b : toRead) {
+          if (this-> _prefetchReads.erase (b.addr) != 0) alive.push_back (b);
+        }
+
+        this-> readStored (alive);
+      }
+    } catch (const std::runtime_error & err) {
+      LOG_WARN ("Prefetch failed : ", err.what ());
+      WITH_WLOCK (this-> _metaM) {
+        for (auto & b : toLoad) {
+          this-> _prefetching.erase (b.addr);
+          this-> _pool.release (b.memory);
+        }
+      }
+
+      return;
+    }
+
+    WITH_WLOCK (this-> _metaM) {
+      for (auto & b : toLoad) {
+        // The block was loaded or freed in the meantime, the read copy may be outdated
+        if (this-> _prefetching.erase (b.addr) == 0) {
+          this-> _pool.release (b.memory);
+          continue;
+        }
+
+        if (this-> _loaded.size () >= this-> _max_blocks) {
+          this-> evictSome (this-> _loaded.size () - this-> _max_blocks + 1);
+        }
+
+        this-> install (b.addr, b.memory);
+        this-> _nbPrefetched += 1;
+      }
+    }
+  }
+
+  void Allocator::prefetcherMain (concurrency::Thread) {
+    std::vector <uint64_t> addrs;
+    for (;;) {
+      this-> _prefetchSem.wait ();
+      if (!this-> _prefetcherRunning) break;
+
+      // Every queued block has its own post, the extra posts of the drained blocks find an empty queue
+      addrs.clear ();
+      WITH_LOCK (this-> _prefetchM) {
+        while (this-> _prefetchQueue.size () != 0 && addrs.size () < PREFETCH_BATCH) {
+          addrs.push_back (this-> _prefetchQueue.front ());
+          this-> _prefetchQueue.pop_front ();
+        }
+      }
+
+      if (addrs.size () != 0) {
+        this-> prefetchSome (addrs);
+      }
+    }
+  }
+
+  void Allocator::stopPrefetcher () {
+    if (this-> _prefetcherRunning) {
+      this-> _prefetcherRunning = false;
+      this-> _prefetchSem.post ();
+
+      concurrency::join (this-> _prefetcher);
+      this-> _prefetcher = concurrency::Thread (0);
+
+      WITH_LOCK (this-> _prefetchM) {
+        this-> _prefetchQueue.clear ();
+      }
+    }
+  }
+
+  void Allocator::flushSome (uint8_t * staging) {
+    uint32_t low = 0;
+    std::vector <std::pair <uint32_t, uint64_t> > dirty;
+    WITH_RLOCK (this-> _metaM) {
+      uint32_t high = this-> _highWatermark * this-> _max_blocks;
+      low = this-> _lowWatermark * this-> _max_blocks;
+      if (this-> _nbDirty <= high) return;
+
+      for (auto & it : this-> _loaded) {
+        auto & bl = this-> _blocks [it.first - 1];
+        if (bl.dirty && bl.pins == 0) {
+          dirty.emplace_back (bl.lru, it.first);
+        }
+      }
+    }
+
+    // The blocks are saved without _metaM, the misses waiting for the exclusive lock do not wait for the persister
+    std::sort (dirty.begin (), dirty.end ());
+    std::vector <BlockIo> toWrite;
+    for (auto & it : dirty) {
+      if (this-> _nbDirty <= low) break;
+
+      auto addr = it.second;
+      uint64_t version = 0;
+      WITH_RLOCK (this-> _metaM) {
+        if (addr > this-> _blocks.size ()) continue; // freed since the candidates were picked
+
+        // The copy is consistent, writes to the block are done under its stripe
+        auto & bl = this-> _blocks [addr - 1];
+        WITH_LOCK (this-> stripe (addr)) {
+          if (bl.mem != nullptr && bl.dirty && bl.pins == 0) {
+            memcpy (staging, bl.mem, this-> _block_size);
+            version = bl.version;
+          }
+        }
+
+        if (version == 0) continue;
+
+        // _persistM is held until the copy is saved, an eviction or a free of the block reaches the persister after it
+        this-> _persistM.lock ();
+        toWrite = this-> elideZeros ({{addr, staging}});
+      }
+
+      try {
+        this-> _nbDirtySaves += this-> writeStored (toWrite);
+      } catch (...) {
+        this-> _persistM.unlock ();
+        throw; // the block is still dirty
+      }
+
+      this-> _persistM.unlock ();
+
+      // A block written since the copy stays dirty
+      WITH_RLOCK (this-> _metaM) {
+        if (addr > this-> _blocks.size ()) continue;
+
+        auto & bl = this-> _blocks [addr - 1];
+        WITH_LOCK (this-> stripe (addr)) {
+          if (bl.mem != nullptr && bl.version == version) {
+            this-> markClean (addr);
+          }
+        }
+      }
+    }
+  }
+
+  void Allocator::flusherMain (concurrency::Thread) {
+    auto staging = new uint8_t [this-> _block_size];
+    while (this-> _flusherRunning) {
+      try {
+        this-> flushSome (staging);
+      } catch (const std::runtime_error & err) {
+        LOG_ERROR ("Write back failed : ", err.what ());
+      }
+
+      this-> _flushSem.wait (FLUSH_PERIOD);
+    }
+
+    delete [] staging;
+  }
+
+  void Allocator::exporterMain (concurrency::Thread) {
+    concurrency::timer t;
+    AllocatorMetrics metrics;
+    while (this-> _exporterRunning) {
+      this-> _exportSem.wait (this-> _exportPeriod);
+
+      // the last snapshot is written when the export is stopped
+      this-> getMetrics (metrics);
+      this-> _exporter-> append ((uint32_t) (t.time_since_start () * 1000), *metrics.toConfig ());
+    }
+  }
+
+  void Allocator::freeBlock (uint64_t addr) {
+    // No need to lock, only called within lock
+    auto & bl = this-> _blocks [addr - 1];
+    if (bl.source != 0) this-> unalias (addr);
+    if (bl.aliases != 0) this-> unshare (addr);
+
+    this-> unindex (addr);
+    if (bl.mem != nullptr) {
+      this-> _pool.release (bl.mem);
+      bl.mem = nullptr;
+    }
+
+    // std::cout << "Freeing block : " << addr << std::endl;
+    this-> markClean (addr);
+    WITH_LOCK (this-> _persistM) {
+      this-> _persister-> erase (addr);
+      this-> _zeroHeads.erase (addr);
+      this-> _prefetchReads.erase (addr);
+      bl.zero = false;
+    }
+
+    this-> _prefetching.erase (addr);
+    this-> _loaded.erase (addr);
+    this-> _policy-> onRemove (addr);
+    this-> _emptyBlocks.emplace (addr);
+
+    // Trailing free blocks are removed, so new arrays can be allocated in consecutive blocks at the end
+    while (this-> _blocks.size () != 0 && this-> _emptyBlocks.count (this-> _blocks.size ()) != 0) {
+      this-> _emptyBlocks.erase (this-> _blocks.size ());
+      this-> _blocks.pop_back ();
+    }
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================      MISCS      ==============================
+   * ============================================================================
+   * ============================================================================
+   * */
 
   void Allocator::printLoaded () const {
     std::cout << "=============" << std::endl;
     for (auto & it : this-> _loaded) {
-      auto info = this-> _blocks [it.first - 1];
+      auto & info = this-> _blocks [it.first - 1];
       std::cout << it.first << " " << ((uint32_t*) (it.second)) << " " << info.lru << std::endl;
     }
     std::cout << "=============" << std::endl;
@@ -459,7 +2304,7 @@ namespace rd_utils::memory::cache {
 
   void Allocator::printBlocks () const {
     std::cout << "=============" << std::endl;
-    uint32_t addr = 1;
+    uint64_t addr = 1;
     for (auto & info : this-> _blocks) {
       std::cout << addr << " " << ((uint32_t*) (info.mem)) << " " << info.lru << std::endl;
       addr += 1;
@@ -473,23 +2318,18 @@ namespace rd_utils::memory::cache {
     for (size_t addr = 1 ; addr <= alloc._blocks.size () ; addr++) {
       auto & info = alloc._blocks [addr - 1];
       s << "\tBLOCK(" << addr << ", [" << info.lru << "," << info.maxSize << "]) {\n";
+      if (alloc._emptyBlocks.count (addr) != 0) {
+        s << "\t\tFREE\n\t}\n";
+        continue;
+      }
+
       free_list_instance * inst = reinterpret_cast <free_list_instance*> (info.mem);
       if (inst == nullptr) {
-        inst = alloc.load (addr);
+        inst = alloc.load (addr, false);
       }
 
       if (inst != nullptr) {
-        auto memory = reinterpret_cast <const uint8_t*> (inst);
-        s << "\t\tLIST{";
-        int i = 0;
-        auto nodeOffset = inst-> head;
-        while (nodeOffset != 0) {
-          auto node = reinterpret_cast <const rd_utils::memory::cache::free_list_node *> (memory + nodeOffset);
-          if (i != 0) { s << ", "; i += 1; }
-          s << "(" << nodeOffset << "," << nodeOffset + node-> size << ")";
-          nodeOffset = node-> next;
-        }
-        s << "}\n";
+        ::operator<< (s << "\t\t", *inst) << "\n";
       } else {
         s << "EMPTY" << std::endl;
       }
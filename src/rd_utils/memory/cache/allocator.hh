@@ -5,29 +5,202 @@
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
+#include <set>
+#include <deque>
+#include <atomic>
 
 #include "free_list.hh"
+#include "eviction.hh"
+#include "metrics.hh"
+#include "pool.hh"
 #include <rd_utils/memory/cache/remote/persist.hh>
 #include <rd_utils/concurrency/mutex.hh>
+#include <rd_utils/concurrency/rwlock.hh>
+#include <rd_utils/concurrency/semaphore.hh>
+#include <rd_utils/concurrency/thread.hh>
+#include <rd_utils/utils/trace/_.hh>
 
 namespace rd_utils::memory::cache {
 
 #define ALLOC_HEAD_SIZE (sizeof (free_list_instance) + sizeof (uint32_t))
 
+// The number of locks shared by the blocks to protect data accesses
+#define NB_BLOCK_STRIPES 64
+
+// The maximal time between two passes of the flusher (in seconds)
+#define FLUSH_PERIOD 0.1
+
+// The number of blocks read ahead by sequential accesses
+#define PREFETCH_DEPTH 2
+
+// The maximum number of queued prefetches loaded by a single persister batch
+#define PREFETCH_BATCH 8
+
+// The biggest allocation served by the thread magazines (bigger sizes always go through the allocator)
+#define MAGAZINE_MAX_SIZE 256
+
+// The number of size classes of the magazines (8, 16, ..., MAGAZINE_MAX_SIZE)
+#define MAGAZINE_NB_CLASSES 6
+
+// The maximum number of segments kept by a magazine in a size class
+#define MAGAZINE_SIZE 64
+
+// The number of segments taken from (or given back to) the allocator at once
+#define MAGAZINE_BATCH 32
+
+// The default time between two passes of the compactor (in seconds)
+#define COMPACT_PERIOD 10
+
+// The default occupancy under which a resident block is evacuated by the compactor
+#define COMPACT_SPARSE_RATIO 0.25
+
+// The maximum number of pieces gathered by the collections before a readv / writev
+#define IOV_BATCH 16
+
+// The first bit of a block address holding its size class (0 for the blocks of the allocator itself)
+#define ALLOC_CLASS_SHIFT 56
+
+// The bits of a block address holding the address of the block in its size class
+#define ALLOC_ADDR_MASK ((((uint64_t) 1) << ALLOC_CLASS_SHIFT) - 1)
+
+// The maximum number of size classes added to an allocator
+#define ALLOC_MAX_CLASSES 8
+
+// An allocation goes to the smallest size class in which it takes at most 1 / ALLOC_CLASS_FILL of a block
+#define ALLOC_CLASS_FILL 4
+
+// An array goes to the biggest size class of which it fills at least this number of blocks
+#define ALLOC_CLASS_MIN_BLOCKS 4
+
+// The time between two rebalancings of the budget between the size classes (in seconds)
+#define ALLOC_CLASS_BALANCE_PERIOD 1
+
+        /**
+         * Hints given by the collections on the way their blocks are going to be accessed
+         */
+        enum class AccessHint : uint32_t {
+                // Default behavior, sequential readers read one block ahead
+                NORMAL = 0,
+                // The blocks are read in order, read further ahead
+                SEQUENTIAL,
+                // The accesses have no order, never read ahead
+                RANDOM,
+                // The blocks will be accessed soon, load them in background
+                WILLNEED,
+                // The blocks will not be accessed soon, evict them
+                DONTNEED
+        };
+
         struct AllocatedSegment {
-                uint32_t blockAddr;
+                uint64_t blockAddr;
                 uint32_t offset;
         };
 
+        /**
+         * A piece of a scatter-gather access (readv / writev)
+         */
+        struct IoVec {
+                // The accessed segment
+                AllocatedSegment seg;
+
+                // The offset of the piece in the segment
+                uint32_t offset;
+
+                // The size of the piece (in bytes)
+                uint32_t size;
+
+                // The buffer read into (readv) or written from (writev)
+                void * data;
+        };
+
+        /**
+         * @returns: the index of the block containing the element /i/ of a collection
+         * @params:
+         *    - i: the index of the element
+         *    - perBlock: the number of elements in a block
+         * @info: a 32 bits division is used while the index fits in 32 bits, it is several times faster than a 64 bits one on most cpus
+         */
+        inline uint64_t block_index (uint64_t i, uint32_t perBlock) {
+                if (i <= UINT32_MAX) return (uint32_t) i / perBlock;
+                return i / perBlock;
+        }
+
         struct BlockInfo {
                 uint8_t * mem;
-                uint32_t lru;
+                std::atomic<uint32_t> lru;
                 uint32_t maxSize;
+
+                // The number of pins on the block, a pinned block is never evicted
+                std::atomic<uint32_t> pins;
+
+                // True if the block was modified since it was last persisted
+                std::atomic<bool> dirty;
+
+                // The value of Allocator::_nbMarks when the block was last marked dirty (0 if it never was)
+                uint64_t version;
+
+                // The block whose content is shared by this block (0 if the block owns its content)
+                uint64_t source;
+
+                // The number of blocks sharing the content of this block
+                uint32_t aliases;
+
+                // True if the last persisted content of the block is zeros after its head (nothing is stored, protected by _persistM)
+                bool zero;
+        };
+
+        class Allocator;
+
+        /**
+         * Cache of free small segments owned by a thread
+         * @info:
+         * ======
+         * The segments of a magazine are allocated in the allocator, the
+         * owner thread hands them out without taking the allocator lock.
+         * The mutex is only contended when the allocator drains every
+         * magazine (e.g. before being configured)
+         * ======
+         */
+        struct Magazine {
+                concurrency::mutex m;
+
+                // The allocator owning the segments (nullptr if it was destroyed), read by the owner thread without the mutex
+                std::atomic <Allocator*> owner {nullptr};
+
+                // The free segments of each size class
+                std::vector <AllocatedSegment> segments [MAGAZINE_NB_CLASSES];
+        };
+
+        /**
+         * A shard of the segments that the compactor can move
+         */
+        struct RelocationShard {
+                concurrency::mutex m;
+
+                // The owner handles and the sizes of the segments (nullptr handle for an unused slot)
+                std::vector <std::pair <AllocatedSegment*, uint32_t> > slots;
+
+                // The unused slots
+                std::vector <uint64_t> free;
         };
 
         class Allocator {
         private:
 
+                // The id of the allocator (0 for the global allocator)
+                uint32_t _id;
+
+                /**
+                 * Lock protecting the allocator metadata
+                 * @info:
+                 * ======
+                 * data accesses (read/write/copy) to resident blocks only take it in shared mode, the
+                 * exclusive mode is reserved to loads, evictions and allocation metadata changes.
+                 * Every allocator has its own lock, allocators never wait for each other
+                 * ======
+                 */
+                mutable concurrency::rwlock _metaM;
+
                 // The maximum number of blocks that can be loaded at the same time
                 uint32_t _max_blocks;
 
@@ -37,26 +210,205 @@ namespace rd_utils::memory::cache {
                 // The maximum size allocable in a block
                 uint32_t _max_allocable;
 
+                // The recycled buffers of the blocks
+                BlockPool _pool;
+
                 // The list of block currently in memory (id-> memory)
-                std::unordered_map <uint32_t, uint8_t*> _loaded;
+                std::unordered_map <uint64_t, uint8_t*> _loaded;
 
                 // The list of blocks allocated by the allocator (id -> lru)
-                std::vector <BlockInfo> _blocks;
+                std::deque <BlockInfo> _blocks;
+
+                // The resident blocks indexed by the size of their biggest free segment (maxSize, addr)
+                std::set <std::pair <uint32_t, uint64_t> > _residentIndex;
+
+                // The blocks stored by the persister indexed by the size of their biggest free segment (maxSize, addr)
+                std::set <std::pair <uint32_t, uint64_t> > _storedIndex;
+
+                // The blocks that were freed, they can be reused without loading anything
+                std::set <uint64_t> _emptyBlocks;
+
+                // The locks protecting the data of the resident blocks (block addr % NB_BLOCK_STRIPES)
+                std::vector <concurrency::mutex> _stripes;
 
                 // The persister to store blocks to disk
-                remote::BlockPersister * _persister;
+                remote::BlockPersister * _persister = nullptr;
+
+                // The policy selecting the blocks to evict
+                EvictionPolicy * _policy = nullptr;
 
                 // Counter used to compute the ordering of loads
-                uint32_t _lastLRU = 1;
+                std::atomic<uint32_t> _lastLRU = 1;
 
                 // The lru used to compute number of uniq loads
                 uint32_t _lruStamp = 0;
 
                 // The number of uniq load between two stamps
-                uint32_t _uniqLoads = 0;
+                std::atomic<uint32_t> _uniqLoads = 0;
+
+                // The number of resident dirty blocks
+                std::atomic<uint32_t> _nbDirty = 0;
+
+                // The number of calls to markDirty, a block whose version changed during its write back stays dirty
+                std::atomic<uint64_t> _nbMarks = 0;
+
+                // The number of evicted blocks that did not need to be saved
+                std::atomic<uint32_t> _nbCleanEvictions = 0;
+
+                // The flusher starts writing back dirty blocks above this ratio of the loadable blocks
+                float _highWatermark = 0.5;
+
+                // The flusher stops writing back dirty blocks under this ratio of the loadable blocks
+                float _lowWatermark = 0.25;
+
+                // True while the flusher thread is running
+                std::atomic<bool> _flusherRunning = false;
+
+                // Semaphore waking up the flusher
+                concurrency::semaphore _flushSem;
+
+                // The flusher thread
+                concurrency::Thread _flusher;
+
+                // Lock serializing the accesses to the persister (the flusher and the prefetcher use it outside of the exclusive lock)
+                concurrency::mutex _persistM;
+
+                // The blocks currently loaded by the prefetcher
+                std::unordered_set <uint64_t> _prefetching;
+
+                // The blocks of the prefetcher waiting for their read (protected by _persistM, a freed block is removed so it is never read)
+                std::unordered_set <uint64_t> _prefetchReads;
+
+                // The blocks waiting to be prefetched
+                std::deque <uint64_t> _prefetchQueue;
+
+                // Lock protecting the prefetch queue
+                concurrency::mutex _prefetchM;
+
+                // Semaphore counting the blocks in the prefetch queue
+                concurrency::semaphore _prefetchSem;
+
+                // True while the prefetcher thread is running
+                std::atomic<bool> _prefetcherRunning = false;
+
+                // The prefetcher thread
+                concurrency::Thread _prefetcher;
+
+                // The number of blocks loaded by the prefetcher
+                std::atomic<uint32_t> _nbPrefetched = 0;
+
+                // The number of accesses to resident blocks
+                std::atomic<uint64_t> _nbHits = 0;
+
+                // The number of accesses that had to load their block from the persister
+                std::atomic<uint64_t> _nbMisses = 0;
+
+                // The number of blocks removed from memory
+                std::atomic<uint64_t> _nbEvictions = 0;
+
+                // The number of blocks written to the persister
+                std::atomic<uint64_t> _nbDirtySaves = 0;
+
+                // The number of bytes read from the persister
+                std::atomic<uint64_t> _bytesLoaded = 0;
+
+                // The number of bytes written to the persister
+                std::atomic<uint64_t> _bytesSaved = 0;
+
+                // The number of block saves and loads skipped because the block was zeros after its head
+                std::atomic<uint64_t> _nbZeroElided = 0;
+
+                // The heads of the blocks persisted as zeros (addr -> the first ALLOC_HEAD_SIZE bytes, protected by _persistM)
+                std::unordered_map <uint64_t, std::vector <uint8_t> > _zeroHeads;
+
+                // The blocks sharing the content of each source block (source -> aliases)
+                std::unordered_map <uint64_t, std::vector <uint64_t> > _aliases;
+
+                // The number of blocks sharing the content of another block
+                uint64_t _nbAliases = 0;
+
+                // The latencies of the persister reads (protected by _persistM)
+                LatencyHistogram _loadLatency = {};
+
+                // The latencies of the persister writes (protected by _persistM)
+                LatencyHistogram _saveLatency = {};
+
+                // The exporter of the metrics (owned, nullptr if the metrics are not exported)
+                utils::trace::TraceExporter * _exporter = nullptr;
+
+                // The time between two exports of the metrics (in seconds)
+                float _exportPeriod = 1;
+
+                // True while the metrics exporter thread is running
+                std::atomic<bool> _exporterRunning = false;
+
+                // Semaphore waking up the metrics exporter
+                concurrency::semaphore _exportSem;
+
+                // The metrics exporter thread
+                concurrency::Thread _exportThread;
+
+                // The magazines of the threads using the allocator
+                std::unordered_set <Magazine*> _magazines;
+
+                // Lock protecting the list of magazines
+                concurrency::mutex _magazineM;
+
+                // The relocatable segments, sharded by tracking thread
+                std::vector <RelocationShard> _relocatable;
+
+                // The occupancy under which the compactor thread evacuates a block
+                float _sparseRatio = COMPACT_SPARSE_RATIO;
+
+                // The time between two passes of the compactor thread (in seconds)
+                float _compactPeriod = COMPACT_PERIOD;
+
+                // True while the compactor thread is running
+                std::atomic<bool> _compactorRunning = false;
+
+                // Semaphore waking up the compactor
+                concurrency::semaphore _compactSem;
+
+                // The compactor thread
+                concurrency::Thread _compactor;
+
+                // The report of the last pass of the compactor thread
+                CompactionReport _lastCompaction = {};
+
+                // Lock protecting the last compaction report
+                concurrency::mutex _compactM;
+
+                // The allocators of the other block size classes (owned, the class of a tagged address is its index + 1)
+                std::vector <Allocator*> _classes;
+
+                // Every size class, the allocator included (by increasing block size)
+                std::vector <Allocator*> _routes;
+
+                // The tag of the block addresses of the allocator when it is a size class of another one (0 otherwise)
+                uint64_t _tag = 0;
+
+                // The memory of the resident blocks of every size class (in bytes)
+                uint64_t _budget = 0;
+
+                // The bytes loaded by each route at the last rebalancing
+                std::vector <uint64_t> _lastLoaded;
+
+                // Lock serializing the rebalancings of the budget
+                concurrency::mutex _classM;
+
+                // True while the balancer thread is running
+                std::atomic<bool> _balancerRunning = false;
+
+                // Semaphore waking up the balancer
+                concurrency::semaphore _balanceSem;
+
+                // The thread rebalancing the budget between the size classes
+                concurrency::Thread _balancer;
 
         private:
 
+                friend struct MagazineHolder;
+
                 Allocator (const Allocator&);
 
                 void operator=(const Allocator&);
@@ -66,8 +418,6 @@ namespace rd_utils::memory::cache {
                 // The global allocator
                 static Allocator __GLOBAL__;
 
-                static concurrency::mutex __GLOBAL_MUTEX__;
-
         public:
 
 
@@ -101,21 +451,120 @@ namespace rd_utils::memory::cache {
 
                 /**
                  * Configure the size of the allocator
+                 * @params:
+                 *    - policy: the replacement policy used to select the blocks to evict
+                 *    - codec: the codec used to encode the evicted blocks
                  * @warning: only works if there is no allocations alive
                  */
-                void configure (uint32_t nbBlocks, uint32_t blockSize);
+                void configure (uint32_t nbBlocks, uint32_t blockSize, EvictionPolicyKind policy = EvictionPolicyKind::LRU, remote::CodecKind codec = remote::CodecKind::RAW);
 
                 /**
                  * Configure the size of the allocator
+                 * @params:
+                 *    - policy: the replacement policy used to select the blocks to evict
+                 *    - codec: the codec used to encode the blocks sent to the repository
+                 * @warning: only works if there is no allocations alive
+                 */
+                void configure (uint32_t nbBlocks, uint32_t blockSize, net::SockAddrV4 remotePersist, EvictionPolicyKind policy = EvictionPolicyKind::LRU, remote::CodecKind codec = remote::CodecKind::RAW);
+
+                /**
+                 * Configure the size of the allocator
+                 * @params:
+                 *    - persister: the persister storing the evicted blocks (e.g. a remote::TieredPersister), owned by the allocator
+                 *    - policy: the replacement policy used to select the blocks to evict
                  * @warning: only works if there is no allocations alive
                  */
-                void configure (uint32_t nbBlocks, uint32_t blockSize, net::SockAddrV4 remotePersist);
+                void configure (uint32_t nbBlocks, uint32_t blockSize, remote::BlockPersister * persister, EvictionPolicyKind policy = EvictionPolicyKind::LRU);
+
+                /**
+                 * Split the memory budget of the allocator between several block size classes
+                 * @params:
+                 *    - blockSizes: the block sizes of the other classes (e.g. 64KB and 64MB, the blocks of the allocator are a class too)
+                 *    - budget: the memory of the resident blocks of every class (in bytes)
+                 *    - persisters: the persister of each class, in the order of blockSizes (owned, a local persister for the missing ones)
+                 * @info:
+                 * ======
+                 * Every class is an allocator of its own, the allocator routes
+                 * the allocations to them and tags the addresses of their
+                 * blocks (ALLOC_CLASS_SHIFT), so the collections use the
+                 * allocator as before. A small allocation goes to the smallest
+                 * class in which it takes at most 1 / ALLOC_CLASS_FILL of a block,
+                 * an array goes to the biggest class of which it fills
+                 * ALLOC_CLASS_MIN_BLOCKS blocks.
+                 *
+                 * The budget is shared between the classes by balanceClasses,
+                 * called every ALLOC_CLASS_BALANCE_PERIOD seconds by a background
+                 * thread, and by resize. The flusher, the compactor, the
+                 * numa node and the magazines apply to every class. Configuring
+                 * the allocator again removes the classes
+                 * ======
+                 * @throws: if there are allocations alive, or too many classes
+                 */
+                void configureClasses (const std::vector <uint32_t> & blockSizes, uint64_t budget, const std::vector <remote::BlockPersister*> & persisters = {});
+
+                /**
+                 * Share the budget between the size classes
+                 * @info:
+                 * ======
+                 * Every class keeps 2 blocks, the rest of the budget goes to the
+                 * classes that loaded the most bytes since the last rebalancing,
+                 * up to the size of their allocated blocks. What is left is
+                 * shared the same way so new allocations find room. The classes
+                 * over their new share write back and evict blocks
+                 * ======
+                 */
+                void balanceClasses ();
 
                 /**
                  * Remove all allocated blocks
                  */
                 void dispose ();
 
+                /**
+                 * Start a background thread writing back the dirty blocks ahead of their eviction
+                 * @params:
+                 *    - high: the ratio of dirty loaded blocks from which blocks are written back
+                 *    - low: the ratio of dirty loaded blocks at which the write back stops
+                 * @info:
+                 * ======
+                 * the least recently used dirty blocks are written first, so
+                 * when they are evicted the miss path only drops clean blocks
+                 * ======
+                 */
+                void startFlusher (float high = 0.5, float low = 0.25);
+
+                /**
+                 * Stop the flusher thread (if running) and wait for its end
+                 */
+                void stopFlusher ();
+
+                /**
+                 * Start a background thread appending a snapshot of the metrics to a trace periodically
+                 * @params:
+                 *    - exporter: the trace (csv, json, ...) in which the metrics are written (owned by the allocator)
+                 *    - period: the time between two snapshots (in seconds)
+                 * @info: the timestamps of the trace are in milliseconds since the start of the export
+                 */
+                void startMetricsExport (utils::trace::TraceExporter * exporter, float period = 1);
+
+                /**
+                 * Stop the metrics exporter thread (if running), and close its trace
+                 */
+                void stopMetricsExport ();
+
+                /**
+                 * Start a background thread compacting the resident blocks periodically
+                 * @params:
+                 *    - period: the time between two passes (in seconds)
+                 *    - sparse: the occupancy under which a block is evacuated
+                 */
+                void startCompactor (float period = COMPACT_PERIOD, float sparse = COMPACT_SPARSE_RATIO);
+
+                /**
+                 * Stop the compactor thread (if running) and wait for its end
+                 */
+                void stopCompactor ();
+
                 /**
                  * this-> dispose ();
                  */
@@ -146,12 +595,36 @@ namespace rd_utils::memory::cache {
                  *    - true iif a segment was found
                  *    - alloc: the allocated segment
                  */
-                bool allocateSegments (uint32_t elemSize, uint64_t size, AllocatedSegment & rest, uint32_t & fstBlock, uint32_t & nbBlocks, uint32_t & blockSize);
+                bool allocateSegments (uint32_t elemSize, uint64_t size, AllocatedSegment & rest, uint64_t & fstBlock, uint64_t & nbBlocks, uint32_t & blockSize);
+
+                /**
+                 * Allocate a small segment from the magazine of the calling thread
+                 * @params:
+                 *    - size: the size to allocate (the allocator is used directly above MAGAZINE_MAX_SIZE)
+                 * @returns:
+                 *    - true iif a segment was found
+                 *    - alloc: the allocated segment, to free with freeSmall and the same size
+                 * @info: the allocator lock is only taken when the magazine is empty, to take MAGAZINE_BATCH segments at once
+                 */
+                bool allocateSmall (uint32_t size, AllocatedSegment & alloc);
+
+                /**
+                 * Give a segment allocated by allocateSmall back to the magazine of the calling thread
+                 * @params:
+                 *    - size: the size given to allocateSmall
+                 * @info: the allocator lock is only taken when the magazine is full, to free MAGAZINE_BATCH segments at once
+                 */
+                void freeSmall (AllocatedSegment alloc, uint32_t size);
+
+                /**
+                 * Free the segments cached by the magazines of every thread
+                 */
+                void drainMagazines ();
 
                 /**
                  * @returns: true if the block /addr/ is loaded
                  */
-                bool isLoaded (uint32_t addr) const;
+                bool isLoaded (uint64_t addr) const;
 
                 /**
                  * Free an allocated memory segment
@@ -161,13 +634,56 @@ namespace rd_utils::memory::cache {
                 /**
                  * Free a full block
                  */
-                void freeFast (uint32_t blockAddr);
+                void freeFast (uint64_t blockAddr);
 
                 /**
                  * Free a list of segments
                  */
                 void free (const std::vector <AllocatedSegment> & allocs);
 
+                /**
+                 * Let the compactor move a segment
+                 * @params:
+                 *    - handle: the segment of the owner, updated in place when the segment is moved
+                 *    - size: the size of the data of the segment (a moved segment keeps the size it was allocated with)
+                 * @returns: the ticket to give to untrack
+                 * @info:
+                 * ======
+                 * the handle is only rewritten under the exclusive lock, the
+                 * owner must pass the handle itself (not a copy) to read,
+                 * write and copy, and must not keep copies of it.
+                 *
+                 * the handle must stay at the same address until untrack
+                 * ======
+                 */
+                uint64_t track (AllocatedSegment * handle, uint32_t size);
+
+                /**
+                 * Stop moving a segment registered with track
+                 * @params:
+                 *    - ticket: the value returned by track
+                 * @info: must be called before the segment is freed, the handle is not modified afterwards
+                 */
+                void untrack (uint64_t ticket);
+
+                /**
+                 * Move the tracked segments out of the sparse resident blocks, and free the emptied blocks
+                 * @params:
+                 *    - sparse: the occupancy under which a block is evacuated
+                 * @returns:
+                 *    - report: the state of the resident blocks before and after the pass, and what was moved
+                 * @info:
+                 * ======
+                 * the segments of the magazines are freed first. A block is
+                 * only evacuated if it is not pinned and all its live segments
+                 * are tracked, the segments are moved to the other resident
+                 * blocks (never to a stored or a new block), so a pass does
+                 * no I/O. The accesses to the allocator wait for the end of
+                 * the pass
+                 * ======
+                 */
+                void compact (CompactionReport & report, float sparse = COMPACT_SPARSE_RATIO);
+
                 /**
                  * ============================================================================
                  * ============================================================================
@@ -184,7 +700,7 @@ namespace rd_utils::memory::cache {
                  *    - offset: the offset of the allocated segment
                  *    - size: the size to read
                  */
-                void read (AllocatedSegment alloc, void * data, uint32_t offset, uint32_t size);
+                void read (const AllocatedSegment & alloc, void * data, uint32_t offset, uint32_t size);
 
                 /**
                  * Write onto an allocated segment into memory
@@ -194,7 +710,7 @@ namespace rd_utils::memory::cache {
                  *    - offset: the offset of the allocated segment
                  *    - size: the size to read
                  */
-                void write (AllocatedSegment alloc, const void * data, uint32_t offset, uint32_t size);
+                void write (const AllocatedSegment & alloc, const void * data, uint32_t offset, uint32_t size);
 
                 /**
                  * Copy data from an allocated segment to another
@@ -203,7 +719,96 @@ namespace rd_utils::memory::cache {
                  *    - right: the segment in which we write data
                  *    - size: the size in bytes to copy
                  */
-                void copy (AllocatedSegment input, AllocatedSegment output, uint32_t size);
+                void copy (const AllocatedSegment & input, const AllocatedSegment & output, uint32_t size);
+
+                /**
+                 * Make a block share the content of another one (copy on write)
+                 * @params:
+                 *    - src: the block whose content is shared
+                 *    - dst: the block that gets the content of src, its current content is dropped
+                 * @info:
+                 * ======
+                 * only metadata is changed, the data is duplicated on the
+                 * first write to one of the blocks, or when one of them is
+                 * pinned (a block already pinned is copied immediately).
+                 *
+                 * Both blocks must be full blocks holding a single segment
+                 * (the full blocks of the arrays), a free part of a shared
+                 * block could not be allocated
+                 * ======
+                 * @throws: if one of the blocks is not full, or if their size class is unknown
+                 */
+                void share (uint64_t src, uint64_t dst);
+
+                /**
+                 * Read a list of pieces of segments
+                 * @params:
+                 *    - vecs: the pieces to read, sorted by block in place
+                 *    - nb: the number of pieces
+                 * @info:
+                 * ======
+                 * the allocator is locked once for all the pieces, the
+                 * pieces of a block are read together under a single stripe,
+                 * and the missing blocks are loaded in a single persister
+                 * batch
+                 * ======
+                 */
+                void readv (IoVec * vecs, uint32_t nb);
+
+                /**
+                 * Write a list of pieces of segments
+                 * @params:
+                 *    - vecs: the pieces to write, sorted by block in place (the order of overlapping pieces is kept)
+                 *    - nb: the number of pieces
+                 * @info: same locking and loading as readv
+                 */
+                void writev (IoVec * vecs, uint32_t nb);
+
+                /**
+                 * Load a block in background, so a future access does not wait for the persister
+                 * @info: does nothing if the block is already loaded
+                 */
+                void prefetch (uint64_t blockAddr);
+
+                /**
+                 * Load a list of blocks in background
+                 */
+                void prefetch (const std::vector <uint64_t> & blockAddrs);
+
+                /**
+                 * Evict a block from memory now (saving it if it was modified)
+                 * @info: does nothing if the block is not loaded or pinned
+                 */
+                void evict (uint64_t blockAddr);
+
+                /**
+                 * Load a block and keep it in memory until it is unpinned
+                 * @params:
+                 *    - blockAddr: the block to pin
+                 *    - write: true if the block memory is going to be modified
+                 * @returns: the memory of the block (valid until the matching unpin)
+                 * @info:
+                 * ======
+                 * the memory is accessed without going through the block
+                 * locks, concurrent accesses to the same segment must be
+                 * synchronized by the caller
+                 *
+                 * if every resident block is pinned, a load goes above the
+                 * maximum number of loaded blocks until some are unpinned
+                 *
+                 * a read pin of a block sharing its content (share) reads the
+                 * shared memory, only a write pin gives the block its own copy
+                 * ======
+                 */
+                uint8_t * pin (uint64_t blockAddr, bool write = true);
+
+                /**
+                 * Release a pin taken with pin
+                 * @params:
+                 *    - blockAddr: the pinned block
+                 *    - memory: the memory returned by pin (a read pin can be held by another block than blockAddr)
+                 */
+                void unpin (uint64_t blockAddr, const uint8_t * memory);
 
 
                 /**
@@ -221,14 +826,40 @@ namespace rd_utils::memory::cache {
 
                 /**
                  * @returns: the maximum number of loaded blocks
+                 * @info: with size classes, the budget of every class counted in blocks of the allocator
                  */
                 uint32_t getMaxNbLoadable () const;
 
+                /**
+                 * @returns: the number of block size classes (1 without classes)
+                 */
+                uint32_t getNbClasses () const;
+
+                /**
+                 * @returns: the allocator of the ith size class, by increasing block size (the allocator itself is one of them)
+                 */
+                Allocator & getClass (uint32_t i);
+
+                /**
+                 * @returns: the memory budget shared by the size classes (in bytes, 0 without classes)
+                 */
+                uint64_t getBudget () const;
+
+                /**
+                 * @returns: the size of a block (in bytes)
+                 */
+                uint32_t getBlockSize () const;
+
                 /**
                  * @returns: the number of loaded blocks
                  */
                 uint32_t getNbLoaded () const;
 
+                /**
+                 * @returns: the memory of the loaded blocks of every size class (in bytes)
+                 */
+                uint64_t getResidentBytes () const;
+
                 /**
                  * @returns: the maximum number of bits that can be allocated in a single block
                  */
@@ -237,23 +868,62 @@ namespace rd_utils::memory::cache {
                 /**
                  * @returns: the number of blocks sent persisted
                  */
-                uint32_t getNbStored () const;
+                uint64_t getNbStored () const;
 
                 /**
                  * @returns: the minimum number of blocks that must be stored on disk (if loaded is full)
                  */
-                uint32_t getMinNbStorable () const;
+                uint64_t getMinNbStorable () const;
 
                 /**
                  * @returns: the number of allocated blocks
                  */
-                uint32_t getNbAllocated () const;
+                uint64_t getNbAllocated () const;
 
                 /**
                  * @returns: the number of uniq block loads since last counter reset
                  */
                 uint32_t getUniqLoaded () const;
 
+                /**
+                 * @returns: the number of loaded blocks modified since they were last persisted
+                 */
+                uint32_t getNbDirty () const;
+
+                /**
+                 * @returns: the number of evictions that did not need to save the block
+                 */
+                uint32_t getNbCleanEvictions () const;
+
+                /**
+                 * @returns: the number of blocks loaded by the prefetcher
+                 */
+                uint32_t getNbPrefetched () const;
+
+                /**
+                 * @returns: the numa node of the memory of the blocks (-1 if not bound)
+                 */
+                int getNumaNode ();
+
+                /**
+                 * Take a snapshot of the metrics of the allocator
+                 * @returns:
+                 *    - metrics: the resident blocks, hits, misses, evictions, saves, bytes moved and persister latencies
+                 */
+                void getMetrics (AllocatorMetrics & metrics);
+
+                /**
+                 * Measure the occupancy of the resident blocks
+                 * @params:
+                 *    - sparse: the occupancy under which a block is counted as sparse
+                 */
+                void getFragmentation (FragmentationMetrics & metrics, float sparse = COMPACT_SPARSE_RATIO);
+
+                /**
+                 * @returns: the report of the last pass of the compactor thread
+                 */
+                void getLastCompaction (CompactionReport & report);
+
                 /**
                  * ============================================================================
                  * ============================================================================
@@ -264,15 +934,34 @@ namespace rd_utils::memory::cache {
 
                 /**
                  * Change the number of blocks that can be loaded at the same time
-                 * @info: can be done dynamically (with already allocated blocks)
+                 * @info:
+                 * ======
+                 * can be done dynamically (with already allocated blocks). With
+                 * size classes, the budget of every class becomes nbBlocks
+                 * blocks of the allocator, and is balanced between the classes
+                 * ======
                  */
                 void resize (uint32_t nbBlocks);
 
+                /**
+                 * Place the memory of the blocks on a numa node
+                 * @params:
+                 *    - node: the numa node, -1 to let the kernel place the pages
+                 * @info: the resident blocks are moved to the node, the blocks loaded afterwards are allocated there
+                 * @throws: if the node does not exist
+                 */
+                void setNumaNode (int node);
+
                 /**
                  * Reset the uniq block loading counter
                  */
                 void resetUniqCounter ();
 
+                /**
+                 * Reset the counters and latency histograms of the metrics
+                 */
+                void resetMetrics ();
+
 
                 /**
                  * ============================================================================
@@ -299,27 +988,288 @@ namespace rd_utils::memory::cache {
 
         private:
 
+                /**
+                 * @returns: the size class of a tagged block address
+                 * @throws: if the tag is not the one of a size class of the allocator
+                 */
+                Allocator * owner (uint64_t addr) const;
+
+                /**
+                 * @returns: the size class receiving an allocation
+                 * @params:
+                 *    - size: the size of the allocation
+                 *    - newBlock: the allocation takes a block of its own
+                 */
+                Allocator * route (uint64_t size, bool newBlock) const;
+
+                /**
+                 * @returns: the size class receiving an array of /size/ bytes
+                 */
+                Allocator * routeArray (uint64_t size) const;
+
+                /**
+                 * The main loop of the balancer thread
+                 */
+                void balancerMain (concurrency::Thread);
+
+                /**
+                 * Readv / writev on pieces of several size classes
+                 */
+                void dispatch (IoVec * vecs, uint32_t nb, bool write);
+
+                /**
+                 * Delete the size classes
+                 * @throws: if a class has allocations alive
+                 */
+                void removeClasses ();
+
+                /**
+                 * Change the number of loadable blocks of the allocator (not of its size classes)
+                 */
+                void resizeOwn (uint32_t nbBlocks);
+
+                /**
+                 * Allocate a segment of memory
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                bool allocateInner (uint32_t size, AllocatedSegment & alloc, bool newBlock);
+
+                /**
+                 * Free an allocated memory segment
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                void freeInner (AllocatedSegment alloc);
+
+                /**
+                 * Update the lru of a block if it is resident
+                 * @warning: _metaM must be held (shared mode is enough)
+                 * @returns: the memory of the block, nullptr if the block is not loaded
+                 */
+                uint8_t * touch (uint64_t addr);
+
+                /**
+                 * @returns: the lock protecting the data of the block /addr/
+                 */
+                concurrency::mutex & stripe (uint64_t addr);
+
+                /**
+                 * Mark a block as modified since it was last persisted
+                 * @warning: the lock of the block must be held (stripe, or _metaM in exclusive mode)
+                 */
+                void markDirty (uint64_t addr);
+
+                /**
+                 * Mark a block as persisted
+                 * @warning: the lock of the block must be held (stripe, or _metaM in exclusive mode)
+                 */
+                void markClean (uint64_t addr);
+
+                /**
+                 * Write back the least recently used dirty blocks until the low watermark is reached
+                 * @params:
+                 *    - staging: a buffer of a block size, in which the blocks are copied before being saved
+                 */
+                void flushSome (uint8_t * staging);
+
+                /**
+                 * The main loop of the flusher thread
+                 */
+                void flusherMain (concurrency::Thread);
+
+                /**
+                 * The main loop of the metrics exporter thread
+                 */
+                void exporterMain (concurrency::Thread);
+
+                /**
+                 * Measure the occupancy of the resident blocks
+                 * @warning: _metaM must be held (shared mode is enough)
+                 */
+                void measureFragmentation (FragmentationMetrics & metrics, float sparse) const;
+
+                /**
+                 * Move the tracked segments of a block to the other indexed resident blocks
+                 * @params:
+                 *    - owned: the tracked segments of each resident block (handle, size), updated with the moves
+                 * @returns: false if a segment did not fit in any resident block
+                 * @warning: _metaM must be held in exclusive mode, and the relocation shards locked
+                 */
+                bool evacuate (uint64_t addr, std::unordered_map <uint64_t, std::vector <std::pair <AllocatedSegment*, uint32_t> > > & owned, CompactionReport & report);
+
+                /**
+                 * The main loop of the compactor thread
+                 */
+                void compactorMain (concurrency::Thread);
+
+                /**
+                 * @returns: the magazine of the calling thread for this allocator (created on first use)
+                 */
+                Magazine * magazine ();
+
+                /**
+                 * Free the segments of a magazine (its lock must be held)
+                 */
+                void drain (Magazine * mag);
+
+                /**
+                 * Drain and forget the magazine of a thread that ended
+                 */
+                void releaseMagazine (Magazine * mag);
+
                 /**
                  * Load a block into memory
                  * @params:
                  *    - addr: the address of the block to load
+                 *    - write: true if the block is going to be modified (a shared block gets its own copy)
+                 * @info: a read of a block sharing the content of another one returns the memory of the source
+                 */
+                free_list_instance * load (uint64_t addr, bool write = true);
+
+                /**
+                 * @returns: the block holding the data of the block /addr/ (its source if it shares the content of another block)
+                 */
+                uint64_t physical (uint64_t addr) const;
+
+                /**
+                 * @returns: true if the content of the block is shared with other blocks (writing to it needs the exclusive lock)
+                 */
+                bool shared (uint64_t addr) const;
+
+                /**
+                 * Give its own copy of the content of its source to a block
+                 * @returns: the memory of the block
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                uint8_t * materialize (uint64_t addr);
+
+                /**
+                 * Stop sharing the content of a block with other blocks (they get their own copy)
+                 * @info: a single copy is made, the other aliases share the first one
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                void unshare (uint64_t addr);
+
+                /**
+                 * Forget the source of a block (its content is not copied)
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                void unalias (uint64_t addr);
+
+                /**
+                 * @returns: the block holding the memory returned by a pin of addr
+                 * @warning: _metaM must be held
                  */
-                free_list_instance * load (uint32_t addr);
+                uint64_t pinned (uint64_t addr, const uint8_t * memory) const;
+
+                /**
+                 * Read blocks from the persister, the blocks persisted as zeros are rebuilt without reading anything
+                 * @warning: _persistM must be held
+                 */
+                void fetch (const std::vector <remote::BlockIo> & blocks);
+
+                /**
+                 * Read blocks from the persister
+                 * @warning: _persistM must be held
+                 */
+                void readStored (const std::vector <remote::BlockIo> & blocks);
+
+                /**
+                 * Write blocks to the persister, only the head of the blocks that are zeros after it is kept (in memory)
+                 * @returns: the number of blocks written to the persister
+                 * @warning: _persistM must be held
+                 */
+                uint32_t store (const std::vector <remote::BlockIo> & blocks);
+
+                /**
+                 * Keep the head of the blocks that are zeros after it instead of storing them
+                 * @returns: the blocks to write to the persister
+                 * @warning: _persistM and _metaM must be held
+                 */
+                std::vector <remote::BlockIo> elideZeros (const std::vector <remote::BlockIo> & blocks);
+
+                /**
+                 * Write blocks to the persister (the metadata of the blocks is not accessed)
+                 * @returns: the number of blocks written
+                 * @warning: _persistM must be held
+                 */
+                uint32_t writeStored (const std::vector <remote::BlockIo> & blocks);
+
+                /**
+                 * Move the data of a list of pieces (readv / writev)
+                 */
+                void transfer (IoVec * vecs, uint32_t nb, bool write);
+
+                /**
+                 * Load the blocks that are not resident in a single persister batch
+                 * @params:
+                 *    - addrs: the blocks to load, at most the number of loadable blocks are loaded
+                 * @warning: _metaM must be held in exclusive mode
+                 */
+                void loadBatch (const std::vector <uint64_t> & addrs);
 
                 /**
                  * Allocate a new block (and load it)
                  */
-                uint8_t * allocateNewBlock (uint32_t & addr);
+                uint8_t * allocateNewBlock (uint64_t & addr);
+
+                /**
+                 * Create an empty block in memory at the address /addr/
+                 */
+                uint8_t * createBlock (uint64_t addr);
+
+                /**
+                 * Allocate a segment in the block /addr/ (already loaded at /mem/)
+                 * @returns: true if the segment fitted
+                 */
+                bool allocateIn (uint64_t addr, free_list_instance * mem, uint32_t size, AllocatedSegment & alloc);
+
+                /**
+                 * Insert a block in the size index matching its state (resident or stored)
+                 * @warning: must be called each time maxSize or mem of a block is changed (with unindex before the change)
+                 */
+                void index (uint64_t addr);
+
+                /**
+                 * Remove a block from the size indexes
+                 */
+                void unindex (uint64_t addr);
 
                 /**
                  * Free a block from memory
                  */
-                void freeBlock (uint32_t);
+                void freeBlock (uint64_t);
+
+                /**
+                 * Evict a number of blocks from the loaded blocks (pinned blocks are skipped)
+                 * @returns: the number of evicted blocks
+                 */
+                uint32_t evictSome (uint32_t nb);
+
+                /**
+                 * Save the dirty blocks of a list of resident blocks (in a single persister batch) and remove them from memory
+                 * @warning: the blocks must not be tracked by the eviction policy anymore
+                 */
+                void writeBack (const std::vector <uint64_t> & addrs);
+
+                /**
+                 * Register a block that was just read from the persister as resident
+                 */
+                void install (uint64_t addr, uint8_t * mem);
+
+                /**
+                 * Load blocks from the persister (in a single batch) without holding the allocator lock
+                 */
+                void prefetchSome (const std::vector <uint64_t> & addrs);
+
+                /**
+                 * The main loop of the prefetcher thread
+                 */
+                void prefetcherMain (concurrency::Thread);
 
                 /**
-                 * Evict a number of blocks from the loaded blocks
+                 * Stop the prefetcher thread (if running) and wait for its end
                  */
-                void evictSome (uint32_t nb);
+                void stopPrefetcher ();
 
 
         };
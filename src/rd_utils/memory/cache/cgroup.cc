@@ -0,0 +1,169 @@
+#include "cgroup.hh"
+#include <cstdlib>
+#include <stdexcept>
+#include <rd_utils/utils/files.hh>
+#include <rd_utils/utils/str.hh>
+
+namespace rd_utils::memory::cache {
+
+  /**
+   * @returns: the value of a cgroup limit file (UINT64_MAX for "max" or a missing file)
+   */
+  static uint64_t read_limit (const std::string & path) {
+    if (!utils::file_exists (path)) return UINT64_MAX;
+
+    auto content = utils::strip (utils::read_file (path));
+    if (content.size () == 0 || content == "max") return UINT64_MAX;
+
+    return std::strtoull (content.c_str (), nullptr, 10);
+  }
+
+  /**
+   * Read the avg10 values of a pressure file ("some avg10=1.23 avg60=... total=...")
+   */
+  static void read_pressure (const std::string & path, float & some, float & full) {
+    some = 0;
+    full = 0;
+    if (!utils::file_exists (path)) return;
+
+    for (auto & line : utils::splitLines (utils::read_file (path))) {
+      auto fields = utils::splitByString (line, " ");
+      if (fields.size () < 2 || fields [1].rfind ("avg10=", 0) != 0) continue;
+
+      auto value = std::strtof (fields [1].c_str () + 6, nullptr);
+      if (fields [0] == "some") some = value;
+      else if (fields [0] == "full") full = value;
+    }
+  }
+
+  CgroupMemoryController::CgroupMemoryController (Allocator & alloc, float ratio, const std::string & path) :
+    _alloc (&alloc)
+    , _path (path == "" ? findCgroup () : path)
+    , _ratio (ratio)
+    , _unlimited (alloc.getMaxNbLoadable ())
+    , _thread (0)
+  {
+    if (!utils::directory_exists (this-> _path)) {
+      throw std::runtime_error ("Cgroup not found : " + this-> _path);
+    }
+  }
+
+  std::string CgroupMemoryController::findCgroup () {
+    bool isV2 = false;
+    auto root = utils::get_cgroup_mount_point (isV2);
+    if (root == "" || !isV2) {
+      throw std::runtime_error ("Cgroup v2 is not mounted");
+    }
+
+    // the line of the unified hierarchy is "0::/path/of/the/cgroup"
+    for (auto & line : utils::splitLines (utils::read_file ("/proc/self/cgroup"))) {
+      if (line.rfind ("0::", 0) == 0) {
+        return root + utils::strip (line.substr (3));
+      }
+    }
+
+    return root;
+  }
+
+  void CgroupMemoryController::readInfo (CgroupMemoryInfo & info) const {
+    info.max = read_limit (this-> _path + "/memory.max");
+    info.high = read_limit (this-> _path + "/memory.high");
+
+    auto current = read_limit (this-> _path + "/memory.current");
+    info.current = current == UINT64_MAX ? 0 : current;
+
+    read_pressure (this-> _path + "/memory.pressure", info.pressureSome, info.pressureFull);
+  }
+
+  uint32_t CgroupMemoryController::computeBudget (const CgroupMemoryInfo & info) const {
+    uint64_t limit = std::min (info.max, info.high);
+    if (limit == UINT64_MAX) return this-> _unlimited;
+
+    uint64_t blockSize = this-> _alloc-> getBlockSize ();
+    uint64_t cache = this-> _alloc-> getResidentBytes ();
+
+    // the rest of the process keeps what it already uses, the cache cannot take it
+    uint64_t others = info.current > cache ? info.current - cache : 0;
+    uint64_t budget = (uint64_t) (limit * this-> _ratio);
+    if (others + budget > limit) {
+      budget = limit > others ? limit - others : 0;
+    }
+
+    return std::max ((uint64_t) 2, budget / blockSize);
+  }
+
+  uint32_t CgroupMemoryController::step () {
+    CgroupMemoryInfo info;
+    this-> readInfo (info);
+
+    auto budget = this-> computeBudget (info);
+    auto current = this-> _alloc-> getMaxNbLoadable ();
+    uint32_t delta = std::max ((uint32_t) 1, (uint32_t) (budget * CGROUP_RESIZE_STEP));
+
+    uint64_t limit = std::min (info.max, info.high);
+    bool pressure = info.pressureSome >= CGROUP_PRESSURE_HIGH || (limit != UINT64_MAX && info.current >= limit * CGROUP_USAGE_HIGH);
+
+    uint32_t target = current;
+    if (pressure) {
+      target = current > delta ? current - delta : 2;
+    } else if (info.pressureSome < CGROUP_PRESSURE_LOW && current < budget) {
+      target = std::min (budget, current + delta);
+    }
+
+    // the budget is a hard limit, a new limit of the cgroup applies immediately
+    if (target > budget) target = budget;
+    if (target < 2) target = 2;
+
+    if (target != current) {
+      this-> _alloc-> resize (target);
+    }
+
+    WITH_LOCK (this-> _m) {
+      this-> _info = info;
+      this-> _budget = budget;
+      if (target < current) this-> _nbShrinks += 1;
+      else if (target > current) this-> _nbGrows += 1;
+    }
+
+    return target;
+  }
+
+  void CgroupMemoryController::start (float period) {
+    this-> stop ();
+
+    this-> _period = period;
+    this-> _running = true;
+    this-> _thread = concurrency::spawn (this, &CgroupMemoryController::controllerMain);
+  }
+
+  void CgroupMemoryController::stop () {
+    if (this-> _running) {
+      this-> _running = false;
+      this-> _sem.post ();
+
+      concurrency::join (this-> _thread);
+      this-> _thread = concurrency::Thread (0);
+    }
+  }
+
+  void CgroupMemoryController::getInfo (CgroupMemoryInfo & info, uint32_t & budget, uint32_t & nbShrinks, uint32_t & nbGrows) {
+    WITH_LOCK (this-> _m) {
+      info = this-> _info;
+      budget = this-> _budget;
+      nbShrinks = this-> _nbShrinks;
+      nbGrows = this-> _nbGrows;
+    }
+  }
+
+  void CgroupMemoryController::controllerMain (concurrency::Thread) {
+    while (this-> _running) {
+      this-> step ();
+      this-> _sem.wait (this-> _period);
+    }
+  }
+
+  CgroupMemoryController::~CgroupMemoryController () {
+    this-> stop ();
+  }
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include "allocator.hh"
+#include <rd_utils/concurrency/mutex.hh>
+#include <rd_utils/concurrency/semaphore.hh>
+#include <rd_utils/concurrency/thread.hh>
+
+namespace rd_utils::memory::cache {
+
+// The default time between two passes of the controller (in seconds)
+#define CGROUP_CONTROL_PERIOD 1
+
+// The default part of the memory limit of the cgroup given to the resident blocks
+#define CGROUP_BUDGET_RATIO 0.5
+
+// The stall ratio over the last 10s (some avg10 of memory.pressure, in %) above which the allocator shrinks
+#define CGROUP_PRESSURE_HIGH 10.0
+
+// The stall ratio under which the allocator can grow back toward its budget
+#define CGROUP_PRESSURE_LOW 1.0
+
+// The ratio of the memory limit above which the allocator shrinks even without stalls
+#define CGROUP_USAGE_HIGH 0.95
+
+// The part of the budget (in blocks) removed or given back at each pass
+#define CGROUP_RESIZE_STEP 0.1
+
+        /**
+         * Memory state of a cgroup (v2)
+         */
+        struct CgroupMemoryInfo {
+                // memory.max (UINT64_MAX if unlimited)
+                uint64_t max;
+
+                // memory.high (UINT64_MAX if unlimited)
+                uint64_t high;
+
+                // memory.current
+                uint64_t current;
+
+                // The share of time some tasks stalled on memory over the last 10s (in %)
+                float pressureSome;
+
+                // The share of time all tasks stalled on memory over the last 10s (in %)
+                float pressureFull;
+        };
+
+        /**
+         * Controller resizing the resident set of an allocator from the memory limits of its cgroup
+         * @info:
+         * ======
+         * The budget of the allocator is a part of the lowest limit of the
+         * cgroup (memory.high or memory.max), reduced if the rest of the
+         * process already uses the remainder of the limit. Without limit,
+         * the number of loadable blocks of the allocator at the creation
+         * of the controller is the budget.
+         *
+         * Every pass reads memory.pressure (PSI): when the tasks of the
+         * cgroup stall on memory, or its usage is close to the limit, the
+         * allocator is shrunk by a step, when the pressure is low it grows
+         * back toward the budget by a step. The evicted blocks are written
+         * to the persister of the allocator
+         * ======
+         */
+        class CgroupMemoryController {
+        private:
+
+                // The controlled allocator
+                Allocator * _alloc;
+
+                // The directory of the cgroup
+                std::string _path;
+
+                // The part of the limit given to the allocator
+                float _ratio;
+
+                // The number of blocks used when the cgroup has no limit
+                uint32_t _unlimited;
+
+                // The current budget of the allocator (in blocks)
+                uint32_t _budget = 0;
+
+                // The last state read from the cgroup
+                CgroupMemoryInfo _info = {};
+
+                // The number of times the allocator was shrunk
+                uint32_t _nbShrinks = 0;
+
+                // The number of times the allocator was grown
+                uint32_t _nbGrows = 0;
+
+                // Lock protecting the state of the controller
+                concurrency::mutex _m;
+
+                // The time between two passes (in seconds)
+                float _period = CGROUP_CONTROL_PERIOD;
+
+                // True while the controller thread is running
+                std::atomic<bool> _running = false;
+
+                // Semaphore waking up the controller
+                concurrency::semaphore _sem;
+
+                // The controller thread
+                concurrency::Thread _thread;
+
+        private:
+
+                CgroupMemoryController (const CgroupMemoryController &);
+                void operator= (const CgroupMemoryController &);
+
+        public:
+
+                /**
+                 * @params:
+                 *    - alloc: the controlled allocator
+                 *    - ratio: the part of the memory limit given to the resident blocks
+                 *    - path: the directory of the cgroup, the cgroup of the process if empty
+                 * @throws: if the cgroup cannot be found (cgroup v2 is required)
+                 */
+                CgroupMemoryController (Allocator & alloc = Allocator::instance (), float ratio = CGROUP_BUDGET_RATIO, const std::string & path = "");
+
+                /**
+                 * @returns: the directory of the cgroup (v2) of the current process
+                 * @throws: if cgroup v2 is not mounted
+                 */
+                static std::string findCgroup ();
+
+                /**
+                 * Read the memory limits, usage and pressure of the cgroup
+                 * @info: missing files are read as no limit and no pressure
+                 */
+                void readInfo (CgroupMemoryInfo & info) const;
+
+                /**
+                 * Do a pass of the controller (read the cgroup and resize the allocator)
+                 * @returns: the number of loadable blocks of the allocator after the pass
+                 */
+                uint32_t step ();
+
+                /**
+                 * Start a background thread doing a pass periodically
+                 * @params:
+                 *    - period: the time between two passes (in seconds)
+                 */
+                void start (float period = CGROUP_CONTROL_PERIOD);
+
+                /**
+                 * Stop the controller thread (if running) and wait for its end
+                 */
+                void stop ();
+
+                /**
+                 * @returns:
+                 *    - info: the last state read from the cgroup
+                 *    - budget: the budget of the allocator (in blocks)
+                 *    - nbShrinks: the number of times the allocator was shrunk
+                 *    - nbGrows: the number of times the allocator was grown
+                 */
+                void getInfo (CgroupMemoryInfo & info, uint32_t & budget, uint32_t & nbShrinks, uint32_t & nbGrows);
+
+                /**
+                 * this-> stop ()
+                 */
+                ~CgroupMemoryController ();
+
+        private:
+
+                /**
+                 * @returns: the budget of the allocator (in blocks) given the state of the cgroup
+                 */
+                uint32_t computeBudget (const CgroupMemoryInfo & info) const;
+
+                /**
+                 * The main loop of the controller thread
+                 */
+                void controllerMain (concurrency::Thread);
+
+        };
+
+}
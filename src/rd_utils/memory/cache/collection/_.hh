@@ -4,3 +4,5 @@
 #include "list.hh"
 #include "str.hh"
 #include "box.hh"
+#include "paged.hh"
+#include "shared.hh"
@@ -3,8 +3,9 @@
 
 namespace rd_utils::memory::cache::collection {
 
-  CacheArrayBase::CacheArrayBase () :
-    _rest ({0, 0})
+  CacheArrayBase::CacheArrayBase (Allocator & alloc) :
+    _alloc (&alloc)
+    , _rest ({0, 0})
     , _fstBlockAddr (0)
     , _size (0)
     , _innerSize (0)
@@ -13,13 +14,15 @@ namespace rd_utils::memory::cache::collection {
     , _sizeDividePerBlock (0)
   {}
 
-  CacheArrayBase::CacheArrayBase (uint32_t size, uint32_t innerSize) {
+  CacheArrayBase::CacheArrayBase (uint64_t size, uint32_t innerSize, Allocator & alloc) :
+    _alloc (&alloc)
+  {
     this-> allocate (size, innerSize);
   }
 
-  void CacheArrayBase::allocate (uint32_t size, uint32_t innerSize) {
-    uint32_t nbBl;
-    Allocator::instance ().allocateSegments (innerSize, ((uint64_t) size) * ((uint64_t) innerSize), this-> _rest, this-> _fstBlockAddr, nbBl, this-> _sizePerBlock);
+  void CacheArrayBase::allocate (uint64_t size, uint32_t innerSize) {
+    uint64_t nbBl;
+    this-> _alloc-> allocateSegments (innerSize, ((uint64_t) size) * ((uint64_t) innerSize), this-> _rest, this-> _fstBlockAddr, nbBl, this-> _sizePerBlock);
     if (nbBl == 0) {
       this-> _nbBlocks = 0;
       this-> _sizeDividePerBlock = 1;
@@ -37,6 +40,7 @@ namespace rd_utils::memory::cache::collection {
   void CacheArrayBase::move (CacheArrayBase * other) {
     this-> dispose ();
 
+    this-> _alloc = other-> _alloc;
     this-> _rest = other-> _rest;
     this-> _fstBlockAddr = other-> _fstBlockAddr;
     this-> _nbBlocks = other-> _nbBlocks;
@@ -44,6 +48,7 @@ namespace rd_utils::memory::cache::collection {
     this-> _innerSize = other-> _innerSize;
     this-> _sizePerBlock = other-> _sizePerBlock;
     this-> _sizeDividePerBlock = other-> _sizeDividePerBlock;
+    this-> _hint = other-> _hint;
 
     other-> _rest = {0, 0};
     other-> _fstBlockAddr = 0;
@@ -53,77 +58,60 @@ namespace rd_utils::memory::cache::collection {
     other-> _sizePerBlock = 0;
   }
 
-  CacheArrayBase::CacheArrayBase (CacheArrayBase * other) {
+  CacheArrayBase::CacheArrayBase (CacheArrayBase * other) :
+    CacheArrayBase (*other-> _alloc)
+  {
     this-> move (other);
   }
 
   void CacheArrayBase::send (net::TcpStream & stream, uint32_t bufferSize) {
-    uint32_t nbInBuffer = bufferSize / this-> _innerSize;
+    uint32_t nbInBuffer = std::max (bufferSize / this-> _innerSize, (uint32_t) 1);
     uint8_t * buffer = new uint8_t [nbInBuffer * this-> _innerSize];
-    stream.sendU32 (this-> _size, true);
+    stream.sendU64 (this-> _size, true);
     stream.sendU32 (this-> _innerSize, true);
 
-    for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
-      AllocatedSegment seg = {.blockAddr = this-> _fstBlockAddr + i, .offset = ALLOC_HEAD_SIZE};
-      this-> sendBlock (stream, seg, this-> _sizeDividePerBlock, buffer, nbInBuffer);
+    // a buffer crossing the end of a block is filled by a single readv
+    for (uint64_t i = 0 ; i < this-> _size ;) {
+      uint32_t nb = std::min ((uint64_t) nbInBuffer, this-> _size - i);
+      this-> readNb (i, buffer, nb);
+      stream.sendRaw (buffer, nb * this-> _innerSize);
+
+      i += nb;
     }
 
-    auto globIndex = this-> _nbBlocks * this-> _sizeDividePerBlock;
-    this-> sendBlock (stream, this-> _rest, this-> _size - globIndex, buffer, nbInBuffer);
     delete [] buffer;
   }
 
   void CacheArrayBase::recv (net::TcpStream & stream, uint32_t bufferSize) {
-    auto size = stream.receiveU32 ();
+    auto size = stream.receiveU64 ();
     auto innerSize = stream.receiveU32 ();
 
     this-> dispose ();
     this-> allocate (size, innerSize);
 
-    uint32_t nbInBuffer = bufferSize / this-> _innerSize;
+    uint32_t nbInBuffer = std::max (bufferSize / this-> _innerSize, (uint32_t) 1);
     uint8_t * buffer = new uint8_t [nbInBuffer * this-> _innerSize];
-    for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
-      AllocatedSegment seg = {.blockAddr = this-> _fstBlockAddr + i, .offset = ALLOC_HEAD_SIZE};
-      this-> recvBlock (stream, seg, this-> _sizeDividePerBlock, buffer, nbInBuffer);
-    }
-
-    auto globIndex = this-> _nbBlocks * this-> _sizeDividePerBlock;
-    this-> recvBlock (stream, this-> _rest, this-> _size - globIndex, buffer, nbInBuffer);
-    delete [] buffer;
-  }
-
-
-
-  void CacheArrayBase::sendBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer) {
-    for (uint32_t i = 0 ; i < nbElements ;) {
-      auto nb = (nbElements - i) > nbInBuffer ? nbInBuffer : (nbElements - i);
-      Allocator::instance ().read (seg, buffer,  i * this-> _innerSize, nb * this-> _innerSize);
-      stream.sendRaw (buffer, nb * this-> _innerSize);
-
-      i += nb;
-    }
-  }
-
-  void CacheArrayBase::recvBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer) {
-    for (uint32_t i = 0 ; i < nbElements ; ) {
-      auto nb = (nbElements - i) > nbInBuffer ? nbInBuffer : (nbElements - i);
+    for (uint64_t i = 0 ; i < this-> _size ;) {
+      uint32_t nb = std::min ((uint64_t) nbInBuffer, this-> _size - i);
       if (stream.receiveRaw (buffer, nb * this-> _innerSize)) {
-        Allocator::instance ().write (seg, buffer, i * this-> _innerSize, nb * this-> _innerSize);
+        this-> writeNb (i, buffer, nb);
       }
 
       i += nb;
     }
+
+    delete [] buffer;
   }
 
   void CacheArrayBase::dispose () {
     if (this-> _rest.blockAddr != 0) {
       if (this-> _nbBlocks != 0) {
-        for (uint32_t index = 0 ; index < this-> _nbBlocks ; index ++) {
-          Allocator::instance ().freeFast (this-> _fstBlockAddr + index);
+        for (uint64_t index = 0 ; index < this-> _nbBlocks ; index ++) {
+          this-> _alloc-> freeFast (this-> _fstBlockAddr + index);
         }
       }
 
-      Allocator::instance ().free (this-> _rest);
+      this-> _alloc-> free (this-> _rest);
 
       this-> _rest = {0, 0};
       this-> _fstBlockAddr = 0;
@@ -134,16 +122,61 @@ namespace rd_utils::memory::cache::collection {
     }
   }
 
-  uint32_t CacheArrayBase::len () const {
+  uint64_t CacheArrayBase::len () const {
     return this-> _size;
   }
 
-  uint32_t CacheArrayBase::nbBlocks () const {
+  Allocator & CacheArrayBase::getAllocator () const {
+    return *this-> _alloc;
+  }
+
+  uint64_t CacheArrayBase::nbBlocks () const {
     if (this-> _size != 0) {
       return this-> _nbBlocks + 1;
     } else return 0;
   }
 
+  void CacheArrayBase::advise (AccessHint hint, uint64_t beg, uint64_t end) {
+    if (hint == AccessHint::NORMAL || hint == AccessHint::SEQUENTIAL || hint == AccessHint::RANDOM) {
+      this-> _hint = hint;
+      return;
+    }
+
+    if (end > this-> _size) end = this-> _size;
+    if (beg >= end) return;
+
+    auto last = this-> blockIndex (end - 1);
+    for (auto index = this-> blockIndex (beg) ; index <= last ; index++) {
+      auto addr = this-> blockAddr (index);
+      if (addr == 0) continue;
+
+      if (hint == AccessHint::WILLNEED) {
+        this-> _alloc-> prefetch (addr);
+      } else {
+        this-> _alloc-> evict (addr);
+      }
+    }
+  }
+
+  uint64_t CacheArrayBase::blockIndex (uint64_t i) const {
+    auto index = block_index (i, this-> _sizeDividePerBlock);
+    return index < this-> _nbBlocks ? index : this-> _nbBlocks;
+  }
+
+  uint64_t CacheArrayBase::blockAddr (uint64_t index) const {
+    if (index < this-> _nbBlocks) return this-> _fstBlockAddr + index;
+    return this-> _rest.blockAddr;
+  }
+
+  void CacheArrayBase::readAhead (uint64_t index) const {
+    if (this-> _hint == AccessHint::RANDOM) return;
+
+    auto depth = this-> _hint == AccessHint::SEQUENTIAL ? PREFETCH_DEPTH : 1;
+    for (uint64_t j = index + 1 ; j <= index + depth && j <= this-> _nbBlocks ; j++) {
+      this-> _alloc-> prefetch (this-> blockAddr (j));
+    }
+  }
+
   CacheArrayBase::~CacheArrayBase () {
     this-> dispose ();
   }
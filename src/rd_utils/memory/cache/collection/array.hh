@@ -20,20 +20,23 @@ namespace rd_utils::memory::cache::collection {
   class CacheArrayBase {
   protected:
 
+    // The allocator of the blocks of the array
+    Allocator * _alloc;
+
     // The memory segment of the array
     AllocatedSegment _rest;
 
     // The index of the first block
-    uint32_t _fstBlockAddr;
+    uint64_t _fstBlockAddr;
 
     // The number of elements in the array
-    uint32_t _size;
+    uint64_t _size;
 
     // The size of inner elements
     uint32_t _innerSize;
 
     // The nb of blocks allocated especially for this array
-    uint32_t _nbBlocks;
+    uint64_t _nbBlocks;
 
     // The size per block (without considering the rest)
     uint32_t _sizePerBlock;
@@ -41,34 +44,182 @@ namespace rd_utils::memory::cache::collection {
     // The size per block (or 1, if there is only this-> _rest)
     uint32_t _sizeDividePerBlock;
 
+    // The way the array is going to be accessed
+    AccessHint _hint = AccessHint::NORMAL;
+
   protected:
 
     CacheArrayBase (CacheArrayBase * other);
     void move (CacheArrayBase * other);
 
+    /**
+     * Locate the elements [i, i + nb) in the segments of the array
+     * @params:
+     *    - buffer: the memory of the elements outside of the array
+     * @returns:
+     *    - vec: the piece of the elements in the block of the element /i/
+     *    - the number of elements of the piece (the piece stops at the end of the block)
+     */
+    inline uint32_t piece (uint64_t i, uint8_t * buffer, uint32_t nb, IoVec & vec) const {
+      uint64_t index = block_index (i, this-> _sizeDividePerBlock);
+      uint32_t offset = (i - (index * this-> _sizeDividePerBlock));
+
+      if (index < this-> _nbBlocks) {
+        vec.seg = {.blockAddr = index + this-> _fstBlockAddr, .offset = ALLOC_HEAD_SIZE};
+        if (nb > this-> _sizeDividePerBlock - offset) nb = this-> _sizeDividePerBlock - offset;
+      } else {
+        vec.seg = this-> _rest;
+        if (this-> _sizeDividePerBlock == 1) offset = index;
+      }
+
+      vec.offset = offset * this-> _innerSize;
+      vec.size = nb * this-> _innerSize;
+      vec.data = buffer;
+      return nb;
+    }
+
+    /**
+     * Read the elements [i, i + nb) into buffer, the allocator is accessed once for IOV_BATCH blocks
+     */
+    inline void readNb (uint64_t i, uint8_t * buffer, uint32_t nb) const {
+      IoVec vecs [IOV_BATCH];
+      uint32_t n = 0;
+      while (nb != 0) {
+        auto len = this-> piece (i, buffer, nb, vecs [n++]);
+        i += len;
+        nb -= len;
+        buffer += len * this-> _innerSize;
+
+        if (n == IOV_BATCH || nb == 0) {
+          this-> _alloc-> readv (vecs, n);
+          n = 0;
+        }
+      }
+    }
+
+    /**
+     * Write the elements of buffer into [i, i + nb), the allocator is accessed once for IOV_BATCH blocks
+     */
+    inline void writeNb (uint64_t i, uint8_t * buffer, uint32_t nb) {
+      IoVec vecs [IOV_BATCH];
+      uint32_t n = 0;
+      while (nb != 0) {
+        auto len = this-> piece (i, buffer, nb, vecs [n++]);
+        i += len;
+        nb -= len;
+        buffer += len * this-> _innerSize;
+
+        if (n == IOV_BATCH || nb == 0) {
+          this-> _alloc-> writev (vecs, n);
+          n = 0;
+        }
+      }
+    }
+
+    /**
+     * Locate the bytes [offset, offset + size) of the elements in the segments of the array (same as piece, counted in bytes)
+     * @returns: the number of bytes of the piece
+     */
+    inline uint64_t bytePiece (uint64_t offset, uint8_t * buffer, uint64_t size, IoVec & vec) const {
+      uint64_t index = this-> _sizePerBlock == 0 ? 0 : offset / this-> _sizePerBlock;
+      if (index < this-> _nbBlocks) {
+        vec.seg = {.blockAddr = index + this-> _fstBlockAddr, .offset = ALLOC_HEAD_SIZE};
+        vec.offset = offset - index * this-> _sizePerBlock;
+        if (size > this-> _sizePerBlock - vec.offset) size = this-> _sizePerBlock - vec.offset;
+      } else {
+        vec.seg = this-> _rest;
+        vec.offset = offset - this-> _nbBlocks * this-> _sizePerBlock;
+      }
+
+      vec.size = size;
+      vec.data = buffer;
+      return size;
+    }
+
+    /**
+     * Move the bytes [offset, offset + size) of the elements from or to buffer, the allocator is accessed once for IOV_BATCH blocks
+     */
+    inline void transferBytes (uint64_t offset, uint8_t * buffer, uint64_t size, bool write) const {
+      IoVec vecs [IOV_BATCH];
+      uint32_t n = 0;
+      while (size != 0) {
+        auto len = this-> bytePiece (offset, buffer, size, vecs [n++]);
+        offset += len;
+        size -= len;
+        buffer += len;
+
+        if (n == IOV_BATCH || size == 0) {
+          if (write) this-> _alloc-> writev (vecs, n);
+          else this-> _alloc-> readv (vecs, n);
+          n = 0;
+        }
+      }
+    }
+
   public:
 
-    CacheArrayBase ();
+    CacheArrayBase (Allocator & alloc = Allocator::instance ());
 
-    CacheArrayBase (uint32_t size, uint32_t innerSize);
+    CacheArrayBase (uint64_t size, uint32_t innerSize, Allocator & alloc = Allocator::instance ());
 
     void send (net::TcpStream & stream, uint32_t bufferSize);
 
     void recv (net::TcpStream & stream, uint32_t bufferSize);
 
-    uint32_t len () const ;
+    uint64_t len () const ;
 
-    uint32_t nbBlocks () const;
+    uint64_t nbBlocks () const;
 
-    virtual ~CacheArrayBase ();
+    /**
+     * @returns: the allocator of the blocks of the array
+     */
+    Allocator & getAllocator () const;
 
-  private:
+    /**
+     * Read the raw bytes [offset, offset + size) of the elements of the array
+     */
+    inline void readBytes (uint64_t offset, uint8_t * buffer, uint64_t size) const {
+      this-> transferBytes (offset, buffer, size, false);
+    }
+
+    /**
+     * Write the raw bytes [offset, offset + size) of the elements of the array
+     */
+    inline void writeBytes (uint64_t offset, const uint8_t * buffer, uint64_t size) {
+      this-> transferBytes (offset, const_cast <uint8_t*> (buffer), size, true);
+    }
+
+    /**
+     * Give a hint on the way the array is going to be accessed
+     * @info:
+     * ======
+     * SEQUENTIAL and RANDOM change the read ahead of the pullers,
+     * WILLNEED and DONTNEED apply immediately to the blocks containing
+     * the elements [beg, end)
+     * ======
+     */
+    void advise (AccessHint hint, uint64_t beg = 0, uint64_t end = UINT64_MAX);
+
+    /**
+     * @returns: the index of the block containing the element /i/ (_nbBlocks for the rest segment)
+     */
+    uint64_t blockIndex (uint64_t i) const;
 
-    void sendBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer);
+    /**
+     * @returns: the address of the block /index/ of the array
+     */
+    uint64_t blockAddr (uint64_t index) const;
 
-    void recvBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer);
+    /**
+     * Prefetch the blocks following the block /index/, according to the access hint
+     */
+    void readAhead (uint64_t index) const;
 
-    void allocate (uint32_t size, uint32_t innerSize);
+    virtual ~CacheArrayBase ();
+
+  private:
+
+    void allocate (uint64_t size, uint32_t innerSize);
 
     void dispose ();
 
@@ -91,7 +242,7 @@ namespace rd_utils::memory::cache::collection {
 
       collection::CacheArray<T> * _context;
 
-      uint32_t _beg;
+      uint64_t _beg;
 
       uint32_t _i;
 
@@ -101,7 +252,7 @@ namespace rd_utils::memory::cache::collection {
 
     public:
 
-      Pusher (collection::CacheArray<T> * context, uint32_t i, T * buffer, uint32_t bufferSize) :
+      Pusher (collection::CacheArray<T> * context, uint64_t i, T * buffer, uint32_t bufferSize) :
         _context (context)
         , _beg (i)
         , _i (0)
@@ -158,7 +309,7 @@ namespace rd_utils::memory::cache::collection {
 
       collection::CacheArray<T> * _context;
 
-      uint32_t _beg;
+      uint64_t _beg;
 
       uint32_t _i;
 
@@ -166,14 +317,18 @@ namespace rd_utils::memory::cache::collection {
 
       uint32_t _bufferSize;
 
+      // The last block from which the blocks were read ahead
+      uint64_t _ahead;
+
     public:
 
-      Puller (collection::CacheArray<T> * context, uint32_t i, T * buffer, uint32_t bufferSize) :
+      Puller (collection::CacheArray<T> * context, uint64_t i, T * buffer, uint32_t bufferSize) :
         _context (context)
         , _beg (i)
         , _i (bufferSize - 1)
         , _buffer (buffer)
         , _bufferSize (bufferSize)
+        , _ahead (UINT64_MAX)
       {}
 
       const T & current () {
@@ -198,9 +353,16 @@ namespace rd_utils::memory::cache::collection {
     private:
 
       bool retreive () {
-        auto read = std::min (this-> _bufferSize, this-> _context-> len () - this-> _beg);
+        uint32_t read = std::min ((uint64_t) this-> _bufferSize, this-> _context-> len () - this-> _beg);
         if (read == 0) return false;
 
+        // the next blocks are loaded while this one is consumed
+        auto index = this-> _context-> blockIndex (this-> _beg);
+        if (index != this-> _ahead) {
+          this-> _ahead = index;
+          this-> _context-> readAhead (index);
+        }
+
         this-> _context-> getNb (this-> _beg, this-> _buffer, read);
         this-> _beg += read;
         this-> _bufferSize = read;
@@ -217,33 +379,33 @@ namespace rd_utils::memory::cache::collection {
 
       CacheArray<T> * _context;
 
-      uint32_t _beg, _len;
+      uint64_t _beg, _len;
 
     public:
 
-      Slice (CacheArray<T> * context, uint32_t beg, uint32_t len):
+      Slice (CacheArray<T> * context, uint64_t beg, uint64_t len):
         _context (context)
         , _beg (beg)
         , _len (len)
       {}
 
-      inline void set (uint32_t i, const T & val) {
+      inline void set (uint64_t i, const T & val) {
         this-> _context-> set (i + this-> _beg, val);
       }
 
-      inline T get (uint32_t i) {
+      inline T get (uint64_t i) {
         return this-> _context-> get (i + this-> _beg);
       }
 
-      inline uint32_t len () const {
+      inline uint64_t len () const {
         return this-> _len;
       }
 
-      inline void setNb (uint32_t i, T * buffer, uint32_t nb) {
+      inline void setNb (uint64_t i, T * buffer, uint32_t nb) {
         this-> _context-> setNb (i + this-> _beg, buffer, nb);
       }
 
-      inline void getNb (uint32_t i, T * buffer, uint32_t nb) {
+      inline void getNb (uint64_t i, T * buffer, uint32_t nb) {
         this-> _context-> getNb (i + this-> _beg, buffer, nb);
       }
 
@@ -277,6 +439,91 @@ namespace rd_utils::memory::cache::collection {
 
     };
 
+    /**
+     * Elements of the array accessed in place inside a pinned block
+     * @info: the block stays in memory (and the pointer valid) until the span is released or destroyed
+     */
+    class Span {
+    private:
+
+      Allocator * _alloc;
+
+      uint64_t _blockAddr;
+
+      // The memory returned by the pin
+      uint8_t * _mem;
+
+      T * _data;
+
+      uint32_t _len;
+
+    private:
+
+      Span (const Span &);
+      void operator= (const Span &);
+
+    public:
+
+      Span (Allocator * alloc, uint64_t blockAddr, uint8_t * mem, T * data, uint32_t len) :
+        _alloc (alloc)
+        , _blockAddr (blockAddr)
+        , _mem (mem)
+        , _data (data)
+        , _len (len)
+      {}
+
+      Span (Span && other) :
+        _alloc (other._alloc)
+        , _blockAddr (other._blockAddr)
+        , _mem (other._mem)
+        , _data (other._data)
+        , _len (other._len)
+      {
+        other._blockAddr = 0;
+        other._mem = nullptr;
+        other._data = nullptr;
+        other._len = 0;
+      }
+
+      inline T & operator[] (uint32_t i) {
+        return this-> _data [i];
+      }
+
+      inline T * data () {
+        return this-> _data;
+      }
+
+      inline T * begin () {
+        return this-> _data;
+      }
+
+      inline T * end () {
+        return this-> _data + this-> _len;
+      }
+
+      inline uint32_t len () const {
+        return this-> _len;
+      }
+
+      /**
+       * Unpin the block, the span cannot be used afterwards
+       */
+      void release () {
+        if (this-> _blockAddr != 0) {
+          this-> _alloc-> unpin (this-> _blockAddr, this-> _mem);
+          this-> _blockAddr = 0;
+          this-> _mem = nullptr;
+          this-> _data = nullptr;
+          this-> _len = 0;
+        }
+      }
+
+      ~Span () {
+        this-> release ();
+      }
+
+    };
+
   public:
 
     CacheArray (CacheArray <T> && other) :
@@ -287,55 +534,70 @@ namespace rd_utils::memory::cache::collection {
       this-> move (&other);
     }
 
-    CacheArray () {}
+    /**
+     * Create an empty array
+     * @params:
+     *    - alloc: the allocator of the blocks of the array
+     */
+    CacheArray (Allocator & alloc = Allocator::instance ()) :
+      CacheArrayBase (alloc)
+    {}
 
     /**
      * Create a new array of a fixed size
+     * @params:
+     *    - alloc: the allocator of the blocks of the array
      */
-    CacheArray (uint32_t size) :
-      CacheArrayBase (size, sizeof (T))
+    CacheArray (uint64_t size, Allocator & alloc = Allocator::instance ()) :
+      CacheArrayBase (size, sizeof (T), alloc)
     {}
 
-    collection::CacheArray<T>::Slice slice (uint32_t start, uint32_t end) {
+    collection::CacheArray<T>::Slice slice (uint64_t start, uint64_t end) {
       return collection::CacheArray<T>::Slice (this, start, end - start);
     }
 
-    collection::CacheArray<T>::Puller puller (uint32_t start, T * buffer, uint32_t bufferSize) {
+    collection::CacheArray<T>::Puller puller (uint64_t start, T * buffer, uint32_t bufferSize) {
       return collection::CacheArray<T>::Puller (this, start, buffer, bufferSize);
     }
 
-    collection::CacheArray<T>::Pusher pusher (uint32_t start, T * buffer, uint32_t bufferSize) {
+    collection::CacheArray<T>::Pusher pusher (uint64_t start, T * buffer, uint32_t bufferSize) {
       return collection::CacheArray<T>::Pusher (this, start, buffer, bufferSize);
     }
 
     /**
-     * Access an element in the array as a lvalue
+     * Pin the block containing the element /i/ and access its elements without copy
+     * @params:
+     *    - i: the index of the first element of the span
+     *    - nb: the maximal number of elements in the span
+     *    - write: true if the elements are going to be modified through the span
+     * @returns: a span of at most /nb/ elements, shorter if the block ends before
      */
-    inline void set (uint32_t i, const T & val) {
-      uint32_t absolute = i;
+    collection::CacheArray<T>::Span pin (uint64_t i, uint32_t nb, bool write = true) {
       AllocatedSegment seg = this-> _rest;
-
-      int32_t index = absolute / (this-> _sizeDividePerBlock);
-      uint32_t offset = (absolute - (index * this-> _sizeDividePerBlock));
+      uint64_t index = block_index (i, this-> _sizeDividePerBlock);
+      uint32_t offset, avail;
 
       if (index < this-> _nbBlocks) {
         seg.blockAddr = index + this-> _fstBlockAddr;
         seg.offset = ALLOC_HEAD_SIZE;
-      } else if (this-> _sizeDividePerBlock == 1) {
-        offset = index;
+        offset = i - (index * this-> _sizeDividePerBlock);
+        avail = this-> _sizeDividePerBlock - offset;
+      } else {
+        offset = i - (this-> _nbBlocks * this-> _sizeDividePerBlock);
+        avail = this-> _size - i;
       }
 
-      Allocator::instance ().write (seg, &val, offset * sizeof (T), sizeof (T));
+      return this-> pinSegment (seg, offset, std::min (nb, avail), write);
     }
 
     /**
-     * Access an element in the array
+     * Access an element in the array as a lvalue
      */
-    inline T get (uint32_t i) const {
-      uint32_t absolute = i;
+    inline void set (uint64_t i, const T & val) {
+      uint64_t absolute = i;
       AllocatedSegment seg = this-> _rest;
 
-      int32_t index = absolute / (this-> _sizeDividePerBlock);
+      uint64_t index = block_index (absolute, this-> _sizeDividePerBlock);
       uint32_t offset = (absolute - (index * this-> _sizeDividePerBlock));
 
       if (index < this-> _nbBlocks) {
@@ -345,161 +607,138 @@ namespace rd_utils::memory::cache::collection {
         offset = index;
       }
 
-      char buffer [sizeof (T)];
-      Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T));
-      return *reinterpret_cast<T*> (buffer);
+      this-> _alloc-> write (seg, &val, offset * sizeof (T), sizeof (T));
     }
 
-    inline void setNb (uint32_t i, T * buffer, uint32_t nb) {
-      uint32_t absolute = i;
+    /**
+     * Access an element in the array
+     */
+    inline T get (uint64_t i) const {
+      uint64_t absolute = i;
       AllocatedSegment seg = this-> _rest;
 
-      int32_t index = absolute / (this-> _sizeDividePerBlock);
+      uint64_t index = block_index (absolute, this-> _sizeDividePerBlock);
       uint32_t offset = (absolute - (index * this-> _sizeDividePerBlock));
 
       if (index < this-> _nbBlocks) {
         seg.blockAddr = index + this-> _fstBlockAddr;
         seg.offset = ALLOC_HEAD_SIZE;
-
-        auto end = nb + offset;
-        if (end > this-> _sizeDividePerBlock) {
-          auto rest = end - this-> _sizeDividePerBlock;
-          nb = nb - rest;
-          Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-          setNb (i + nb, buffer + nb, rest);
-        } else {
-          Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-        }
-      } else {
-        if (this-> _sizeDividePerBlock == 1) {
-          offset = index;
-        }
-
-        Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
+      } else if (this-> _sizeDividePerBlock == 1) {
+        offset = index;
       }
-    }
-
-    inline void getNb (uint32_t i, T * buffer, uint32_t nb) const {
-      uint32_t absolute = i;
-      AllocatedSegment seg = this-> _rest;
-
-      int32_t index = absolute / (this-> _sizeDividePerBlock);
-      uint32_t offset = (absolute - (index * this-> _sizeDividePerBlock));
 
-      if (index < this-> _nbBlocks) {
-        seg.blockAddr = index + this-> _fstBlockAddr;
-        seg.offset = ALLOC_HEAD_SIZE;
+      char buffer [sizeof (T)];
+      this-> _alloc-> read (seg, buffer, offset * sizeof (T), sizeof (T));
+      return *reinterpret_cast<T*> (buffer);
+    }
 
-        auto end = nb + offset;
-        if (end > this-> _sizeDividePerBlock) {
-          auto rest = end - this-> _sizeDividePerBlock;
-          nb = nb - rest;
-          getNb (i + nb, buffer + nb, rest);
-        }
+    /**
+     * Write nb elements in the array
+     * @info: the pieces of the blocks crossed by the elements are written with a single writev
+     */
+    inline void setNb (uint64_t i, T * buffer, uint32_t nb) {
+      this-> writeNb (i, reinterpret_cast <uint8_t*> (buffer), nb);
+    }
 
-        Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-      } else {
-        if (this-> _sizeDividePerBlock == 1) {
-          offset = index;
-        }
-        Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-      }
+    /**
+     * Read nb elements of the array
+     * @info: the pieces of the blocks crossed by the elements are read with a single readv
+     */
+    inline void getNb (uint64_t i, T * buffer, uint32_t nb) const {
+      this-> readNb (i, reinterpret_cast <uint8_t*> (buffer), nb);
     }
 
     template <typename F>
-    void map (T * buffer, uint32_t bufferSize, F func) {
-      std::list <uint32_t> toLoad;
+    void map (F func) {
+      std::vector <uint64_t> toLoad;
       AllocatedSegment seg = {.blockAddr = 0, .offset = ALLOC_HEAD_SIZE};
-      for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
+      for (uint64_t i = 0 ; i < this-> _nbBlocks ; i++) {
         seg.blockAddr = this-> _fstBlockAddr + i;
-        if (Allocator::instance ().isLoaded (seg.blockAddr)) {
-          this-> mapBlock (seg, this-> _sizeDividePerBlock, buffer, bufferSize, func);
+        if (this-> _alloc-> isLoaded (seg.blockAddr)) {
+          this-> mapBlock (seg, this-> _sizeDividePerBlock, func);
         } else {
           toLoad.push_back (i);
         }
       }
 
+      this-> prefetchNext (toLoad, 0);
       auto globIndex = this-> _nbBlocks * this-> _sizeDividePerBlock;
-      this-> mapBlock (this-> _rest, this-> _size - globIndex, buffer, bufferSize, func);
-      for (auto & it : toLoad) {
-        seg.blockAddr = this-> _fstBlockAddr + it;
-        this-> mapBlock (seg, this-> _sizeDividePerBlock, buffer, bufferSize, func);
+      this-> mapBlock (this-> _rest, this-> _size - globIndex, func);
+      for (uint64_t k = 0 ; k < toLoad.size () ; k++) {
+        this-> prefetchNext (toLoad, k + 1);
+        seg.blockAddr = this-> _fstBlockAddr + toLoad [k];
+        this-> mapBlock (seg, this-> _sizeDividePerBlock, func);
       }
     }
 
     template <typename F>
-    void generate (T * buffer, uint32_t bufferSize, F func) {
-      std::list <uint32_t> toLoad;
+    void generate (F func) {
+      std::vector <uint64_t> toLoad;
       AllocatedSegment seg = {.blockAddr = 0, .offset = ALLOC_HEAD_SIZE};
       uint64_t globIndex = 0;
       auto div = this-> _sizeDividePerBlock;
 
-      for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
+      for (uint64_t i = 0 ; i < this-> _nbBlocks ; i++) {
         seg.blockAddr = this-> _fstBlockAddr + i;
-        if (Allocator::instance ().isLoaded (seg.blockAddr)) {
+        if (this-> _alloc-> isLoaded (seg.blockAddr)) {
           globIndex = i * div;
-          this-> generateBlock (seg, globIndex, div, buffer, bufferSize, func);
+          this-> generateBlock (seg, globIndex, div, func);
         } else {
           toLoad.push_back (i);
         }
       }
 
+      this-> prefetchNext (toLoad, 0);
       globIndex = this-> _nbBlocks * div;
-      this-> generateBlock (this-> _rest, globIndex, this-> _size - globIndex, buffer, bufferSize, func);
-      for (auto & it : toLoad) {
-        seg.blockAddr = this-> _fstBlockAddr + it;
-        globIndex = it * div;
-        this-> generateBlock (seg, globIndex, div, buffer, bufferSize, func);
+      this-> generateBlock (this-> _rest, globIndex, this-> _size - globIndex, func);
+      for (uint64_t k = 0 ; k < toLoad.size () ; k++) {
+        this-> prefetchNext (toLoad, k + 1);
+        seg.blockAddr = this-> _fstBlockAddr + toLoad [k];
+        globIndex = toLoad [k] * div;
+        this-> generateBlock (seg, globIndex, div, func);
       }
     }
 
     template <typename F, typename Z>
-    Z reduce (T * buffer, uint32_t bufferSize, F func, Z fst) {
+    Z reduce (F func, Z fst) {
       Z result = fst;
 
-      std::list <uint32_t> toLoad;
+      std::vector <uint64_t> toLoad;
       AllocatedSegment seg = {.blockAddr = 0, .offset = ALLOC_HEAD_SIZE};
       uint64_t globIndex = 0, read = 0;
-      for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
+      for (uint64_t i = 0 ; i < this-> _nbBlocks ; i++) {
         seg.blockAddr = this-> _fstBlockAddr + i;
-        if (Allocator::instance ().isLoaded (seg.blockAddr)) {
-          globIndex = i * (this-> _sizePerBlock / sizeof (T));
-          this-> reduceBlock (seg, globIndex, this-> _sizePerBlock / sizeof (T), result, buffer, bufferSize, func);
+        if (this-> _alloc-> isLoaded (seg.blockAddr)) {
+          this-> reduceBlock (seg, this-> _sizePerBlock / sizeof (T), result, func);
           read += (this-> _sizePerBlock / sizeof (T));
         } else {
-          toLoad.push_back (this-> _fstBlockAddr + i);
+          toLoad.push_back (i);
         }
       }
 
+      this-> prefetchNext (toLoad, 0);
       globIndex = this-> _nbBlocks * (this-> _sizePerBlock / sizeof (T));
-      this-> reduceBlock (this-> _rest, globIndex, this-> _size - (globIndex), result, buffer, bufferSize, func);
+      this-> reduceBlock (this-> _rest, this-> _size - (globIndex), result, func);
 
-      for (auto & it : toLoad) {
-        seg.blockAddr = it;
-        globIndex = it * (this-> _sizePerBlock / sizeof (T));
-        this-> reduceBlock (seg, globIndex, this-> _sizePerBlock / sizeof (T), result, buffer, bufferSize, func);
+      for (uint64_t k = 0 ; k < toLoad.size () ; k++) {
+        this-> prefetchNext (toLoad, k + 1);
+        seg.blockAddr = this-> _fstBlockAddr + toLoad [k];
+        this-> reduceBlock (seg, this-> _sizePerBlock / sizeof (T), result, func);
       }
 
       return result;
     }
 
     void copyRaw (collection::CacheArray<T> & aux) {
-      std::list <uint32_t> toLoad;
-      AllocatedSegment seg = {.blockAddr = 0, .offset = ALLOC_HEAD_SIZE};
-      for (uint32_t i = 0 ; i < this-> _nbBlocks ; i++) {
-        seg.blockAddr = this-> _fstBlockAddr + i;
-        auto auxSeg = aux._fstBlockAddr + i;
-        if (Allocator::instance ().isLoaded (seg.blockAddr) || Allocator::instance ().isLoaded (auxSeg)) {
-          Allocator::instance ().copy ({.blockAddr = auxSeg, .offset = seg.offset}, seg, this-> _sizePerBlock);
-        } else { toLoad.push_back (i); }
-      }
+      // the blocks are copied inside the allocator, they cannot cross allocators
+      if (aux._alloc != this-> _alloc) throw std::runtime_error ("Raw copy between arrays of different allocators");
 
-      Allocator::instance ().copy (aux._rest, this-> _rest, this-> _size * sizeof (T) - (this-> _nbBlocks * this-> _sizePerBlock));
-      for (auto & it : toLoad) {
-        seg.blockAddr = this-> _fstBlockAddr + it;
-        auto auxSeg = aux._fstBlockAddr + it;
-        Allocator::instance ().copy ({.blockAddr = auxSeg, .offset = seg.offset}, seg, this-> _sizePerBlock);
+      // the full blocks share the content of the blocks of aux (nothing is loaded), the data is copied on the first write to one of them
+      for (uint64_t i = 0 ; i < this-> _nbBlocks ; i++) {
+        this-> _alloc-> share (aux._fstBlockAddr + i, this-> _fstBlockAddr + i);
       }
+
+      this-> _alloc-> copy (aux._rest, this-> _rest, this-> _size * sizeof (T) - (this-> _nbBlocks * this-> _sizePerBlock));
     }
 
     bool equals (const std::vector <T> & vec, T * buffer, uint32_t nb) {
@@ -514,16 +753,28 @@ namespace rd_utils::memory::cache::collection {
       return true;
     }
 
-    inline void copy (uint32_t i, collection::CacheArray<T>::Slice aux, T * buffer, uint32_t bufferSize) {
+    inline void copy (uint64_t i, collection::CacheArray<T>::Slice aux, T * buffer, uint32_t bufferSize) {
       this-> copy (i, aux._context, aux._beg, std::min (aux._len, this-> _size - i), buffer, bufferSize);
     }
 
-    inline void copy (uint32_t i, collection::CacheArray<T>::Slice aux) {
+    inline void copy (uint64_t i, collection::CacheArray<T>::Slice aux) {
       this-> copy (i, aux._context, aux._beg, std::min (aux._len, this-> _size - i));
     }
 
   private :
 
+    /**
+     * Prefetch the blocks of /toLoad/ (block indexes) starting at /k/, according to the access hint
+     */
+    void prefetchNext (const std::vector <uint64_t> & toLoad, uint64_t k) const {
+      if (this-> _hint == AccessHint::RANDOM) return;
+
+      auto depth = this-> _hint == AccessHint::SEQUENTIAL ? PREFETCH_DEPTH : 1;
+      for (uint64_t j = k ; j < k + depth && j < toLoad.size () ; j++) {
+        this-> _alloc-> prefetch (this-> _fstBlockAddr + toLoad [j]);
+      }
+    }
+
     /**
      * Copy elements from the aux array into this array using a buffer to accelerate the copy and minimize the number of allocator access
      * @params:
@@ -533,15 +784,16 @@ namespace rd_utils::memory::cache::collection {
      *    - buffer: the buffer used to make the copy
      *    - bufferSize the size of the buffer used for the copy
      */
-    void copy (uint32_t i, collection::CacheArray<T> * aux, uint32_t j, uint32_t nb, T * buffer, uint32_t bufferSize) {
+    void copy (uint64_t i, collection::CacheArray<T> * aux, uint64_t j, uint64_t nb, T * buffer, uint32_t bufferSize) {
       if (bufferSize == 0 || bufferSize == 1) {
         this-> copy (i, aux, j, nb);
+        return;
       }
 
       auto aligned = (nb / bufferSize) * bufferSize;
       auto rest = nb - aligned;
 
-      for (uint32_t k = 0 ; k < aligned ; k += bufferSize) {
+      for (uint64_t k = 0 ; k < aligned ; k += bufferSize) {
         aux-> getNb (k + j, buffer, bufferSize);
         this-> setNb (k + i, buffer, bufferSize);
       }
@@ -559,47 +811,55 @@ namespace rd_utils::memory::cache::collection {
      *    - j: the index where to get the data (in aux)
      *    - nb: the number of elements to copy
      */
-    void copy (uint32_t i, collection::CacheArray<T> * aux, uint32_t j, uint32_t nb) {
-      for (uint32_t k = 0 ; k < nb ; k++) {
+    void copy (uint64_t i, collection::CacheArray<T> * aux, uint64_t j, uint64_t nb) {
+      for (uint64_t k = 0 ; k < nb ; k++) {
         this-> set (k + i, aux-> get (k + j));
       }
     }
 
+    /**
+     * Pin the elements of a segment
+     * @params:
+     *    - offset: the index of the first element in the segment
+     *    - nb: the number of elements of the span
+     */
+    collection::CacheArray<T>::Span pinSegment (AllocatedSegment seg, uint32_t offset, uint32_t nb, bool write) {
+      auto mem = this-> _alloc-> pin (seg.blockAddr, write);
+      auto data = reinterpret_cast <T*> (mem + seg.offset) + offset;
+      return collection::CacheArray<T>::Span (this-> _alloc, seg.blockAddr, mem, data, nb);
+    }
+
+    /**
+     * The elements of a block are mapped in place, the block is pinned for the whole loop (and unpinned if func throws)
+     */
     template <typename F>
-    void mapBlock (AllocatedSegment seg, uint32_t nbElements, T * buffer, uint32_t bufferSize, F func) {
-      for (uint32_t i = 0 ; i < nbElements ; i += bufferSize) {
-        auto nb = nbElements - i > bufferSize ? bufferSize : nbElements - i;
-        Allocator::instance ().read (seg, buffer,  i * sizeof (T), sizeof (T) * nb);
-        for (uint32_t j = 0 ; j < nb ; j++) {
-          buffer [j] = func (buffer [j]);
-        }
+    void mapBlock (AllocatedSegment seg, uint32_t nbElements, F func) {
+      if (nbElements == 0) return;
 
-        Allocator::instance ().write (seg, buffer,  i * sizeof (T), sizeof (T) * nb);
+      auto span = this-> pinSegment (seg, 0, nbElements, true);
+      for (uint32_t j = 0 ; j < nbElements ; j++) {
+        span [j] = func (span [j]);
       }
     }
 
     template <typename F>
-    void generateBlock (AllocatedSegment seg, uint64_t globIndex, uint32_t nbElements, T * buffer, uint32_t bufferSize, F func) {
-      for (uint32_t i = 0 ; i < nbElements ; i += bufferSize) {
-        auto nb = nbElements - i > bufferSize ? bufferSize : nbElements - i;
+    void generateBlock (AllocatedSegment seg, uint64_t globIndex, uint32_t nbElements, F func) {
+      if (nbElements == 0) return;
 
-        for (uint32_t j = 0 ; j < nb ; j++) {
-          buffer [j] = func (globIndex  + i + j);
-        }
-
-        Allocator::instance ().write (seg, buffer,  i * sizeof (T), sizeof (T) * nb);
+      auto span = this-> pinSegment (seg, 0, nbElements, true);
+      for (uint32_t j = 0 ; j < nbElements ; j++) {
+        span [j] = func (globIndex + j);
       }
     }
 
     template <typename Z, typename F>
-    void reduceBlock (AllocatedSegment seg, uint64_t globIndex, uint32_t nbElements, Z & result, T * buffer, uint32_t bufferSize, F func) {
-      for (uint32_t i = 0 ; i < nbElements ; i += bufferSize) {
-        auto nb = (nbElements - i) > bufferSize ? bufferSize : (nbElements - i);
+    void reduceBlock (AllocatedSegment seg, uint32_t nbElements, Z & result, F func) {
+      if (nbElements == 0) return;
 
-        Allocator::instance ().read (seg, buffer,  i * sizeof (T), sizeof (T) * nb);
-        for (uint64_t j = 0 ; j < nb ; j++) {
-          result = func (result, buffer [j]);
-        }
+      auto span = this-> pinSegment (seg, 0, nbElements, false);
+      const T * data = span.data ();
+      for (uint32_t j = 0 ; j < nbElements ; j++) {
+        result = func (result, data [j]);
       }
     }
 
@@ -612,7 +872,7 @@ std::ostream& operator << (std::ostream & s, rd_utils::memory::cache::collection
   uint32_t BLK_SIZE = 8192;
   T * buffer = new T [BLK_SIZE];
   auto len = array.len ();
-  uint32_t i = 0;
+  uint64_t i = 0;
   auto p = array.puller (0, buffer, BLK_SIZE);
   s << "[";
   p.next ();
@@ -10,8 +10,14 @@ namespace rd_utils::memory::cache::collection {
   class CacheBox {
   private:
 
+    // The allocator of the box
+    Allocator * _alloc;
+
     AllocatedSegment _segment;
 
+    // The registration of the segment in the compactor of the allocator
+    uint64_t _ticket;
+
   private:
 
     CacheBox (const CacheBox& other);
@@ -24,26 +30,32 @@ namespace rd_utils::memory::cache::collection {
      * @params:
      *    - allocator: the allocator used to allocate the box
      */
-    CacheBox ()
+    CacheBox (Allocator & allocator = Allocator::instance ()) :
+      _alloc (&allocator)
     {
-      if (!Allocator::instance ().allocate (sizeof (T), this-> _segment)) {
+      // small boxes are carved from the magazine of the thread, without taking the allocator lock
+      if (!this-> _alloc-> allocateSmall (sizeof (T), this-> _segment)) {
         LOG_ERROR ("Failed to allocate box");
         exit (-1);
       }
+
+      // the box is neither copied nor moved, the compactor can relocate its segment
+      this-> _ticket = this-> _alloc-> track (&this-> _segment, sizeof (T));
     }
 
     void write (const T& t) {
-      Allocator::instance ().write (this-> _segment, &t, 0, sizeof (T));
+      this-> _alloc-> write (this-> _segment, &t, 0, sizeof (T));
     }
 
     T read () {
       T t;
-      Allocator::instance ().read (this-> _segment, &t, 0, sizeof (T));
+      this-> _alloc-> read (this-> _segment, &t, 0, sizeof (T));
       return t;
     }
 
     ~CacheBox () {
-      Allocator::instance ().free (this-> _segment);
+      this-> _alloc-> untrack (this-> _ticket);
+      this-> _alloc-> freeSmall (this-> _segment, sizeof (T));
       this-> _segment = {0};
     }
 
@@ -2,25 +2,27 @@
 
 namespace rd_utils::memory::cache::collection {
 
-  ArrayListBase::ArrayListBase () :
-    _metadata ()
+  ArrayListBase::ArrayListBase (Allocator & alloc) :
+    _alloc (&alloc)
+    , _metadata ()
     , _size (0)
     , _innerSize (0)
     , _allocable (0)
   {}
 
-  ArrayListBase::ArrayListBase (uint32_t nbBlocks, uint32_t innerSize) :
-    _metadata ()
+  ArrayListBase::ArrayListBase (uint32_t nbBlocks, uint32_t innerSize, Allocator & alloc) :
+    _alloc (&alloc)
+    , _metadata ()
     , _size (0)
     , _innerSize (innerSize)
     , _allocable (0)
   {
     while (nbBlocks > this-> _metadata.size ()) this-> grow ();
-    auto all = Allocator::instance ().getMaxAllocable () - sizeof (uint32_t);
+    auto all = this-> _alloc-> getMaxAllocable () - sizeof (uint32_t);
     this-> _allocable = (all - (all % innerSize)) / innerSize;
   }
 
-  uint32_t ArrayListBase::len () const {
+  uint64_t ArrayListBase::len () const {
     return this-> _size;
   }
 
@@ -28,42 +30,65 @@ namespace rd_utils::memory::cache::collection {
     return this-> _metadata.size ();
   }
 
+  void ArrayListBase::advise (AccessHint hint, uint64_t beg, uint64_t end) {
+    if (hint == AccessHint::NORMAL || hint == AccessHint::SEQUENTIAL || hint == AccessHint::RANDOM) {
+      this-> _hint = hint;
+      return;
+    }
+
+    if (end > this-> _size) end = this-> _size;
+    if (beg >= end) return;
+
+    for (auto index = beg / this-> _allocable ; index <= (end - 1) / this-> _allocable ; index++) {
+      if (hint == AccessHint::WILLNEED) {
+        this-> _alloc-> prefetch (this-> _metadata [index]);
+      } else {
+        this-> _alloc-> evict (this-> _metadata [index]);
+      }
+    }
+  }
+
+  void ArrayListBase::readAhead (uint64_t index) const {
+    if (this-> _hint == AccessHint::RANDOM) return;
+
+    uint32_t depth = this-> _hint == AccessHint::SEQUENTIAL ? PREFETCH_DEPTH : 1;
+    for (uint64_t j = index + 1 ; j <= index + depth && j < this-> _metadata.size () ; j++) {
+      this-> _alloc-> prefetch (this-> _metadata [j]);
+    }
+  }
+
   ArrayListBase::~ArrayListBase () {
     this-> dispose ();
   }
 
   void ArrayListBase::send (net::TcpStream & stream, uint32_t bufferSize) {
-    uint32_t nbInBuffer = bufferSize / this-> _innerSize;
+    uint32_t nbInBuffer = std::max (bufferSize / this-> _innerSize, (uint32_t) 1);
     uint8_t * buffer = new uint8_t [nbInBuffer * this-> _innerSize];
-    stream.sendU32 (this-> _size);
+    stream.sendU64 (this-> _size);
     stream.sendU32 (this-> _innerSize);
 
-    for (auto bl : this-> _metadata) {
-      AllocatedSegment seg = {.blockAddr = bl, .offset = ALLOC_HEAD_SIZE};
-      this-> sendBlock (stream, seg, this-> _allocable, buffer, nbInBuffer);
-    }
-  }
-
-  void ArrayListBase::sendBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer) {
-    for (uint32_t i = 0 ; i < nbElements ;) {
-      auto nb = (nbElements - i) > nbInBuffer ? nbInBuffer : (nbElements - i);
-      Allocator::instance ().read (seg, buffer,  i * this-> _innerSize, nb * this-> _innerSize);
+    // every allocated block is sent entirely, a buffer crossing the end of a block is filled by a single readv
+    uint64_t capacity = this-> _metadata.size () * (uint64_t) this-> _allocable;
+    for (uint64_t i = 0 ; i < capacity ;) {
+      uint32_t nb = std::min ((uint64_t) nbInBuffer, capacity - i);
+      this-> readNb (i, buffer, nb);
       stream.sendRaw (buffer, nb * this-> _innerSize);
 
       i += nb;
     }
-  }
 
+    delete [] buffer;
+  }
 
   void ArrayListBase::grow () {
     AllocatedSegment seg;
-    Allocator::instance ().allocate (this-> _allocable, seg, true, false);
+    this-> _alloc-> allocate (this-> _allocable * this-> _innerSize, seg, true);
     this-> _metadata.push_back (seg.blockAddr);
   }
 
   void ArrayListBase::dispose () {
     for (auto & it : this-> _metadata) {
-      Allocator::instance ().freeFast (it);
+      this-> _alloc-> freeFast (it);
     }
 
     this-> _metadata.clear ();
@@ -11,11 +11,14 @@ namespace rd_utils::memory::cache::collection {
   class ArrayListBase {
   protected:
 
+    // The allocator of the blocks of the list
+    Allocator * _alloc;
+
     // List of allocated blocks
-    std::vector<uint32_t> _metadata;
+    std::vector<uint64_t> _metadata;
 
     // The number of elements actually contained in the array
-    uint32_t _size;
+    uint64_t _size;
 
     // The size of an element
     uint32_t _innerSize;
@@ -23,31 +26,51 @@ namespace rd_utils::memory::cache::collection {
     // The number of element in each blocks
     uint32_t _allocable;
 
+    // The way the list is going to be accessed
+    AccessHint _hint = AccessHint::NORMAL;
+
   protected:
 
     ArrayListBase (ArrayListBase * other);
     void move (ArrayListBase * other);
 
-    ArrayListBase ();
+    ArrayListBase (Allocator & alloc = Allocator::instance ());
 
   public:
 
     /**
      * @params:
      *    - nbBlocks: number of blocks to pre allocate
+     *    - alloc: the allocator of the blocks of the list
      */
-    ArrayListBase (uint32_t nbBlocks, uint32_t innerSize);
+    ArrayListBase (uint32_t nbBlocks, uint32_t innerSize, Allocator & alloc = Allocator::instance ());
 
     /**
      * @returns: the number of elements stored in the array
      */
-    uint32_t len () const;
+    uint64_t len () const;
 
     /**
      * @returns: the number of blocks stored in the array
      */
     uint32_t nbBlocks () const;
 
+    /**
+     * Give a hint on the way the list is going to be accessed
+     * @info:
+     * ======
+     * SEQUENTIAL and RANDOM change the read ahead of the pullers,
+     * WILLNEED and DONTNEED apply immediately to the blocks containing
+     * the elements [beg, end)
+     * ======
+     */
+    void advise (AccessHint hint, uint64_t beg = 0, uint64_t end = UINT64_MAX);
+
+    /**
+     * Prefetch the blocks following the block /index/, according to the access hint
+     */
+    void readAhead (uint64_t index) const;
+
     void send (net::TcpStream & stream, uint32_t bufferSize);
 
     /**
@@ -67,7 +90,67 @@ namespace rd_utils::memory::cache::collection {
      */
     void dispose ();
 
-    void sendBlock (net::TcpStream & stream, AllocatedSegment seg, uint32_t nbElements, uint8_t * buffer, uint32_t nbInBuffer);
+    /**
+     * Locate the elements [i, i + nb) in the blocks of the list
+     * @params:
+     *    - buffer: the memory of the elements outside of the list
+     * @returns:
+     *    - vec: the piece of the elements in the block of the element /i/
+     *    - the number of elements of the piece (the piece stops at the end of the block)
+     * @throws: if the block of /i/ is not allocated
+     */
+    inline uint32_t piece (uint64_t i, uint8_t * buffer, uint32_t nb, IoVec & vec) const {
+      uint64_t index = block_index (i, this-> _allocable);
+      uint32_t offset = (i - (index * this-> _allocable));
+
+      if (index >= this-> _metadata.size ()) throw std::runtime_error ("Out of bounds");
+
+      vec.seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
+      if (nb > this-> _allocable - offset) nb = this-> _allocable - offset;
+
+      vec.offset = offset * this-> _innerSize;
+      vec.size = nb * this-> _innerSize;
+      vec.data = buffer;
+      return nb;
+    }
+
+    /**
+     * Read the elements [i, i + nb) into buffer, the allocator is accessed once for IOV_BATCH blocks
+     */
+    inline void readNb (uint64_t i, uint8_t * buffer, uint32_t nb) const {
+      IoVec vecs [IOV_BATCH];
+      uint32_t n = 0;
+      while (nb != 0) {
+        auto len = this-> piece (i, buffer, nb, vecs [n++]);
+        i += len;
+        nb -= len;
+        buffer += len * this-> _innerSize;
+
+        if (n == IOV_BATCH || nb == 0) {
+          this-> _alloc-> readv (vecs, n);
+          n = 0;
+        }
+      }
+    }
+
+    /**
+     * Write the elements of buffer into [i, i + nb), the allocator is accessed once for IOV_BATCH blocks
+     */
+    inline void writeNb (uint64_t i, uint8_t * buffer, uint32_t nb) {
+      IoVec vecs [IOV_BATCH];
+      uint32_t n = 0;
+      while (nb != 0) {
+        auto len = this-> piece (i, buffer, nb, vecs [n++]);
+        i += len;
+        nb -= len;
+        buffer += len * this-> _innerSize;
+
+        if (n == IOV_BATCH || nb == 0) {
+          this-> _alloc-> writev (vecs, n);
+          n = 0;
+        }
+      }
+    }
   };
 
   template <typename T>
@@ -77,19 +160,21 @@ namespace rd_utils::memory::cache::collection {
     private:
 
       collection::CacheArrayList<T> * _context;
-      uint32_t _beg;
+      uint64_t _beg;
       uint32_t _i;
       T* _buffer;
       uint32_t _bufferSize;
+      uint64_t _ahead;
 
     public:
 
-      Puller (CacheArrayList<T> * context, uint32_t i, T * buffer, uint32_t bufferSize) :
+      Puller (CacheArrayList<T> * context, uint64_t i, T * buffer, uint32_t bufferSize) :
         _context (context)
         , _beg (i)
         , _i (bufferSize - 1)
         , _buffer (buffer)
         , _bufferSize (bufferSize)
+        , _ahead (UINT64_MAX)
       {}
 
       const T& current () {
@@ -108,8 +193,16 @@ namespace rd_utils::memory::cache::collection {
     private:
 
       bool retreive () {
-        auto read = std::min (this-> _bufferSize, this-> _context-> len () - this-> _beg);
+        uint32_t read = std::min ((uint64_t) this-> _bufferSize, this-> _context-> len () - this-> _beg);
         if (read == 0) return false;
+
+        // the next blocks are loaded while this one is consumed
+        auto index = block_index (this-> _beg, this-> _context-> _allocable);
+        if (index != this-> _ahead) {
+          this-> _ahead = index;
+          this-> _context-> readAhead (index);
+        }
+
         this-> _context-> getNb (this-> _beg, this-> _buffer, read);
         this-> _beg += read;
         this-> _bufferSize = read;
@@ -123,14 +216,14 @@ namespace rd_utils::memory::cache::collection {
     private:
 
       collection::CacheArrayList<T> * _context;
-      uint32_t _beg;
+      uint64_t _beg;
       uint32_t _i;
       T * _buffer;
       uint32_t _bufferSize;
 
     public:
 
-      Pusher (collection::CacheArrayList<T> * context, uint32_t i, T * buffer, uint32_t bufferSize) :
+      Pusher (collection::CacheArrayList<T> * context, uint64_t i, T * buffer, uint32_t bufferSize) :
         _context (context)
         , _beg (i)
         , _i (0)
@@ -179,39 +272,43 @@ namespace rd_utils::memory::cache::collection {
       this-> move (&other);
     }
 
-    CacheArrayList () :
-      ArrayListBase (0, sizeof (T))
+    /**
+     * @params:
+     *    - alloc: the allocator of the blocks of the list
+     */
+    CacheArrayList (Allocator & alloc = Allocator::instance ()) :
+      ArrayListBase (0, sizeof (T), alloc)
     {}
 
     /**
      * Create an array puller to read the array sequentially
      */
-    collection::CacheArrayList<T>::Puller puller (uint32_t start, T * buffer, uint32_t bufferSize) {
+    collection::CacheArrayList<T>::Puller puller (uint64_t start, T * buffer, uint32_t bufferSize) {
       return collection::CacheArrayList<T>::Puller (this, start, buffer, bufferSize);
     }
 
-    collection::CacheArrayList<T>::Pusher pusher (uint32_t start, T * buffer, uint32_t bufferSize) {
+    collection::CacheArrayList<T>::Pusher pusher (uint64_t start, T * buffer, uint32_t bufferSize) {
       return collection::CacheArrayList<T>::Pusher (this, start, buffer, bufferSize);
     }
 
     /**
      * Write an element in the array
      */
-    inline void set (uint32_t i, const T & val) {
-      int32_t index = i / this-> _allocable;
+    inline void set (uint64_t i, const T & val) {
+      uint64_t index = block_index (i, this-> _allocable);
       uint32_t offset = (i - (index * this-> _allocable));
 
       if (index >= this-> _metadata.size ()) std::runtime_error ("Out of bounds");
 
       AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
-      Allocator::instance ().write (seg, &val, offset * sizeof (T), sizeof (T));
+      this-> _alloc-> write (seg, &val, offset * sizeof (T), sizeof (T));
     }
 
     /**
      * Read an element in the array
      */
-    inline void get (uint32_t i, const T & val) {
-      int32_t index = i / this-> _allocable;
+    inline T get (uint64_t i) {
+      uint64_t index = block_index (i, this-> _allocable);
       uint32_t offset = (i - (index * this-> _allocable));
 
       if (index >= this-> _metadata.size ()) throw std::runtime_error ("Out of bounds");
@@ -219,7 +316,7 @@ namespace rd_utils::memory::cache::collection {
       AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
 
       char buffer [sizeof (T)];
-      Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T));
+      this-> _alloc-> read (seg, buffer, offset * sizeof (T), sizeof (T));
       return *reinterpret_cast <T*> (buffer);
     }
 
@@ -231,21 +328,8 @@ namespace rd_utils::memory::cache::collection {
      *    - buffer: the buffer used to write
      *    - nb: the number of elements contained in the buffer (assuming buffer can contains at least /nb/ * sizeof (T))
      */
-    inline void setNb (uint32_t i, T * buffer, uint32_t nb) {
-      uint32_t index = i / this-> _allocable;
-      uint32_t offset = (i - (index * this-> _allocable));
-
-      if (index >= this-> _metadata.size ()) std::runtime_error ("Out of bounds");
-      AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
-      auto end = nb + offset;
-      if (end > this-> _allocable) {
-        auto rest = end - this-> _allocable;
-        nb = nb - rest;
-        Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-        setNb (i + nb, buffer + nb, rest);
-      } else {
-        Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-      }
+    inline void setNb (uint64_t i, T * buffer, uint32_t nb) {
+      this-> writeNb (i, reinterpret_cast <uint8_t*> (buffer), nb);
     }
 
     /**
@@ -254,7 +338,7 @@ namespace rd_utils::memory::cache::collection {
      *   - val: the value to write at the end of the array
      */
     inline void push (const T & val) {
-      uint32_t index = this-> _size / this-> _allocable;
+      uint64_t index = block_index (this-> _size, this-> _allocable);
       uint32_t offset = (this-> _size - (index * this-> _allocable));
 
       if (index >= this-> _metadata.size ()) {
@@ -263,13 +347,13 @@ namespace rd_utils::memory::cache::collection {
 
       this-> _size += 1;
       AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
-      Allocator::instance ().write (seg, &val, offset * sizeof (T), sizeof (T));
+      this-> _alloc-> write (seg, &val, offset * sizeof (T), sizeof (T));
     }
 
     /**
      * Push or overwrite nb elements in the array
      */
-    inline void pushOrSetNb (uint32_t i, T * buffer, uint32_t nb) {
+    inline void pushOrSetNb (uint64_t i, T * buffer, uint32_t nb) {
       if (i < this-> _size) {
         uint32_t before = this-> _size - i > nb ? nb : this-> _size - i;
         uint32_t after = nb - before;
@@ -287,26 +371,13 @@ namespace rd_utils::memory::cache::collection {
      *    - nb: the number of elements contained in the buffer (assuming buffer can contains at least /nb/ * sizeof (T))
      */
     inline void pushNb (T * buffer, uint32_t nb) {
-      uint32_t index = this-> _size / this-> _allocable;
-      uint32_t offset = (this-> _size - (index * this-> _allocable));
-
-      if (index >= this-> _metadata.size ()) {
+      // the blocks are allocated first, so all the pieces are written by a single writev
+      while (this-> _metadata.size () * (uint64_t) this-> _allocable < this-> _size + nb) {
         this-> grow ();
       }
 
-      AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
-      auto end = nb + offset;
-      if (end > this-> _allocable) {
-        auto rest = end - this-> _allocable;
-        nb = nb - rest;
-        this-> _size += nb;
-
-        Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-        pushNb (buffer + nb, rest);
-      } else {
-        this-> _size += nb;
-        Allocator::instance ().write (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-      }
+      this-> writeNb (this-> _size, reinterpret_cast <uint8_t*> (buffer), nb);
+      this-> _size += nb;
     }
 
     /**
@@ -316,22 +387,8 @@ namespace rd_utils::memory::cache::collection {
      *    - buffer: the buffer used to read
      *    - nb: the number of elements to read (assuming buffer can contains at least /nb/ * sizeof (T))
      */
-    inline void getNb (uint32_t i, T * buffer, uint32_t nb) {
-      uint32_t index = i / this-> _allocable;
-      uint32_t offset = (i - (index * this-> _allocable));
-
-      if (index >= this-> _metadata.size ()) throw std::runtime_error ("Out of bounds");
-
-      AllocatedSegment seg = {.blockAddr = this-> _metadata [index], .offset = ALLOC_HEAD_SIZE};
-      auto end = nb + offset;
-      if (end > this-> _allocable) {
-        auto rest = end - this-> _allocable;
-        nb = nb - rest;
-        Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-        getNb (i + nb, buffer + nb, rest);
-      } else {
-        Allocator::instance ().read (seg, buffer, offset * sizeof (T), sizeof (T) * nb);
-      }
+    inline void getNb (uint64_t i, T * buffer, uint32_t nb) {
+      this-> readNb (i, reinterpret_cast <uint8_t*> (buffer), nb);
     }
 
   };
@@ -342,8 +399,8 @@ template <typename T>
 std::ostream& operator<< (std::ostream & s, rd_utils::memory::cache::collection::CacheArrayList<T> & array) {
   uint32_t BLK_SIZE = 8192 / sizeof (T);
   T * buffer = new T [BLK_SIZE];
-  uint32_t len = array.len ();
-  uint32_t i = 0;
+  uint64_t len = array.len ();
+  uint64_t i = 0;
   auto p = array.puller (0, buffer, BLK_SIZE);
   s << "[";
   p.next ();
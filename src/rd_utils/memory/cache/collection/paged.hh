@@ -0,0 +1,93 @@
+#pragma once
+
+#include <rd_utils/memory/cache/paged.hh>
+#include "array.hh"
+
+namespace rd_utils::memory::cache::collection {
+
+  /**
+   * A cache array seen as a plain contiguous array of T
+   * @info:
+   * ======
+   * The elements are accessed through a pointer, so pointer based code
+   * (std::sort, vectorized loops) runs on the array without copying it
+   * in a buffer first. The pages are read from the array on the first
+   * access, at most maxChunks chunks of PAGED_CHUNK_SIZE bytes are
+   * mapped at the same time (see PagedRegion).
+   *
+   * The writes through the view reach the array when the view is
+   * synced, when their chunk is evicted, and when the view is destroyed.
+   * While the view is open the array should only be modified through
+   * the view (or invalidate must be called after modifying the array),
+   * and the memory of the view must not be given to the methods of the
+   * array or of its allocator
+   * ======
+   */
+  template <typename T>
+  class PagedArray : public PagedRegion {
+  private:
+
+    // The viewed array
+    CacheArray<T> * _array;
+
+  private:
+
+    PagedArray (const PagedArray<T> &);
+    void operator= (const PagedArray<T> &);
+
+  public:
+
+    /**
+     * @params:
+     *    - array: the viewed array
+     *    - maxChunks: the maximum number of chunks mapped at the same time
+     *    - userfault: try userfaultfd before falling back to signals
+     */
+    PagedArray (CacheArray<T> & array, uint32_t maxChunks = PAGED_MAX_CHUNKS, bool userfault = true) :
+      PagedRegion (array.len () * sizeof (T), maxChunks, userfault)
+      , _array (&array)
+    {}
+
+    /**
+     * @returns: the elements of the array
+     */
+    T * data () const {
+      return reinterpret_cast <T*> (PagedRegion::data ());
+    }
+
+    T * begin () const {
+      return this-> data ();
+    }
+
+    T * end () const {
+      return this-> data () + this-> _array-> len ();
+    }
+
+    uint64_t len () const {
+      return this-> _array-> len ();
+    }
+
+    T & operator[] (uint64_t i) const {
+      return this-> data () [i];
+    }
+
+    /**
+     * Write back the modified elements and release the view
+     */
+    ~PagedArray () {
+      this-> close ();
+    }
+
+  protected:
+
+    void readRange (uint64_t offset, uint8_t * data, uint64_t size) override {
+      this-> _array-> readBytes (offset, data, size);
+    }
+
+    void writeRange (uint64_t offset, const uint8_t * data, uint64_t size) override {
+      this-> _array-> writeBytes (offset, data, size);
+    }
+
+  };
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include <rd_utils/memory/cache/shared.hh>
+#include "array.hh"
+
+namespace rd_utils::memory::cache::collection {
+
+  /**
+   * A read-only array published in a shared block cache
+   * @info:
+   * ======
+   * The array is written once to the block file of the cache
+   * (publish), then every process attached to the cache can open it by
+   * name and read it, the blocks read by one process are resident for
+   * the others. An element never crosses two blocks.
+   * ======
+   */
+  template <typename T>
+  class SharedArray {
+  private:
+
+    // The cache of the array
+    SharedBlockCache * _cache;
+
+    // The blocks of the array in the block file
+    SharedArrayInfo _info;
+
+    // The number of elements in a block
+    uint32_t _perBlock;
+
+  public:
+
+    /**
+     * Open a published array
+     * @throws: if no array of this name was published, or if its elements are not T
+     */
+    SharedArray (SharedBlockCache & cache, const std::string & name) :
+      _cache (&cache)
+    {
+      if (!cache.find (name, this-> _info)) throw std::runtime_error ("No shared array named : " + name);
+      if (this-> _info.elemSize != sizeof (T)) throw std::runtime_error ("Shared array of a different type : " + name);
+
+      this-> _perBlock = cache.getBlockSize () / sizeof (T);
+    }
+
+    /**
+     * Publish the content of a cache array
+     * @throws: if the name is already used
+     */
+    static void publish (SharedBlockCache & cache, const std::string & name, const CacheArray<T> & array) {
+      auto info = cache.reserve (name, sizeof (T), array.len ());
+      uint32_t perBlock = cache.getBlockSize () / sizeof (T);
+
+      std::vector <uint8_t> buffer (perBlock * sizeof (T));
+      for (uint64_t b = 0 ; b < info.nbBlocks ; b++) {
+        uint64_t nb = std::min ((uint64_t) perBlock, array.len () - b * perBlock);
+        array.readBytes (b * perBlock * sizeof (T), buffer.data (), nb * sizeof (T));
+        cache.store (info.fstBlock + b, buffer.data (), nb * sizeof (T));
+      }
+
+      cache.commit (name);
+    }
+
+    /**
+     * Publish the content of a buffer
+     * @throws: if the name is already used
+     */
+    static void publish (SharedBlockCache & cache, const std::string & name, const T * data, uint64_t len) {
+      auto info = cache.reserve (name, sizeof (T), len);
+      uint32_t perBlock = cache.getBlockSize () / sizeof (T);
+
+      for (uint64_t b = 0 ; b < info.nbBlocks ; b++) {
+        uint64_t nb = std::min ((uint64_t) perBlock, len - b * perBlock);
+        cache.store (info.fstBlock + b, reinterpret_cast <const uint8_t*> (data + b * perBlock), nb * sizeof (T));
+      }
+
+      cache.commit (name);
+    }
+
+    /**
+     * @returns: the number of elements in the array
+     */
+    inline uint64_t len () const {
+      return this-> _info.len;
+    }
+
+    /**
+     * @returns: the element at index i
+     */
+    inline T get (uint64_t i) const {
+      T result;
+      this-> _cache-> read (this-> _info.fstBlock + i / this-> _perBlock, (i % this-> _perBlock) * sizeof (T), &result, sizeof (T));
+      return result;
+    }
+
+    /**
+     * Read the elements [i, i + nb) in buffer
+     */
+    void getNb (uint64_t i, T * buffer, uint64_t nb) const {
+      while (nb != 0) {
+        uint64_t inBlock = i % this-> _perBlock;
+        uint64_t read = std::min (nb, this-> _perBlock - inBlock);
+        this-> _cache-> read (this-> _info.fstBlock + i / this-> _perBlock, inBlock * sizeof (T), buffer, read * sizeof (T));
+
+        buffer += read;
+        i += read;
+        nb -= read;
+      }
+    }
+
+  };
+
+}
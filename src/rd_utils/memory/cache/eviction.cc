@@ -0,0 +1,363 @@
+#include "eviction.hh"
+#include <stdexcept>
+
+namespace rd_utils::memory::cache {
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================    BLOCK LIST    =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void BlockList::pushFront (uint64_t addr) {
+    this-> _list.push_front (addr);
+    this-> _pos.emplace (addr, this-> _list.begin ());
+  }
+
+  void BlockList::moveFront (uint64_t addr) {
+    auto it = this-> _pos.find (addr);
+    if (it != this-> _pos.end ()) {
+      this-> _list.splice (this-> _list.begin (), this-> _list, it-> second);
+    }
+  }
+
+  uint64_t BlockList::popBack () {
+    if (this-> _list.empty ()) return 0;
+
+    auto addr = this-> _list.back ();
+    this-> _list.pop_back ();
+    this-> _pos.erase (addr);
+
+    return addr;
+  }
+
+  bool BlockList::erase (uint64_t addr) {
+    auto it = this-> _pos.find (addr);
+    if (it == this-> _pos.end ()) return false;
+
+    this-> _list.erase (it-> second);
+    this-> _pos.erase (it);
+    return true;
+  }
+
+  bool BlockList::contains (uint64_t addr) const {
+    return this-> _pos.find (addr) != this-> _pos.end ();
+  }
+
+  uint32_t BlockList::size () const {
+    return this-> _list.size ();
+  }
+
+  void BlockList::clear () {
+    this-> _list.clear ();
+    this-> _pos.clear ();
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ===============================    POLICY    ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void EvictionPolicy::resize (uint32_t capacity) {
+    this-> _capacity = capacity;
+  }
+
+  EvictionPolicy * EvictionPolicy::create (EvictionPolicyKind kind, uint32_t capacity) {
+    EvictionPolicy * result = nullptr;
+    switch (kind) {
+    case EvictionPolicyKind::LRU : result = new LruPolicy (); break;
+    case EvictionPolicyKind::CLOCK : result = new ClockPolicy (); break;
+    case EvictionPolicyKind::TWO_Q : result = new TwoQPolicy (); break;
+    case EvictionPolicyKind::ARC : result = new ArcPolicy (); break;
+    default :
+      throw std::runtime_error ("Unknown eviction policy");
+    }
+
+    result-> resize (capacity);
+    return result;
+  }
+
+  void EvictionPolicy::markLoaded (uint64_t addr) {
+    this-> _recent [this-> _recentHead] = addr;
+    this-> _recentHead = (this-> _recentHead + 1) % CORRELATED_WINDOW;
+  }
+
+  bool EvictionPolicy::correlated (uint64_t addr) const {
+    for (uint32_t i = 0 ; i < CORRELATED_WINDOW ; i++) {
+      if (this-> _recent [i] == addr) return true;
+    }
+
+    return false;
+  }
+
+  EvictionPolicy::~EvictionPolicy () {}
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =================================    LRU    ================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void LruPolicy::onLoad (uint64_t addr) {
+    this-> _blocks.pushFront (addr);
+    this-> _referenced [addr].store (0, std::memory_order_relaxed);
+  }
+
+  void LruPolicy::onAccess (uint64_t addr) {
+    // the map is only modified under the exclusive lock of the allocator, the hits only read it
+    auto it = this-> _referenced.find (addr);
+    if (it != this-> _referenced.end ()) {
+      it-> second.store (1, std::memory_order_relaxed);
+    }
+  }
+
+  void LruPolicy::onRemove (uint64_t addr) {
+    this-> _blocks.erase (addr);
+    this-> _referenced.erase (addr);
+  }
+
+  uint64_t LruPolicy::evict () {
+    // the blocks hit since they were last moved are moved to the front now, in the order of the list
+    for (;;) {
+      auto addr = this-> _blocks.popBack ();
+      if (addr == 0) return 0;
+
+      auto it = this-> _referenced.find (addr);
+      if (it != this-> _referenced.end () && it-> second.load (std::memory_order_relaxed) != 0) {
+        it-> second.store (0, std::memory_order_relaxed);
+        this-> _blocks.pushFront (addr);
+        continue;
+      }
+
+      this-> _referenced.erase (addr);
+      return addr;
+    }
+  }
+
+  void LruPolicy::reinsert (uint64_t addr) {
+    this-> onLoad (addr);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ================================    CLOCK    ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void ClockPolicy::onLoad (uint64_t addr) {
+    uint32_t slot;
+    if (this-> _free.size () != 0) {
+      slot = this-> _free.back ();
+      this-> _free.pop_back ();
+    } else {
+      slot = this-> _ring.size ();
+      this-> _ring.emplace_back ();
+    }
+
+    // The reference bit is set, a block that was just loaded is about to be used
+    this-> _ring [slot].addr = addr;
+    this-> _ring [slot].ref = 1;
+    this-> _slots.emplace (addr, slot);
+  }
+
+  void ClockPolicy::onAccess (uint64_t addr) {
+    auto it = this-> _slots.find (addr);
+    if (it != this-> _slots.end ()) {
+      this-> _ring [it-> second].ref.store (1, std::memory_order_relaxed);
+    }
+  }
+
+  void ClockPolicy::onRemove (uint64_t addr) {
+    auto it = this-> _slots.find (addr);
+    if (it != this-> _slots.end ()) {
+      this-> _ring [it-> second].addr = 0;
+      this-> _free.push_back (it-> second);
+      this-> _slots.erase (it);
+    }
+  }
+
+  uint64_t ClockPolicy::evict () {
+    if (this-> _slots.size () == 0) return 0;
+
+    // at most two turns, the first one clears the reference bits
+    for (;;) {
+      if (this-> _hand >= this-> _ring.size ()) this-> _hand = 0;
+      auto & slot = this-> _ring [this-> _hand];
+      this-> _hand += 1;
+
+      if (slot.addr == 0) continue;
+      if (slot.ref.load (std::memory_order_relaxed) != 0) {
+        slot.ref.store (0, std::memory_order_relaxed);
+        continue;
+      }
+
+      auto addr = slot.addr;
+      this-> onRemove (addr);
+      return addr;
+    }
+  }
+
+  void ClockPolicy::reinsert (uint64_t addr) {
+    this-> onLoad (addr);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =================================    2Q    =================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  uint32_t TwoQPolicy::kin () const {
+    return std::max (1u, this-> _capacity / 4);
+  }
+
+  uint32_t TwoQPolicy::kout () const {
+    return std::max (1u, this-> _capacity / 2);
+  }
+
+  void TwoQPolicy::onLoad (uint64_t addr) {
+    this-> markLoaded (addr);
+    if (this-> _a1out.erase (addr)) { // accessed again shortly after its eviction, it is a hot block
+      this-> _am.pushFront (addr);
+    } else {
+      this-> _a1in.pushFront (addr);
+    }
+  }
+
+  void TwoQPolicy::onAccess (uint64_t addr) {
+    WITH_LOCK (this-> _m) {
+      // correlated hits in a1in are ignored, references of a single scan must not promote the block
+      if (this-> _a1in.contains (addr)) {
+        if (!this-> correlated (addr)) {
+          this-> _a1in.erase (addr);
+          this-> _am.pushFront (addr);
+        }
+      } else {
+        this-> _am.moveFront (addr);
+      }
+    }
+  }
+
+  void TwoQPolicy::onRemove (uint64_t addr) {
+    if (!this-> _a1in.erase (addr)) {
+      if (!this-> _am.erase (addr)) {
+        this-> _a1out.erase (addr);
+      }
+    }
+  }
+
+  uint64_t TwoQPolicy::evict () {
+    if (this-> _a1in.size () > this-> kin () || this-> _am.size () == 0) {
+      auto addr = this-> _a1in.popBack ();
+      if (addr != 0) {
+        this-> _a1out.pushFront (addr);
+        while (this-> _a1out.size () > this-> kout ()) {
+          this-> _a1out.popBack ();
+        }
+
+        return addr;
+      }
+    }
+
+    return this-> _am.popBack ();
+  }
+
+  void TwoQPolicy::reinsert (uint64_t addr) {
+    // a block evicted from a1in was remembered as a ghost, it is not a hot block
+    if (this-> _a1out.erase (addr)) {
+      this-> _a1in.pushFront (addr);
+    } else {
+      this-> _am.pushFront (addr);
+    }
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =================================    ARC    ================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void ArcPolicy::onLoad (uint64_t addr) {
+    this-> markLoaded (addr);
+    auto c = this-> _capacity;
+    if (this-> _b1.erase (addr)) { // recency was undersized
+      auto delta = std::max (1u, this-> _b2.size () / std::max (1u, this-> _b1.size () + 1));
+      this-> _p = std::min (c, this-> _p + delta);
+      this-> _t2.pushFront (addr);
+    } else if (this-> _b2.erase (addr)) { // frequency was undersized
+      auto delta = std::max (1u, this-> _b1.size () / std::max (1u, this-> _b2.size () + 1));
+      this-> _p = this-> _p > delta ? this-> _p - delta : 0;
+      this-> _t2.pushFront (addr);
+    } else {
+      this-> _t1.pushFront (addr);
+    }
+
+    // the directory never remembers more than 2c blocks, and l1 never more than c
+    while (this-> _t1.size () + this-> _b1.size () > c && this-> _b1.size () != 0) {
+      this-> _b1.popBack ();
+    }
+
+    while (this-> _t1.size () + this-> _t2.size () + this-> _b1.size () + this-> _b2.size () > 2 * c && this-> _b2.size () != 0) {
+      this-> _b2.popBack ();
+    }
+  }
+
+  void ArcPolicy::onAccess (uint64_t addr) {
+    WITH_LOCK (this-> _m) {
+      if (this-> _t1.contains (addr)) {
+        if (!this-> correlated (addr)) {
+          this-> _t1.erase (addr);
+          this-> _t2.pushFront (addr);
+        }
+      } else {
+        this-> _t2.moveFront (addr);
+      }
+    }
+  }
+
+  void ArcPolicy::onRemove (uint64_t addr) {
+    if (this-> _t1.erase (addr)) return;
+    if (this-> _t2.erase (addr)) return;
+    if (this-> _b1.erase (addr)) return;
+    this-> _b2.erase (addr);
+  }
+
+  uint64_t ArcPolicy::evict () {
+    if (this-> _t1.size () != 0 && (this-> _t1.size () > this-> _p || this-> _t2.size () == 0)) {
+      auto addr = this-> _t1.popBack ();
+      this-> _b1.pushFront (addr);
+      return addr;
+    }
+
+    auto addr = this-> _t2.popBack ();
+    if (addr != 0) {
+      this-> _b2.pushFront (addr);
+    }
+
+    return addr;
+  }
+
+  void ArcPolicy::reinsert (uint64_t addr) {
+    // the block goes back to the list it was evicted from, the target size of t1 does not move
+    if (this-> _b1.erase (addr)) {
+      this-> _t1.pushFront (addr);
+    } else {
+      this-> _b2.erase (addr);
+      this-> _t2.pushFront (addr);
+    }
+  }
+
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <rd_utils/concurrency/mutex.hh>
+
+namespace rd_utils::memory::cache {
+
+// The number of last loaded blocks whose hits are considered as correlated references (same scan)
+#define CORRELATED_WINDOW 4
+
+        /**
+         * The replacement policies that can be used by the allocator to select the blocks to evict
+         */
+        enum class EvictionPolicyKind : uint32_t {
+                LRU = 1,
+                CLOCK,
+                TWO_Q,
+                ARC
+        };
+
+        /**
+         * A list of block addresses with O(1) insertion, removal and move to front
+         */
+        class BlockList {
+        private:
+
+                // The blocks (front is the most recent)
+                std::list <uint64_t> _list;
+
+                // The position of the blocks in the list
+                std::unordered_map <uint64_t, std::list <uint64_t>::iterator> _pos;
+
+        public:
+
+                /**
+                 * Insert a block at the front of the list
+                 */
+                void pushFront (uint64_t addr);
+
+                /**
+                 * Move a block already in the list to the front
+                 */
+                void moveFront (uint64_t addr);
+
+                /**
+                 * Remove the last block of the list
+                 * @returns: the removed block, 0 if the list is empty
+                 */
+                uint64_t popBack ();
+
+                /**
+                 * Remove a block from the list
+                 * @returns: true if the block was in the list
+                 */
+                bool erase (uint64_t addr);
+
+                /**
+                 * @returns: true if the block is in the list
+                 */
+                bool contains (uint64_t addr) const;
+
+                /**
+                 * @returns: the number of blocks in the list
+                 */
+                uint32_t size () const;
+
+                /**
+                 * Remove all the blocks
+                 */
+                void clear ();
+
+        };
+
+        /**
+         * Policy selecting the resident blocks to evict
+         * @info:
+         * ======
+         * onAccess can be called concurrently from many threads (under the
+         * shared allocator lock), every other method is called by the
+         * allocator under its exclusive lock
+         * ======
+         */
+        class EvictionPolicy {
+        public:
+
+                /**
+                 * A block was loaded (or created) into memory
+                 */
+                virtual void onLoad (uint64_t addr) = 0;
+
+                /**
+                 * A resident block was accessed
+                 */
+                virtual void onAccess (uint64_t addr) = 0;
+
+                /**
+                 * A block was freed, forget everything about it
+                 */
+                virtual void onRemove (uint64_t addr) = 0;
+
+                /**
+                 * Select the next block to evict, and stop tracking it as resident
+                 * @returns: the address of the block, 0 if there is no resident block
+                 */
+                virtual uint64_t evict () = 0;
+
+                /**
+                 * A block returned by evict stays resident (it is pinned), put it back with the resident blocks
+                 * @info: this is not a new load, the block is not counted as a hit of the ghosts the eviction put it in
+                 */
+                virtual void reinsert (uint64_t addr) = 0;
+
+                /**
+                 * Change the number of blocks that can be resident at the same time
+                 */
+                virtual void resize (uint32_t capacity);
+
+                /**
+                 * Create a policy
+                 * @params:
+                 *    - kind: the kind of policy to create
+                 *    - capacity: the number of blocks that can be resident at the same time
+                 */
+                static EvictionPolicy * create (EvictionPolicyKind kind, uint32_t capacity);
+
+                virtual ~EvictionPolicy ();
+
+        protected:
+
+                // The number of blocks that can be resident at the same time
+                uint32_t _capacity = 0;
+
+                // The last loaded blocks
+                uint64_t _recent [CORRELATED_WINDOW] = {0};
+
+                // The next insertion in _recent
+                uint32_t _recentHead = 0;
+
+        protected:
+
+                /**
+                 * Register a block as recently loaded
+                 */
+                void markLoaded (uint64_t addr);
+
+                /**
+                 * @returns: true if the block was among the last loaded blocks
+                 * @info:
+                 * ======
+                 * a block is accessed many times in a row right after its
+                 * load (one access per element), those hits do not mean the
+                 * block is used frequently
+                 * ======
+                 */
+                bool correlated (uint64_t addr) const;
+
+        };
+
+        /**
+         * Least recently used
+         * @info:
+         * ======
+         * hits only set a reference bit so they never take a lock, a
+         * referenced block is moved to the front of the list when the
+         * eviction reaches it (under the exclusive lock of the allocator)
+         * ======
+         */
+        class LruPolicy : public EvictionPolicy {
+        private:
+
+                BlockList _blocks;
+
+                // The reference bit of each resident block (set by the hits since the block was last moved to the front)
+                std::unordered_map <uint64_t, std::atomic<uint8_t> > _referenced;
+
+        public:
+
+                void onLoad (uint64_t addr) override;
+                void onAccess (uint64_t addr) override;
+                void onRemove (uint64_t addr) override;
+                uint64_t evict () override;
+                void reinsert (uint64_t addr) override;
+
+        };
+
+        /**
+         * Second chance, accesses only set a reference bit so hits never take a lock
+         */
+        class ClockPolicy : public EvictionPolicy {
+        private:
+
+                struct Slot {
+                        uint64_t addr;
+                        std::atomic<uint8_t> ref;
+                };
+
+                // The ring of blocks (addr == 0 for free slots)
+                std::deque <Slot> _ring;
+
+                // The slot of each resident block
+                std::unordered_map <uint64_t, uint32_t> _slots;
+
+                // The free slots of the ring
+                std::vector <uint32_t> _free;
+
+                // The position of the clock hand
+                uint32_t _hand = 0;
+
+        public:
+
+                void onLoad (uint64_t addr) override;
+                void onAccess (uint64_t addr) override;
+                void onRemove (uint64_t addr) override;
+                uint64_t evict () override;
+                void reinsert (uint64_t addr) override;
+
+        };
+
+        /**
+         * 2Q (Johnson & Shasha), blocks accessed only once stay in a FIFO and are evicted before the frequently used ones
+         */
+        class TwoQPolicy : public EvictionPolicy {
+        private:
+
+                concurrency::mutex _m;
+
+                // Resident blocks seen once
+                BlockList _a1in;
+
+                // Resident blocks seen more than once
+                BlockList _am;
+
+                // Ghosts of the blocks evicted from a1in
+                BlockList _a1out;
+
+        public:
+
+                void onLoad (uint64_t addr) override;
+                void onAccess (uint64_t addr) override;
+                void onRemove (uint64_t addr) override;
+                uint64_t evict () override;
+                void reinsert (uint64_t addr) override;
+
+        private:
+
+                uint32_t kin () const;
+                uint32_t kout () const;
+
+        };
+
+        /**
+         * Adaptive replacement cache (Megiddo & Modha), balances recency and frequency using ghost hits
+         */
+        class ArcPolicy : public EvictionPolicy {
+        private:
+
+                concurrency::mutex _m;
+
+                // Resident blocks seen once recently
+                BlockList _t1;
+
+                // Resident blocks seen at least twice recently
+                BlockList _t2;
+
+                // Ghosts of the blocks evicted from t1
+                BlockList _b1;
+
+                // Ghosts of the blocks evicted from t2
+                BlockList _b2;
+
+                // The target size of t1
+                uint32_t _p = 0;
+
+        public:
+
+                void onLoad (uint64_t addr) override;
+                void onAccess (uint64_t addr) override;
+                void onRemove (uint64_t addr) override;
+                uint64_t evict () override;
+                void reinsert (uint64_t addr) override;
+
+        };
+
+}
@@ -4,209 +4,322 @@
 
 namespace rd_utils::memory::cache {
 
-  void free_list_create (free_list_instance * memory, uint32_t total_size) {
-    memset (memory, 0, total_size);
-    memory-> total_size = total_size - sizeof (free_list_instance);
-    memory-> head = sizeof (free_list_instance);
-    free_list_node * head = reinterpret_cast<free_list_node*> (reinterpret_cast <uint8_t*> (memory) + sizeof (free_list_instance));
+#define FREE_BIT 1
+#define PREV_FREE_BIT 2
+#define FLAGS_MASK 7
 
-    head-> size = total_size - sizeof (free_list_instance);
-    head-> next = 0;
+  // A free segment needs the header, the two links and the boundary tag
+#define MIN_SEGMENT_SIZE 16
 
-    /*
-    //                       /---------------------\
-    //                       |                     v
-    // | total_size 4B | memory 8B | head 8B | -> | offset 4B | size 4B  | next 8B | ... |
-    //                                 \-------------^
-    */
-  }
+  static_assert (sizeof (free_list_instance) % (1 << FREE_LIST_ALIGN_LOG2) == sizeof (uint32_t), "free list header must keep the payloads aligned");
 
-  bool free_list_find_best_fit (const free_list_instance * inst, uint32_t size, uint32_t & offset, uint32_t & prevOffset) {
-    auto memory = reinterpret_cast <const uint8_t*> (inst);
-    uint32_t nodeOffset = inst-> head;
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ===============================    MAPPING   ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
 
-    uint32_t prev = 0;
-    auto min_found = inst-> total_size + 1;
-    bool found = false;
+  static inline uint32_t msb (uint32_t x) {
+    return 31 - __builtin_clz (x);
+  }
 
-    while (nodeOffset != 0) {
-      auto node = reinterpret_cast <const free_list_node*> (memory + nodeOffset);
-      if (node-> size >= size && (min_found > node-> size || !found)) {
-        offset = nodeOffset;
-        prevOffset = prev;
-        min_found = node-> size;
-        found = true;
-      }
+  static inline uint32_t lsb (uint32_t x) {
+    return __builtin_ctz (x);
+  }
 
-      prev = nodeOffset;
-      nodeOffset = node-> next;
+  /**
+   * @returns: the class (fl, sl) containing segments of size /size/
+   */
+  static inline void mapping_insert (uint32_t size, uint32_t & fl, uint32_t & sl) {
+    if (size < (1 << FREE_LIST_FL_SHIFT)) {
+      fl = 0;
+      sl = size >> FREE_LIST_ALIGN_LOG2;
+    } else {
+      auto m = msb (size);
+      fl = m - FREE_LIST_FL_SHIFT + 1;
+      sl = (size >> (m - FREE_LIST_SL_LOG2)) ^ (1 << FREE_LIST_SL_LOG2);
     }
-
-    return found;
   }
 
-  bool free_list_allocate_inner (free_list_instance * inst, uint32_t & size, uint32_t & offset) {
-    uint8_t * memory = reinterpret_cast <uint8_t*> (inst);
-    uint32_t prevOffset = 0, nodeOffset = 0;
-    if (!free_list_find_best_fit (inst, size, nodeOffset, prevOffset)) { return false; }
+  /**
+   * @returns: the first class whose segments are all big enough for /size/
+   */
+  static inline void mapping_search (uint32_t size, uint32_t & fl, uint32_t & sl) {
+    if (size >= (1 << FREE_LIST_FL_SHIFT)) {
+      uint64_t rounded = (uint64_t) size + (1 << (msb (size) - FREE_LIST_SL_LOG2)) - 1;
+      if (rounded > UINT32_MAX) rounded = UINT32_MAX;
+      size = rounded;
+    }
 
-    auto node = reinterpret_cast<free_list_node*> (memory + nodeOffset);
-    free_list_node* previous = nullptr;
-    if (prevOffset != 0) { previous = reinterpret_cast <free_list_node*> (memory + prevOffset); }
+    mapping_insert (size, fl, sl);
+  }
 
-    offset = nodeOffset;
-    auto restSize = (node-> size - size);
-    if (restSize > sizeof (free_list_node)) { // create a new node at the given offset
-      uint32_t newNodeOffset = nodeOffset + size;
-      free_list_node * new_node = reinterpret_cast <free_list_node*> (memory + newNodeOffset);
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ===============================    SEGMENTS   ==============================
+   * ============================================================================
+   * ============================================================================
+   * */
 
-      new_node-> size = restSize;
-      new_node-> next = node-> next;
+  static inline free_list_node * node_at (free_list_instance * inst, uint32_t offset) {
+    return reinterpret_cast <free_list_node*> (reinterpret_cast <uint8_t*> (inst) + offset);
+  }
 
-      if (previous) {
-        previous-> next = newNodeOffset;
-      } else {
-        inst-> head = newNodeOffset;
-      }
+  static inline uint32_t & tag_of (free_list_instance * inst, uint32_t offset, uint32_t size) {
+    return *reinterpret_cast <uint32_t*> (reinterpret_cast <uint8_t*> (inst) + offset + size - sizeof (uint32_t));
+  }
 
-      return true;
-    } else { // not enough size to create a node, use it all
-      size = node-> size;
-      if (previous) {
-        previous-> next = node-> next;
-      } else {
-        inst-> head = node-> next;
-      }
+  static inline uint32_t end_of (const free_list_instance * inst) {
+    return sizeof (free_list_instance) + inst-> total_size;
+  }
 
-      return true;
-    }
+  static inline uint32_t size_of (const free_list_node * node) {
+    return node-> size & ~FLAGS_MASK;
   }
 
-  uint32_t free_list_real_size (uint32_t size) {
-    uint32_t reqSize = size + sizeof (uint32_t);
-    if (reqSize < sizeof (free_list_node)) reqSize = sizeof (free_list_node);
-    return reqSize;
+  /**
+   * Approximate the biggest free segment from the highest non empty class
+   * @info: the segments of a class are not sorted, the first one is a lower bound of the biggest (exact to the width of the class)
+   */
+  static void update_max_free (free_list_instance * inst) {
+    inst-> max_free = 0;
+    if (inst-> fl_bitmap == 0) return;
+
+    auto fl = msb (inst-> fl_bitmap);
+    auto sl = msb (inst-> sl_bitmap [fl]);
+    inst-> max_free = size_of (node_at (inst, inst-> heads [fl][sl]));
   }
 
-  bool free_list_allocate (free_list_instance * inst, uint32_t size, uint32_t & offset) {
-    uint8_t * memory = reinterpret_cast <uint8_t*> (inst);
-    uint32_t reqSize = free_list_real_size (size);
+  /**
+   * @returns: an upper bound of the biggest free segment, the last size of the highest non empty class
+   */
+  static uint32_t max_free_bound (const free_list_instance * inst) {
+    if (inst-> fl_bitmap == 0) return 0;
+
+    auto fl = msb (inst-> fl_bitmap);
+    auto sl = msb (inst-> sl_bitmap [fl]);
+    if (fl == 0) return ((sl + 1) << FREE_LIST_ALIGN_LOG2) - 1;
 
-    if (free_list_allocate_inner (inst, reqSize, offset)) {
-      *reinterpret_cast<uint32_t*> (memory + offset) = reqSize;
-      offset += sizeof (uint32_t);
+    auto m = fl + FREE_LIST_FL_SHIFT - 1;
+    uint64_t last = ((uint64_t) 1 << m) + ((uint64_t) (sl + 1) << (m - FREE_LIST_SL_LOG2)) - 1;
+    return last > UINT32_MAX ? UINT32_MAX : last;
+  }
+
+  static void insert_free (free_list_instance * inst, uint32_t offset) {
+    auto node = node_at (inst, offset);
+    auto size = size_of (node);
+    uint32_t fl, sl;
+    mapping_insert (size, fl, sl);
 
-      return true;
+    node-> prev = 0;
+    node-> next = inst-> heads [fl][sl];
+    if (node-> next != 0) {
+      node_at (inst, node-> next)-> prev = offset;
     }
 
-    return false;
+    inst-> heads [fl][sl] = offset;
+    inst-> fl_bitmap |= (1 << fl);
+    inst-> sl_bitmap [fl] |= (1 << sl);
+
+    tag_of (inst, offset, size) = size;
+    if (size > inst-> max_free) inst-> max_free = size;
   }
 
-  bool free_list_free_inner (free_list_instance * inst, uint32_t offset, uint32_t size) {
-    uint8_t * memory = reinterpret_cast <uint8_t*> (inst);
-    uint32_t nodeOffset = inst-> head, prevOffset = 0;
-    free_list_node* prev = nullptr;
+  static void remove_free (free_list_instance * inst, uint32_t offset) {
+    auto node = node_at (inst, offset);
+    auto size = size_of (node);
+    uint32_t fl, sl;
+    mapping_insert (size, fl, sl);
 
-    if (nodeOffset == 0) {
-      inst-> head = offset;
-      auto head = reinterpret_cast <free_list_node*> (memory + offset);
+    if (node-> prev != 0) {
+      node_at (inst, node-> prev)-> next = node-> next;
+    } else {
+      inst-> heads [fl][sl] = node-> next;
+    }
 
-      head-> size = size;
-      head-> next = 0;
-      return true;
+    if (node-> next != 0) {
+      node_at (inst, node-> next)-> prev = node-> prev;
     }
 
-    while (nodeOffset != 0) {
-      auto node = reinterpret_cast <free_list_node*> (memory + nodeOffset);
-      if (nodeOffset + node-> size == offset) { // freeing the block just after the node
-        node-> size += size;
+    if (inst-> heads [fl][sl] == 0) {
+      inst-> sl_bitmap [fl] &= ~(1 << sl);
+      if (inst-> sl_bitmap [fl] == 0) {
+        inst-> fl_bitmap &= ~(1 << fl);
+      }
+    }
+
+    if (size >= inst-> max_free) update_max_free (inst);
+  }
+
+  /**
+   * Set or clear the PREV_FREE flag of the segment following /offset/
+   */
+  static inline void mark_next (free_list_instance * inst, uint32_t offset, uint32_t size, bool free) {
+    auto next = offset + size;
+    if (next < end_of (inst)) {
+      auto node = node_at (inst, next);
+      if (free) node-> size |= PREV_FREE_BIT;
+      else node-> size &= ~PREV_FREE_BIT;
+    }
+  }
 
-        // the current free block is touching the next element
-        if (node-> next == (nodeOffset + node-> size)) {
-          auto next = reinterpret_cast <free_list_node*> (memory + node-> next);
-          node-> size += next-> size; // fusionning them
-          node-> next = next-> next;
+  /**
+   * @returns: a free segment of at least /size/ bytes, 0 if there is none
+   */
+  static uint32_t find_free (free_list_instance * inst, uint32_t size) {
+    uint32_t fl, sl;
+    mapping_search (size, fl, sl);
+
+    if (fl < FREE_LIST_FL_COUNT) {
+      auto slMap = inst-> sl_bitmap [fl] & (~0u << sl);
+      if (slMap == 0) {
+        auto flMap = (fl + 1 < 32) ? (inst-> fl_bitmap & (~0u << (fl + 1))) : 0;
+        if (flMap != 0) {
+          fl = lsb (flMap);
+          slMap = inst-> sl_bitmap [fl];
         }
+      }
 
-        return true;
+      if (slMap != 0) {
+        return inst-> heads [fl][lsb (slMap)];
       }
+    }
 
-      if (nodeOffset > offset) { // we past the offset of the block to free
-        auto newNodeOffset = offset;
-        auto new_node = reinterpret_cast <free_list_node*> (memory + offset);
-        new_node-> size = size;
-
-        if (prev) { // between two nodes
-          new_node-> next = nodeOffset;
-          prev-> next = newNodeOffset;
-        } else { // between the beginning and the head
-          new_node-> next = nodeOffset;
-          inst-> head = newNodeOffset;
-        }
+    // No class is guaranteed to fit, but the class of the size may contain a segment big enough
+    mapping_insert (size, fl, sl);
+    auto offset = inst-> heads [fl][sl];
+    while (offset != 0) {
+      auto node = node_at (inst, offset);
+      if (size_of (node) >= size) return offset;
+      offset = node-> next;
+    }
 
-        // Touching new node and next
-        if (new_node-> next != 0 && newNodeOffset + new_node-> size == new_node-> next) {
-          auto next = reinterpret_cast<free_list_node*> (memory + new_node-> next);
-          new_node-> size += next-> size;
-          new_node-> next = next-> next;
-        }
+    return 0;
+  }
 
-        if (prev && prevOffset + prev-> size == newNodeOffset) {
-          auto next = reinterpret_cast<free_list_node*> (memory + new_node-> next);
-          prev-> size += new_node-> size;
-          prev-> next = next-> next;
-        }
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ================================    PUBLIC   ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
 
-        return true;
-      }
+  void free_list_create (free_list_instance * memory, uint32_t total_size) {
+    // every byte read by the list is written here or when a segment is split, the segments do not need to be zeroed
+    memset (memory, 0, sizeof (free_list_instance));
+    auto area = (total_size - sizeof (free_list_instance)) & ~((1 << FREE_LIST_ALIGN_LOG2) - 1);
+    memory-> total_size = area;
 
-      // last node, but the offset is past it
-      if (node-> next == 0 && nodeOffset + node-> size < offset) {
-        auto newNodeOffset = offset;
-        auto new_node = reinterpret_cast <free_list_node*> (memory + offset);
+    /*
+    // | header | seg (size | flags) | ... | seg | ... |
+    //              ^                           ^
+    //          sizeof (header)         sizeof (header) + total_size
+    */
+    auto head = node_at (memory, sizeof (free_list_instance));
+    head-> size = area | FREE_BIT;
+    insert_free (memory, sizeof (free_list_instance));
+  }
 
-        new_node-> size = size;
-        new_node-> next = 0;
-        node-> next = newNodeOffset;
+  uint32_t free_list_real_size (uint32_t size) {
+    uint64_t reqSize = (uint64_t) size + sizeof (uint32_t);
+    reqSize = (reqSize + (1 << FREE_LIST_ALIGN_LOG2) - 1) & ~((uint64_t) (1 << FREE_LIST_ALIGN_LOG2) - 1);
+    if (reqSize < MIN_SEGMENT_SIZE) reqSize = MIN_SEGMENT_SIZE;
+    if (reqSize > UINT32_MAX) return UINT32_MAX;
 
-        return true;
-      }
+    return reqSize;
+  }
 
-      prev = node;
-      prevOffset = nodeOffset;
-      nodeOffset = node-> next;
+  bool free_list_allocate (free_list_instance * inst, uint32_t size, uint32_t & offset) {
+    auto reqSize = free_list_real_size (size);
+    // max_free is only a lower bound, a request above it can still fit in the highest class
+    if (reqSize > inst-> max_free && reqSize > max_free_bound (inst)) return false;
+
+    auto nodeOffset = find_free (inst, reqSize);
+    if (nodeOffset == 0) return false;
+
+    remove_free (inst, nodeOffset);
+    auto node = node_at (inst, nodeOffset);
+    auto nodeSize = size_of (node);
+    auto flags = node-> size & PREV_FREE_BIT;
+
+    if (nodeSize - reqSize >= MIN_SEGMENT_SIZE) { // split, the rest stays free
+      auto restOffset = nodeOffset + reqSize;
+      node_at (inst, restOffset)-> size = (nodeSize - reqSize) | FREE_BIT;
+      insert_free (inst, restOffset);
+
+      node-> size = reqSize | flags;
+    } else { // not enough size to create a segment, use it all
+      node-> size = nodeSize | flags;
+      mark_next (inst, nodeOffset, nodeSize, false);
     }
 
-    return false;
+    inst-> used_size += size_of (node);
+    offset = nodeOffset + sizeof (uint32_t);
+    return true;
   }
 
   bool free_list_free (free_list_instance * inst, uint32_t offset) {
-    uint8_t * memory = reinterpret_cast <uint8_t*> (inst);
-    auto size = *reinterpret_cast<uint32_t*> (memory + (offset - sizeof (uint32_t)));
-    auto ret = free_list_free_inner (inst, offset - sizeof (uint32_t), size);
+    uint32_t nodeOffset = offset - sizeof (uint32_t);
+    auto node = node_at (inst, nodeOffset);
+    if (node-> size & FREE_BIT) return false;
+
+    auto size = size_of (node);
+    inst-> used_size -= size;
+
+    // merging with the previous segment, its size is in the boundary tag just before the segment
+    if (node-> size & PREV_FREE_BIT) {
+      auto prevSize = *reinterpret_cast <uint32_t*> (reinterpret_cast <uint8_t*> (inst) + nodeOffset - sizeof (uint32_t));
+      auto prevOffset = nodeOffset - prevSize;
+      remove_free (inst, prevOffset);
+
+      nodeOffset = prevOffset;
+      size += prevSize;
+      node = node_at (inst, nodeOffset);
+    }
+
+    // merging with the next segment
+    auto nextOffset = nodeOffset + size;
+    if (nextOffset < end_of (inst)) {
+      auto next = node_at (inst, nextOffset);
+      if (next-> size & FREE_BIT) {
+        auto nextSize = size_of (next);
+        remove_free (inst, nextOffset);
+        size += nextSize;
+      }
+    }
 
-    return ret;
+    // the segment before a free segment is always used (segments are merged), so the only flag is free
+    node-> size = size | FREE_BIT;
+    insert_free (inst, nodeOffset);
+    mark_next (inst, nodeOffset, size, true);
+
+    return true;
+  }
+
+  uint32_t free_list_segment_size (const free_list_instance * inst, uint32_t offset) {
+    auto node = reinterpret_cast <const free_list_node*> (reinterpret_cast <const uint8_t*> (inst) + offset - sizeof (uint32_t));
+    return size_of (node);
   }
 
   bool free_list_empty (free_list_instance * inst) {
-    if (inst-> head == sizeof (free_list_instance)) {
-      auto head = reinterpret_cast <free_list_node*> (reinterpret_cast <uint8_t*> (inst) + inst-> head);
-      return  head-> size == inst-> total_size;
-    }
-    return false;
+    auto head = node_at (inst, sizeof (free_list_instance));
+    return (head-> size & FREE_BIT) && size_of (head) == inst-> total_size;
   }
 
   uint32_t free_list_max_size (const free_list_instance * inst) {
-    auto memory = reinterpret_cast <const uint8_t*> (inst);
-    auto nodeOffset = inst-> head;
-    uint32_t max = 0;
-    while (nodeOffset != 0) {
-      auto node = reinterpret_cast <const free_list_node *> (memory + nodeOffset);
-      if (node-> size - sizeof (uint32_t) > max) max = node-> size - sizeof (uint32_t);
-      nodeOffset = node-> next;
-    }
+    if (inst-> max_free < sizeof (uint32_t)) return 0;
+    return inst-> max_free - sizeof (uint32_t);
+  }
 
-    return max;
+  uint32_t free_list_capacity (uint32_t total_size) {
+    if (total_size < sizeof (free_list_instance) + MIN_SEGMENT_SIZE) return 0;
+
+    auto area = (total_size - sizeof (free_list_instance)) & ~((1 << FREE_LIST_ALIGN_LOG2) - 1);
+    return area - sizeof (uint32_t);
   }
 
 }
@@ -215,12 +328,20 @@ std::ostream & operator<<(std::ostream & s, const rd_utils::memory::cache::free_
   auto memory = reinterpret_cast <const uint8_t*> (&inst);
   s << "LIST{";
   int i = 0;
-  auto nodeOffset = inst.head;
-  while (nodeOffset != 0) {
-    auto node = reinterpret_cast <const rd_utils::memory::cache::free_list_node *> (memory + nodeOffset);
-    if (i != 0) { s << ", "; i += 1; }
-    s << "(" << nodeOffset << "," << nodeOffset + node-> size << ")";
-    nodeOffset = node-> next;
+  uint32_t offset = sizeof (rd_utils::memory::cache::free_list_instance);
+  uint32_t end = offset + inst.total_size;
+  while (offset < end) {
+    auto node = reinterpret_cast <const rd_utils::memory::cache::free_list_node *> (memory + offset);
+    auto size = node-> size & ~FLAGS_MASK;
+    if (size == 0) break;
+
+    if (node-> size & FREE_BIT) {
+      if (i != 0) { s << ", "; }
+      s << "(" << offset << "," << offset + size << ")";
+      i += 1;
+    }
+
+    offset += size;
   }
   s << "}";
   return s;
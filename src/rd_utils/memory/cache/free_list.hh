@@ -4,14 +4,65 @@
 
 namespace rd_utils::memory::cache {
 
+  /**
+   * Two-Level Segregated Fit allocator stored inside a block of memory
+   * @info:
+   * ======
+   * Everything (bitmaps, list heads and links) is stored as offsets
+   * relative to the beginning of the block, so a block can be persisted
+   * and reloaded as raw bytes at another address.
+   *
+   * Every physical segment starts with a 4B header (size | flags), free
+   * segments also store their free list links, and their size at the end
+   * of the segment (boundary tag), used to merge with the previous segment
+   *
+   * The header of the list ends 4B after an 8B boundary, so segments start
+   * right after it and the payloads (after the segment header) are 8B aligned
+   * ======
+   */
+
+  // The granularity of the segment sizes (log2)
+#define FREE_LIST_ALIGN_LOG2 3
+
+  // The number of second level classes per first level class (log2)
+#define FREE_LIST_SL_LOG2 3
+
+#define FREE_LIST_SL_COUNT (1 << FREE_LIST_SL_LOG2)
+
+  // Sizes smaller than 1 << FREE_LIST_FL_SHIFT are all stored in the first first level class
+#define FREE_LIST_FL_SHIFT (FREE_LIST_SL_LOG2 + FREE_LIST_ALIGN_LOG2)
+
+#define FREE_LIST_FL_COUNT (32 - FREE_LIST_FL_SHIFT + 1)
+
   struct free_list_node {
+    // The size of the segment (with header), and the flags in the lower bits
     uint32_t size;
+
+    // The next free segment of the same class
     uint32_t next;
+
+    // The previous free segment of the same class
+    uint32_t prev;
   };
 
   struct free_list_instance {
+    // The size managed by the free list (without this header)
     uint32_t total_size;
-    uint32_t head;
+
+    // The size of the biggest free segment (a lower bound, exact to its second level class)
+    uint32_t max_free;
+
+    // The size of the allocated segments (with their headers)
+    uint32_t used_size;
+
+    // The first level classes containing at least one free segment
+    uint32_t fl_bitmap;
+
+    // The second level classes containing at least one free segment
+    uint32_t sl_bitmap [FREE_LIST_FL_COUNT];
+
+    // The first free segment of each class (0 if empty)
+    uint32_t heads [FREE_LIST_FL_COUNT][FREE_LIST_SL_COUNT];
   };
 
   /**
@@ -24,7 +75,6 @@ namespace rd_utils::memory::cache {
    * @returns:
    *    - offset: the offset of the segment, if found
    *    - true, iif a segment was found
-   *    - max_size: the remaining maximum allocable size (biggest remaining free block after allocation)
    */
   bool free_list_allocate (free_list_instance * inst, uint32_t size, uint32_t & offset);
 
@@ -40,16 +90,26 @@ namespace rd_utils::memory::cache {
    */
   bool free_list_free (free_list_instance * inst, uint32_t offset);
 
+  /**
+   * @returns: the size taken in the list by the allocated segment at offset (with its header)
+   */
+  uint32_t free_list_segment_size (const free_list_instance * inst, uint32_t offset);
+
   /**
    * @returns: true if the list is empty
    */
   bool free_list_empty (free_list_instance * inst);
 
   /**
-   * @returns: the size of the biggest free block in the list
+   * @returns: the size of the biggest free block in the list (a lower bound, exact to its class)
    */
   uint32_t free_list_max_size (const free_list_instance * inst);
 
+  /**
+   * @returns: the size of the biggest object that fits in an empty free list created in /total_size/ bytes
+   */
+  uint32_t free_list_capacity (uint32_t total_size);
+
 }
 
 
@@ -0,0 +1,110 @@
+#include "metrics.hh"
+#include <cstring>
+
+namespace rd_utils::memory::cache {
+
+  void LatencyHistogram::record (double elapsed) {
+    uint64_t us = elapsed > 0 ? (uint64_t) (elapsed * 1000000) : 0;
+    uint32_t bucket = us == 0 ? 0 : 64 - __builtin_clzll (us);
+    if (bucket >= LATENCY_NB_BUCKETS) bucket = LATENCY_NB_BUCKETS - 1;
+
+    this-> buckets [bucket] += 1;
+    this-> count += 1;
+    this-> total += elapsed;
+    if (elapsed > this-> max) this-> max = elapsed;
+  }
+
+  double LatencyHistogram::mean () const {
+    if (this-> count == 0) return 0;
+    return this-> total / (double) this-> count;
+  }
+
+  double LatencyHistogram::percentile (double p) const {
+    if (this-> count == 0) return 0;
+
+    uint64_t rank = p * this-> count;
+    if (rank >= this-> count) rank = this-> count - 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0 ; i < LATENCY_NB_BUCKETS ; i++) {
+      seen += this-> buckets [i];
+      if (seen > rank) {
+        // the upper bound of the bucket, never above the highest latency
+        double bound = (double) (1ULL << i) / 1000000;
+        return bound < this-> max ? bound : this-> max;
+      }
+    }
+
+    return this-> max;
+  }
+
+  void LatencyHistogram::clear () {
+    memset (this-> buckets, 0, sizeof (this-> buckets));
+    this-> count = 0;
+    this-> total = 0;
+    this-> max = 0;
+  }
+
+  double FragmentationMetrics::occupancy () const {
+    if (this-> usedBytes + this-> freeBytes == 0) return 0;
+    return (double) this-> usedBytes / (double) (this-> usedBytes + this-> freeBytes);
+  }
+
+  double FragmentationMetrics::fragmentation () const {
+    if (this-> freeBytes == 0) return 0;
+    return 1.0 - (double) this-> largestFree / (double) this-> freeBytes;
+  }
+
+  double AllocatorMetrics::hitRatio () const {
+    if (this-> hits + this-> misses == 0) return 0;
+    return (double) this-> hits / (double) (this-> hits + this-> misses);
+  }
+
+  std::vector <std::string> AllocatorMetrics::header () {
+    return {
+      "resident", "loadable", "allocated", "dirty",
+      "hits", "misses", "hit_ratio", "prefetched",
+      "evictions", "dirty_saves", "clean_evictions",
+      "bytes_loaded", "bytes_saved", "shared", "zero_elided",
+      "loads", "load_mean_us", "load_p50_us", "load_p99_us", "load_max_us",
+      "saves", "save_mean_us", "save_p50_us", "save_p99_us", "save_max_us"
+    };
+  }
+
+  std::shared_ptr <utils::config::Dict> AllocatorMetrics::toConfig () const {
+    auto d = std::make_shared <utils::config::Dict> ();
+    d-> insert ("resident", (int64_t) this-> nbResident);
+    d-> insert ("loadable", (int64_t) this-> nbLoadable);
+    d-> insert ("allocated", (int64_t) this-> nbAllocated);
+    d-> insert ("dirty", (int64_t) this-> nbDirty);
+
+    d-> insert ("hits", (int64_t) this-> hits);
+    d-> insert ("misses", (int64_t) this-> misses);
+    d-> insert ("hit_ratio", this-> hitRatio ());
+    d-> insert ("prefetched", (int64_t) this-> prefetched);
+
+    d-> insert ("evictions", (int64_t) this-> evictions);
+    d-> insert ("dirty_saves", (int64_t) this-> dirtySaves);
+    d-> insert ("clean_evictions", (int64_t) this-> cleanEvictions);
+
+    d-> insert ("bytes_loaded", (int64_t) this-> bytesLoaded);
+    d-> insert ("bytes_saved", (int64_t) this-> bytesSaved);
+    d-> insert ("shared", (int64_t) this-> nbShared);
+    d-> insert ("zero_elided", (int64_t) this-> zeroElided);
+
+    d-> insert ("loads", (int64_t) this-> loadLatency.count);
+    d-> insert ("load_mean_us", this-> loadLatency.mean () * 1000000);
+    d-> insert ("load_p50_us", this-> loadLatency.percentile (0.5) * 1000000);
+    d-> insert ("load_p99_us", this-> loadLatency.percentile (0.99) * 1000000);
+    d-> insert ("load_max_us", this-> loadLatency.max * 1000000);
+
+    d-> insert ("saves", (int64_t) this-> saveLatency.count);
+    d-> insert ("save_mean_us", this-> saveLatency.mean () * 1000000);
+    d-> insert ("save_p50_us", this-> saveLatency.percentile (0.5) * 1000000);
+    d-> insert ("save_p99_us", this-> saveLatency.percentile (0.99) * 1000000);
+    d-> insert ("save_max_us", this-> saveLatency.max * 1000000);
+
+    return d;
+  }
+
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <rd_utils/utils/config/_.hh>
+
+namespace rd_utils::memory::cache {
+
+// The number of buckets of a latency histogram, bucket i counts the latencies in [2^(i-1), 2^i[ microseconds
+#define LATENCY_NB_BUCKETS 32
+
+        /**
+         * Histogram of the latencies of an operation, with logarithmic buckets
+         * @warning: not thread safe, the allocator records the latencies of the persister under its lock
+         */
+        struct LatencyHistogram {
+                // The number of latencies of each bucket
+                uint64_t buckets [LATENCY_NB_BUCKETS];
+
+                // The number of recorded latencies
+                uint64_t count;
+
+                // The sum of the recorded latencies (in seconds)
+                double total;
+
+                // The highest recorded latency (in seconds)
+                double max;
+
+                /**
+                 * Register the latency of an operation
+                 * @params:
+                 *    - elapsed: the duration of the operation in seconds
+                 */
+                void record (double elapsed);
+
+                /**
+                 * @returns: the mean latency in seconds
+                 */
+                double mean () const;
+
+                /**
+                 * @returns: an upper bound of the latency of the p quantile (in seconds)
+                 * @params:
+                 *    - p: the quantile in [0, 1] (e.g. 0.99)
+                 */
+                double percentile (double p) const;
+
+                /**
+                 * Forget all the recorded latencies
+                 */
+                void clear ();
+        };
+
+        /**
+         * Snapshot of the state and statistics of an allocator
+         * @info:
+         * ======
+         * A hit is an access to a resident block, a miss an access that
+         * had to load the block from the persister. An eviction removes a
+         * block from memory, it is saved (dirty save) if it was modified
+         * since it was last persisted. The flusher also does dirty saves
+         * ahead of the evictions. Counters are cumulated since the
+         * configuration of the allocator
+         * ======
+         */
+        struct AllocatorMetrics {
+                // The number of blocks in memory
+                uint32_t nbResident;
+
+                // The maximum number of blocks in memory
+                uint32_t nbLoadable;
+
+                // The number of allocated blocks (resident or stored)
+                uint64_t nbAllocated;
+
+                // The number of resident blocks modified since they were last persisted
+                uint32_t nbDirty;
+
+                uint64_t hits;
+                uint64_t misses;
+
+                // The number of blocks loaded in background
+                uint64_t prefetched;
+
+                uint64_t evictions;
+
+                // The number of blocks written to the persister (evictions and flusher)
+                uint64_t dirtySaves;
+
+                // The number of evictions that did not need to save the block
+                uint64_t cleanEvictions;
+
+                // The number of bytes read from the persister
+                uint64_t bytesLoaded;
+
+                // The number of bytes written to the persister
+                uint64_t bytesSaved;
+
+                // The number of blocks sharing the content of another block (copy on write)
+                uint64_t nbShared;
+
+                // The number of block saves and loads skipped because the block was zeros
+                uint64_t zeroElided;
+
+                // The latencies of the persister reads (a batch is one operation)
+                LatencyHistogram loadLatency;
+
+                // The latencies of the persister writes (a batch is one operation)
+                LatencyHistogram saveLatency;
+
+                /**
+                 * @returns: hits / (hits + misses)
+                 */
+                double hitRatio () const;
+
+                /**
+                 * @returns: the names of the exported metrics (in the order of the columns of a csv trace)
+                 */
+                static std::vector <std::string> header ();
+
+                /**
+                 * @returns: the exported metrics, latencies are in microseconds
+                 */
+                std::shared_ptr <utils::config::Dict> toConfig () const;
+        };
+
+        /**
+         * Snapshot of the occupancy of the resident blocks of an allocator
+         * @info:
+         * ======
+         * Blocks whose live segments use only a small part of their space
+         * still take a resident slot, and have to be loaded again when one
+         * of their segments is accessed after an eviction. Only the
+         * resident blocks are examined, the occupancy of a stored block is
+         * not known without reading it
+         * ======
+         */
+        struct FragmentationMetrics {
+                // The number of resident blocks holding allocations
+                uint32_t nbBlocks;
+
+                // The number of resident blocks whose occupancy is under the sparse ratio
+                uint32_t nbSparse;
+
+                // The bytes used by the live segments of the resident blocks (segment headers included)
+                uint64_t usedBytes;
+
+                // The free bytes of the resident blocks
+                uint64_t freeBytes;
+
+                // The sum of the biggest free segment of each resident block
+                uint64_t largestFree;
+
+                // The number of resident blocks that would hold the live segments if they were packed
+                uint32_t nbPacked;
+
+                /**
+                 * @returns: usedBytes / (usedBytes + freeBytes)
+                 */
+                double occupancy () const;
+
+                /**
+                 * @returns: 1 - largestFree / freeBytes (0 when every block has its free space in a single segment)
+                 */
+                double fragmentation () const;
+        };
+
+        /**
+         * Result of a compaction pass
+         */
+        struct CompactionReport {
+                // The state of the resident blocks before the pass
+                FragmentationMetrics before;
+
+                // The state of the resident blocks after the pass
+                FragmentationMetrics after;
+
+                // The number of relocated segments
+                uint32_t nbMoved;
+
+                // The number of bytes copied by the relocations
+                uint64_t bytesMoved;
+
+                // The number of blocks freed by the pass
+                uint32_t nbFreed;
+        };
+
+}
@@ -0,0 +1,429 @@
+#include "paged.hh"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+#include <rd_utils/utils/log.hh>
+
+namespace rd_utils::memory::cache {
+
+  // The states of the chunks
+#define PAGED_ABSENT 0
+#define PAGED_CLEAN 1
+#define PAGED_DIRTY 2
+
+  // The regions using the signal backend
+  static concurrency::mutex __REGIONS_M__;
+  static std::vector <PagedRegion*> __REGIONS__;
+
+  // The SIGSEGV action replaced by the handler of the regions
+  static struct sigaction __PREVIOUS__;
+  static bool __INSTALLED__ = false;
+
+  // The number of region calls of the current thread holding the lock of a region (fault handling, sync, invalidate)
+  // a fault of such a thread cannot be handled, the region would be locked twice and the backing data entered again
+  static thread_local uint32_t __IN_REGION__ = 0;
+
+  struct RegionGuard {
+    RegionGuard () { __IN_REGION__ += 1; }
+    ~RegionGuard () { __IN_REGION__ -= 1; }
+  };
+
+  /**
+   * @returns: a new private anonymous mapping (nullptr on failure)
+   */
+  static uint8_t * map_anonymous (void * at, uint64_t size, int prot) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (at != nullptr ? MAP_FIXED : 0);
+    auto mem = ::mmap (at, size, prot, flags, -1, 0);
+    if (mem == MAP_FAILED) return nullptr;
+
+    return reinterpret_cast <uint8_t*> (mem);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ================================    CTORS   ================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  PagedRegion::PagedRegion (uint64_t len, uint32_t maxChunks, bool userfault) :
+    _len (len)
+    , _maxChunks (std::max (maxChunks, (uint32_t) 1))
+    , _handler (0)
+  {
+    this-> _size = std::max ((uint64_t) 1, (len + PAGED_CHUNK_SIZE - 1) / PAGED_CHUNK_SIZE) * PAGED_CHUNK_SIZE;
+    this-> _state.resize (this-> _size / PAGED_CHUNK_SIZE, PAGED_ABSENT);
+
+    if (userfault && this-> openUserfault ()) {
+      this-> _backend = PagedBackend::USERFAULTFD;
+      this-> _running = true;
+      this-> _handler = concurrency::spawn (this, &PagedRegion::handlerMain);
+      return;
+    }
+
+    // every access faults until its chunk is mapped
+    this-> _base = map_anonymous (nullptr, this-> _size, PROT_NONE);
+    if (this-> _base == nullptr) {
+      throw std::runtime_error ("Failed to map a paged region of " + std::to_string (this-> _size) + "B");
+    }
+
+    this-> _backend = PagedBackend::SIGNAL;
+    WITH_LOCK (__REGIONS_M__) {
+      if (!__INSTALLED__) {
+        struct sigaction action;
+        memset (&action, 0, sizeof (action));
+        action.sa_sigaction = &PagedRegion::onSignal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset (&action.sa_mask);
+
+        ::sigaction (SIGSEGV, &action, &__PREVIOUS__);
+        __INSTALLED__ = true;
+      }
+
+      __REGIONS__.push_back (this);
+    }
+  }
+
+  bool PagedRegion::openUserfault () {
+    // without write protection the writes made to a chunk during its eviction would be lost, the signals are used instead
+#if defined (SYS_userfaultfd) && defined (UFFDIO_COPY) && defined (UFFDIO_WRITEPROTECT) && defined (UFFDIO_COPY_MODE_WP)
+    int fd = -1;
+#ifdef UFFD_USER_MODE_ONLY
+    // the faults of the kernel are not needed, this mode is allowed to unprivileged processes
+    fd = ::syscall (SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+#endif
+    if (fd < 0) fd = ::syscall (SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) return false;
+
+    struct uffdio_api api = {.api = UFFD_API, .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP, .ioctls = 0};
+    if (::ioctl (fd, UFFDIO_API, &api) != 0) {
+      ::close (fd);
+      return false;
+    }
+
+    auto base = map_anonymous (nullptr, this-> _size, PROT_READ | PROT_WRITE);
+    if (base == nullptr) {
+      ::close (fd);
+      return false;
+    }
+
+    // anonymous memory cannot be write protected before linux 5.7
+    struct uffdio_register reg = {.range = {.start = (uintptr_t) base, .len = this-> _size}, .mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP, .ioctls = 0};
+    if (::ioctl (fd, UFFDIO_REGISTER, &reg) != 0) {
+      ::munmap (base, this-> _size);
+      ::close (fd);
+      return false;
+    }
+
+    this-> _wakeFd = ::eventfd (0, EFD_CLOEXEC);
+    if (this-> _wakeFd < 0) {
+      ::munmap (base, this-> _size);
+      ::close (fd);
+      return false;
+    }
+
+    this-> _base = base;
+    this-> _uffd = fd;
+    this-> _staging = new uint8_t [PAGED_CHUNK_SIZE];
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void PagedRegion::close () {
+    if (this-> _base == nullptr) return;
+
+    this-> sync ();
+    this-> unmap ();
+  }
+
+  void PagedRegion::unmap () {
+    if (this-> _base == nullptr) return;
+
+    if (this-> _backend == PagedBackend::USERFAULTFD) {
+      this-> _running = false;
+      uint64_t one = 1;
+      if (::write (this-> _wakeFd, &one, sizeof (one)) == sizeof (one)) {
+        concurrency::join (this-> _handler);
+      }
+
+      this-> _handler = concurrency::Thread (0);
+      ::close (this-> _wakeFd);
+      ::close (this-> _uffd);
+      delete [] this-> _staging;
+
+      this-> _wakeFd = -1;
+      this-> _uffd = -1;
+      this-> _staging = nullptr;
+    } else {
+      WITH_LOCK (__REGIONS_M__) {
+        __REGIONS__.erase (std::find (__REGIONS__.begin (), __REGIONS__.end (), this));
+      }
+    }
+
+    ::munmap (this-> _base, this-> _size);
+    this-> _base = nullptr;
+    this-> _mapped.clear ();
+    std::fill (this-> _state.begin (), this-> _state.end (), PAGED_ABSENT);
+  }
+
+  PagedRegion::~PagedRegion () {
+    this-> unmap ();
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ============================      GETTERS      =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  uint8_t * PagedRegion::data () const {
+    return this-> _base;
+  }
+
+  uint64_t PagedRegion::byteLen () const {
+    return this-> _len;
+  }
+
+  PagedBackend PagedRegion::getBackend () const {
+    return this-> _backend;
+  }
+
+  void PagedRegion::getInfo (uint64_t & nbFaults, uint64_t & nbEvictions) const {
+    nbFaults = this-> _nbFaults;
+    nbEvictions = this-> _nbEvictions;
+  }
+
+  uint64_t PagedRegion::chunkLen (uint64_t chunk) const {
+    uint64_t offset = chunk * PAGED_CHUNK_SIZE;
+    if (offset >= this-> _len) return 0;
+
+    return std::min ((uint64_t) PAGED_CHUNK_SIZE, this-> _len - offset);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================      CHUNKS      =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void PagedRegion::sync () {
+    RegionGuard guard;
+    WITH_LOCK (this-> _m) {
+      for (auto chunk : this-> _mapped) {
+        this-> flushChunk (chunk);
+      }
+    }
+  }
+
+  void PagedRegion::invalidate () {
+    RegionGuard guard;
+    WITH_LOCK (this-> _m) {
+      for (auto chunk : this-> _mapped) {
+        this-> evictChunk (chunk);
+      }
+
+      this-> _mapped.clear ();
+    }
+  }
+
+  bool PagedRegion::fault (uintptr_t addr, bool write, bool wp) {
+    auto base = (uintptr_t) this-> _base;
+    if (addr < base || addr >= base + this-> _size) return false;
+
+    auto chunk = (addr - base) / PAGED_CHUNK_SIZE;
+    RegionGuard guard;
+    WITH_LOCK (this-> _m) {
+      this-> _nbFaults += 1;
+      if (this-> _state [chunk] == PAGED_ABSENT) {
+        // the fault handler cannot throw (the signal handler runs in the faulting thread), the caller falls back on failure
+        try {
+          this-> mapChunk (chunk, write);
+        } catch (...) {
+          return false;
+        }
+
+        return true;
+      }
+
+#if defined (UFFDIO_WAKE)
+      // the chunk was mapped by the fault of another thread, the faulting thread only has to retry
+      if (this-> _backend == PagedBackend::USERFAULTFD && !wp) {
+        auto mem = this-> _base + chunk * PAGED_CHUNK_SIZE;
+        struct uffdio_range range = {.start = (uintptr_t) mem, .len = PAGED_CHUNK_SIZE};
+        ::ioctl (this-> _uffd, UFFDIO_WAKE, &range);
+        return true;
+      }
+#endif
+
+      // a write to a write protected chunk (with signals, a read fault of a chunk mapped in the meantime is counted as a write)
+      this-> _state [chunk] = PAGED_DIRTY;
+      this-> protect (chunk, true);
+    }
+
+    return true;
+  }
+
+  void PagedRegion::mapChunk (uint64_t chunk, bool write) {
+    while (this-> _mapped.size () >= this-> _maxChunks) {
+      // the victim stays mapped if its write back fails
+      this-> evictChunk (this-> _mapped.front ());
+      this-> _mapped.pop_front ();
+    }
+
+    auto offset = chunk * PAGED_CHUNK_SIZE;
+    auto len = this-> chunkLen (chunk);
+    auto mem = this-> _base + offset;
+
+    if (this-> _backend == PagedBackend::USERFAULTFD) {
+#if defined (UFFDIO_COPY_MODE_WP)
+      this-> readRange (offset, this-> _staging, len);
+      memset (this-> _staging + len, 0, PAGED_CHUNK_SIZE - len);
+
+      // the pages are write protected from the start, unless the fault is a write
+      struct uffdio_copy copy = {.dst = (uintptr_t) mem, .src = (uintptr_t) this-> _staging, .len = PAGED_CHUNK_SIZE, .mode = write ? 0 : UFFDIO_COPY_MODE_WP, .copy = 0};
+      if (::ioctl (this-> _uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST) {
+        throw std::runtime_error ("Failed to map a chunk of a paged region");
+      }
+
+      this-> _state [chunk] = write ? PAGED_DIRTY : PAGED_CLEAN;
+#endif
+    } else {
+      // the chunk is filled aside and moved at once, the other threads never see it half read
+      auto staging = map_anonymous (nullptr, PAGED_CHUNK_SIZE, PROT_READ | PROT_WRITE);
+      if (staging == nullptr) throw std::runtime_error ("Failed to map a chunk of a paged region");
+
+      try {
+        this-> readRange (offset, staging, len);
+      } catch (...) {
+        ::munmap (staging, PAGED_CHUNK_SIZE);
+        throw;
+      }
+
+      ::mprotect (staging, PAGED_CHUNK_SIZE, PROT_READ);
+      if (::mremap (staging, PAGED_CHUNK_SIZE, PAGED_CHUNK_SIZE, MREMAP_MAYMOVE | MREMAP_FIXED, mem) == MAP_FAILED) {
+        ::munmap (staging, PAGED_CHUNK_SIZE);
+        throw std::runtime_error ("Failed to map a chunk of a paged region");
+      }
+
+      this-> _state [chunk] = PAGED_CLEAN;
+    }
+
+    this-> _mapped.push_back (chunk);
+  }
+
+  void PagedRegion::flushChunk (uint64_t chunk) {
+    if (this-> _state [chunk] != PAGED_DIRTY) return;
+
+    auto offset = chunk * PAGED_CHUNK_SIZE;
+    auto mem = this-> _base + offset;
+
+    // the writers of the chunk fault (and wait for the lock) until it is written back
+    this-> protect (chunk, false);
+    this-> writeRange (offset, mem, this-> chunkLen (chunk));
+    this-> _state [chunk] = PAGED_CLEAN;
+  }
+
+  void PagedRegion::evictChunk (uint64_t chunk) {
+    this-> flushChunk (chunk);
+
+    auto mem = this-> _base + chunk * PAGED_CHUNK_SIZE;
+    if (this-> _backend == PagedBackend::USERFAULTFD) {
+      // the pages are missing again, the next access is a new fault
+      ::madvise (mem, PAGED_CHUNK_SIZE, MADV_DONTNEED);
+    } else {
+      // a new mapping releases the pages and protects the chunk in a single step
+      map_anonymous (mem, PAGED_CHUNK_SIZE, PROT_NONE);
+    }
+
+    this-> _state [chunk] = PAGED_ABSENT;
+    this-> _nbEvictions += 1;
+  }
+
+  void PagedRegion::protect (uint64_t chunk, bool writable) {
+    auto mem = this-> _base + chunk * PAGED_CHUNK_SIZE;
+    if (this-> _backend == PagedBackend::SIGNAL) {
+      ::mprotect (mem, PAGED_CHUNK_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ);
+      return;
+    }
+
+#ifdef UFFDIO_WRITEPROTECT
+    // removing the protection also wakes the faulting threads
+    struct uffdio_writeprotect wp = {.range = {.start = (uintptr_t) mem, .len = PAGED_CHUNK_SIZE}, .mode = writable ? 0 : UFFDIO_WRITEPROTECT_MODE_WP};
+    ::ioctl (this-> _uffd, UFFDIO_WRITEPROTECT, &wp);
+#endif
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================      FAULTS      =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void PagedRegion::handlerMain (concurrency::Thread) {
+    struct pollfd fds [2] = {{.fd = this-> _uffd, .events = POLLIN, .revents = 0}, {.fd = this-> _wakeFd, .events = POLLIN, .revents = 0}};
+    while (this-> _running) {
+      if (::poll (fds, 2, -1) <= 0) continue;
+      if ((fds [1].revents & POLLIN) != 0) break;
+
+      struct uffd_msg msg;
+      while (::read (this-> _uffd, &msg, sizeof (msg)) == sizeof (msg)) {
+        if (msg.event != UFFD_EVENT_PAGEFAULT) continue;
+
+        auto flags = msg.arg.pagefault.flags;
+        bool wp = false;
+#ifdef UFFD_PAGEFAULT_FLAG_WP
+        wp = (flags & UFFD_PAGEFAULT_FLAG_WP) != 0;
+#endif
+
+        if (!this-> fault (msg.arg.pagefault.address, (flags & UFFD_PAGEFAULT_FLAG_WRITE) != 0, wp)) {
+          // the faulting thread would wait forever for its page
+          LOG_ERROR ("Failed to map a chunk of a paged region at ", msg.arg.pagefault.address);
+          exit (-1);
+        }
+      }
+    }
+  }
+
+  void PagedRegion::onSignal (int sig, siginfo_t * info, void * ctx) {
+    auto addr = (uintptr_t) info-> si_addr;
+
+    // a fault in a call to the backing data (or in the handling of another fault) is not handled, it would deadlock
+    if (__IN_REGION__ == 0) {
+      WITH_LOCK (__REGIONS_M__) {
+        for (auto region : __REGIONS__) {
+          if (region-> fault (addr, false, false)) return;
+        }
+      }
+    }
+
+    // not a fault of a region (or a chunk that cannot be mapped), the previous handler decides
+    if ((__PREVIOUS__.sa_flags & SA_SIGINFO) != 0 && __PREVIOUS__.sa_sigaction != nullptr) {
+      __PREVIOUS__.sa_sigaction (sig, info, ctx);
+    } else if (__PREVIOUS__.sa_handler != SIG_DFL && __PREVIOUS__.sa_handler != SIG_IGN) {
+      __PREVIOUS__.sa_handler (sig);
+    } else {
+      // the faulting instruction is executed again and kills the process as usual
+      ::signal (SIGSEGV, SIG_DFL);
+    }
+  }
+
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <signal.h>
+#include <rd_utils/concurrency/mutex.hh>
+#include <rd_utils/concurrency/thread.hh>
+
+namespace rd_utils::memory::cache {
+
+// The number of bytes loaded on a fault (a multiple of the page size)
+#define PAGED_CHUNK_SIZE (64 * 1024)
+
+// The default maximum number of chunks mapped at the same time
+#define PAGED_MAX_CHUNKS 256
+
+        /**
+         * The mechanism catching the accesses to the pages of a region
+         */
+        enum class PagedBackend : uint8_t {
+                // The faults are handled by a thread reading a userfaultfd
+                USERFAULTFD,
+
+                // The pages are protected (mprotect), the faults are handled by a SIGSEGV handler in the faulting thread
+                SIGNAL
+        };
+
+        /**
+         * A contiguous range of virtual memory whose pages are loaded on access
+         * @info:
+         * ======
+         * The region is split in chunks of PAGED_CHUNK_SIZE bytes. The first
+         * access to a chunk faults, the fault handler reads the chunk from
+         * the backing data (readRange) and maps it write protected. The first
+         * write to a mapped chunk faults again, the chunk is marked dirty and
+         * made writable.
+         *
+         * At most maxChunks chunks are mapped, the oldest chunk is evicted to
+         * map a new one: its content is written back (writeRange) if it is
+         * dirty and its pages are released, the next access faults again.
+         *
+         * The faults are handled by userfaultfd when the kernel allows it
+         * with write protection (linux 5.7, the writes made to a chunk while
+         * it is evicted would be lost otherwise), and by mprotect and a
+         * SIGSEGV handler otherwise.
+         * The fault handler accesses the backing data, so the memory of the
+         * region must not be used inside a call to the backing data (e.g. as
+         * the buffer of a read of the same allocator).
+         *
+         * The signal backend is only a fallback for the kernels refusing
+         * userfaultfd: its handler reads the backing data in the faulting
+         * thread, that may hold locks of the backing data (an allocator
+         * lock). A fault of a thread already inside a call of a region is
+         * refused, and so is a chunk that cannot be read, the previous
+         * SIGSEGV handler runs instead
+         * ======
+         */
+        class PagedRegion {
+        private:
+
+                // The start of the mapping
+                uint8_t * _base = nullptr;
+
+                // The size of the backing data
+                uint64_t _len = 0;
+
+                // The size of the mapping (a multiple of the chunk size)
+                uint64_t _size = 0;
+
+                // The maximum number of chunks mapped at the same time
+                uint32_t _maxChunks;
+
+                // Lock protecting the state of the chunks
+                concurrency::mutex _m;
+
+                // The state of each chunk (PAGED_ABSENT, PAGED_CLEAN or PAGED_DIRTY)
+                std::vector <uint8_t> _state;
+
+                // The mapped chunks in mapping order (the front is evicted first)
+                std::deque <uint64_t> _mapped;
+
+                // The fault handling mechanism
+                PagedBackend _backend = PagedBackend::SIGNAL;
+
+                // The userfaultfd of the region (-1 with the signal backend)
+                int _uffd = -1;
+
+                // The eventfd waking up the fault handler thread when the region is closed
+                int _wakeFd = -1;
+
+                // The buffer in which a chunk is read before being moved in the region
+                uint8_t * _staging = nullptr;
+
+                // The fault handler thread (userfaultfd)
+                concurrency::Thread _handler;
+
+                // True while the fault handler thread is running
+                std::atomic<bool> _running = false;
+
+                // The number of faults handled
+                std::atomic<uint64_t> _nbFaults = 0;
+
+                // The number of evicted chunks
+                std::atomic<uint64_t> _nbEvictions = 0;
+
+        private:
+
+                PagedRegion (const PagedRegion &);
+                void operator= (const PagedRegion &);
+
+        public:
+
+                /**
+                 * @params:
+                 *    - len: the size of the backing data (in bytes)
+                 *    - maxChunks: the maximum number of chunks mapped at the same time
+                 *    - userfault: try userfaultfd before falling back to signals
+                 * @throws: if the memory cannot be mapped
+                 */
+                PagedRegion (uint64_t len, uint32_t maxChunks = PAGED_MAX_CHUNKS, bool userfault = true);
+
+                /**
+                 * @returns: the start of the region
+                 */
+                uint8_t * data () const;
+
+                /**
+                 * @returns: the size of the backing data (in bytes)
+                 */
+                uint64_t byteLen () const;
+
+                /**
+                 * @returns: the mechanism handling the faults
+                 */
+                PagedBackend getBackend () const;
+
+                /**
+                 * @returns:
+                 *    - nbFaults: the number of faults handled
+                 *    - nbEvictions: the number of evicted chunks
+                 */
+                void getInfo (uint64_t & nbFaults, uint64_t & nbEvictions) const;
+
+                /**
+                 * Write back the dirty chunks (they stay mapped)
+                 */
+                void sync ();
+
+                /**
+                 * Write back the dirty chunks and unmap every chunk, the next accesses read the backing data again
+                 * @info: to call after the backing data was modified outside of the region
+                 */
+                void invalidate ();
+
+                /**
+                 * Write back the dirty chunks and release the mapping
+                 * @warning: must be called by the destructor of the subclasses, writeRange is not callable anymore in ~PagedRegion
+                 */
+                void close ();
+
+                virtual ~PagedRegion ();
+
+        protected:
+
+                /**
+                 * Read a range of the backing data
+                 */
+                virtual void readRange (uint64_t offset, uint8_t * data, uint64_t size) = 0;
+
+                /**
+                 * Write a range of the backing data
+                 */
+                virtual void writeRange (uint64_t offset, const uint8_t * data, uint64_t size) = 0;
+
+        private:
+
+                /**
+                 * Stop the fault handling and release the mapping (nothing is written back)
+                 */
+                void unmap ();
+
+                /**
+                 * Open a userfaultfd on the region
+                 * @returns: false if the kernel refused it or cannot write protect the pages
+                 */
+                bool openUserfault ();
+
+                /**
+                 * Handle a fault at /addr/
+                 * @returns: false if the address is not in the region, or if its chunk could not be mapped
+                 */
+                bool fault (uintptr_t addr, bool write, bool wp);
+
+                /**
+                 * Map a chunk that is not mapped (evicting the oldest ones if needed)
+                 * @warning: _m must be held
+                 */
+                void mapChunk (uint64_t chunk, bool write);
+
+                /**
+                 * Write back a chunk if it is dirty, it is write protected after
+                 * @warning: _m must be held
+                 */
+                void flushChunk (uint64_t chunk);
+
+                /**
+                 * Write back and unmap a chunk
+                 * @warning: _m must be held
+                 */
+                void evictChunk (uint64_t chunk);
+
+                /**
+                 * Change the write protection of a mapped chunk
+                 */
+                void protect (uint64_t chunk, bool writable);
+
+                /**
+                 * @returns: the size of the backing data in a chunk
+                 */
+                uint64_t chunkLen (uint64_t chunk) const;
+
+                /**
+                 * The main loop of the fault handler thread (userfaultfd)
+                 */
+                void handlerMain (concurrency::Thread);
+
+                /**
+                 * The SIGSEGV handler of the regions using the signal backend
+                 */
+                static void onSignal (int sig, siginfo_t * info, void * ctx);
+
+        };
+
+}
@@ -0,0 +1,160 @@
+#include "pool.hh"
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <rd_utils/utils/files.hh>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#endif
+
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+namespace rd_utils::memory::cache {
+
+  /**
+   * Set the numa policy of a memory range (libnuma is not required)
+   * @params:
+   *    - node: the node of the pages, -1 to restore the default policy
+   */
+  static void bind_node (void * buffer, uint64_t size, int node) {
+#ifdef SYS_mbind
+    uint64_t mask [BLOCK_POOL_MAX_NODES / 64] = {0};
+    if (node < 0) {
+      ::syscall (SYS_mbind, buffer, size, MPOL_DEFAULT, nullptr, 0, 0);
+      return;
+    }
+
+    // the kernel reads maxnode - 1 bits of the mask
+    mask [node / 64] = 1ULL << (node % 64);
+    ::syscall (SYS_mbind, buffer, size, MPOL_BIND, mask, BLOCK_POOL_MAX_NODES + 1, MPOL_MF_MOVE);
+#endif
+  }
+
+  BlockPool::BlockPool () {}
+
+  void BlockPool::configure (uint64_t size) {
+    this-> clear ();
+
+    WITH_LOCK (this-> _m) {
+      this-> _size = size;
+      this-> _align = size >= BLOCK_POOL_HUGE_ALIGN ? BLOCK_POOL_HUGE_ALIGN : BLOCK_POOL_PAGE_ALIGN;
+    }
+  }
+
+  void BlockPool::setNode (int node) {
+    if (node >= BLOCK_POOL_MAX_NODES || node < -1) {
+      throw std::runtime_error ("Numa node out of range : " + std::to_string (node));
+    }
+
+    if (node >= 0 && !utils::directory_exists ("/sys/devices/system/node/node" + std::to_string (node))) {
+      throw std::runtime_error ("Unknown numa node : " + std::to_string (node));
+    }
+
+    this-> clear ();
+    WITH_LOCK (this-> _m) {
+      this-> _node = node;
+    }
+  }
+
+  int BlockPool::getNode () {
+    WITH_LOCK (this-> _m) {
+      return this-> _node;
+    }
+
+    return -1;
+  }
+
+  void BlockPool::bind (uint8_t * buffer) {
+    uint64_t size;
+    int node;
+    WITH_LOCK (this-> _m) {
+      size = this-> _size;
+      node = this-> _node;
+    }
+
+    bind_node (buffer, size, node);
+  }
+
+  uint8_t * BlockPool::acquire () {
+    uint64_t size, align;
+    int node;
+    WITH_LOCK (this-> _m) {
+      if (this-> _free.size () != 0) {
+        auto buffer = this-> _free.back ();
+        this-> _free.pop_back ();
+        this-> _nbReused += 1;
+        return buffer;
+      }
+
+      this-> _nbAllocated += 1;
+      size = this-> _size;
+      align = this-> _align;
+      node = this-> _node;
+    }
+
+    // the allocation is done outside the lock, the kernel maps the pages on first touch
+    void * buffer = nullptr;
+    if (posix_memalign (&buffer, align, size) != 0) {
+      throw std::runtime_error ("Failed to allocate a block buffer");
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (align == BLOCK_POOL_HUGE_ALIGN) {
+      ::madvise (buffer, size & ~((uint64_t) BLOCK_POOL_HUGE_ALIGN - 1), MADV_HUGEPAGE);
+    }
+#endif
+
+    // the pages are not touched yet, they are faulted on the node of the pool
+    if (node >= 0) {
+      bind_node (buffer, size, node);
+    }
+
+    return reinterpret_cast <uint8_t*> (buffer);
+  }
+
+  void BlockPool::release (uint8_t * buffer) {
+    if (buffer == nullptr) return;
+
+    WITH_LOCK (this-> _m) {
+      if (this-> _free.size () < BLOCK_POOL_MAX_FREE) {
+        this-> _free.push_back (buffer);
+        return;
+      }
+    }
+
+    ::free (buffer);
+  }
+
+  void BlockPool::clear () {
+    std::vector <uint8_t*> buffers;
+    WITH_LOCK (this-> _m) {
+      buffers.swap (this-> _free);
+    }
+
+    for (auto buffer : buffers) {
+      ::free (buffer);
+    }
+  }
+
+  void BlockPool::getInfo (uint64_t & nbAllocated, uint64_t & nbReused) {
+    WITH_LOCK (this-> _m) {
+      nbAllocated = this-> _nbAllocated;
+      nbReused = this-> _nbReused;
+    }
+  }
+
+  BlockPool::~BlockPool () {
+    this-> clear ();
+  }
+
+}
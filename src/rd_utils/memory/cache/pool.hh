@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <rd_utils/concurrency/mutex.hh>
+
+namespace rd_utils::memory::cache {
+
+// The alignment of the buffers of blocks of at least a huge page (transparent huge pages are 2MB on x86_64)
+#define BLOCK_POOL_HUGE_ALIGN (2 * 1024 * 1024)
+
+// The alignment of the buffers of smaller blocks
+#define BLOCK_POOL_PAGE_ALIGN 4096
+
+// The maximum number of unused buffers kept by a pool
+#define BLOCK_POOL_MAX_FREE 8
+
+// The number of numa nodes that can be addressed by the node mask of mbind
+#define BLOCK_POOL_MAX_NODES 1024
+
+        /**
+         * Pool of recycled block buffers
+         * @info:
+         * ======
+         * Evicting a block and loading another one reuses the same buffer
+         * instead of going through the malloc heap (and faulting new pages)
+         * every time. Buffers are aligned on 2MB and advised as huge pages
+         * when the blocks are big enough, so a block is mapped by a few TLB
+         * entries. A recycled buffer is not zeroed, it holds the content
+         * of its previous block.
+         *
+         * A pool can be bound to a numa node, the pages of its buffers are
+         * then placed on this node (mbind), and stay there when recycled
+         * ======
+         */
+        class BlockPool {
+        private:
+
+                concurrency::mutex _m;
+
+                // The size of the buffers
+                uint64_t _size = 0;
+
+                // The alignment of the buffers
+                uint64_t _align = BLOCK_POOL_PAGE_ALIGN;
+
+                // The unused buffers
+                std::vector <uint8_t*> _free;
+
+                // The number of buffers allocated from the system
+                uint64_t _nbAllocated = 0;
+
+                // The number of buffers reused from the pool
+                uint64_t _nbReused = 0;
+
+                // The numa node of the buffers (-1 if not bound)
+                int _node = -1;
+
+        public:
+
+                BlockPool ();
+
+                BlockPool (const BlockPool & other) = delete;
+                void operator=(const BlockPool & other) = delete;
+
+                /**
+                 * Change the size of the buffers, the unused buffers are released
+                 * @warning: the buffers in use must have been released before
+                 */
+                void configure (uint64_t size);
+
+                /**
+                 * Place the buffers on a numa node, the unused buffers are released
+                 * @params:
+                 *    - node: the numa node, -1 to let the kernel place the pages
+                 * @throws: if the node does not exist
+                 */
+                void setNode (int node);
+
+                /**
+                 * @returns: the numa node of the buffers (-1 if not bound)
+                 */
+                int getNode ();
+
+                /**
+                 * Move the pages of a buffer in use to the numa node of the pool
+                 * @info: best effort, the buffer stays where it is if the kernel refuses the policy
+                 */
+                void bind (uint8_t * buffer);
+
+                /**
+                 * @returns: a buffer of the size of a block (content undefined)
+                 */
+                uint8_t * acquire ();
+
+                /**
+                 * Give a buffer back to the pool (released to the system if the pool is full)
+                 */
+                void release (uint8_t * buffer);
+
+                /**
+                 * Release all the unused buffers to the system
+                 */
+                void clear ();
+
+                /**
+                 * @returns:
+                 *    - nbAllocated: the number of buffers allocated from the system
+                 *    - nbReused: the number of acquisitions served by a recycled buffer
+                 */
+                void getInfo (uint64_t & nbAllocated, uint64_t & nbReused);
+
+                ~BlockPool ();
+
+        };
+
+}
@@ -1,3 +1,4 @@
 #pragma once
 
 #include "repo.hh"
+#include "tiered.hh"
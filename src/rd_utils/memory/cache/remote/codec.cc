@@ -0,0 +1,325 @@
+#include "codec.hh"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace rd_utils::memory::cache::remote {
+
+#define LZ_MIN_MATCH 4
+
+  // The last bytes of a block are always literals, so the decompressor never reads a match past the end
+#define LZ_LAST_LITERALS 5
+
+#define LZ_MAX_OFFSET 65535
+
+  // The step between two searched positions grows by one every 1 << LZ_SKIP_TRIGGER positions without a match
+#define LZ_SKIP_TRIGGER 6
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ===============================    CODECS    ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  BlockCodec * BlockCodec::create (CodecKind kind) {
+    switch (kind) {
+    case CodecKind::RAW : return new RawCodec ();
+    case CodecKind::LZ : return new LzCodec ();
+    default :
+      throw std::runtime_error ("Unknown codec");
+    }
+  }
+
+  BlockCodec::~BlockCodec () {}
+
+  double CodecInfo::ratio () const {
+    if (this-> encodedBytes == 0) return 1;
+    return (double) this-> rawBytes / (double) this-> encodedBytes;
+  }
+
+  double CodecInfo::encodeThroughput () const {
+    if (this-> encodeTime <= 0) return 0;
+    return (double) this-> rawBytes / this-> encodeTime;
+  }
+
+  double CodecInfo::decodeThroughput () const {
+    if (this-> decodeTime <= 0) return 0;
+    return (double) this-> decodedBytes / this-> decodeTime;
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =================================    RAW    ================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  CodecKind RawCodec::kind () const {
+    return CodecKind::RAW;
+  }
+
+  uint64_t RawCodec::compress (const uint8_t * in, uint64_t size, uint8_t * out, uint64_t capacity) {
+    if (size > capacity || size == 0) return 0;
+    memcpy (out, in, size);
+    return size;
+  }
+
+  bool RawCodec::decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) const {
+    if (length != size) return false;
+    memcpy (out, in, size);
+    return true;
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =================================    LZ    =================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  static inline uint32_t read32 (const uint8_t * p) {
+    uint32_t v;
+    memcpy (&v, p, sizeof (uint32_t));
+    return v;
+  }
+
+  static inline uint32_t lz_hash (uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - LZ_HASH_LOG);
+  }
+
+  /**
+   * @returns: the number of equal bytes at the beginning of a and b (at most max)
+   */
+  static inline uint64_t match_length (const uint8_t * a, const uint8_t * b, uint64_t max) {
+    uint64_t len = 0;
+    while (len + sizeof (uint64_t) <= max) {
+      uint64_t x, y;
+      memcpy (&x, a + len, sizeof (uint64_t));
+      memcpy (&y, b + len, sizeof (uint64_t));
+      if (x != y) return len + (__builtin_ctzll (x ^ y) >> 3);
+      len += sizeof (uint64_t);
+    }
+
+    while (len < max && a [len] == b [len]) len += 1;
+    return len;
+  }
+
+  /**
+   * Write the extension of a length that does not fit in a token
+   */
+  static inline bool lz_write_length (uint8_t *& op, const uint8_t * oend, uint64_t len) {
+    while (len >= 255) {
+      if (op == oend) return false;
+      *(op++) = 255;
+      len -= 255;
+    }
+
+    if (op == oend) return false;
+    *(op++) = len;
+    return true;
+  }
+
+  static inline bool lz_read_length (const uint8_t *& ip, const uint8_t * iend, uint64_t & len) {
+    uint8_t b;
+    do {
+      if (ip == iend) return false;
+      b = *(ip++);
+      len += b;
+    } while (b == 255);
+
+    return true;
+  }
+
+  /**
+   * Write a sequence of literals followed by a match
+   * @params:
+   *    - matchLen: the length of the match, 0 for the last sequence of the block (literals only)
+   * @returns: false if the sequence does not fit in the output
+   */
+  static bool lz_write_sequence (uint8_t *& op, const uint8_t * oend, const uint8_t * lit, uint64_t litLen, uint32_t offset, uint64_t matchLen) {
+    if (op == oend) return false;
+
+    auto token = op++;
+    *token = std::min <uint64_t> (litLen, 15) << 4;
+    if (litLen >= 15 && !lz_write_length (op, oend, litLen - 15)) return false;
+    if ((uint64_t) (oend - op) < litLen) return false;
+
+    memcpy (op, lit, litLen);
+    op += litLen;
+    if (matchLen == 0) return true;
+
+    if (oend - op < 2) return false;
+    *(op++) = offset & 0xFF;
+    *(op++) = offset >> 8;
+
+    auto m = matchLen - LZ_MIN_MATCH;
+    *token |= std::min <uint64_t> (m, 15);
+    if (m >= 15 && !lz_write_length (op, oend, m - 15)) return false;
+
+    return true;
+  }
+
+  static bool lz_decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) {
+    auto ip = in, iend = in + length;
+    auto op = out, oend = out + size;
+
+    for (;;) {
+      if (ip == iend) return false;
+      auto token = *(ip++);
+
+      uint64_t litLen = token >> 4;
+      if (litLen == 15 && !lz_read_length (ip, iend, litLen)) return false;
+      if (litLen > (uint64_t) (iend - ip) || litLen > (uint64_t) (oend - op)) return false;
+
+      memcpy (op, ip, litLen);
+      ip += litLen;
+      op += litLen;
+
+      // the last sequence has no match
+      if (ip == iend) return op == oend;
+
+      if (iend - ip < 2) return false;
+      uint64_t offset = ip [0] | (ip [1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (uint64_t) (op - out)) return false;
+
+      uint64_t matchLen = token & 15;
+      if (matchLen == 15 && !lz_read_length (ip, iend, matchLen)) return false;
+      matchLen += LZ_MIN_MATCH;
+      if (matchLen > (uint64_t) (oend - op)) return false;
+
+      // the match can overlap the bytes it produces (repeated pattern of length offset)
+      auto match = op - offset;
+      if (offset == 1) {
+        memset (op, *match, matchLen);
+      } else if (offset >= matchLen) {
+        memcpy (op, match, matchLen);
+      } else {
+        for (uint64_t i = 0 ; i < matchLen ; i++) op [i] = match [i];
+      }
+
+      op += matchLen;
+    }
+  }
+
+  LzCodec::LzCodec () :
+    _table (1 << LZ_HASH_LOG, 0)
+  {}
+
+  CodecKind LzCodec::kind () const {
+    return CodecKind::LZ;
+  }
+
+  uint64_t LzCodec::compress (const uint8_t * in, uint64_t size, uint8_t * out, uint64_t capacity) {
+    if (size > UINT32_MAX) return 0; // positions are stored on 32 bits
+
+    std::fill (this-> _table.begin (), this-> _table.end (), 0);
+    auto op = out;
+    auto oend = out + capacity;
+    uint64_t anchor = 0;
+
+    if (size >= LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+      uint64_t matchLimit = size - LZ_LAST_LITERALS;
+      uint64_t ip = 0;
+      while (ip + LZ_MIN_MATCH <= matchLimit) {
+        auto seq = read32 (in + ip);
+        auto h = lz_hash (seq);
+        uint64_t ref = this-> _table [h];
+        this-> _table [h] = ip;
+
+        // the slot can be empty (0) or overwritten by a colliding sequence, so the candidate is always checked
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32 (in + ref) != seq) {
+          ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+          continue;
+        }
+
+        auto len = LZ_MIN_MATCH + match_length (in + ip + LZ_MIN_MATCH, in + ref + LZ_MIN_MATCH, matchLimit - ip - LZ_MIN_MATCH);
+        if (!lz_write_sequence (op, oend, in + anchor, ip - anchor, ip - ref, len)) return 0;
+
+        ip += len;
+        anchor = ip;
+      }
+    }
+
+    if (!lz_write_sequence (op, oend, in + anchor, size - anchor, 0, 0)) return 0;
+    return op - out;
+  }
+
+  bool LzCodec::decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) const {
+    return lz_decompress (in, length, out, size);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ===============================    FRAMES    ===============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  uint64_t codec_encode (BlockCodec & codec, const uint8_t * memory, uint64_t size, std::vector <uint8_t> & frame) {
+    if (frame.size () < sizeof (CodecHeader) + size) {
+      frame.resize (sizeof (CodecHeader) + size);
+    }
+
+    return codec_encode (codec, memory, size, frame.data ());
+  }
+
+  uint64_t codec_encode (BlockCodec & codec, const uint8_t * memory, uint64_t size, uint8_t * frame) {
+    auto payload = frame + sizeof (CodecHeader);
+    CodecHeader header;
+    uint64_t length = 0;
+
+    // the compressed payload must be strictly smaller than the block, otherwise the block is stored raw
+    if (codec.kind () != CodecKind::RAW && size > 1) {
+      length = codec.compress (memory, size, payload, size - 1);
+    }
+
+    if (length != 0) {
+      header.kind = (uint32_t) codec.kind ();
+      header.length = length;
+    } else {
+      memcpy (payload, memory, size);
+      header.kind = (uint32_t) CodecKind::RAW;
+      header.length = size;
+    }
+
+    memcpy (frame, &header, sizeof (CodecHeader));
+    return sizeof (CodecHeader) + header.length;
+  }
+
+  void codec_decode (const uint8_t * frame, uint64_t length, uint8_t * memory, uint64_t size) {
+    if (length < sizeof (CodecHeader)) {
+      throw std::runtime_error ("Corrupted block frame");
+    }
+
+    CodecHeader header;
+    memcpy (&header, frame, sizeof (CodecHeader));
+    if (header.length != length - sizeof (CodecHeader)) {
+      throw std::runtime_error ("Corrupted block frame");
+    }
+
+    auto payload = frame + sizeof (CodecHeader);
+    bool ok = false;
+    switch ((CodecKind) header.kind) {
+    case CodecKind::RAW :
+      ok = header.length == size;
+      if (ok) memcpy (memory, payload, size);
+      break;
+    case CodecKind::LZ :
+      ok = lz_decompress (payload, header.length, memory, size);
+      break;
+    default :
+      break;
+    }
+
+    if (!ok) {
+      throw std::runtime_error ("Corrupted block frame");
+    }
+  }
+
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace rd_utils::memory::cache::remote {
+
+// The hash table of the lz codec contains 1 << LZ_HASH_LOG entries
+#define LZ_HASH_LOG 14
+
+        /**
+         * The codecs that can be used to encode the persisted blocks
+         */
+        enum class CodecKind : uint32_t {
+                RAW = 1,
+                LZ
+        };
+
+        /**
+         * The header of an encoded block
+         * @info:
+         * ======
+         * Blocks are persisted as | header | payload |, the payload being
+         * encoded by the codec written in the header. A block that does not
+         * get smaller when encoded is stored raw, so a frame is never more
+         * than sizeof (CodecHeader) bytes bigger than the block
+         * ======
+         */
+        struct CodecHeader {
+                // The codec used to encode the payload
+                uint32_t kind;
+
+                // The length of the payload
+                uint32_t length;
+        };
+
+        /**
+         * Statistics of the codec of a persister
+         */
+        struct CodecInfo {
+                // The codec used to encode the blocks
+                CodecKind kind;
+
+                // The number of blocks encoded
+                uint64_t nbEncoded;
+
+                // The number of encoded blocks stored raw because they were incompressible
+                uint64_t nbIncompressible;
+
+                // The size of the encoded blocks before encoding
+                uint64_t rawBytes;
+
+                // The size of the encoded blocks after encoding (with their headers)
+                uint64_t encodedBytes;
+
+                // The time spent encoding blocks
+                double encodeTime;
+
+                // The number of blocks decoded
+                uint64_t nbDecoded;
+
+                // The size of the decoded blocks
+                uint64_t decodedBytes;
+
+                // The time spent decoding blocks
+                double decodeTime;
+
+                /**
+                 * @returns: rawBytes / encodedBytes
+                 */
+                double ratio () const;
+
+                /**
+                 * @returns: the number of bytes encoded per second
+                 */
+                double encodeThroughput () const;
+
+                /**
+                 * @returns: the number of bytes decoded per second
+                 */
+                double decodeThroughput () const;
+        };
+
+        /**
+         * Compression of the blocks written by the persisters
+         * @warning: a codec is not thread safe, it must be used by one thread at a time
+         */
+        class BlockCodec {
+        public:
+
+                /**
+                 * @returns: the kind of codec
+                 */
+                virtual CodecKind kind () const = 0;
+
+                /**
+                 * Compress a block
+                 * @params:
+                 *    - in: the block to compress
+                 *    - size: the size of the block
+                 *    - out: the buffer in which the compressed block is written
+                 *    - capacity: the size of out
+                 * @returns: the length of the compressed block, 0 if it does not fit in capacity
+                 */
+                virtual uint64_t compress (const uint8_t * in, uint64_t size, uint8_t * out, uint64_t capacity) = 0;
+
+                /**
+                 * Decompress a block
+                 * @params:
+                 *    - in: the compressed block
+                 *    - length: the length of the compressed block
+                 *    - out: the buffer in which the block is written
+                 *    - size: the size of the block
+                 * @returns: true if the block was decompressed, false if it was corrupted
+                 */
+                virtual bool decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) const = 0;
+
+                /**
+                 * Create a codec
+                 */
+                static BlockCodec * create (CodecKind kind);
+
+                virtual ~BlockCodec ();
+
+        };
+
+        /**
+         * No compression, blocks are copied as is
+         */
+        class RawCodec : public BlockCodec {
+        public:
+
+                CodecKind kind () const override;
+                uint64_t compress (const uint8_t * in, uint64_t size, uint8_t * out, uint64_t capacity) override;
+                bool decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) const override;
+
+        };
+
+        /**
+         * Byte oriented LZ77 compression (lz4 block format)
+         * @info:
+         * ======
+         * Sequences are | token | literals | offset | match |, the token
+         * storing the number of literals and the length of the match on 4
+         * bits each (extended by bytes of 255 when they do not fit).
+         * Matches are found with a single hash table of the last positions
+         * of each 4B sequence, no entropy coding, so decompression is a
+         * sequence of memcpy
+         * ======
+         */
+        class LzCodec : public BlockCodec {
+        private:
+
+                // The last position of each hashed 4B sequence
+                std::vector <uint32_t> _table;
+
+        public:
+
+                LzCodec ();
+
+                CodecKind kind () const override;
+                uint64_t compress (const uint8_t * in, uint64_t size, uint8_t * out, uint64_t capacity) override;
+                bool decompress (const uint8_t * in, uint64_t length, uint8_t * out, uint64_t size) const override;
+
+        };
+
+        /**
+         * Encode a block into a frame, the block is stored raw if the codec does not reduce its size
+         * @params:
+         *    - codec: the codec used to compress the block
+         *    - memory: the block to encode
+         *    - size: the size of the block
+         *    - frame: the buffer in which the frame is written (resized if too small)
+         * @returns: the length of the frame
+         */
+        uint64_t codec_encode (BlockCodec & codec, const uint8_t * memory, uint64_t size, std::vector <uint8_t> & frame);
+
+        /**
+         * Encode a block into a frame
+         * @params:
+         *    - frame: the buffer in which the frame is written, at least sizeof (CodecHeader) + size bytes
+         * @returns: the length of the frame
+         */
+        uint64_t codec_encode (BlockCodec & codec, const uint8_t * memory, uint64_t size, uint8_t * frame);
+
+        /**
+         * Decode a frame written by codec_encode, whatever the codec used to encode it
+         * @params:
+         *    - frame: the frame to decode
+         *    - length: the length of the frame
+         *    - memory: the buffer in which the block is written
+         *    - size: the size of the block
+         * @throws: if the frame is corrupted
+         */
+        void codec_decode (const uint8_t * frame, uint64_t length, uint8_t * memory, uint64_t size);
+
+}
@@ -1,15 +1,33 @@
 #include "persist.hh"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <rd_utils/utils/base64.hh>
 #include <rd_utils/utils/log.hh>
-#include "repo.hh"
 
 namespace rd_utils::memory::cache::remote {
 
-  BlockPersister::BlockPersister () {}
+  BlockPersister::BlockPersister (CodecKind codec) :
+    _codec (BlockCodec::create (codec))
+    , _codecInfo ({codec, 0, 0, 0, 0, 0, 0, 0, 0})
+  {}
+
+  void BlockPersister::setCodec (CodecKind codec) {
+    delete this-> _codec;
+    this-> _codec = BlockCodec::create (codec);
+    this-> _codecInfo = {codec, 0, 0, 0, 0, 0, 0, 0, 0};
+  }
 
   void BlockPersister::printInfo () const {
     std::cout << "Load " << this-> _nbLoaded << " (" << this-> _loadElapsed << "), Save " << this-> _nbSaved << "(" << this-> _saveElapsed << ")\n";
+    std::cout << "Codec " << (uint32_t) this-> _codecInfo.kind << " ratio " << this-> _codecInfo.ratio ()
+              << ", encode " << this-> _codecInfo.encodeThroughput () / (1024 * 1024) << "MB/s"
+              << ", decode " << this-> _codecInfo.decodeThroughput () / (1024 * 1024) << "MB/s"
+              << ", incompressible " << this-> _codecInfo.nbIncompressible << "/" << this-> _codecInfo.nbEncoded << "\n";
   }
 
   void BlockPersister::getInfo (uint64_t & nbWrites, double & writeTime, uint64_t & nbReads, double & readTime) const {
@@ -20,7 +38,57 @@ namespace rd_utils::memory::cache::remote {
     writeTime = this-> _saveElapsed;
   }
 
-  BlockPersister::~BlockPersister () {}
+  void BlockPersister::getInfo (CodecInfo & info) const {
+    info = this-> _codecInfo;
+  }
+
+  void BlockPersister::loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    for (auto & b : blocks) {
+      this-> load (b.addr, b.memory, size);
+    }
+  }
+
+  void BlockPersister::saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    for (auto & b : blocks) {
+      this-> save (b.addr, b.memory, size);
+    }
+  }
+
+  uint64_t BlockPersister::encode (const uint8_t * memory, uint64_t size) {
+    if (this-> _frame.size () < sizeof (CodecHeader) + size) {
+      this-> _frame.resize (sizeof (CodecHeader) + size);
+    }
+
+    return this-> encode (memory, size, this-> _frame.data ());
+  }
+
+  uint64_t BlockPersister::encode (const uint8_t * memory, uint64_t size, uint8_t * frame) {
+    concurrency::timer t;
+    auto length = codec_encode (*this-> _codec, memory, size, frame);
+
+    this-> _codecInfo.encodeTime += t.time_since_start ();
+    this-> _codecInfo.nbEncoded += 1;
+    this-> _codecInfo.rawBytes += size;
+    this-> _codecInfo.encodedBytes += length;
+    if (this-> _codec-> kind () != CodecKind::RAW && length == sizeof (CodecHeader) + size) {
+      this-> _codecInfo.nbIncompressible += 1;
+    }
+
+    return length;
+  }
+
+  void BlockPersister::decode (const uint8_t * frame, uint64_t length, uint8_t * memory, uint64_t size) {
+    concurrency::timer t;
+    codec_decode (frame, length, memory, size);
+
+    this-> _codecInfo.decodeTime += t.time_since_start ();
+    this-> _codecInfo.nbDecoded += 1;
+    this-> _codecInfo.decodedBytes += size;
+  }
+
+  BlockPersister::~BlockPersister () {
+    delete this-> _codec;
+  }
 
   /***
    * =====================================================================
@@ -30,67 +98,339 @@ namespace rd_utils::memory::cache::remote {
    * =====================================================================
    **/
 
-  LocalPersister::LocalPersister (const std::string & path) :
-    _path (path)
+  static inline uint64_t align_slot (uint64_t size) {
+    return (size + LOCAL_SLOT_ALIGN - 1) & ~((uint64_t) LOCAL_SLOT_ALIGN - 1);
+  }
+
+  static void pwrite_all (int fd, const uint8_t * mem, uint64_t size, uint64_t offset) {
+    uint64_t done = 0;
+    while (done != size) {
+      auto nb = ::pwrite (fd, mem + done, size - done, offset + done);
+      if (nb < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error (std::string ("Failed to write block : ") + strerror (errno));
+      }
+
+      done += nb;
+    }
+  }
+
+  static void pread_all (int fd, uint8_t * mem, uint64_t size, uint64_t offset) {
+    uint64_t done = 0;
+    while (done != size) {
+      auto nb = ::pread (fd, mem + done, size - done, offset + done);
+      if (nb < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error (std::string ("Failed to read block : ") + strerror (errno));
+      }
+
+      if (nb == 0) throw std::runtime_error ("Failed to read block : end of file");
+      done += nb;
+    }
+  }
+
+  LocalPersister::LocalPersister (const std::string & path, CodecKind codec, bool direct) :
+    BlockPersister (codec)
+    , _path (path)
+    , _direct (direct)
   {
     this-> _path = this-> _path + "." + std::to_string (getpid ());
-    this-> _buffer = new char [255];
   }
 
-  bool LocalPersister::exists (uint64_t addr) {
-    this-> _nbLoaded += 1;
-    int nb = snprintf (this-> _buffer, 255, "%s%ld", this-> _path.c_str (), addr);
-    this-> _buffer [nb] = '\0';
+  uint32_t LocalPersister::open (uint64_t size) {
+    auto slotSize = align_slot (sizeof (CodecHeader) + size);
+    for (uint32_t i = 0 ; i < this-> _slabs.size () ; i++) {
+      if (this-> _slabs [i].slotSize == slotSize) return i;
+    }
 
-    return utils::file_exists (this-> _buffer);
+    // the first slab keeps the name of the single file of a persister of homogeneous blocks
+    Slab slab = {this-> _path, -1, slotSize, 0, {}};
+    if (this-> _slabs.size () != 0) slab.path += "." + std::to_string (this-> _slabs.size ());
+    slab.path += ".slab";
+
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+    if (this-> _direct) {
+      slab.fd = ::open (slab.path.c_str (), flags | O_DIRECT, 0600);
+      if (slab.fd < 0) { // tmpfs and some other file systems do not support it
+        this-> _direct = false;
+      }
+    }
+
+    if (slab.fd < 0) {
+      slab.fd = ::open (slab.path.c_str (), flags, 0600);
+    }
+
+    if (slab.fd < 0) {
+      throw std::runtime_error (std::string ("Failed to create slab file : ") + strerror (errno));
+    }
+
+    // the batch buffers are big enough for any slot
+    if (slotSize > this-> _maxSlotSize) {
+      for (auto buffer : this-> _batch) free (buffer);
+      this-> _batch.clear ();
+      this-> _maxSlotSize = slotSize;
+    }
+
+    if (this-> _slabs.size () == 0) {
+      this-> _ring = new IoRing (LOCAL_RING_DEPTH);
+      if (!this-> _ring-> isAvailable ()) {
+        delete this-> _ring;
+        this-> _ring = nullptr;
+      }
+    }
+
+    this-> _slabs.push_back (std::move (slab));
+    return this-> _slabs.size () - 1;
+  }
+
+  uint8_t * LocalPersister::batchBuffer (uint32_t i) {
+    while (this-> _batch.size () <= i) {
+      void * buffer = nullptr;
+      if (posix_memalign (&buffer, LOCAL_SLOT_ALIGN, this-> _maxSlotSize) != 0) {
+        throw std::runtime_error ("Failed to allocate io buffer");
+      }
+
+      this-> _batch.push_back (reinterpret_cast <uint8_t*> (buffer));
+    }
+
+    return this-> _batch [i];
+  }
+
+  LocalPersister::Slot & LocalPersister::slotOf (uint64_t addr, uint32_t slab) {
+    // a block saved again is written in place
+    auto it = this-> _slots.find (addr);
+    if (it != this-> _slots.end () && it-> second.slab != slab) {
+      this-> releaseSlot (it-> second);
+      this-> _slots.erase (it);
+      it = this-> _slots.end ();
+    }
+
+    if (it == this-> _slots.end ()) {
+      it = this-> _slots.emplace (addr, Slot {slab, this-> acquireSlot (slab), 0}).first;
+    }
+
+    return it-> second;
+  }
+
+  uint64_t LocalPersister::acquireSlot (uint32_t slab) {
+    auto & s = this-> _slabs [slab];
+    for (uint64_t w = 0 ; w < s.used.size () ; w++) {
+      if (s.used [w] != ~(uint64_t) 0) {
+        auto index = w * 64 + __builtin_ctzll (~s.used [w]);
+        if (index < s.nbSlots) {
+          s.used [w] |= ((uint64_t) 1 << (index % 64));
+          return index;
+        }
+      }
+    }
+
+    // the file is full, it grows but stays sparse until the new slots are written
+    auto index = s.nbSlots;
+    s.nbSlots = std::max ((uint64_t) LOCAL_INITIAL_SLOTS, s.nbSlots * 2);
+    if (::ftruncate (s.fd, s.nbSlots * s.slotSize) != 0) {
+      throw std::runtime_error (std::string ("Failed to extend slab file : ") + strerror (errno));
+    }
+
+    s.used.resize ((s.nbSlots + 63) / 64, 0);
+    s.used [index / 64] |= ((uint64_t) 1 << (index % 64));
+    return index;
+  }
+
+  void LocalPersister::releaseSlot (const Slot & slot) {
+    auto & s = this-> _slabs [slot.slab];
+    s.used [slot.index / 64] &= ~((uint64_t) 1 << (slot.index % 64));
+
+    // the size of the file does not change, but the disk space is given back (the call fails on file systems that do not support it)
+    std::ignore = ::fallocate (s.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, slot.index * s.slotSize, s.slotSize);
+  }
+
+  bool LocalPersister::exists (uint64_t addr) {
+    return this-> _slots.find (addr) != this-> _slots.end ();
   }
 
   void LocalPersister::load (uint64_t addr, uint8_t * memory, uint64_t size) {
     // LOG_INFO ("LOADING block : ", addr);
 
-    this-> _nbLoaded += 1;
-    int nb = snprintf (this-> _buffer, 255, "%s%ld", this-> _path.c_str (), addr);
-    this-> _buffer [nb] = '\0';
+    auto it = this-> _slots.find (addr);
+    if (it == this-> _slots.end ()) {
+      throw std::runtime_error ("Loading a block that was never saved");
+    }
 
+    this-> _nbLoaded += 1;
     concurrency::timer t;
-    auto file = fopen (this-> _buffer, "r");
-    if (file == nullptr) {
-      throw std::runtime_error ("???");
+    auto & slab = this-> _slabs [it-> second.slab];
+    auto offset = it-> second.index * slab.slotSize;
+    auto length = it-> second.length;
+
+    if (this-> _direct) {
+      auto frame = this-> batchBuffer (0);
+      pread_all (slab.fd, frame, align_slot (length), offset);
+      this-> decode (frame, length, memory, size);
+    } else {
+      if (this-> _frame.size () < length) this-> _frame.resize (length);
+      pread_all (slab.fd, this-> _frame.data (), length, offset);
+      this-> decode (this-> _frame.data (), length, memory, size);
     }
 
-    std::ignore = ::fread (memory, size, 1, file);
-    fclose (file);
     this-> _loadElapsed += t.time_since_start ();
-    remove (this-> _buffer);
   }
 
   void LocalPersister::save (uint64_t addr, uint8_t * memory, uint64_t size) {
     // LOG_INFO ("STORING block : ", addr);
 
+    auto index = this-> open (size);
     this-> _nbSaved += 1;
-    int nb = snprintf (this-> _buffer, 255, "%s%ld", this-> _path.c_str (), addr);
-    this-> _buffer [nb] = '\0';
-
     concurrency::timer t;
-    auto file = fopen (this-> _buffer, "w");
-    fwrite (memory, size, 1, file);
-    this-> _saveElapsed += t.time_since_start ();
+    auto & slot = this-> slotOf (addr, index);
+    auto & slab = this-> _slabs [index];
+    auto offset = slot.index * slab.slotSize;
+
+    if (this-> _direct) {
+      auto frame = this-> batchBuffer (0);
+      slot.length = this-> encode (memory, size, frame);
+
+      auto aligned = align_slot (slot.length);
+      memset (frame + slot.length, 0, aligned - slot.length);
+      pwrite_all (slab.fd, frame, aligned, offset);
+    } else {
+      slot.length = this-> encode (memory, size);
+      pwrite_all (slab.fd, this-> _frame.data (), slot.length, offset);
+    }
 
-    fclose (file);
+    this-> _saveElapsed += t.time_since_start ();
   }
 
   void LocalPersister::erase (uint64_t addr) {
     // LOG_INFO ("ERASE block : ", addr);
 
-    int nb = snprintf (this-> _buffer, 255, "%s%ld", this-> _path.c_str (), addr);
-    this-> _buffer [nb] = '\0';
+    auto it = this-> _slots.find (addr);
+    if (it != this-> _slots.end ()) {
+      this-> releaseSlot (it-> second);
+      this-> _slots.erase (it);
+    }
+  }
+
+  void LocalPersister::loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    if (this-> _ring == nullptr || !this-> _ring-> isAvailable () || blocks.size () < 2) {
+      BlockPersister::loadBatch (blocks, size);
+      return;
+    }
+
+    concurrency::timer t;
+    std::vector <int64_t> results;
+    std::vector <Slot> slots;
+    for (uint64_t start = 0 ; start < blocks.size () ; start += this-> _ring-> getCapacity ()) {
+      uint32_t nb = std::min ((uint64_t) this-> _ring-> getCapacity (), blocks.size () - start);
+      results.assign (nb, 0);
+      slots.clear ();
+
+      // every slot is found before the reads are prepared, a failure leaves nothing in the ring
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto it = this-> _slots.find (blocks [start + i].addr);
+        if (it == this-> _slots.end ()) {
+          throw std::runtime_error ("Loading a block that was never saved");
+        }
+
+        slots.push_back (it-> second);
+      }
+
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto & slab = this-> _slabs [slots [i].slab];
+        auto len = this-> _direct ? align_slot (slots [i].length) : slots [i].length;
+        this-> _ring-> prepareRead (slab.fd, this-> batchBuffer (i), len, slots [i].index * slab.slotSize, i);
+      }
+
+      this-> _ring-> submitAndWait (results);
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        if (results [i] < 0) {
+          throw std::runtime_error (std::string ("Failed to read block : ") + strerror (-results [i]));
+        }
+
+        // short reads are completed synchronously
+        auto frame = this-> batchBuffer (i);
+        auto & slab = this-> _slabs [slots [i].slab];
+        auto len = this-> _direct ? align_slot (slots [i].length) : slots [i].length;
+        if ((uint64_t) results [i] < len) {
+          pread_all (slab.fd, frame + results [i], len - results [i], slots [i].index * slab.slotSize + results [i]);
+        }
+
+        this-> decode (frame, slots [i].length, blocks [start + i].memory, size);
+      }
+
+      this-> _nbLoaded += nb;
+    }
 
-    remove (this-> _buffer);
-    fflush (nullptr);
+    this-> _loadElapsed += t.time_since_start ();
+  }
+
+  void LocalPersister::saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    if (blocks.size () == 0) return;
+
+    auto index = this-> open (size);
+    if (this-> _ring == nullptr || !this-> _ring-> isAvailable () || blocks.size () < 2) {
+      BlockPersister::saveBatch (blocks, size);
+      return;
+    }
+
+    concurrency::timer t;
+    std::vector <int64_t> results;
+    std::vector <uint64_t> lengths, offsets;
+    auto & slab = this-> _slabs [index];
+    for (uint64_t start = 0 ; start < blocks.size () ; start += this-> _ring-> getCapacity ()) {
+      uint32_t nb = std::min ((uint64_t) this-> _ring-> getCapacity (), blocks.size () - start);
+      results.assign (nb, 0);
+      lengths.clear ();
+      offsets.clear ();
+
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        auto frame = this-> batchBuffer (i);
+        auto & slot = this-> slotOf (blocks [start + i].addr, index);
+        slot.length = this-> encode (blocks [start + i].memory, size, frame);
+
+        auto len = slot.length;
+        if (this-> _direct) {
+          len = align_slot (slot.length);
+          memset (frame + slot.length, 0, len - slot.length);
+        }
+
+        lengths.push_back (len);
+        offsets.push_back (slot.index * slab.slotSize);
+      }
+
+      // every frame is encoded before the writes are prepared, a failure leaves nothing in the ring
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        this-> _ring-> prepareWrite (slab.fd, this-> batchBuffer (i), lengths [i], offsets [i], i);
+      }
+
+      this-> _ring-> submitAndWait (results);
+      for (uint32_t i = 0 ; i < nb ; i++) {
+        if (results [i] < 0) {
+          throw std::runtime_error (std::string ("Failed to write block : ") + strerror (-results [i]));
+        }
+
+        // short writes are completed synchronously
+        if ((uint64_t) results [i] < lengths [i]) {
+          pwrite_all (slab.fd, this-> batchBuffer (i) + results [i], lengths [i] - results [i], offsets [i] + results [i]);
+        }
+      }
+
+      this-> _nbSaved += nb;
+    }
+
+    this-> _saveElapsed += t.time_since_start ();
   }
 
   LocalPersister::~LocalPersister () {
-    delete [] this-> _buffer;
+    for (auto & slab : this-> _slabs) {
+      ::close (slab.fd);
+      ::unlink (slab.path.c_str ());
+    }
+
+    for (auto buffer : this-> _batch) {
+      free (buffer);
+    }
+
+    delete this-> _ring;
   }
 
   /***
@@ -102,8 +442,9 @@ namespace rd_utils::memory::cache::remote {
    **/
 
 
-  RemotePersister::RemotePersister (net::SockAddrV4 addr) :
-    _addr (addr)
+  RemotePersister::RemotePersister (net::SockAddrV4 addr, CodecKind codec) :
+    BlockPersister (codec)
+    , _addr (addr)
   {
     net::TcpStream r (this-> _addr);
     r.connect ();
@@ -114,96 +455,197 @@ namespace rd_utils::memory::cache::remote {
     r.close ();
   }
 
-  bool RemotePersister::exists (uint64_t addr) {
-    net::TcpStream r (this-> _addr);
-    r.connect ();
+  net::TcpStream & RemotePersister::session (uint32_t i) {
+    if (this-> _sessions.size () <= i) {
+      this-> _sessions.resize (i + 1);
+    }
 
-    r.sendU32 ((uint32_t) RepositoryProtocol::EXISTS);
-    r.sendU32 (this-> _clientId);
-    r.sendU64 (addr);
-    auto result = r.receiveU32 ();
+    auto & str = this-> _sessions [i];
+    if (str == nullptr || !str-> isOpen ()) {
+      str = std::make_shared <net::TcpStream> (this-> _addr);
+      str-> connect ();
 
-    r.close ();
+      // requests are small and pipelined, they must not wait for the acks of the previous ones
+      int flag = 1;
+      ::setsockopt (str-> getHandle (), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof (int));
 
-    return result == 1;
-  }
+      str-> sendU32 ((uint32_t) RepositoryProtocol::SESSION);
+      str-> sendU32 (this-> _clientId);
 
-  void RemotePersister::load (uint64_t addr, uint8_t * memory, uint64_t size) {
-    concurrency::timer t;
-    net::TcpStream r (this-> _addr);
-    r.connect ();
+      // the repository refuses the sessions it has no worker for
+      if (str-> receiveU32 () != 1) {
+        str-> close ();
+        str = nullptr;
+        throw std::runtime_error ("Session refused by the repository");
+      }
+    }
 
-    r.sendU32 ((uint32_t) RepositoryProtocol::LOAD);
-    r.sendU32 (this-> _clientId);
-    r.sendU64 (addr);
+    return *str;
+  }
 
-    this-> read (r, memory, size);
-    this-> _loadElapsed += t.time_since_start ();
-    this-> _nbLoaded += 1;
+  uint32_t RemotePersister::openSessions (uint64_t nbBlocks) {
+    // the first session is needed, a refusal is an error
+    this-> session (0);
+
+    uint32_t nb = std::min ((uint64_t) this-> _maxSessions, nbBlocks);
+    for (uint32_t i = 1 ; i < nb ; i++) {
+      try {
+        this-> session (i);
+      } catch (const std::runtime_error &) {
+        // the repository is busy, the batches of this persister use fewer sessions from now on
+        this-> _maxSessions = i;
+        return i;
+      }
+    }
 
-    r.close ();
+    return std::max (nb, (uint32_t) 1);
   }
 
-  void RemotePersister::save (uint64_t addr, uint8_t * memory, uint64_t size) {
-    concurrency::timer t;
+  uint32_t RemotePersister::request (net::TcpStream & str, RepositoryProtocol op, uint64_t addr, uint32_t size, const uint8_t * frame, uint32_t length) {
+    this-> _lastId += 1;
+    RepositoryRequest req = {(uint32_t) op, this-> _lastId, addr, length, size};
 
-    net::TcpStream r (this-> _addr);
-    r.connect ();
+    str.sendRaw (&req, 1);
+    if (length != 0) {
+      str.sendRaw (frame, length);
+    }
 
-    r.sendU32 ((uint32_t) RepositoryProtocol::STORE);
-    r.sendU32 (this-> _clientId);
-    r.sendU64 (addr);
+    return req.id;
+  }
 
-    this-> write (r, memory, size);
-    this-> _saveElapsed += t.time_since_start ();
-    this-> _nbSaved += 1;
+  uint32_t RemotePersister::response (net::TcpStream & str, uint32_t id) {
+    RepositoryResponse resp;
+    str.receiveRaw (&resp, 1);
+    if (resp.id != id) {
+      throw std::runtime_error ("Unexpected response from repository");
+    }
 
-    r.close ();
+    return resp.status;
   }
 
-  void RemotePersister::erase (uint64_t addr) {
-    net::TcpStream r (this-> _addr);
-    r.connect ();
+  bool RemotePersister::exists (uint64_t addr) {
+    WITH_LOCK (this-> _m) {
+      auto & str = this-> session (0);
+      auto id = this-> request (str, RepositoryProtocol::EXISTS, addr);
 
-    r.sendU32 ((uint32_t) RepositoryProtocol::ERASE);
-    r.sendU32 (this-> _clientId);
-    r.sendU64 (addr);
-    r.close ();
+      return this-> response (str, id) == 1;
+    }
   }
 
-  void RemotePersister::write (net::TcpStream & str, uint8_t * mem, uint64_t size) {
-    auto handle = str.getHandle ();
-    auto rest = size;
+  void RemotePersister::load (uint64_t addr, uint8_t * memory, uint64_t size) {
+    this-> loadBatch ({{addr, memory}}, size);
+  }
 
-    LOG_INFO ("WritingBlock : ", "=>", rest);
-    if (rest != 0) {
-      uint32_t val = 0;
-      do {
-        auto val_ = ::send (handle, &mem[val], rest - val, 0);
-        val += val_;
-      } while (val != rest);
+  void RemotePersister::save (uint64_t addr, uint8_t * memory, uint64_t size) {
+    this-> saveBatch ({{addr, memory}}, size);
+  }
+
+  void RemotePersister::erase (uint64_t addr) {
+    WITH_LOCK (this-> _m) {
+      auto & str = this-> session (0);
+      auto id = this-> request (str, RepositoryProtocol::ERASE, addr);
+
+      this-> response (str, id);
     }
   }
 
-  void RemotePersister::read (net::TcpStream & str, uint8_t * mem, uint64_t size) {
-    auto handle = str.getHandle ();
-    auto rest = size; // % WRITE_BUFFER_SIZE;
-    LOG_INFO ("Reading Block : ", "=>", rest);
+  void RemotePersister::loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    WITH_LOCK (this-> _m) {
+      concurrency::timer t;
+      uint32_t nbSessions = this-> openSessions (blocks.size ());
+      uint64_t window = nbSessions * REMOTE_PIPELINE_DEPTH;
+
+      // the request of each id
+      std::unordered_map <uint32_t, const BlockIo*> pending;
+      std::vector <uint32_t> inFlight;
+      for (uint64_t start = 0 ; start < blocks.size () ; start += window) {
+        uint64_t end = std::min (blocks.size (), start + window);
+        inFlight.assign (nbSessions, 0);
+
+        // all the requests of the window are sent before reading any response
+        for (uint64_t i = start ; i < end ; i++) {
+          auto s = i % nbSessions;
+          auto id = this-> request (this-> session (s), RepositoryProtocol::LOAD, blocks [i].addr, size);
+          pending.emplace (id, &blocks [i]);
+          inFlight [s] += 1;
+        }
+
+        for (uint32_t s = 0 ; s < nbSessions ; s++) {
+          auto & str = this-> session (s);
+          for (uint32_t k = 0 ; k < inFlight [s] ; k++) {
+            RepositoryResponse resp;
+            str.receiveRaw (&resp, 1);
+
+            auto it = pending.find (resp.id);
+            if (it == pending.end ()) {
+              throw std::runtime_error ("Unexpected response from repository");
+            }
+
+            if (resp.status != 1) {
+              throw std::runtime_error ("Block not found in repository");
+            }
+
+            // the repository encodes the block with its own codec, the frame records which one
+            if (this-> _frame.size () < resp.length) this-> _frame.resize (resp.length);
+            str.receiveRaw (this-> _frame.data (), resp.length);
+
+            this-> decode (this-> _frame.data (), resp.length, it-> second-> memory, size);
+            pending.erase (it);
+          }
+        }
+      }
+
+      this-> _loadElapsed += t.time_since_start ();
+      this-> _nbLoaded += blocks.size ();
+    }
+  }
 
-    if (rest != 0) {
-      uint32_t val = 0;
-      do {
-        auto val_ = ::recv (handle, &mem[val], rest - val, MSG_WAITALL);
-        val += val_;
-      } while (val != rest);
+  void RemotePersister::saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    WITH_LOCK (this-> _m) {
+      concurrency::timer t;
+      uint32_t nbSessions = this-> openSessions (blocks.size ());
+      uint64_t window = nbSessions * REMOTE_PIPELINE_DEPTH;
+
+      std::unordered_map <uint32_t, uint64_t> pending;
+      std::vector <uint32_t> inFlight;
+      for (uint64_t start = 0 ; start < blocks.size () ; start += window) {
+        uint64_t end = std::min (blocks.size (), start + window);
+        inFlight.assign (nbSessions, 0);
+
+        // the acks are tiny, they wait in the socket buffers while the next blocks are sent
+        for (uint64_t i = start ; i < end ; i++) {
+          auto s = i % nbSessions;
+          auto length = this-> encode (blocks [i].memory, size);
+          auto id = this-> request (this-> session (s), RepositoryProtocol::STORE, blocks [i].addr, size, this-> _frame.data (), length);
+          pending.emplace (id, blocks [i].addr);
+          inFlight [s] += 1;
+        }
+
+        for (uint32_t s = 0 ; s < nbSessions ; s++) {
+          auto & str = this-> session (s);
+          for (uint32_t k = 0 ; k < inFlight [s] ; k++) {
+            RepositoryResponse resp;
+            str.receiveRaw (&resp, 1);
+            if (pending.erase (resp.id) == 0 || resp.status != 1) {
+              throw std::runtime_error ("Failed to store block in repository");
+            }
+          }
+        }
+      }
+
+      this-> _saveElapsed += t.time_since_start ();
+      this-> _nbSaved += blocks.size ();
     }
   }
 
   RemotePersister::~RemotePersister () {
-    std::cout << "Closing socket ?" << std::endl;
-    net::TcpStream r (this-> _addr);
-    r.sendU32 ((uint32_t) RepositoryProtocol::CLOSE);
-    r.close ();
+    for (auto & str : this-> _sessions) {
+      if (str != nullptr && str-> isOpen ()) {
+        RepositoryRequest req = {(uint32_t) RepositoryProtocol::CLOSE, 0, 0, 0, 0};
+        str-> sendRaw (&req, 1, false);
+        str-> close ();
+      }
+    }
   }
 
 }
@@ -2,32 +2,76 @@
 
 #include <string>
 #include <cstdio>
+#include <vector>
+#include <unordered_map>
 #include <rd_utils/concurrency/timer.hh>
+#include <rd_utils/memory/cache/remote/codec.hh>
+#include <rd_utils/memory/cache/remote/uring.hh>
 #include <rd_utils/net/_.hh>
+#include <rd_utils/memory/cache/remote/protocol.hh>
 
 
 namespace rd_utils::memory::cache::remote {
 
+// The alignment of the slots of the local persister (the granularity of O_DIRECT io)
+#define LOCAL_SLOT_ALIGN 4096
+
+// The number of slots of the slab file when it is created (doubled each time it is full)
+#define LOCAL_INITIAL_SLOTS 64
+
+// The maximum number of blocks read or written by a single io_uring submission
+#define LOCAL_RING_DEPTH 32
+
+        /**
+         * A block read or written by a batch
+         */
+        struct BlockIo {
+                // The address of the block
+                uint64_t addr;
+
+                // The memory of the block
+                uint8_t * memory;
+        };
+
         class BlockPersister {
         protected:
 
                 // The number of time a block had to be loaded
-                uint32_t _nbLoaded;
+                uint32_t _nbLoaded = 0;
 
                 // The number of times a block was saved to disk
-                uint32_t _nbSaved;
+                uint32_t _nbSaved = 0;
 
                 // Time taken by loads
-                float _loadElapsed;
+                float _loadElapsed = 0;
 
                 // Time taken by saves
-                float _saveElapsed;
+                float _saveElapsed = 0;
 
                 concurrency::timer _t;
 
+                // The codec used to encode the saved blocks
+                BlockCodec * _codec;
+
+                // The statistics of the codec
+                CodecInfo _codecInfo;
+
+                // The last encoded (or received) frame
+                std::vector <uint8_t> _frame;
+
         public:
 
-                BlockPersister ();
+                /**
+                 * @params:
+                 *    - codec: the codec used to encode the saved blocks
+                 */
+                BlockPersister (CodecKind codec = CodecKind::RAW);
+
+                /**
+                 * Change the codec used to encode the saved blocks
+                 * @info: blocks saved with another codec can still be loaded, every block records its codec
+                 */
+                void setCodec (CodecKind codec);
 
                 /**
                  * @returns: true if the block exists
@@ -36,7 +80,7 @@ namespace rd_utils::memory::cache::remote {
 
                 /**
                  * Load a block from disk
-                 * @warning: delete the block from disk
+                 * @info: the block is kept until it is erased, a block that was not modified since its load does not need to be saved again
                  */
                 virtual void load (uint64_t addr, uint8_t* memory, uint64_t size) = 0;
 
@@ -50,11 +94,29 @@ namespace rd_utils::memory::cache::remote {
                  */
                 virtual void erase (uint64_t addr) = 0;
 
+                /**
+                 * Load many blocks at once
+                 * @params:
+                 *    - blocks: the blocks to load (all different)
+                 *    - size: the size of a block
+                 * @info: the default implementation loads the blocks one by one
+                 */
+                virtual void loadBatch (const std::vector <BlockIo> & blocks, uint64_t size);
+
+                /**
+                 * Save many blocks at once
+                 * @params:
+                 *    - blocks: the blocks to save (all different)
+                 *    - size: the size of a block
+                 * @info: the default implementation saves the blocks one by one
+                 */
+                virtual void saveBatch (const std::vector <BlockIo> & blocks, uint64_t size);
+
 
                 /**
                  * Print persister informations to stdout
                  */
-                void printInfo () const;
+                virtual void printInfo () const;
 
                 /**
                  * Retreive persiter statistics
@@ -66,29 +128,121 @@ namespace rd_utils::memory::cache::remote {
                  */
                 void getInfo (uint64_t & nbWrites, double & writeTime, uint64_t & nbReads, double & readTime) const;
 
+                /**
+                 * Retreive the statistics of the codec
+                 * @returns:
+                 *    - info: the number of encoded/decoded blocks, their sizes, and the time taken to encode/decode them
+                 */
+                void getInfo (CodecInfo & info) const;
+
                 virtual ~BlockPersister () = 0;
 
+        protected:
+
+                /**
+                 * Encode a block into this-> _frame
+                 * @returns: the length of the frame
+                 */
+                uint64_t encode (const uint8_t * memory, uint64_t size);
+
+                /**
+                 * Encode a block into a frame of at least sizeof (CodecHeader) + size bytes
+                 * @returns: the length of the frame
+                 */
+                uint64_t encode (const uint8_t * memory, uint64_t size, uint8_t * frame);
+
+                /**
+                 * Decode a frame into the block memory
+                 * @params:
+                 *    - frame: the frame to decode
+                 *    - length: the length of the frame
+                 */
+                void decode (const uint8_t * frame, uint64_t length, uint8_t * memory, uint64_t size);
+
         };
 
 
         /**
          * Class to read/write blocks from memory to disk
+         * @info:
+         * ======
+         * The blocks of a size are stored in a single sparse file divided in
+         * slots of the same size (the size of a frame rounded to
+         * LOCAL_SLOT_ALIGN), a persister shared by blocks of different sizes
+         * has one slab file per size.
+         * Blocks are read and written with positional io (no seek, no
+         * open/close), the free slots are found in a bitmap, and erased
+         * slots are punched out of the file to give the disk space back.
+         * Batches are submitted to an io_uring, one syscall for many blocks,
+         * and use synchronous io if io_uring is not available
+         * ======
          */
         class LocalPersister : public BlockPersister {
         private:
 
-                // The root path of the persister
+                struct Slot {
+                        // The slab file of the slot
+                        uint32_t slab;
+
+                        // The index of the slot in the file
+                        uint64_t index;
+
+                        // The length of the frame stored in the slot
+                        uint64_t length;
+                };
+
+                /**
+                 * A slab file, holding the blocks of one size
+                 */
+                struct Slab {
+                        // The path of the file
+                        std::string path;
+
+                        // The file
+                        int fd;
+
+                        // The size of a slot
+                        uint64_t slotSize;
+
+                        // The number of slots in the file
+                        uint64_t nbSlots;
+
+                        // The used slots (one bit per slot)
+                        std::vector <uint64_t> used;
+                };
+
+        private:
+
+                // The path of the slab files (without the extension)
                 std::string _path;
 
-                char * _buffer;
+                // Open the files with O_DIRECT (bypassing the page cache)
+                bool _direct;
+
+                // The slab files (one per size of block, created on the first save of a block of that size)
+                std::vector <Slab> _slabs;
+
+                // The size of the biggest slot (the size of the batch buffers)
+                uint64_t _maxSlotSize = 0;
+
+                // The slot of each persisted block
+                std::unordered_map <uint64_t, Slot> _slots;
+
+                // The ring used to submit the batches (nullptr if io_uring is not available)
+                IoRing * _ring = nullptr;
+
+                // The aligned frames of the batches (one per block of a submission)
+                std::vector <uint8_t*> _batch;
 
         public:
 
                 /**
                  * @params:
                  *    - path: the directory in which block will be persisted
+                 *    - codec: the codec used to encode the saved blocks
+                 *    - direct: bypass the page cache (falls back to buffered io if the file system does not support it)
                  */
-                LocalPersister (const std::string & path = "./");
+                LocalPersister (const std::string & path = "./", CodecKind codec = CodecKind::RAW, bool direct = false);
 
                 /**
                  * @returns: true if the block exist
@@ -97,7 +251,7 @@ namespace rd_utils::memory::cache::remote {
 
                 /**
                  * Load a block from disk
-                 * @warning: delete the block from disk
+                 * @info: the block is kept until it is erased, a block that was not modified since its load does not need to be saved again
                  */
                  void load (uint64_t addr, uint8_t* memory, uint64_t size) override;
 
@@ -111,14 +265,61 @@ namespace rd_utils::memory::cache::remote {
                  */
                  void erase (uint64_t addr) override;
 
+                /**
+                 * Load many blocks with a single submission
+                 */
+                 void loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
+                /**
+                 * Save many blocks with a single submission
+                 */
+                 void saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
                 /**
                  * Clear the persiter
                  */
                 ~LocalPersister ();
 
+        private:
+
+                /**
+                 * @returns: the slab file whose slots store a frame of a block of size /size/ (created if it does not exist)
+                 */
+                uint32_t open (uint64_t size);
+
+                /**
+                 * @returns: a free slot of a slab file (the file is extended if there is none)
+                 */
+                uint64_t acquireSlot (uint32_t slab);
+
+                /**
+                 * @returns: the slot of a block in a slab file, a new slot is acquired if the block was never saved (or was saved with another size)
+                 */
+                Slot & slotOf (uint64_t addr, uint32_t slab);
+
+                /**
+                 * @returns: the ith aligned frame buffer of the batches
+                 */
+                uint8_t * batchBuffer (uint32_t i);
+
+                /**
+                 * Free a slot and punch it out of its file
+                 */
+                void releaseSlot (const Slot & slot);
+
         };
 
 
+        /**
+         * Persister storing the blocks in a remote repository
+         * @info:
+         * ======
+         * The persister keeps a pool of sessions (long lived connections)
+         * with the repository. Requests carry an id, so a batch sends all
+         * its requests (spread over the sessions) before reading the
+         * responses, in whatever order they come back
+         * ======
+         */
         class RemotePersister : public BlockPersister {
         private:
 
@@ -128,20 +329,32 @@ namespace rd_utils::memory::cache::remote {
                 // The id of the persiter
                 uint32_t _clientId;
 
+                // The sessions with the repository (opened on first use)
+                std::vector <std::shared_ptr <net::TcpStream> > _sessions;
+
+                // The maximum number of sessions used by a batch (lowered when the repository refuses a session)
+                uint32_t _maxSessions = REMOTE_POOL_SIZE;
+
+                // The id of the next request
+                uint32_t _lastId = 0;
+
+                concurrency::mutex _m;
+
         public:
 
                 /**
                  * @params:
                  *    - addr: the address of the remote repository
+                 *    - codec: the codec used to encode the blocks sent to the repository
                  */
-                RemotePersister (net::SockAddrV4 addr);
+                RemotePersister (net::SockAddrV4 addr, CodecKind codec = CodecKind::RAW);
 
 
                  bool exists (uint64_t addr) override;
 
                 /**
                  * Load a block from disk
-                 * @warning: delete the block from disk
+                 * @info: the block is kept until it is erased, a block that was not modified since its load does not need to be saved again
                  */
                  void load (uint64_t addr, uint8_t* memory, uint64_t size) override;
 
@@ -155,6 +368,16 @@ namespace rd_utils::memory::cache::remote {
                  */
                 void erase (uint64_t addr) override;
 
+                /**
+                 * Load many blocks, with many requests in flight on every session
+                 */
+                void loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
+                /**
+                 * Save many blocks, with many requests in flight on every session
+                 */
+                void saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
                 /**
                  * Close the remote connection
                  */
@@ -163,9 +386,32 @@ namespace rd_utils::memory::cache::remote {
 
         private:
 
-                void read (net::TcpStream & str, uint8_t * mem, uint64_t size);
+                /**
+                 * @returns: the ith session with the repository (connected if it was not)
+                 * @throws: if the repository refused the session
+                 */
+                net::TcpStream & session (uint32_t i);
+
+                /**
+                 * Open the sessions of a batch
+                 * @returns: the number of sessions the batch can use
+                 * @throws: if the repository refused the first session
+                 */
+                uint32_t openSessions (uint64_t nbBlocks);
 
-                void write (net::TcpStream & str, uint8_t * mem, uint64_t size);
+                /**
+                 * Send a request on a session
+                 * @params:
+                 *    - size: the size of the block (STORE and LOAD)
+                 *    - frame: the frame following the request (STORE only)
+                 * @returns: the id of the request
+                 */
+                uint32_t request (net::TcpStream & str, RepositoryProtocol op, uint64_t addr, uint32_t size = 0, const uint8_t * frame = nullptr, uint32_t length = 0);
+
+                /**
+                 * Receive the response of a request whose frame is not expected
+                 */
+                uint32_t response (net::TcpStream & str, uint32_t id);
 
         };
 
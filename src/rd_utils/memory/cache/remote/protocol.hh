@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rd_utils::memory::cache::remote {
+
+// The number of sessions opened by a remote persister
+#define REMOTE_POOL_SIZE 4
+
+// The maximum number of requests in flight on a session during a batch
+#define REMOTE_PIPELINE_DEPTH 8
+
+  enum class RepositoryProtocol : uint32_t {
+    STORE = 1,
+    EXISTS,
+    LOAD,
+    ERASE,
+    REGISTER,
+    CLOSE,
+    SESSION // answered by 1 if the session is accepted, 0 if the repository has no worker left for it
+  };
+
+  /**
+   * A request sent on a session
+   * @info:
+   * ======
+   * A session is a connection kept open by a client, on which it sends
+   * requests without waiting for the previous responses. Every request
+   * has an id repeated in its response, so the client does not depend on
+   * the order of the responses
+   * ======
+   */
+  struct RepositoryRequest {
+    // The operation (RepositoryProtocol)
+    uint32_t op;
+
+    // The id of the request
+    uint32_t id;
+
+    // The address of the block
+    uint64_t addr;
+
+    // The length of the frame following the request (STORE only)
+    uint32_t length;
+
+    // The size of the block (STORE and LOAD, 0 means the block size of the repository)
+    uint32_t size;
+  };
+
+  /**
+   * The response to a request of a session
+   */
+  struct RepositoryResponse {
+    // The id of the request
+    uint32_t id;
+
+    // 1 if the operation succeeded (or the block exists), 0 otherwise
+    uint32_t status;
+
+    // The length of the frame following the response (LOAD only)
+    uint32_t length;
+  };
+
+}
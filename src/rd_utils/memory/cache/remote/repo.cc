@@ -1,15 +1,23 @@
 #include "repo.hh"
+#include <algorithm>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 namespace rd_utils::memory::cache::remote {
 
-  Repository::Repository (net::SockAddrV4 addr, uint32_t nbBlocks, uint32_t blockSize) :
+  Repository::Repository (net::SockAddrV4 addr, uint32_t nbBlocks, uint32_t blockSize, CodecKind codec, uint32_t maxCon, EvictionPolicyKind policy, uint32_t quota) :
     _nbBlocks (nbBlocks)
     , _blockSize (blockSize)
     , _addr (addr)
-    , _server (addr, 1)
-  {
-    this-> _persister = new LocalPersister ();
-  }
+    , _server (addr, std::max (maxCon, (uint32_t) 2))
+    , _capacity ((uint64_t) nbBlocks * blockSize)
+    , _resident (0)
+    , _codec (codec)
+    , _policy (policy)
+    , _quota ((uint64_t) (quota == 0 ? nbBlocks : quota) * blockSize)
+    , _maxSessions (std::max (maxCon, (uint32_t) 2) - 1)
+  {}
 
   void Repository::start () {
     this-> _server.start (this, &Repository::onSession);
@@ -29,27 +37,89 @@ namespace rd_utils::memory::cache::remote {
 
   Repository::~Repository () {
     this-> dispose ();
+    for (auto & it : this-> _clients) {
+      for (auto shard : it.second-> shards) {
+        for (auto & block : shard-> blocks) {
+          delete [] block.second.memory;
+        }
+
+        delete shard-> policy;
+        delete shard-> persister;
+        delete shard;
+      }
+
+      delete it.second;
+    }
+
+    this-> _clients.clear ();
+  }
+
+  void Repository::setQuota (uint32_t uid, uint32_t nbBlocks) {
+    auto space = this-> space (uid);
+    auto nb = nbBlocks == 0 ? this-> _nbBlocks : nbBlocks;
+    space-> quota = (uint64_t) nb * this-> _blockSize;
+    for (auto shard : space-> shards) {
+      WITH_LOCK (shard-> m) {
+        shard-> policy-> resize ((nb + REPOSITORY_CLIENT_SHARDS - 1) / REPOSITORY_CLIENT_SHARDS);
+      }
+    }
+
+    // the blocks over the quota are evicted from every shard in turn
+    bool evicted = true;
+    while (space-> used > space-> quota && evicted) {
+      evicted = false;
+      for (auto shard : space-> shards) {
+        WITH_LOCK (shard-> m) {
+          if (space-> used <= space-> quota) break;
+
+          uint32_t size = 0;
+          auto mem = this-> evict (*shard, size);
+          if (mem != nullptr) {
+            this-> release (*space, mem, size);
+            evicted = true;
+          }
+        }
+      }
+    }
+  }
+
+  ClientSpace * Repository::space (uint32_t uid) {
+    WITH_LOCK (this-> _m) {
+      auto it = this-> _clients.find (uid);
+      if (it != this-> _clients.end ()) return it-> second;
+
+      auto space = new ClientSpace ();
+      uint32_t capacity = (this-> _quota / this-> _blockSize + REPOSITORY_CLIENT_SHARDS - 1) / REPOSITORY_CLIENT_SHARDS;
+      for (uint32_t i = 0 ; i < REPOSITORY_CLIENT_SHARDS ; i++) {
+        auto shard = new ClientShard ();
+        shard-> policy = EvictionPolicy::create (this-> _policy, capacity);
+        shard-> persister = new LocalPersister ("./client" + std::to_string (uid) + "." + std::to_string (i), this-> _codec);
+        space-> shards.push_back (shard);
+      }
+
+      space-> quota = this-> _quota;
+      space-> used = 0;
+      space-> sessions = 0;
+
+      this-> _clients.emplace (uid, space);
+      return space;
+    }
+
+    return nullptr;
   }
 
   void Repository::onSession (std::shared_ptr <net::TcpStream> str) {
     auto proto = str-> receiveU32 ();
     switch ((RepositoryProtocol) proto) {
-    case RepositoryProtocol::EXISTS :
-      this-> exists (*str);
-      break;
-    case RepositoryProtocol::STORE:
-      this-> store (*str);
-      break;
-    case RepositoryProtocol::LOAD:
-      this-> load (*str);
-      break;
-    case RepositoryProtocol::ERASE:
-      this-> erase (*str);
+    case RepositoryProtocol::SESSION :
+      this-> session (*str);
       break;
     case RepositoryProtocol::REGISTER:
       LOG_INFO ("New client");
-      this-> _userId ++;
-      str-> sendU32 (this-> _userId);
+      WITH_LOCK (this-> _m) {
+        this-> _userId ++;
+        str-> sendU32 (this-> _userId);
+      }
       break;
     default :
       break;
@@ -58,130 +128,244 @@ namespace rd_utils::memory::cache::remote {
     str-> close ();
   }
 
-  void Repository::exists (net::TcpStream & str) {
-    WITH_LOCK (this-> _m) {
-      uint64_t uid = str.receiveU32 ();
-      uint64_t blid = str.receiveU32 ();
-      auto p = ((uint64_t) (uid << 32)) | blid;
+  void Repository::session (net::TcpStream & str) {
+    uint32_t uid = 0;
+    if (!str.receiveU32 (uid)) return;
 
-      auto memory = this-> _loaded.find (p);
-      if (memory == this-> _loaded.end ()) {
-        str.sendU32 (this-> _persister-> exists (p) ? 1 : 0);
-      } else {
-        str.sendU32 (1);
+    // a refused session does not wait in the queue of the server, the client uses fewer sessions
+    auto space = this-> space (uid);
+    bool accepted = false;
+    WITH_LOCK (this-> _m) {
+      if (this-> _nbSessions < this-> _maxSessions && space-> sessions < REMOTE_POOL_SIZE) {
+        this-> _nbSessions += 1;
+        space-> sessions += 1;
+        accepted = true;
       }
     }
-  }
 
-  void Repository::store (net::TcpStream & str) {
+    if (!accepted) {
+      str.sendU32 (0, false);
+      return;
+    }
+
+    if (str.sendU32 (1, false)) {
+      this-> serve (str, uid, *space);
+    }
+
     WITH_LOCK (this-> _m) {
-      uint64_t uid = str.receiveU32 ();
-      uint64_t blid = str.receiveU32 ();
-      auto p = ((uint64_t) (uid << 32)) | blid;
-
-      auto memory = this-> _loaded.find (p);
-      uint8_t * mem = nullptr;
-      if (memory == this-> _loaded.end ()) {
-        if (this-> _loaded.size () == this-> _nbBlocks) {
-          mem = this-> evict ();
-        }
+      this-> _nbSessions -= 1;
+      space-> sessions -= 1;
+    }
+  }
+
+  void Repository::serve (net::TcpStream & str, uint32_t uid, ClientSpace & space) {
+    // a response is a header followed by a frame, the frame must not wait for the ack of the header
+    int flag = 1;
+    ::setsockopt (str.getHandle (), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof (int));
+
+    // The session is served by this thread until the client closes it, it only locks the shards of its client
+    // The session encodes its responses with its own codec and buffers, so the sessions of a client encode in parallel
+    std::unique_ptr <BlockCodec> codec (BlockCodec::create (this-> _codec));
+    std::vector <uint8_t> frame;
+    std::vector <uint8_t> block (this-> _blockSize);
 
-        if (mem == nullptr) {
-          mem = new uint8_t [this-> _blockSize];
+    RepositoryRequest req;
+    try {
+      while (str.receiveRaw (&req, 1, false)) {
+        switch ((RepositoryProtocol) req.op) {
+        case RepositoryProtocol::EXISTS :
+          this-> exists (str, space, req);
+          break;
+        case RepositoryProtocol::STORE :
+          this-> store (str, space, req, frame, block);
+          break;
+        case RepositoryProtocol::LOAD :
+          this-> load (str, space, req, *codec, frame, block);
+          break;
+        case RepositoryProtocol::ERASE :
+          this-> erase (str, space, req);
+          break;
+        default : // CLOSE, or a corrupted stream
+          return;
         }
+      }
+    } catch (const std::runtime_error & err) {
+      LOG_WARN ("Session of client ", uid, " closed : ", err.what ());
+    }
+  }
+
+  void Repository::exists (net::TcpStream & str, ClientSpace & space, const RepositoryRequest & req) {
+    RepositoryResponse resp = {req.id, 0, 0};
 
-        this-> _loaded.emplace (p, mem);
+    auto & shard = this-> shardOf (space, req.addr);
+    WITH_LOCK (shard.m) {
+      if (shard.blocks.find (req.addr) != shard.blocks.end ()) {
+        resp.status = 1;
       } else {
-        mem = memory-> second;
+        resp.status = shard.persister-> exists (req.addr) ? 1 : 0;
       }
-
-      this-> read (str, mem);
     }
+
+    str.sendRaw (&resp, 1);
   }
 
-  uint8_t* Repository::evict () {
-    if (this-> _loaded.size () != 0) {
-      auto fst = this-> _loaded.begin ();
-      this-> _persister-> save (fst-> first, fst-> second, this-> _blockSize);
-      auto ret = fst-> second;
-      this-> _loaded.erase (fst-> first);
+  void Repository::store (net::TcpStream & str, ClientSpace & space, const RepositoryRequest & req, std::vector <uint8_t> & frame, std::vector <uint8_t> & block) {
+    // the client encodes the block with its own codec, the frame records which one
+    auto size = this-> sizeOf (req);
+    if (req.length > sizeof (CodecHeader) + (uint64_t) size) {
+      throw std::runtime_error ("Frame of " + std::to_string (req.length) + "B for a block of " + std::to_string (size) + "B");
+    }
+
+    if (frame.size () < req.length) frame.resize (req.length);
+    str.receiveRaw (frame.data (), req.length);
+
+    // a corrupted frame throws before the space is modified
+    if (block.size () < size) block.resize (size);
+    codec_decode (frame.data (), req.length, block.data (), size);
 
-      return ret;
-    } else {
-      return nullptr;
+    auto & shard = this-> shardOf (space, req.addr);
+    WITH_LOCK (shard.m) {
+      auto it = shard.blocks.find (req.addr);
+      if (it != shard.blocks.end () && it-> second.size != size) {
+        // the block is replaced by a block of another size
+        this-> remove (space, shard, it);
+        it = shard.blocks.end ();
+      }
+
+      if (it != shard.blocks.end ()) {
+        ::memcpy (it-> second.memory, block.data (), size);
+        it-> second.dirty = true;
+        shard.policy-> onAccess (req.addr);
+      } else {
+        auto mem = this-> reserve (space, shard, size);
+        if (mem != nullptr) {
+          ::memcpy (mem, block.data (), size);
+          shard.blocks.emplace (req.addr, RepositoryBlock {mem, size, true});
+          shard.policy-> onLoad (req.addr);
+        } else {
+          // the client has no room in memory, the block is written through to disk
+          shard.persister-> save (req.addr, block.data (), size);
+        }
+      }
     }
+
+    RepositoryResponse resp = {req.id, 1, 0};
+    str.sendRaw (&resp, 1);
   }
 
-  void Repository::load (net::TcpStream & str) {
-    WITH_LOCK (this-> _m) {
-      concurrency::timer t;
-      uint64_t uid = str.receiveU32 ();
-      uint64_t blid = str.receiveU32 ();
-      auto p = ((uint64_t) (uid << 32)) | blid;
-
-      auto memory = this-> _loaded.find (p);
-      uint8_t * mem = nullptr;
-      if (memory == this-> _loaded.end ()) {
-        if (this-> _loaded.size () == this-> _nbBlocks) {
-          mem = this-> evict ();
-        }
+  void Repository::load (net::TcpStream & str, ClientSpace & space, const RepositoryRequest & req, BlockCodec & codec, std::vector <uint8_t> & frame, std::vector <uint8_t> & block) {
+    RepositoryResponse resp = {req.id, 0, 0};
 
-        if (mem == nullptr) {
-          mem = new uint8_t [this-> _blockSize];
+    auto size = this-> sizeOf (req);
+    auto & shard = this-> shardOf (space, req.addr);
+    WITH_LOCK (shard.m) {
+      auto it = shard.blocks.find (req.addr);
+      if (it != shard.blocks.end ()) {
+        shard.policy-> onAccess (req.addr);
+        resp.status = 1;
+        resp.length = codec_encode (codec, it-> second.memory, it-> second.size, frame);
+      } else if (shard.persister-> exists (req.addr)) {
+        // the block stays cached (clean) after the load, the client may drop it without storing it again
+        auto mem = this-> reserve (space, shard, size);
+        if (mem != nullptr) {
+          shard.persister-> load (req.addr, mem, size);
+          shard.blocks.emplace (req.addr, RepositoryBlock {mem, size, false});
+          shard.policy-> onLoad (req.addr);
+        } else {
+          if (block.size () < size) block.resize (size);
+          mem = block.data ();
+          shard.persister-> load (req.addr, mem, size);
         }
 
-        this-> _loaded.emplace (p, mem);
-        this-> _persister-> load (p, mem, this-> _blockSize);
-      } else {
-        mem = memory-> second;
+        resp.status = 1;
+        resp.length = codec_encode (codec, mem, size, frame);
       }
+    }
 
-      this-> write (str, mem);
-      delete [] mem;
-      this-> _loaded.erase (p);
+    str.sendRaw (&resp, 1);
+    if (resp.status == 1) {
+      str.sendRaw (frame.data (), resp.length);
     }
   }
 
-  void Repository::erase (net::TcpStream & str) {
-    WITH_LOCK (this-> _m) {
-      uint64_t uid = str.receiveU32 ();
-      uint64_t blid = str.receiveU32 ();
-      auto p = ((uint64_t) (uid << 32)) | blid;
-
-      auto memory = this-> _loaded.find (p);
-      if (memory != this-> _loaded.end ()) {
-        delete[] memory-> second;
-        this-> _loaded.erase (p);
-      } else {
-        this-> _persister-> erase (p);
+  void Repository::erase (net::TcpStream & str, ClientSpace & space, const RepositoryRequest & req) {
+    auto & shard = this-> shardOf (space, req.addr);
+    WITH_LOCK (shard.m) {
+      auto it = shard.blocks.find (req.addr);
+      if (it != shard.blocks.end ()) {
+        this-> remove (space, shard, it);
       }
+
+      // a resident block can also have a persisted copy
+      shard.persister-> erase (req.addr);
     }
+
+    RepositoryResponse resp = {req.id, 1, 0};
+    str.sendRaw (&resp, 1);
+  }
+
+  uint32_t Repository::sizeOf (const RepositoryRequest & req) const {
+    return req.size == 0 ? this-> _blockSize : req.size;
+  }
+
+  ClientShard & Repository::shardOf (ClientSpace & space, uint64_t addr) const {
+    return *space.shards [addr % REPOSITORY_CLIENT_SHARDS];
   }
 
-  void Repository::read (net::TcpStream & stream, uint8_t * mem) {
-    auto handle = stream.getHandle ();
-    auto rest = this-> _blockSize;
+  uint8_t* Repository::reserve (ClientSpace & space, ClientShard & shard, uint32_t size) {
+    for (;;) {
+      // the room is taken in the quota of the client, then in the capacity of the repository
+      auto used = space.used.load ();
+      while (used + size <= space.quota) {
+        if (space.used.compare_exchange_weak (used, used + size)) {
+          auto nb = this-> _resident.load ();
+          while (nb + size <= this-> _capacity) {
+            if (this-> _resident.compare_exchange_weak (nb, nb + size)) {
+              return new uint8_t [size];
+            }
+          }
 
-    if (rest != 0) {
-      uint32_t val = 0;
-      do {
-        auto val_ = ::recv (handle, &mem[val], rest - val, MSG_WAITALL);
-        val += val_;
-      } while (val != rest);
+          space.used -= size;
+          break;
+        }
+      }
+
+      // a client at its quota, or in a full repository, replaces its own blocks of the shard (the blocks of the other clients are never evicted)
+      uint32_t evicted = 0;
+      auto mem = this-> evict (shard, evicted);
+      if (mem == nullptr || evicted == size) return mem;
+
+      // a block of another size makes room for the new one, but its memory cannot be reused
+      this-> release (space, mem, evicted);
     }
   }
 
-  void Repository::write (net::TcpStream & stream, uint8_t * mem) {
-    auto handle = stream.getHandle ();
-    auto rest = this-> _blockSize;
+  uint8_t* Repository::evict (ClientShard & shard, uint32_t & size) {
+    auto addr = shard.policy-> evict ();
+    auto it = shard.blocks.find (addr);
+    if (it == shard.blocks.end ()) return nullptr;
 
-    if (rest != 0) {
-      uint32_t val = 0;
-      do {
-        auto val_ = ::send (handle, &mem[val], rest - val, 0);
-        val += val_;
-      } while (val != rest);
+    // a clean block already has an up to date copy on disk
+    if (it-> second.dirty) {
+      shard.persister-> save (addr, it-> second.memory, it-> second.size);
     }
+
+    auto mem = it-> second.memory;
+    size = it-> second.size;
+    shard.blocks.erase (it);
+    return mem;
+  }
+
+  void Repository::remove (ClientSpace & space, ClientShard & shard, std::unordered_map <uint64_t, RepositoryBlock>::iterator it) {
+    shard.policy-> onRemove (it-> first);
+    this-> release (space, it-> second.memory, it-> second.size);
+    shard.blocks.erase (it);
+  }
+
+  void Repository::release (ClientSpace & space, uint8_t * memory, uint32_t size) {
+    delete [] memory;
+    space.used -= size;
+    this-> _resident.fetch_sub (size);
   }
 
 }
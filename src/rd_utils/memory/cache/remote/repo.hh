@@ -3,19 +3,82 @@
 
 #include <rd_utils/net/server.hh>
 #include <rd_utils/memory/cache/_.hh>
+#include <rd_utils/memory/cache/remote/protocol.hh>
 #include <memory>
+#include <atomic>
 
 namespace rd_utils::memory::cache::remote {
 
 #define WRITE_BUFFER_SIZE 1024 * 1024 * 1024
 
-  enum class RepositoryProtocol : uint32_t {
-    STORE = 1,
-    EXISTS,
-    LOAD,
-    ERASE,
-    REGISTER,
-    CLOSE
+// The default maximum number of sessions served at the same time by a repository
+#define REPOSITORY_MAX_SESSIONS 16
+
+// The number of shards of the blocks of a client
+#define REPOSITORY_CLIENT_SHARDS 8
+
+  /**
+   * A block resident in the memory of the repository
+   */
+  struct RepositoryBlock {
+    // The content of the block
+    uint8_t * memory;
+
+    // The size of the block
+    uint32_t size;
+
+    // True if the block was stored since it was last written to disk
+    bool dirty;
+  };
+
+  /**
+   * A shard of the blocks of a client
+   * @info:
+   * ======
+   * The blocks of a client are spread over its shards by address. A
+   * shard has its own lock, replacement policy and persister (its own
+   * files), so the sessions of a client accessing blocks of different
+   * shards, and their disk accesses, run in parallel
+   * ======
+   */
+  struct ClientShard {
+    concurrency::mutex m;
+
+    // The resident blocks of the shard (by address in the client)
+    std::unordered_map <uint64_t, RepositoryBlock> blocks;
+
+    // The policy selecting the resident block of the shard to evict
+    EvictionPolicy * policy;
+
+    // The persister to store the evicted blocks of the shard to disk
+    BlockPersister * persister;
+  };
+
+  /**
+   * The blocks of a client
+   * @info:
+   * ======
+   * Every client has its own space in the repository: its shards of
+   * resident blocks and its quota. The sessions of different clients
+   * never wait for each other, and a client that reaches its quota (or
+   * the capacity of the repository) only evicts its own blocks, from the
+   * shard of the block it makes room for. The blocks of a client can
+   * have different sizes (a client whose allocator has size classes),
+   * the quota and the capacity are counted in bytes
+   * ======
+   */
+  struct ClientSpace {
+    // The shards of the blocks (REPOSITORY_CLIENT_SHARDS)
+    std::vector <ClientShard*> shards;
+
+    // The maximum number of bytes of resident blocks of the client
+    std::atomic <uint64_t> quota;
+
+    // The number of bytes of resident blocks of the client
+    std::atomic <uint64_t> used;
+
+    // The number of open sessions of the client (protected by the mutex of the repository)
+    uint32_t sessions;
   };
 
   /**
@@ -38,25 +101,46 @@ namespace rd_utils::memory::cache::remote {
     // Server used for pages input/output
     net::TcpServer _server;
 
-    // The list of loaded blocks
-    std::unordered_map <uint64_t, uint8_t*> _loaded;
+    // The maximum number of bytes of blocks loaded in memory at the same time
+    uint64_t _capacity;
 
-    // The persister to store blocks to disk
-    BlockPersister * _persister;
+    // The number of bytes of blocks resident in memory (all clients)
+    std::atomic <uint64_t> _resident;
+
+    // The codec used to encode the blocks sent to the clients and written to disk
+    CodecKind _codec;
+
+    // The policy used to evict the blocks of the clients
+    EvictionPolicyKind _policy;
+
+    // The default quota of the clients (in bytes)
+    uint64_t _quota;
+
+    // The blocks of each client (protected by _m, a space is never removed before the destruction of the repository)
+    std::unordered_map <uint32_t, ClientSpace*> _clients;
 
     // The last user id
     uint32_t _userId = 0;
 
+    // The maximum number of sessions open at the same time (a worker of the server is always left for the other connections)
+    uint32_t _maxSessions;
+
+    // The number of open sessions (protected by _m)
+    uint32_t _nbSessions = 0;
+
   public:
 
     /**
      * @params:
      *    - addr: the listening address
      *    - nbBlocks: the maximum number of blocks the repository can store into RAM
-     *    - blockSize: the size of a block
-     *    - maxCon: the maximum number of clients that can be connected to the repository at the same time
+     *    - blockSize: the size of a block (the size of the blocks of a request that does not give one)
+     *    - codec: the codec used to encode the blocks sent to the clients and written to disk
+     *    - maxCon: the number of workers of the server, maxCon - 1 sessions are served at the same time (a client opens up to REMOTE_POOL_SIZE sessions, the others are refused)
+     *    - policy: the policy used to select the blocks of a client to evict
+     *    - quota: the maximum number of blocks of a client resident at the same time (0 means nbBlocks, smaller or bigger blocks count for their size)
      */
-    Repository (net::SockAddrV4 addr, uint32_t nbBlocks, uint32_t blockSize);
+    Repository (net::SockAddrV4 addr, uint32_t nbBlocks, uint32_t blockSize, CodecKind codec = CodecKind::RAW, uint32_t maxCon = REPOSITORY_MAX_SESSIONS, EvictionPolicyKind policy = EvictionPolicyKind::LRU, uint32_t quota = 0);
 
     /**
      * Start the repository, now ready for incoming connections and requests
@@ -79,6 +163,14 @@ namespace rd_utils::memory::cache::remote {
      */
     void dispose ();
 
+    /**
+     * Change the quota of a client, its blocks over the quota are evicted to disk
+     * @params:
+     *    - uid: the id of the client
+     *    - nbBlocks: the maximum number of resident blocks of the client (0 means the capacity of the repository, smaller or bigger blocks count for their size)
+     */
+    void setQuota (uint32_t uid, uint32_t nbBlocks);
+
     /**
      * Clear all blocks
      */
@@ -95,39 +187,83 @@ namespace rd_utils::memory::cache::remote {
     void onSession (std::shared_ptr <net::TcpStream>);
 
     /**
-     * Store a block received from the stream
+     * Open a session, and serve its requests until it is closed
+     * @info: a session holds its worker until it is closed, it is refused if it would take the last worker of the server
+     */
+    void session (net::TcpStream&);
+
+    /**
+     * Serve the requests of an accepted session until it is closed
      */
-    void store (net::TcpStream&);
+    void serve (net::TcpStream&, uint32_t uid, ClientSpace & space);
+
+    /**
+     * @returns: the space of a client (created if it does not exist)
+     */
+    ClientSpace * space (uint32_t uid);
+
+    /**
+     * Store a block whose frame follows the request
+     * @params:
+     *    - frame: the buffer of the session
+     *    - block: a buffer of the session (grown to the size of the block), the block is decoded in it
+     * @throws: if the frame is longer than an encoded block or corrupted (nothing is stored)
+     */
+    void store (net::TcpStream&, ClientSpace & space, const RepositoryRequest & req, std::vector <uint8_t> & frame, std::vector <uint8_t> & block);
 
     /**
      * Check if the block exists
      */
-    void exists (net::TcpStream&);
+    void exists (net::TcpStream&, ClientSpace & space, const RepositoryRequest & req);
 
     /**
-     * Load a block received and send it to the stream
+     * Load a block and send it to the stream
+     * @params:
+     *    - codec: the codec of the session
      */
-    void load (net::TcpStream&);
+    void load (net::TcpStream&, ClientSpace & space, const RepositoryRequest & req, BlockCodec & codec, std::vector <uint8_t> & frame, std::vector <uint8_t> & block);
 
     /**
      * Erase an allocated block
      */
-    void erase (net::TcpStream&);
+    void erase (net::TcpStream&, ClientSpace & space, const RepositoryRequest & req);
+
+    /**
+     * @returns: the size of the block of a request
+     */
+    uint32_t sizeOf (const RepositoryRequest & req) const;
+
+    /**
+     * @returns: the shard of the block /addr/ of a client
+     */
+    ClientShard & shardOf (ClientSpace & space, uint64_t addr) const;
+
+    /**
+     * Find the memory of a new resident block of a shard
+     * @info: must be called with the lock of the shard
+     * @returns: the memory of the block, nullptr if the client has no room and the shard no block to evict
+     */
+    uint8_t* reserve (ClientSpace & space, ClientShard & shard, uint32_t size);
 
     /**
-     * Evict a block in the list of loaded blocks
+     * Evict the block of a shard selected by its policy, writing it to disk if it is dirty
+     * @info: must be called with the lock of the shard
+     * @params:
+     *    - size: set to the size of the evicted block
+     * @returns: the memory of the evicted block (still counted as resident), nullptr if the shard has no resident block
      */
-    uint8_t* evict ();
+    uint8_t* evict (ClientShard & shard, uint32_t & size);
 
     /**
-     * Write a block to tcp stream
+     * Remove a resident block of a shard (without writing it to disk)
+     * @info: must be called with the lock of the shard
      */
-    void write (net::TcpStream&, uint8_t*mem);
+    void remove (ClientSpace & space, ClientShard & shard, std::unordered_map <uint64_t, RepositoryBlock>::iterator it);
 
     /**
-     * Read a block from tcp stream
+     * Forget the memory of a block removed from a client
      */
-    void read (net::TcpStream&, uint8_t*mem);
+    void release (ClientSpace & space, uint8_t * memory, uint32_t size);
 
   };
 
@@ -0,0 +1,270 @@
+#include "tiered.hh"
+#include <iostream>
+
+namespace rd_utils::memory::cache::remote {
+
+  /***
+   * =====================================================================
+   * =====================================================================
+   * ========================   MEMORY PERSIST   =========================
+   * =====================================================================
+   * =====================================================================
+   **/
+
+  MemoryPersister::MemoryPersister (CodecKind codec) :
+    BlockPersister (codec)
+  {}
+
+  bool MemoryPersister::exists (uint64_t addr) {
+    return this-> _frames.find (addr) != this-> _frames.end ();
+  }
+
+  void MemoryPersister::load (uint64_t addr, uint8_t * memory, uint64_t size) {
+    auto it = this-> _frames.find (addr);
+    if (it == this-> _frames.end ()) {
+      throw std::runtime_error ("Loading a block that was never saved");
+    }
+
+    this-> _nbLoaded += 1;
+    concurrency::timer t;
+    this-> decode (it-> second.data (), it-> second.size (), memory, size);
+
+    this-> _loadElapsed += t.time_since_start ();
+  }
+
+  void MemoryPersister::save (uint64_t addr, uint8_t * memory, uint64_t size) {
+    this-> _nbSaved += 1;
+    concurrency::timer t;
+    auto length = this-> encode (memory, size);
+
+    // the frame is copied to a buffer of its exact length, the memory saved by the codec is given back
+    auto & frame = this-> _frames [addr];
+    this-> _usedBytes -= frame.size ();
+    frame = std::vector <uint8_t> (this-> _frame.begin (), this-> _frame.begin () + length);
+    this-> _usedBytes += length;
+
+    this-> _saveElapsed += t.time_since_start ();
+  }
+
+  void MemoryPersister::erase (uint64_t addr) {
+    auto it = this-> _frames.find (addr);
+    if (it != this-> _frames.end ()) {
+      this-> _usedBytes -= it-> second.size ();
+      this-> _frames.erase (it);
+    }
+  }
+
+  uint64_t MemoryPersister::getUsedBytes () const {
+    return this-> _usedBytes;
+  }
+
+  /***
+   * =====================================================================
+   * =====================================================================
+   * ========================   TIERED PERSIST   =========================
+   * =====================================================================
+   * =====================================================================
+   **/
+
+  TieredPersister::TieredPersister () :
+    BlockPersister (CodecKind::RAW)
+  {}
+
+  void TieredPersister::addTier (BlockPersister * persister, uint64_t capacity) {
+    this-> _tiers.push_back (Tier {persister, capacity, {}, {}, 0, 0, 0});
+  }
+
+  bool TieredPersister::exists (uint64_t addr) {
+    return this-> find (addr) != this-> _tiers.size ();
+  }
+
+  void TieredPersister::load (uint64_t addr, uint8_t * memory, uint64_t size) {
+    auto t = this-> find (addr);
+    if (t == this-> _tiers.size ()) {
+      throw std::runtime_error ("Loading a block that was never saved");
+    }
+
+    this-> _nbLoaded += 1;
+    concurrency::timer timer;
+
+    this-> _tiers [t].persister-> load (addr, memory, size);
+    this-> _tiers [t].hits += 1;
+    if (t == 0) {
+      this-> touch (this-> _tiers [0], addr);
+    } else {
+      this-> promote (t, {BlockIo {addr, memory}}, size);
+    }
+
+    this-> _loadElapsed += timer.time_since_start ();
+  }
+
+  void TieredPersister::save (uint64_t addr, uint8_t * memory, uint64_t size) {
+    this-> saveBatch ({BlockIo {addr, memory}}, size);
+  }
+
+  void TieredPersister::erase (uint64_t addr) {
+    auto t = this-> find (addr);
+    if (t != this-> _tiers.size ()) {
+      this-> _tiers [t].persister-> erase (addr);
+      this-> forget (this-> _tiers [t], addr);
+    }
+  }
+
+  void TieredPersister::loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    std::vector <std::vector <BlockIo> > groups (this-> _tiers.size ());
+    for (auto & b : blocks) {
+      auto t = this-> find (b.addr);
+      if (t == this-> _tiers.size ()) {
+        throw std::runtime_error ("Loading a block that was never saved");
+      }
+
+      groups [t].push_back (b);
+    }
+
+    this-> _nbLoaded += blocks.size ();
+    concurrency::timer timer;
+
+    // every block is read before any promotion, a promotion can demote the blocks of the lower tiers
+    for (uint32_t t = 0 ; t < groups.size () ; t++) {
+      if (groups [t].size () == 0) continue;
+
+      this-> _tiers [t].persister-> loadBatch (groups [t], size);
+      this-> _tiers [t].hits += groups [t].size ();
+    }
+
+    for (auto & b : groups [0]) {
+      this-> touch (this-> _tiers [0], b.addr);
+    }
+
+    for (uint32_t t = 1 ; t < groups.size () ; t++) {
+      if (groups [t].size () != 0) {
+        this-> promote (t, groups [t], size);
+      }
+    }
+
+    this-> _loadElapsed += timer.time_since_start ();
+  }
+
+  void TieredPersister::saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) {
+    if (this-> _tiers.size () == 0) {
+      throw std::runtime_error ("Saving a block in a tiered persister without tier");
+    }
+
+    this-> _nbSaved += blocks.size ();
+    concurrency::timer timer;
+
+    auto & first = this-> _tiers [0];
+    first.persister-> saveBatch (blocks, size);
+
+    // the new version of the block replaces the one stored in a lower tier
+    for (auto & b : blocks) {
+      auto t = this-> find (b.addr);
+      if (t != 0 && t != this-> _tiers.size ()) {
+        this-> _tiers [t].persister-> erase (b.addr);
+        this-> forget (this-> _tiers [t], b.addr);
+      }
+
+      this-> touch (first, b.addr);
+    }
+
+    this-> demote (0, size);
+    this-> _saveElapsed += timer.time_since_start ();
+  }
+
+  void TieredPersister::promote (uint32_t t, const std::vector <BlockIo> & blocks, uint64_t size) {
+    auto & first = this-> _tiers [0];
+    auto & tier = this-> _tiers [t];
+
+    first.persister-> saveBatch (blocks, size);
+    for (auto & b : blocks) {
+      tier.persister-> erase (b.addr);
+      this-> forget (tier, b.addr);
+      this-> touch (first, b.addr);
+    }
+
+    tier.promotions += blocks.size ();
+    this-> demote (0, size);
+  }
+
+  void TieredPersister::demote (uint32_t t, uint64_t size) {
+    if (t + 1 >= this-> _tiers.size ()) return;
+
+    auto & tier = this-> _tiers [t];
+    if (tier.capacity == 0 || tier.lru.size () <= tier.capacity) return;
+
+    uint64_t nb = tier.lru.size () - tier.capacity;
+    if (this-> _buffer.size () < nb * size) {
+      this-> _buffer.resize (nb * size);
+    }
+
+    std::vector <BlockIo> moved;
+    for (uint64_t i = 0 ; i < nb ; i++) {
+      moved.push_back (BlockIo {tier.lru.back (), this-> _buffer.data () + i * size});
+      this-> forget (tier, tier.lru.back ());
+    }
+
+    auto & next = this-> _tiers [t + 1];
+    tier.persister-> loadBatch (moved, size);
+    next.persister-> saveBatch (moved, size);
+    for (auto & b : moved) {
+      tier.persister-> erase (b.addr);
+      this-> touch (next, b.addr);
+    }
+
+    tier.demotions += nb;
+    this-> demote (t + 1, size);
+  }
+
+  uint32_t TieredPersister::find (uint64_t addr) const {
+    for (uint32_t t = 0 ; t < this-> _tiers.size () ; t++) {
+      if (this-> _tiers [t].pos.find (addr) != this-> _tiers [t].pos.end ()) return t;
+    }
+
+    return this-> _tiers.size ();
+  }
+
+  void TieredPersister::touch (Tier & tier, uint64_t addr) {
+    auto it = tier.pos.find (addr);
+    if (it != tier.pos.end ()) {
+      tier.lru.splice (tier.lru.begin (), tier.lru, it-> second);
+    } else {
+      tier.lru.push_front (addr);
+      tier.pos.emplace (addr, tier.lru.begin ());
+    }
+  }
+
+  void TieredPersister::forget (Tier & tier, uint64_t addr) {
+    auto it = tier.pos.find (addr);
+    if (it != tier.pos.end ()) {
+      tier.lru.erase (it-> second);
+      tier.pos.erase (it);
+    }
+  }
+
+  void TieredPersister::printInfo () const {
+    std::cout << "Load " << this-> _nbLoaded << " (" << this-> _loadElapsed << "), Save " << this-> _nbSaved << "(" << this-> _saveElapsed << ")\n";
+    for (uint32_t t = 0 ; t < this-> _tiers.size () ; t++) {
+      auto & tier = this-> _tiers [t];
+      std::cout << "Tier " << t << " : " << tier.lru.size () << "/" << tier.capacity << " blocks"
+                << ", hits " << tier.hits
+                << ", promotions " << tier.promotions
+                << ", demotions " << tier.demotions << "\n";
+    }
+  }
+
+  void TieredPersister::getInfo (std::vector <TierInfo> & tiers) const {
+    tiers.clear ();
+    for (auto & tier : this-> _tiers) {
+      tiers.push_back (TierInfo {tier.capacity, tier.lru.size (), tier.hits, tier.promotions, tier.demotions});
+    }
+  }
+
+  TieredPersister::~TieredPersister () {
+    for (auto & tier : this-> _tiers) {
+      delete tier.persister;
+    }
+
+    this-> _tiers.clear ();
+  }
+
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <rd_utils/memory/cache/remote/persist.hh>
+
+namespace rd_utils::memory::cache::remote {
+
+        /**
+         * Persister keeping the encoded blocks in memory
+         * @info:
+         * ======
+         * Each block is stored as its frame (sized to the encoded length),
+         * with a compressing codec it is a fast tier in front of a disk
+         * or a repository in a TieredPersister
+         * ======
+         */
+        class MemoryPersister : public BlockPersister {
+        private:
+
+                // The frames of the stored blocks
+                std::unordered_map <uint64_t, std::vector <uint8_t> > _frames;
+
+                // The sum of the lengths of the frames
+                uint64_t _usedBytes = 0;
+
+        public:
+
+                /**
+                 * @params:
+                 *    - codec: the codec used to encode the stored blocks
+                 */
+                MemoryPersister (CodecKind codec = CodecKind::LZ);
+
+                bool exists (uint64_t addr) override;
+
+                void load (uint64_t addr, uint8_t* memory, uint64_t size) override;
+
+                void save (uint64_t addr, uint8_t* memory, uint64_t size) override;
+
+                void erase (uint64_t addr) override;
+
+                /**
+                 * @returns: the memory used by the stored frames
+                 */
+                uint64_t getUsedBytes () const;
+
+        };
+
+        /**
+         * Statistics of a tier of a TieredPersister
+         */
+        struct TierInfo {
+                // The maximum number of blocks of the tier (0 if unlimited)
+                uint64_t capacity;
+
+                // The number of blocks stored in the tier
+                uint64_t nbBlocks;
+
+                // The number of loads served by the tier
+                uint64_t hits;
+
+                // The number of blocks moved from this tier to the first one because they were loaded
+                uint64_t promotions;
+
+                // The number of blocks moved from this tier to the next one because it was full
+                uint64_t demotions;
+        };
+
+        /**
+         * Chain of persisters, from the fastest to the slowest
+         * @info:
+         * ======
+         * A block is stored in exactly one tier. Saved blocks go to the
+         * first tier, and every tier that exceeds its capacity demotes its
+         * least recently used blocks to the next one. A block loaded from
+         * a lower tier is promoted back to the first tier, so a block
+         * evicted by the allocator but still hot comes back from memory
+         * instead of a disk or a network round trip. The last tier has no
+         * capacity limit
+         * ======
+         */
+        class TieredPersister : public BlockPersister {
+        private:
+
+                struct Tier {
+                        // The persister storing the blocks of the tier (owned)
+                        BlockPersister * persister;
+
+                        // The maximum number of blocks of the tier (0 if unlimited)
+                        uint64_t capacity;
+
+                        // The blocks of the tier (front is the most recent)
+                        std::list <uint64_t> lru;
+
+                        // The position of the blocks in lru
+                        std::unordered_map <uint64_t, std::list <uint64_t>::iterator> pos;
+
+                        uint64_t hits;
+                        uint64_t promotions;
+                        uint64_t demotions;
+                };
+
+        private:
+
+                std::vector <Tier> _tiers;
+
+                // The memory of the blocks moved between two tiers
+                std::vector <uint8_t> _buffer;
+
+        public:
+
+                TieredPersister ();
+
+                /**
+                 * Add a tier after the existing ones (slower than them)
+                 * @params:
+                 *    - persister: the persister of the tier (owned by the tiered persister)
+                 *    - capacity: the maximum number of blocks of the tier (0 if unlimited, ignored for the last tier)
+                 * @warning: tiers must be added before the first block is saved
+                 */
+                void addTier (BlockPersister * persister, uint64_t capacity);
+
+                bool exists (uint64_t addr) override;
+
+                /**
+                 * Load a block from the tier storing it, and promote it to the first tier
+                 */
+                void load (uint64_t addr, uint8_t* memory, uint64_t size) override;
+
+                /**
+                 * Save a block in the first tier
+                 */
+                void save (uint64_t addr, uint8_t* memory, uint64_t size) override;
+
+                void erase (uint64_t addr) override;
+
+                /**
+                 * Load many blocks, with one batch per tier
+                 */
+                void loadBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
+                /**
+                 * Save many blocks in the first tier, the demoted blocks are moved in batches
+                 */
+                void saveBatch (const std::vector <BlockIo> & blocks, uint64_t size) override;
+
+                /**
+                 * Print the statistics of the persister and of its tiers to stdout
+                 */
+                void printInfo () const override;
+
+                /**
+                 * Retreive the statistics of the tiers
+                 * @returns:
+                 *    - tiers: the statistics of each tier, from the fastest to the slowest
+                 */
+                void getInfo (std::vector <TierInfo> & tiers) const;
+
+                using BlockPersister::getInfo;
+
+                ~TieredPersister ();
+
+        private:
+
+                /**
+                 * @returns: the index of the tier storing the block, _tiers.size () if none
+                 */
+                uint32_t find (uint64_t addr) const;
+
+                /**
+                 * Move a loaded block from tier t to the first tier
+                 */
+                void promote (uint32_t t, const std::vector <BlockIo> & blocks, uint64_t size);
+
+                /**
+                 * Move the least recently used blocks of tier t to the next tier until t fits in its capacity
+                 */
+                void demote (uint32_t t, uint64_t size);
+
+                /**
+                 * Register a block as the most recent block of a tier
+                 */
+                void touch (Tier & tier, uint64_t addr);
+
+                /**
+                 * Forget a block of a tier
+                 */
+                void forget (Tier & tier, uint64_t addr);
+
+        };
+
+}
@@ -0,0 +1,205 @@
+#include "uring.hh"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace rd_utils::memory::cache::remote {
+
+  static inline int sys_io_uring_setup (uint32_t entries, io_uring_params * params) {
+    return ::syscall (__NR_io_uring_setup, entries, params);
+  }
+
+  static inline int sys_io_uring_enter (int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags) {
+    return ::syscall (__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+  }
+
+  static inline uint32_t * ring_field (void * ring, uint32_t offset) {
+    return reinterpret_cast <uint32_t*> (reinterpret_cast <uint8_t*> (ring) + offset);
+  }
+
+  IoRing::IoRing (uint32_t entries) {
+    io_uring_params params;
+    memset (&params, 0, sizeof (io_uring_params));
+
+    this-> _fd = sys_io_uring_setup (entries, &params);
+    if (this-> _fd < 0) return; // not supported by the kernel, or forbidden by a seccomp filter
+
+    this-> _sqLen = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+    this-> _cqLen = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+      this-> _sqLen = std::max (this-> _sqLen, this-> _cqLen);
+      this-> _cqLen = this-> _sqLen;
+    }
+
+    this-> _sqPtr = mmap (nullptr, this-> _sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this-> _fd, IORING_OFF_SQ_RING);
+    if (this-> _sqPtr == MAP_FAILED) {
+      this-> _sqPtr = nullptr;
+      this-> dispose ();
+      return;
+    }
+
+    if (single) {
+      this-> _cqPtr = this-> _sqPtr;
+    } else {
+      this-> _cqPtr = mmap (nullptr, this-> _cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this-> _fd, IORING_OFF_CQ_RING);
+      if (this-> _cqPtr == MAP_FAILED) {
+        this-> _cqPtr = nullptr;
+        this-> dispose ();
+        return;
+      }
+    }
+
+    this-> _sqesLen = params.sq_entries * sizeof (io_uring_sqe);
+    auto sqes = mmap (nullptr, this-> _sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this-> _fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      this-> dispose ();
+      return;
+    }
+
+    this-> _sqes = reinterpret_cast <io_uring_sqe*> (sqes);
+    this-> _sqHead = ring_field (this-> _sqPtr, params.sq_off.head);
+    this-> _sqTail = ring_field (this-> _sqPtr, params.sq_off.tail);
+    this-> _sqMask = ring_field (this-> _sqPtr, params.sq_off.ring_mask);
+    this-> _sqArray = ring_field (this-> _sqPtr, params.sq_off.array);
+
+    this-> _cqHead = ring_field (this-> _cqPtr, params.cq_off.head);
+    this-> _cqTail = ring_field (this-> _cqPtr, params.cq_off.tail);
+    this-> _cqMask = ring_field (this-> _cqPtr, params.cq_off.ring_mask);
+    this-> _cqes = reinterpret_cast <io_uring_cqe*> (reinterpret_cast <uint8_t*> (this-> _cqPtr) + params.cq_off.cqes);
+
+    this-> _entries = params.sq_entries;
+    this-> _iovs.resize (this-> _entries);
+  }
+
+  bool IoRing::isAvailable () const {
+    return this-> _fd >= 0;
+  }
+
+  uint32_t IoRing::getCapacity () const {
+    return this-> _entries;
+  }
+
+  void IoRing::prepareRead (int fd, uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id) {
+    this-> prepare (IORING_OP_READV, fd, buffer, len, offset, id);
+  }
+
+  void IoRing::prepareWrite (int fd, const uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id) {
+    this-> prepare (IORING_OP_WRITEV, fd, buffer, len, offset, id);
+  }
+
+  void IoRing::prepare (uint8_t opcode, int fd, const uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id) {
+    if (this-> _pending == this-> _entries) {
+      throw std::runtime_error ("Io ring is full");
+    }
+
+    // the ring is only written by this thread, the kernel only moves the head
+    auto tail = *this-> _sqTail;
+    auto index = tail & *this-> _sqMask;
+
+    // readv/writev are supported by every kernel with io_uring, read/write only since 5.6
+    auto & iov = this-> _iovs [index];
+    iov.iov_base = const_cast <uint8_t*> (buffer);
+    iov.iov_len = len;
+
+    auto & sqe = this-> _sqes [index];
+    memset (&sqe, 0, sizeof (io_uring_sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast <uint64_t> (&iov);
+    sqe.len = 1;
+    sqe.off = offset;
+    sqe.user_data = id;
+
+    this-> _sqArray [index] = index;
+    __atomic_store_n (this-> _sqTail, tail + 1, __ATOMIC_RELEASE);
+    this-> _pending += 1;
+  }
+
+  void IoRing::submitAndWait (std::vector <int64_t> & results) {
+    uint32_t toSubmit = this-> _pending;
+    uint32_t done = 0;
+
+    while (done < this-> _pending) {
+      done += this-> reap (results);
+      if (done == this-> _pending) break;
+
+      auto nb = sys_io_uring_enter (this-> _fd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+      if (nb < 0) {
+        if (errno == EINTR || errno == EAGAIN) continue;
+
+        auto err = errno;
+        this-> abort (done);
+        throw std::runtime_error (std::string ("Io ring submission failed : ") + strerror (err));
+      }
+
+      toSubmit -= nb;
+    }
+
+    this-> _pending = 0;
+  }
+
+  uint32_t IoRing::reap (std::vector <int64_t> & results) {
+    uint32_t nb = 0;
+    auto head = *this-> _cqHead;
+    auto tail = __atomic_load_n (this-> _cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      auto & cqe = this-> _cqes [head & *this-> _cqMask];
+      if (cqe.user_data < results.size ()) {
+        results [cqe.user_data] = cqe.res;
+      }
+
+      head += 1;
+      nb += 1;
+    }
+
+    __atomic_store_n (this-> _cqHead, head, __ATOMIC_RELEASE);
+    return nb;
+  }
+
+  void IoRing::abort (uint32_t done) {
+    // the entries the kernel did not consume yet are dropped, the next submission does not see them
+    auto head = __atomic_load_n (this-> _sqHead, __ATOMIC_ACQUIRE);
+    auto tail = *this-> _sqTail;
+    __atomic_store_n (this-> _sqTail, head, __ATOMIC_RELEASE);
+
+    // the consumed entries still write in the buffers of the caller, they are waited for
+    std::vector <int64_t> ignored;
+    uint32_t inflight = this-> _pending - (tail - head) - done;
+    while (inflight != 0) {
+      inflight -= std::min (inflight, this-> reap (ignored));
+      if (inflight == 0) break;
+
+      if (sys_io_uring_enter (this-> _fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN) {
+        // the ring is unusable, the caller falls back to synchronous io
+        this-> dispose ();
+        break;
+      }
+    }
+
+    this-> _pending = 0;
+  }
+
+  void IoRing::dispose () {
+    if (this-> _sqes != nullptr) munmap (this-> _sqes, this-> _sqesLen);
+    if (this-> _cqPtr != nullptr && this-> _cqPtr != this-> _sqPtr) munmap (this-> _cqPtr, this-> _cqLen);
+    if (this-> _sqPtr != nullptr) munmap (this-> _sqPtr, this-> _sqLen);
+    if (this-> _fd >= 0) ::close (this-> _fd);
+
+    this-> _sqes = nullptr;
+    this-> _cqPtr = nullptr;
+    this-> _sqPtr = nullptr;
+    this-> _fd = -1;
+  }
+
+  IoRing::~IoRing () {
+    this-> dispose ();
+  }
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace rd_utils::memory::cache::remote {
+
+        /**
+         * Minimal io_uring submission/completion ring (raw syscalls, no liburing)
+         * @info:
+         * ======
+         * Used to submit many positional reads or writes in a single
+         * syscall. The ring is not thread safe, it is used by one
+         * persister under its lock. If the kernel does not support
+         * io_uring (or it is forbidden), isAvailable returns false and
+         * the caller must use synchronous io
+         * ======
+         */
+        class IoRing {
+        private:
+
+                // The ring file descriptor (-1 if unavailable)
+                int _fd = -1;
+
+                // The number of submission entries
+                uint32_t _entries = 0;
+
+                // The mapped submission ring
+                void * _sqPtr = nullptr;
+                size_t _sqLen = 0;
+
+                uint32_t * _sqHead = nullptr;
+                uint32_t * _sqTail = nullptr;
+                uint32_t * _sqMask = nullptr;
+                uint32_t * _sqArray = nullptr;
+
+                // The mapped submission entries
+                io_uring_sqe * _sqes = nullptr;
+                size_t _sqesLen = 0;
+
+                // The mapped completion ring (same mapping as the submission ring on recent kernels)
+                void * _cqPtr = nullptr;
+                size_t _cqLen = 0;
+
+                uint32_t * _cqHead = nullptr;
+                uint32_t * _cqTail = nullptr;
+                uint32_t * _cqMask = nullptr;
+                io_uring_cqe * _cqes = nullptr;
+
+                // The vectors of the prepared operations (must live until completion)
+                std::vector <iovec> _iovs;
+
+                // The number of prepared operations not completed yet
+                uint32_t _pending = 0;
+
+        public:
+
+                /**
+                 * @params:
+                 *    - entries: the maximum number of operations in flight
+                 */
+                IoRing (uint32_t entries);
+
+                IoRing (const IoRing & other) = delete;
+                void operator=(const IoRing & other) = delete;
+
+                /**
+                 * @returns: true if the ring was created
+                 */
+                bool isAvailable () const;
+
+                /**
+                 * @returns: the number of operations that can be prepared before a submission
+                 */
+                uint32_t getCapacity () const;
+
+                /**
+                 * Prepare a positional read
+                 * @params:
+                 *    - id: the index of the result of the operation in the vector filled by submitAndWait
+                 */
+                void prepareRead (int fd, uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id);
+
+                /**
+                 * Prepare a positional write
+                 * @params:
+                 *    - id: the index of the result of the operation in the vector filled by submitAndWait
+                 */
+                void prepareWrite (int fd, const uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id);
+
+                /**
+                 * Submit the prepared operations and wait for their completion
+                 * @returns:
+                 *    - results: the result of each operation (number of bytes, or -errno)
+                 * @throws: if the submission failed, the prepared operations are dropped or completed before (the ring is released if they cannot be waited for)
+                 */
+                void submitAndWait (std::vector <int64_t> & results);
+
+                ~IoRing ();
+
+        private:
+
+                void prepare (uint8_t opcode, int fd, const uint8_t * buffer, uint64_t len, uint64_t offset, uint32_t id);
+
+                /**
+                 * Consume the available completions
+                 * @returns: the number of completions consumed
+                 */
+                uint32_t reap (std::vector <int64_t> & results);
+
+                /**
+                 * Drop the operations that were not submitted and wait for the completion of the others
+                 * @params:
+                 *    - done: the number of operations already completed
+                 */
+                void abort (uint32_t done);
+
+                void dispose ();
+
+        };
+
+}
@@ -0,0 +1,480 @@
+#include "shared.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rd_utils/concurrency/timer.hh>
+
+namespace rd_utils::memory::cache {
+
+  // The value of the magic of an initialized segment
+#define SHARED_CACHE_MAGIC 0x5244534843414348ULL
+
+  /**
+   * The offsets of the parts of a segment
+   */
+  struct SharedLayout {
+    uint64_t slots;
+    uint64_t table;
+    uint64_t data;
+    uint64_t total;
+  };
+
+  static SharedLayout shared_layout (uint32_t nbSlots, uint32_t nbBuckets, uint32_t blockSize) {
+    SharedLayout layout;
+    layout.slots = (sizeof (SharedCacheHeader) + 63) & ~63ULL;
+    layout.table = (layout.slots + nbSlots * sizeof (SharedSlot) + 63) & ~63ULL;
+
+    // the blocks are page aligned, so they can be read with large copies
+    layout.data = (layout.table + nbBuckets * sizeof (uint32_t) + 4095) & ~4095ULL;
+    layout.total = layout.data + (uint64_t) nbSlots * blockSize;
+    return layout;
+  }
+
+  static inline uint64_t shared_hash (uint64_t key, uint32_t nbBuckets) {
+    return (key * 0x9E3779B97F4A7C15ULL) & (nbBuckets - 1);
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ================================    CTORS   ================================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  SharedBlockCache::SharedBlockCache (const std::string & name, uint32_t nbBlocks, uint32_t blockSize, const std::string & dir) :
+    _name ("/" + name)
+    , _path (dir + "/" + name + ".blocks")
+  {
+    if (!this-> create (std::max (nbBlocks, (uint32_t) 1), blockSize)) {
+      this-> attach ();
+    }
+
+    this-> _file = ::open (this-> _path.c_str (), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (this-> _file < 0) {
+      ::munmap (this-> _mem, this-> _size);
+      throw std::runtime_error ("Failed to open the block file : " + this-> _path);
+    }
+
+    // the attachments are counted under the segment lock, like the arrays they reserve and commit
+    this-> lock ();
+    this-> _head-> nbAttached += 1;
+    this-> unlock ();
+  }
+
+  bool SharedBlockCache::create (uint32_t nbBlocks, uint32_t blockSize) {
+    int fd = ::shm_open (this-> _name.c_str (), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      if (errno == EEXIST) return false;
+      throw std::runtime_error ("Failed to create the shared cache : " + this-> _name);
+    }
+
+    uint32_t nbBuckets = 1;
+    while (nbBuckets < 2 * nbBlocks) nbBuckets <<= 1;
+
+    auto layout = shared_layout (nbBlocks, nbBuckets, blockSize);
+    if (::ftruncate (fd, layout.total) != 0) {
+      ::close (fd);
+      ::shm_unlink (this-> _name.c_str ());
+      throw std::runtime_error ("Failed to size the shared cache : " + this-> _name);
+    }
+
+    auto mem = ::mmap (nullptr, layout.total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (mem == MAP_FAILED) {
+      ::shm_unlink (this-> _name.c_str ());
+      throw std::runtime_error ("Failed to map the shared cache : " + this-> _name);
+    }
+
+    // the segment is zeroed by ftruncate, only the geometry and the locks are set
+    this-> _mem = reinterpret_cast <uint8_t*> (mem);
+    this-> _size = layout.total;
+    this-> _head = reinterpret_cast <SharedCacheHeader*> (mem);
+    this-> _head-> blockSize = blockSize;
+    this-> _head-> nbSlots = nbBlocks;
+    this-> _head-> nbBuckets = nbBuckets;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init (&mattr);
+    pthread_mutexattr_setpshared (&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust (&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init (&this-> _head-> lock, &mattr);
+    pthread_mutexattr_destroy (&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init (&cattr);
+    pthread_condattr_setpshared (&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init (&this-> _head-> loaded, &cattr);
+    pthread_condattr_destroy (&cattr);
+
+    this-> locate ();
+    this-> _head-> magic.store (SHARED_CACHE_MAGIC, std::memory_order_release);
+    return true;
+  }
+
+  void SharedBlockCache::attach () {
+    int fd = ::shm_open (this-> _name.c_str (), O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) throw std::runtime_error ("Failed to open the shared cache : " + this-> _name);
+
+    // the creator sizes the segment right after creating it
+    concurrency::timer t;
+    struct stat st;
+    while (::fstat (fd, &st) == 0 && st.st_size == 0) {
+      if (t.time_since_start () > SHARED_CACHE_OPEN_TIMEOUT) break;
+      ::usleep (1000);
+    }
+
+    if (st.st_size == 0) {
+      ::close (fd);
+      throw std::runtime_error ("The shared cache was never initialized : " + this-> _name);
+    }
+
+    auto mem = ::mmap (nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (mem == MAP_FAILED) throw std::runtime_error ("Failed to map the shared cache : " + this-> _name);
+
+    this-> _mem = reinterpret_cast <uint8_t*> (mem);
+    this-> _size = st.st_size;
+    this-> _head = reinterpret_cast <SharedCacheHeader*> (mem);
+    while (this-> _head-> magic.load (std::memory_order_acquire) != SHARED_CACHE_MAGIC) {
+      if (t.time_since_start () > SHARED_CACHE_OPEN_TIMEOUT) {
+        ::munmap (this-> _mem, this-> _size);
+        throw std::runtime_error ("The shared cache was never initialized : " + this-> _name);
+      }
+
+      ::usleep (1000);
+    }
+
+    this-> locate ();
+  }
+
+  void SharedBlockCache::locate () {
+    auto layout = shared_layout (this-> _head-> nbSlots, this-> _head-> nbBuckets, this-> _head-> blockSize);
+    this-> _slots = reinterpret_cast <SharedSlot*> (this-> _mem + layout.slots);
+    this-> _table = reinterpret_cast <uint32_t*> (this-> _mem + layout.table);
+    this-> _data = this-> _mem + layout.data;
+  }
+
+  void SharedBlockCache::remove (const std::string & name, const std::string & dir) {
+    ::shm_unlink (("/" + name).c_str ());
+    ::unlink ((dir + "/" + name + ".blocks").c_str ());
+  }
+
+  SharedBlockCache::~SharedBlockCache () {
+    if (this-> _mem != nullptr) {
+      this-> lock ();
+      this-> _head-> nbAttached -= 1;
+      this-> unlock ();
+
+      ::munmap (this-> _mem, this-> _size);
+    }
+
+    if (this-> _file >= 0) {
+      ::close (this-> _file);
+    }
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * ============================      GETTERS      =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  uint32_t SharedBlockCache::getBlockSize () const {
+    return this-> _head-> blockSize;
+  }
+
+  uint32_t SharedBlockCache::getNbBlocks () const {
+    return this-> _head-> nbSlots;
+  }
+
+  uint32_t SharedBlockCache::getNbAttached () const {
+    return this-> _head-> nbAttached;
+  }
+
+  void SharedBlockCache::getMetrics (uint64_t & hits, uint64_t & misses, uint64_t & evictions) const {
+    hits = this-> _head-> hits;
+    misses = this-> _head-> misses;
+    evictions = this-> _head-> evictions;
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================     CATALOG     ==============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  bool SharedBlockCache::find (const std::string & name, SharedArrayInfo & info) {
+    this-> lock ();
+    for (uint32_t i = 0 ; i < this-> _head-> nbArrays ; i++) {
+      auto & it = this-> _head-> arrays [i];
+      if (it.ready && name == it.name) {
+        info = it;
+        this-> unlock ();
+        return true;
+      }
+    }
+
+    this-> unlock ();
+    return false;
+  }
+
+  SharedArrayInfo SharedBlockCache::reserve (const std::string & name, uint32_t elemSize, uint64_t len) {
+    if (name.size () >= SHARED_CACHE_NAME_SIZE) throw std::runtime_error ("Shared array name too long : " + name);
+
+    // the elements never cross two blocks
+    uint64_t perBlock = this-> _head-> blockSize / elemSize;
+    if (perBlock == 0) throw std::runtime_error ("Shared array elements bigger than a block");
+
+    this-> lock ();
+    SharedArrayInfo * reclaimed = nullptr;
+    for (uint32_t i = 0 ; i < this-> _head-> nbArrays ; i++) {
+      auto & it = this-> _head-> arrays [i];
+      // a publisher that died before its commit leaves an array that never gets ready, its entry is reused
+      if (!it.ready && ::kill (it.publisher, 0) != 0 && errno == ESRCH) {
+        if (reclaimed == nullptr || name == it.name) reclaimed = &it;
+        continue;
+      }
+
+      if (name == it.name) {
+        this-> unlock ();
+        throw std::runtime_error ("Shared array already published : " + name);
+      }
+    }
+
+    if (reclaimed == nullptr && this-> _head-> nbArrays == SHARED_CACHE_MAX_ARRAYS) {
+      this-> unlock ();
+      throw std::runtime_error ("Too many shared arrays");
+    }
+
+    auto & info = reclaimed != nullptr ? *reclaimed : this-> _head-> arrays [this-> _head-> nbArrays++];
+    uint64_t nbBlocks = (len + perBlock - 1) / perBlock;
+
+    // the blocks of an array that was never ready were never read, they are reused if they are enough
+    if (reclaimed == nullptr || info.nbBlocks < nbBlocks) {
+      info.fstBlock = this-> _head-> nextBlock;
+      this-> _head-> nextBlock += nbBlocks;
+    }
+
+    auto fstBlock = info.fstBlock;
+    memset (&info, 0, sizeof (SharedArrayInfo));
+    memcpy (info.name, name.c_str (), name.size ());
+    info.elemSize = elemSize;
+    info.len = len;
+    info.fstBlock = fstBlock;
+    info.nbBlocks = nbBlocks;
+    info.ready = 0;
+    info.publisher = ::getpid ();
+
+    auto result = info;
+    this-> unlock ();
+
+    return result;
+  }
+
+  void SharedBlockCache::store (uint64_t block, const uint8_t * data, uint32_t size) {
+    uint64_t offset = block * this-> _head-> blockSize;
+    while (size != 0) {
+      auto n = ::pwrite (this-> _file, data, size, offset);
+      if (n <= 0) throw std::runtime_error ("Failed to write the block file : " + this-> _path);
+
+      data += n;
+      size -= n;
+      offset += n;
+    }
+  }
+
+  void SharedBlockCache::commit (const std::string & name) {
+    this-> lock ();
+    for (uint32_t i = 0 ; i < this-> _head-> nbArrays ; i++) {
+      if (name == this-> _head-> arrays [i].name) {
+        this-> _head-> arrays [i].ready = 1;
+      }
+    }
+
+    this-> unlock ();
+  }
+
+  /**
+   * ============================================================================
+   * ============================================================================
+   * =============================      BLOCKS      =============================
+   * ============================================================================
+   * ============================================================================
+   * */
+
+  void SharedBlockCache::read (uint64_t block, uint32_t offset, void * data, uint32_t size) {
+    auto slot = this-> acquire (block);
+    memcpy (data, this-> _data + (uint64_t) slot * this-> _head-> blockSize + offset, size);
+    this-> _slots [slot].pins -= 1;
+  }
+
+  uint32_t SharedBlockCache::acquire (uint64_t block) {
+    uint64_t key = block + 1;
+    this-> lock ();
+    for (;;) {
+      auto b = this-> bucket (key);
+      if (this-> _table [b] != 0) {
+        auto s = this-> _table [b] - 1;
+        auto & slot = this-> _slots [s];
+        if (slot.loading) {
+          if (::kill (slot.loader, 0) != 0 && errno == ESRCH) { // the loader died, its slot is reused
+            this-> unindex (slot.key);
+            slot.key = 0;
+            slot.loading = 0;
+            slot.pins = 0;
+          } else {
+            this-> wait ();
+          }
+
+          continue;
+        }
+
+        slot.pins += 1;
+        slot.referenced = 1;
+        this-> _head-> hits += 1;
+        this-> unlock ();
+        return s;
+      }
+
+      auto s = this-> victim ();
+      if (s == UINT32_MAX) { this-> wait (); continue; }
+
+      auto & slot = this-> _slots [s];
+      if (slot.key != 0) {
+        this-> unindex (slot.key);
+        this-> _head-> evictions += 1;
+      }
+
+      slot.key = key;
+      slot.loading = 1;
+      slot.loader = ::getpid ();
+      slot.pins = 1;
+      slot.referenced = 1;
+      this-> _table [this-> bucket (key)] = s + 1;
+      this-> _head-> misses += 1;
+      this-> unlock ();
+
+      // the block file is read outside of the lock, the readers of the same block wait for it
+      auto mem = this-> _data + (uint64_t) s * this-> _head-> blockSize;
+      uint64_t offset = block * this-> _head-> blockSize;
+      uint32_t done = 0;
+      bool failed = false;
+      while (done < this-> _head-> blockSize) {
+        auto n = ::pread (this-> _file, mem + done, this-> _head-> blockSize - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { failed = true; break; }
+        if (n == 0) break;
+        done += n;
+      }
+
+      if (failed) {
+        // the slot is never served, the readers waiting for it load the block again
+        this-> lock ();
+        this-> unindex (slot.key);
+        slot.key = 0;
+        slot.loading = 0;
+        slot.pins = 0;
+        pthread_cond_broadcast (&this-> _head-> loaded);
+        this-> unlock ();
+
+        throw std::runtime_error ("Failed to read the block file : " + this-> _path);
+      }
+
+      // the last block of the file can be shorter
+      memset (mem + done, 0, this-> _head-> blockSize - done);
+
+      this-> lock ();
+      slot.loading = 0;
+      pthread_cond_broadcast (&this-> _head-> loaded);
+      this-> unlock ();
+
+      return s;
+    }
+  }
+
+  uint32_t SharedBlockCache::victim () {
+    auto nb = this-> _head-> nbSlots;
+    for (uint32_t i = 0 ; i < 2 * nb ; i++) {
+      auto s = this-> _head-> hand;
+      this-> _head-> hand = (s + 1) % nb;
+
+      auto & slot = this-> _slots [s];
+      if (slot.key == 0) return s;
+      if (slot.pins != 0 || slot.loading) continue;
+      if (slot.referenced) { // second chance
+        slot.referenced = 0;
+        continue;
+      }
+
+      return s;
+    }
+
+    return UINT32_MAX;
+  }
+
+  uint32_t SharedBlockCache::bucket (uint64_t key) const {
+    auto mask = this-> _head-> nbBuckets - 1;
+    auto b = shared_hash (key, this-> _head-> nbBuckets);
+    while (this-> _table [b] != 0 && this-> _slots [this-> _table [b] - 1].key != key) {
+      b = (b + 1) & mask;
+    }
+
+    return b;
+  }
+
+  void SharedBlockCache::unindex (uint64_t key) {
+    auto mask = this-> _head-> nbBuckets - 1;
+    auto i = this-> bucket (key);
+    if (this-> _table [i] == 0) return;
+
+    // backward shift, the blocks after the removed one stay reachable from their home bucket
+    this-> _table [i] = 0;
+    for (auto j = (i + 1) & mask ; this-> _table [j] != 0 ; j = (j + 1) & mask) {
+      auto home = shared_hash (this-> _slots [this-> _table [j] - 1].key, this-> _head-> nbBuckets);
+      bool between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+      if (!between) {
+        this-> _table [i] = this-> _table [j];
+        this-> _table [j] = 0;
+        i = j;
+      }
+    }
+  }
+
+  void SharedBlockCache::lock () {
+    // the owner of the lock died, the metadata is only changed in short sections that keep it consistent
+    if (pthread_mutex_lock (&this-> _head-> lock) == EOWNERDEAD) {
+      pthread_mutex_consistent (&this-> _head-> lock);
+    }
+  }
+
+  void SharedBlockCache::unlock () {
+    pthread_mutex_unlock (&this-> _head-> lock);
+  }
+
+  void SharedBlockCache::wait () {
+    struct timespec until;
+    clock_gettime (CLOCK_REALTIME, &until);
+    until.tv_nsec += SHARED_CACHE_WAIT_PERIOD * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec += 1;
+      until.tv_nsec -= 1000000000L;
+    }
+
+    if (pthread_cond_timedwait (&this-> _head-> loaded, &this-> _head-> lock, &until) == EOWNERDEAD) {
+      pthread_mutex_consistent (&this-> _head-> lock);
+    }
+  }
+
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <pthread.h>
+
+namespace rd_utils::memory::cache {
+
+// The maximum number of arrays published in a shared cache
+#define SHARED_CACHE_MAX_ARRAYS 256
+
+// The maximum length of the name of a published array
+#define SHARED_CACHE_NAME_SIZE 64
+
+// The default number of blocks of a shared cache
+#define SHARED_CACHE_NB_BLOCKS 256
+
+// The default size of the blocks of a shared cache
+#define SHARED_CACHE_BLOCK_SIZE (1024 * 1024)
+
+// The time a process waits for the creator of a segment to initialize it (in seconds)
+#define SHARED_CACHE_OPEN_TIMEOUT 5
+
+// The period at which a process waiting for a block checks that its loader is alive (in ms)
+#define SHARED_CACHE_WAIT_PERIOD 10
+
+        /**
+         * An array published in a shared cache
+         */
+        struct SharedArrayInfo {
+                // The name of the array
+                char name [SHARED_CACHE_NAME_SIZE];
+
+                // The size of an element
+                uint32_t elemSize;
+
+                // The number of elements
+                uint64_t len;
+
+                // The first block of the array in the block file
+                uint64_t fstBlock;
+
+                // The number of blocks of the array
+                uint64_t nbBlocks;
+
+                // True once every block is written (the array is visible to the other processes)
+                uint32_t ready;
+
+                // The process publishing the array (its entry is reclaimed if it dies before the commit)
+                int32_t publisher;
+        };
+
+        /**
+         * A slot of the shared cache, holding one block
+         */
+        struct SharedSlot {
+                // The block in the slot (block index + 1, 0 if the slot is empty)
+                uint64_t key;
+
+                // The number of readers copying the slot (a pinned slot is never evicted)
+                std::atomic<uint32_t> pins;
+
+                // True if the slot was read since the clock hand last passed
+                std::atomic<uint8_t> referenced;
+
+                // True while the block is read from the block file
+                uint8_t loading;
+
+                // The process reading the block from the block file
+                int32_t loader;
+        };
+
+        /**
+         * The header of a shared cache segment
+         * @info: the segment holds no pointer, every process maps it at a different address
+         */
+        struct SharedCacheHeader {
+                // Set last by the creator, the segment is usable once it is SHARED_CACHE_MAGIC
+                std::atomic<uint64_t> magic;
+
+                uint32_t blockSize;
+                uint32_t nbSlots;
+                uint32_t nbBuckets;
+
+                // Lock protecting the slots, the table and the catalog (process shared and robust)
+                pthread_mutex_t lock;
+
+                // Signaled when a block is loaded (process shared)
+                pthread_cond_t loaded;
+
+                // The position of the clock hand in the slots
+                uint32_t hand;
+
+                // The number of processes attached to the segment
+                std::atomic<uint32_t> nbAttached;
+
+                // The next unused block of the block file
+                uint64_t nextBlock;
+
+                std::atomic<uint64_t> hits;
+                std::atomic<uint64_t> misses;
+                std::atomic<uint64_t> evictions;
+
+                // The number of published arrays
+                uint32_t nbArrays;
+
+                // The published arrays
+                SharedArrayInfo arrays [SHARED_CACHE_MAX_ARRAYS];
+        };
+
+        /**
+         * A cache of read-only blocks shared by the processes of a host
+         * @info:
+         * ======
+         * The blocks, the slot table and the catalog of the published
+         * arrays live in a named shared memory segment (shm_open), so
+         * every process attached to the same name reads the same resident
+         * blocks, under a single block budget. The blocks are stored in a
+         * single block file next to the segment, written once when an
+         * array is published.
+         *
+         * The metadata is protected by a robust process shared mutex: a
+         * process dying while holding it does not block the others. A
+         * block is pinned while it is copied out (outside the lock), the
+         * pins of a process killed during a copy are never released and
+         * keep their slot resident.
+         *
+         * The first process creates the segment with its geometry, the
+         * other processes attach to it (their geometry is ignored)
+         * ======
+         */
+        class SharedBlockCache {
+        private:
+
+                // The name of the segment
+                std::string _name;
+
+                // The path of the block file
+                std::string _path;
+
+                // The mapping of the segment
+                uint8_t * _mem = nullptr;
+
+                // The size of the segment
+                uint64_t _size = 0;
+
+                // The block file
+                int _file = -1;
+
+                // The header of the segment
+                SharedCacheHeader * _head = nullptr;
+
+                // The slots of the segment
+                SharedSlot * _slots = nullptr;
+
+                // The hash table of the resident blocks (slot + 1, 0 if empty)
+                uint32_t * _table = nullptr;
+
+                // The memory of the slots
+                uint8_t * _data = nullptr;
+
+        private:
+
+                SharedBlockCache (const SharedBlockCache &);
+                void operator= (const SharedBlockCache &);
+
+        public:
+
+                /**
+                 * Attach to a shared cache, creating it if it does not exist
+                 * @params:
+                 *    - name: the name of the cache (shared by the processes of the host)
+                 *    - nbBlocks: the number of resident blocks (only used by the creator)
+                 *    - blockSize: the size of a block (only used by the creator)
+                 *    - dir: the directory of the block file
+                 * @throws: if the segment cannot be created or mapped
+                 */
+                SharedBlockCache (const std::string & name, uint32_t nbBlocks = SHARED_CACHE_NB_BLOCKS, uint32_t blockSize = SHARED_CACHE_BLOCK_SIZE, const std::string & dir = "./");
+
+                /**
+                 * Remove the segment and the block file of a cache
+                 * @info: the attached processes keep their mapping, the next process creates a new cache
+                 */
+                static void remove (const std::string & name, const std::string & dir = "./");
+
+                /**
+                 * @returns: the size of the blocks
+                 */
+                uint32_t getBlockSize () const;
+
+                /**
+                 * @returns: the number of resident blocks
+                 */
+                uint32_t getNbBlocks () const;
+
+                /**
+                 * @returns: the number of processes attached to the cache (a process killed without detaching is still counted)
+                 */
+                uint32_t getNbAttached () const;
+
+                /**
+                 * @returns:
+                 *    - hits: the number of reads of resident blocks
+                 *    - misses: the number of blocks read from the block file
+                 *    - evictions: the number of blocks replaced in a slot
+                 */
+                void getMetrics (uint64_t & hits, uint64_t & misses, uint64_t & evictions) const;
+
+                /**
+                 * Find a published array
+                 * @returns: false if no array of this name was published
+                 */
+                bool find (const std::string & name, SharedArrayInfo & info);
+
+                /**
+                 * Reserve the blocks of an array to publish
+                 * @info: the entry of an array whose publisher died before its commit is reused
+                 * @returns: the array, not visible until commit is called
+                 * @throws: if the name is already used or the catalog is full
+                 */
+                SharedArrayInfo reserve (const std::string & name, uint32_t elemSize, uint64_t len);
+
+                /**
+                 * Write a block of the block file (a reserved block that is not committed yet)
+                 */
+                void store (uint64_t block, const uint8_t * data, uint32_t size);
+
+                /**
+                 * Make a reserved array visible to the other processes
+                 */
+                void commit (const std::string & name);
+
+                /**
+                 * Read a part of a block
+                 * @params:
+                 *    - block: the index of the block in the block file
+                 *    - offset: the offset in the block
+                 * @info: the block is loaded in a slot if it is not resident
+                 * @throws: if the block file cannot be read
+                 */
+                void read (uint64_t block, uint32_t offset, void * data, uint32_t size);
+
+                /**
+                 * Detach from the segment
+                 */
+                ~SharedBlockCache ();
+
+        private:
+
+                /**
+                 * Create and initialize the segment
+                 * @returns: false if another process created it first
+                 */
+                bool create (uint32_t nbBlocks, uint32_t blockSize);
+
+                /**
+                 * Map a segment created by another process
+                 */
+                void attach ();
+
+                /**
+                 * Set the pointers to the parts of the segment
+                 */
+                void locate ();
+
+                /**
+                 * Take the lock of the segment (recovering it if its owner died)
+                 */
+                void lock ();
+
+                /**
+                 * Release the lock of the segment
+                 */
+                void unlock ();
+
+                /**
+                 * Wait for a block to be loaded, at most SHARED_CACHE_WAIT_PERIOD ms (the lock must be held)
+                 */
+                void wait ();
+
+                /**
+                 * Pin the slot of a block, loading it if needed
+                 * @returns: the slot of the block
+                 * @throws: if the block file cannot be read, the slot is released
+                 */
+                uint32_t acquire (uint64_t block);
+
+                /**
+                 * Select a slot to replace (clock)
+                 * @returns: UINT32_MAX if every slot is pinned or loading
+                 * @warning: the lock must be held
+                 */
+                uint32_t victim ();
+
+                /**
+                 * @returns: the bucket of the table holding a block, or its empty bucket
+                 * @warning: the lock must be held
+                 */
+                uint32_t bucket (uint64_t key) const;
+
+                /**
+                 * Remove a block from the table
+                 * @warning: the lock must be held
+                 */
+                void unindex (uint64_t key);
+
+        };
+
+}